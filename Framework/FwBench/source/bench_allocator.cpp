@@ -0,0 +1,108 @@
+﻿/**
+ * @file bench_allocator.cpp
+ * @brief FwDefaultAllocatorのスループット
+ */
+#include "stdafx.h"
+
+#if defined(FW_PLATFORM_WIN32)
+#include <malloc.h>
+#endif
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numLiveBlocks     = 64;       ///< スレッド毎に保持しておくブロック数
+static const size_t     s_maxBlockSize      = 900;
+static const sint32_t   s_taggedAllocatorTag = 1;       ///< ヘッダ付きで確保される既定タグ以外のタグ
+
+/**
+ * @brief スレッドキャッシュ導入前と同じ、全体で1つのミューテックスを取るCRTの確保
+ */
+class FwMutexAllocator {
+public:
+    void * Alloc(const size_t size) {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+#if defined(FW_PLATFORM_WIN32)
+        return _aligned_malloc(size, FW_PLATFORM_ALIGN_SIZE);
+#else
+        return aligned_alloc(FW_PLATFORM_ALIGN_SIZE, RoundUp(size, static_cast<size_t>(FW_PLATFORM_ALIGN_SIZE)));
+#endif
+    }
+
+    void Free(void * ptr) {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+#if defined(FW_PLATFORM_WIN32)
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+
+private:
+    std::recursive_mutex    _mutex;
+};
+
+/**
+ * @brief 一定数のブロックを保持したまま確保と解放を繰り返す
+ * @return 確保した回数
+ */
+template<class _Alloc, class _Free>
+static uint64_t RunChurn(const uint32_t threadIndex, const uint32_t numOps, _Alloc alloc, _Free free) {
+    void * blocks[s_numLiveBlocks] = {};
+    uint32_t seed = threadIndex * 7919 + 1;
+    for (uint32_t i = 0; i < numOps; ++i) {
+        seed = seed * 1103515245 + 12345;
+        const size_t size = 1 + (seed >> 8) % s_maxBlockSize;
+        const uint32_t slot = i % s_numLiveBlocks;
+        if (blocks[slot] != nullptr) {
+            free(blocks[slot]);
+        }
+        blocks[slot] = alloc(size);
+        // 触れておかないと確保だけの計測になる
+        *reinterpret_cast<volatile uint8_t *>(blocks[slot]) = static_cast<uint8_t>(i);
+    }
+    for (auto block : blocks) {
+        if (block != nullptr) {
+            free(block);
+        }
+    }
+    return numOps;
+}
+
+}   // namespace
+
+
+FW_BENCH(allocator, "multi-threaded small alloc/free throughput: FwMalloc vs. a global mutex around the CRT") {
+    const uint32_t numOps = 1000000 * context.scale;
+    FwMutexAllocator mutexAllocator;
+
+    // 既定のアロケータを別タグにも割り当て、ヘッダ付きブロックの経路も計測する
+    FwMemAllocator * oldTaggedAllocator = FwSetMemAllocator(s_taggedAllocatorTag, FwGetMemAllocator(FwDefaultMemAllocatorTag));
+
+    printf("  %8s %16s %16s %16s %8s\n", "threads", "mutex Mops/s", "FwMalloc Mops/s", "tagged Mops/s", "speedup");
+    for (uint32_t numThreads = FwBenchNextThreadCount(0, context.maxThreads); numThreads != 0; numThreads = FwBenchNextThreadCount(numThreads, context.maxThreads)) {
+        const double mutexSeconds = FwBenchRunThreads(numThreads, [&](uint32_t index) {
+            RunChurn(index, numOps,
+                [&](size_t size) { return mutexAllocator.Alloc(size); },
+                [&](void * ptr) { mutexAllocator.Free(ptr); });
+        });
+        const double fwSeconds = FwBenchRunThreads(numThreads, [&](uint32_t index) {
+            RunChurn(index, numOps,
+                [](size_t size) { return FwMalloc(size, FwDefaultMemAllocatorTag); },
+                [](void * ptr) { FwFree(ptr); });
+        });
+        const double taggedSeconds = FwBenchRunThreads(numThreads, [&](uint32_t index) {
+            RunChurn(index, numOps,
+                [](size_t size) { return FwMalloc(size, s_taggedAllocatorTag); },
+                [](void * ptr) { FwFree(ptr); });
+        });
+
+        const double totalOps = static_cast<double>(numOps) * numThreads;
+        printf("  %8u %16.2f %16.2f %16.2f %7.2fx\n", numThreads, totalOps / mutexSeconds * 1e-6, totalOps / fwSeconds * 1e-6, totalOps / taggedSeconds * 1e-6, mutexSeconds / fwSeconds);
+    }
+
+    FwSetMemAllocator(s_taggedAllocatorTag, oldTaggedAllocator);
+    return FW_OK;
+}
@@ -0,0 +1,293 @@
+﻿/**
+ * @file bench_coroutine.cpp
+ * @brief co_awaitで待つローダーとブロッキングのWaitで待つローダーの、同時に発行できる読み込み数と再開までの遅延
+ * @note  FW_BUILD_CONFIG_ENABLE_COROUTINEが無効か、コンパイラがコルーチンに対応していなければ何もしません
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+#if FW_ENABLE_COROUTINE
+
+namespace {
+
+static char_t           s_fileName[]        = _T("fw_bench_coroutine.tmp");    ///< str_tで渡すので書き換え可能な配列にしておく
+static const uint32_t   s_numAssets         = 256;          ///< 同時に読み込むアセット数
+static const uint32_t   s_chunksPerAsset    = 8;            ///< アセット1つを読む回数（前の読み込みを見てから次を読む）
+static const uint32_t   s_chunkSize         = 16 * 1024;
+static const uint32_t   s_assetSize         = s_chunksPerAsset * s_chunkSize;
+static const uint32_t   s_numResumes        = 2000;         ///< scale倍したタスクグループを待つ回数
+
+/**
+ * @brief 位置毎に決まった値
+ */
+FW_INLINE uint8_t GetPattern(const uint64_t offset) {
+    return static_cast<uint8_t>(offset % 251);
+}
+
+/**
+ * @brief offsetから読んだ内容が決まった値と一致するか
+ */
+bool IsPattern(const uint8_t * buffer, const size_t size, const uint64_t offset) {
+    for (size_t i = 0; i < size; ++i) {
+        if (buffer[i] != GetPattern(offset + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @struct FwLoadState
+ * @brief 全てのローダーで共有する読み込みの状況
+ */
+struct FwLoadState {
+    std::atomic<uint32_t>   numInFlight;
+    std::atomic<uint32_t>   maxInFlight;    ///< 同時に完了を待っていた読み込みの最大数
+    std::atomic<uint32_t>   numFailed;
+
+    FwLoadState() : numInFlight(0), maxInFlight(0), numFailed(0) {}
+
+    void BeginRead() {
+        const uint32_t numReads = numInFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint32_t current = maxInFlight.load(std::memory_order_relaxed);
+        while (current < numReads && !maxInFlight.compare_exchange_weak(current, numReads, std::memory_order_relaxed)) {
+        }
+    }
+
+    void EndRead(const sint32_t result, const uint8_t * buffer, const uint64_t offset) {
+        numInFlight.fetch_sub(1, std::memory_order_relaxed);
+        if (result != FW_OK || !IsPattern(buffer, s_chunkSize, offset)) {
+            numFailed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+/**
+ * @brief アセットを先頭から1つずつco_awaitで読む
+ * @note  完了を待つ間はワーカーを手放すので、ワーカー数に関わらず全てのアセットの読み込みが同時に発行される
+ */
+FwCoroutine LoadAssetAsync(FwFileManager * manager, FwLoadState & state, const uint32_t asset) {
+    FwFileStream * stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessRead);
+    if (stream == nullptr) {
+        state.numFailed.fetch_add(1, std::memory_order_relaxed);
+        co_return;
+    }
+
+    uint8_t chunk[s_chunkSize];
+    for (uint32_t i = 0; i < s_chunksPerAsset; ++i) {
+        const uint64_t offset = static_cast<uint64_t>(asset) * s_assetSize + i * s_chunkSize;
+        state.BeginRead();
+        const sint32_t result = co_await stream->ReadAtAsync(chunk, s_chunkSize, s_chunkSize, offset);
+        state.EndRead(result, chunk, offset);
+    }
+    stream->Close();
+}
+
+/**
+ * @brief アセットを先頭から1つずつSubmitとWaitで読む
+ * @note  完了を待つ間はワーカーが止まるので、同時に発行できる読み込みはワーカー数まで
+ */
+void LoadAssetBlocking(FwFileManager * manager, FwLoadState & state, const uint32_t asset) {
+    FwFileStream * stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessRead);
+    if (stream == nullptr) {
+        state.numFailed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint8_t chunk[s_chunkSize];
+    for (uint32_t i = 0; i < s_chunksPerAsset; ++i) {
+        const uint64_t offset = static_cast<uint64_t>(asset) * s_assetSize + i * s_chunkSize;
+        state.BeginRead();
+        stream->ReadAt(chunk, s_chunkSize, s_chunkSize, offset);
+        stream->Submit();
+        const sint32_t result = stream->Wait();
+        state.EndRead(result, chunk, offset);
+    }
+    stream->Close();
+}
+
+/**
+ * @struct FwLoadResult
+ */
+struct FwLoadResult {
+    double      seconds;
+    uint32_t    maxInFlight;
+    bool        valid;
+};
+
+/**
+ * @brief 全てのアセットを読み込む
+ */
+FwLoadResult LoadAssets(FwFileManager * manager, FwTaskFactory * factory, const bool async) {
+    FwLoadState state;
+    FwBenchTimer timer;
+    if (async) {
+        std::vector<FwCoroutine> loaders;
+        loaders.reserve(s_numAssets);
+        for (uint32_t asset = 0; asset < s_numAssets; ++asset) {
+            loaders.push_back(LoadAssetAsync(manager, state, asset));
+            loaders.back().Start(factory);
+        }
+        for (FwCoroutine & loader : loaders) {
+            loader.Wait();
+        }
+    } else {
+        FwLoadState * statePtr = &state;
+        FwTaskGroup * group = factory->CreateTaskGroup(s_numAssets);
+        for (uint32_t asset = 0; asset < s_numAssets; ++asset) {
+            group->AddTask([manager, statePtr, asset](FwTaskArgType) { LoadAssetBlocking(manager, *statePtr, asset); });
+        }
+        group->Submit();
+        group->Wait();
+        factory->DestroyTaskGroup(group);
+    }
+
+    FwLoadResult result;
+    result.seconds = timer.GetSeconds();
+    result.maxInFlight = state.maxInFlight.load();
+    result.valid = (state.numFailed.load() == 0) && (state.numInFlight.load() == 0);
+    return result;
+}
+
+/**
+ * @brief タスクグループを送出してco_awaitで待ち、最後のタスクが終わってから再開するまでの遅延を記録する
+ */
+FwCoroutine AwaitGroups(FwTaskFactory * factory, const uint32_t numResumes, std::vector<uint64_t> & latencies) {
+    std::atomic<uint64_t> endTime(0);
+    std::atomic<uint64_t> * endTimePtr = &endTime;
+    FwTaskGroup * group = factory->CreateTaskGroup(1);
+    for (uint32_t i = 0; i < numResumes; ++i) {
+        group->AddTask([endTimePtr](FwTaskArgType) { endTimePtr->store(FwBenchGetTimeNanoseconds(), std::memory_order_release); });
+        group->Submit();
+        co_await *group;
+        latencies.push_back(FwBenchGetTimeNanoseconds() - endTime.load(std::memory_order_acquire));
+        group->Reset();
+    }
+    factory->DestroyTaskGroup(group);
+}
+
+/**
+ * @brief タスクグループを送出してWaitで待ち、最後のタスクが終わってから戻るまでの遅延を記録する
+ */
+void WaitGroups(FwTaskFactory * factory, const uint32_t numResumes, std::vector<uint64_t> & latencies) {
+    std::atomic<uint64_t> endTime(0);
+    std::atomic<uint64_t> * endTimePtr = &endTime;
+    FwTaskGroup * group = factory->CreateTaskGroup(1);
+    for (uint32_t i = 0; i < numResumes; ++i) {
+        group->AddTask([endTimePtr](FwTaskArgType) { endTimePtr->store(FwBenchGetTimeNanoseconds(), std::memory_order_release); });
+        group->Submit();
+        group->Wait();
+        latencies.push_back(FwBenchGetTimeNanoseconds() - endTime.load(std::memory_order_acquire));
+        group->Reset();
+    }
+    factory->DestroyTaskGroup(group);
+}
+
+/**
+ * @class FwBenchAssetFile
+ * @brief 一時ディレクトリにアセットを詰めたファイルを書いておく
+ */
+class FwBenchAssetFile {
+public:
+    FwFileManager * GetManager() const {
+        return _manager;
+    }
+
+    bool IsValid() const {
+        return _valid;
+    }
+
+    FwBenchAssetFile()
+    : _manager(nullptr)
+    , _valid(false) {
+        FwFileManagerDesc desc;
+        desc.Init();
+        _manager = CreateFileManager(&desc);
+        char_t tempDir[FwPath::kMaxPathLen + 1];
+        _manager->SetBasePath(FwPath::GetTempDir(tempDir, FW_ARRAY_SIZEOF(tempDir)));
+        FwPath::Combine(_filePath, FW_ARRAY_SIZEOF(_filePath), tempDir, s_fileName);
+
+        const uint32_t fileSize = s_numAssets * s_assetSize;
+        std::vector<uint8_t> data(fileSize);
+        for (uint32_t i = 0; i < fileSize; ++i) {
+            data[i] = GetPattern(i);
+        }
+        FwFileStream * stream = _manager->FileStreamOpen(s_fileName, FwFileOptAccessWrite);
+        if (stream != nullptr) {
+            stream->Write(data.data(), fileSize, fileSize);
+            stream->Submit();
+            _valid = (stream->Wait() == FW_OK);
+            stream->Close();
+        }
+    }
+
+    ~FwBenchAssetFile() {
+        // 破棄する関数は無いので、スレッドを止めるだけにする
+        _manager->Shutdown();
+        FwFileDelete(_filePath);
+    }
+
+
+private:
+    FwFileManager * _manager;
+    bool            _valid;
+    char_t          _filePath[FwPath::kMaxPathLen + 1];
+};
+
+}   // namespace
+
+#endif  // FW_ENABLE_COROUTINE
+
+
+FW_BENCH(coroutine, "straight-line loaders: co_await ReadAtAsync / co_await group vs. blocking Submit+Wait on the workers") {
+#if FW_ENABLE_COROUTINE
+    FwBenchAssetFile file;
+    FW_BENCH_CHECK(file.IsValid());
+    const uint32_t numResumes = s_numResumes * context.scale;
+
+    printf("  assets: %u x %u reads of %u KB, each read waits for the previous one\n", s_numAssets, s_chunksPerAsset, s_chunkSize / 1024);
+    printf("  %8s %-10s %12s %12s %14s %14s\n", "workers", "loader", "assets/s", "in flight", "resume p50 us", "resume p99 us");
+    for (uint32_t numWorkers = FwBenchNextThreadCount(0, context.maxThreads); numWorkers != 0; numWorkers = FwBenchNextThreadCount(numWorkers, context.maxThreads)) {
+        FwTaskFactoryDesc desc;
+        desc.Init();
+        desc.numWorkers = static_cast<sint32_t>(numWorkers);
+        FwTaskFactory * factory = FwCreateTaskFactory(&desc);
+        FW_BENCH_CHECK(factory != nullptr);
+
+        const FwLoadResult blocking = LoadAssets(file.GetManager(), factory, false);
+        const FwLoadResult async = LoadAssets(file.GetManager(), factory, true);
+
+        std::vector<uint64_t> waitLatencies;
+        std::vector<uint64_t> resumeLatencies;
+        waitLatencies.reserve(numResumes);
+        resumeLatencies.reserve(numResumes);
+        WaitGroups(factory, numResumes, waitLatencies);
+        {
+            FwCoroutine awaiter = AwaitGroups(factory, numResumes, resumeLatencies);
+            awaiter.Start(factory);
+            awaiter.Wait();
+        }
+        FwDestroyTaskFactory(factory);
+
+        FW_BENCH_CHECK(blocking.valid && async.valid);
+        FW_BENCH_CHECK(waitLatencies.size() == numResumes && resumeLatencies.size() == numResumes);
+        // 待つ間にワーカーを手放すので、ワーカー数より多くの読み込みが同時に発行される
+        FW_BENCH_CHECK(blocking.maxInFlight <= numWorkers + 1);
+        FW_BENCH_CHECK(numWorkers + 1 < async.maxInFlight);
+
+        std::sort(waitLatencies.begin(), waitLatencies.end());
+        std::sort(resumeLatencies.begin(), resumeLatencies.end());
+        printf("  %8u %-10s %12.1f %12u %14.2f %14.2f\n", numWorkers, "wait", s_numAssets / blocking.seconds, blocking.maxInFlight,
+            FwBenchPercentile(waitLatencies, 50.0) * 1e-3, FwBenchPercentile(waitLatencies, 99.0) * 1e-3);
+        printf("  %8u %-10s %12.1f %12u %14.2f %14.2f\n", numWorkers, "co_await", s_numAssets / async.seconds, async.maxInFlight,
+            FwBenchPercentile(resumeLatencies, 50.0) * 1e-3, FwBenchPercentile(resumeLatencies, 99.0) * 1e-3);
+    }
+    printf("  in flight: most reads waiting for completion at the same time\n");
+    printf("  resume: from the end of the last task in a group until the waiter continues\n");
+#else
+    (void)context;
+    printf("  skipped: FW_BUILD_CONFIG_ENABLE_COROUTINE is off or the compiler has no C++20 coroutines\n");
+#endif
+    return FW_OK;
+}
@@ -0,0 +1,124 @@
+﻿/**
+ * @file bench_fiber.cpp
+ * @brief ファイバーの切り替えの遅延と、待機中のタスクをファイバーで中断した時のスループット
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numSwitches       = 2000000;
+static const uint32_t   s_numRounds         = 3;        ///< 最も速かった回を採用する
+static const uint32_t   s_numFrames         = 200;
+static const uint32_t   s_numOuterTasks     = 16;       ///< 中でWaitするタスク数
+static const uint32_t   s_numInnerTasks     = 32;
+static const uint32_t   s_innerTaskWork     = 2000;     ///< 内側のタスク毎の空回し回数
+
+/**
+ * @struct FwPingPong
+ * @brief 2つのファイバーの間を往復する
+ */
+struct FwPingPong {
+    FwFiber     main;
+    FwFiber     partner;
+    uint32_t    numSwitches;
+
+    static void PartnerEntry(void * userArgs) {
+        FwPingPong * self = reinterpret_cast<FwPingPong *>(userArgs);
+        for (;;) {
+            ++self->numSwitches;
+            self->partner.SwitchTo(&self->main);
+        }
+    }
+};
+
+/**
+ * @brief 各タスクが内側のグループを送出してWaitするフレームを実行する
+ * @return 実行したタスク数
+ */
+uint32_t RunNestedWaitFrame(FwTaskFactory * factory) {
+    std::atomic<uint32_t> numRuns(0);
+    std::atomic<uint32_t> * numRunsPtr = &numRuns;
+
+    FwTaskGroup * outer = factory->CreateTaskGroup(s_numOuterTasks);
+    for (uint32_t i = 0; i < s_numOuterTasks; ++i) {
+        outer->AddTask([factory, numRunsPtr](FwTaskArgType) {
+            FwTaskGroup * inner = factory->CreateTaskGroup(s_numInnerTasks);
+            for (uint32_t j = 0; j < s_numInnerTasks; ++j) {
+                inner->AddTask([numRunsPtr](FwTaskArgType) {
+                    volatile uint32_t work = 0;
+                    for (uint32_t k = 0; k < s_innerTaskWork; ++k) {
+                        work += k;
+                    }
+                    numRunsPtr->fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            inner->Submit();
+            inner->Wait();
+            factory->DestroyTaskGroup(inner);
+            numRunsPtr->fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    outer->Submit();
+    outer->Wait();
+    factory->DestroyTaskGroup(outer);
+    return numRuns.load();
+}
+
+}   // namespace
+
+
+FW_BENCH(fiber, "FwFiber context switch latency and nested Wait throughput with and without fibers") {
+    const uint32_t numSwitches = s_numSwitches * context.scale;
+
+    // 往復で2回切り替わる
+    double bestSeconds = 0.0;
+    for (uint32_t round = 0; round < s_numRounds; ++round) {
+        FwPingPong pingPong;
+        pingPong.numSwitches = 0;
+        FW_BENCH_CHECK(pingPong.main.ConvertFromThread());
+        FW_BENCH_CHECK(pingPong.partner.Create(&FwPingPong::PartnerEntry, &pingPong));
+
+        FwBenchTimer timer;
+        for (uint32_t i = 0; i < numSwitches / 2; ++i) {
+            pingPong.main.SwitchTo(&pingPong.partner);
+        }
+        const double seconds = timer.GetSeconds();
+        FW_BENCH_CHECK(pingPong.numSwitches == numSwitches / 2);
+
+        pingPong.partner.Destroy();
+        pingPong.main.Destroy();
+        if (round == 0 || seconds < bestSeconds) {
+            bestSeconds = seconds;
+        }
+    }
+    printf("  context switch: %.1f ns\n\n", bestSeconds / numSwitches * 1e9);
+
+    // Waitで中断するか、その場で他のタスクを実行するか
+    const uint32_t numFrames = s_numFrames * context.scale;
+    const uint32_t expected = s_numOuterTasks * (s_numInnerTasks + 1);
+    printf("  %8s %8s %14s\n", "workers", "fibers", "frame us");
+    for (uint32_t numWorkers = FwBenchNextThreadCount(0, context.maxThreads); numWorkers != 0; numWorkers = FwBenchNextThreadCount(numWorkers, context.maxThreads)) {
+        for (uint32_t numFibers : { 0u, 32u }) {
+            FwTaskFactoryDesc desc;
+            desc.Init();
+            desc.numWorkers = static_cast<sint32_t>(numWorkers);
+            desc.numFibers = numFibers;
+            FwTaskFactory * factory = FwCreateTaskFactory(&desc);
+            FW_BENCH_CHECK(factory != nullptr);
+
+            FwBenchTimer timer;
+            bool complete = true;
+            for (uint32_t frame = 0; frame < numFrames; ++frame) {
+                complete = complete && (RunNestedWaitFrame(factory) == expected);
+            }
+            const double seconds = timer.GetSeconds();
+            FwDestroyTaskFactory(factory);
+            FW_BENCH_CHECK(complete);
+
+            printf("  %8u %8u %14.1f\n", numWorkers, numFibers, seconds / numFrames * 1e6);
+        }
+    }
+    return FW_OK;
+}
@@ -0,0 +1,697 @@
+﻿/**
+ * @file bench_file_io.cpp
+ * @brief FwFileManagerの読み書きの順序と結果の検査、バックエンドとメモリマップの読み込み速度、読み込みの合体、完了の受け取り
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static char_t           s_fileName[]    = _T("fw_bench_file_io.tmp");  ///< str_tで渡すので書き換え可能な配列にしておく
+static const uint32_t   s_fileSize      = 64 * 1024;    ///< 最初に書いておくデータのサイズ
+static const uint32_t   s_headSize      = 256;          ///< 先頭から現在位置で読むサイズ
+static const uint32_t   s_readAtSize    = 256;          ///< 合体させる位置指定の読み込み1つのサイズ
+static const uint32_t   s_tailSize      = 1024;         ///< 末尾に書き足すサイズ（libcのバッファに収まる）
+static const uint32_t   s_markSize      = 100;
+static const uint32_t   s_largeFileSize = 64 * 1024 * 1024; ///< scale倍したバックエンド比較用のファイルサイズ
+static const uint32_t   s_chunkSize     = 256 * 1024;   ///< 先頭から順に読む時の1回のサイズ
+static const uint32_t   s_pageSize      = 4 * 1024;     ///< ランダムに読む時の1回のサイズ
+static const uint32_t   s_numPageReads  = 8192;         ///< ランダムに読む回数
+static const uint32_t   s_archiveSize   = 8 * 1024 * 1024;  ///< 小さなレコードを詰めたアーカイブのサイズ
+static const uint32_t   s_recordSize    = 1024;         ///< アーカイブから読むレコード1つのサイズ
+static const uint32_t   s_recordStride  = 1536;         ///< レコードの間隔（隙間は合体する時に読み飛ばす）
+static const uint32_t   s_numRecords    = 4096;         ///< scale倍して読むレコード数
+static const uint32_t   s_numRounds     = 64;           ///< 順序を検査する書き込みの回数
+static const uint32_t   s_blockSize     = 512;          ///< 順序を検査する読み書き1つのサイズ
+static const uint32_t   s_numStreams    = 256;          ///< 1つのスレッドから同時に読むストリーム数
+static const uint32_t   s_readsPerStream = 16;          ///< scale倍したストリーム毎の読み込み数
+static const double     s_deadlockTimeout = 5.0;        ///< 完了が届かなければ止まったとみなす秒数
+
+/**
+ * @brief 位置毎に決まった値
+ */
+FW_INLINE uint8_t GetPattern(const uint64_t offset) {
+    return static_cast<uint8_t>(offset % 251);
+}
+
+/**
+ * @brief 全てのバイトがvalueか
+ */
+bool IsFilled(const uint8_t * buffer, const size_t size, const uint8_t value) {
+    for (size_t i = 0; i < size; ++i) {
+        if (buffer[i] != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief offsetから読んだ内容が決まった値と一致するか
+ */
+bool IsPattern(const uint8_t * buffer, const size_t size, const uint64_t offset) {
+    for (size_t i = 0; i < size; ++i) {
+        if (buffer[i] != GetPattern(offset + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @class FwBenchFileManager
+ * @brief 一時ディレクトリを基準にしたファイルマネージャ
+ */
+class FwBenchFileManager {
+public:
+    FwFileManager * operator->() const {
+        return _manager;
+    }
+
+    /**
+     * @brief 一時ファイルの完全パス
+     */
+    const str_t GetFilePath() {
+        return _filePath;
+    }
+
+    explicit FwBenchFileManager(FwFileManagerDesc & desc)
+    : _manager(CreateFileManager(&desc)) {
+        char_t tempDir[FwPath::kMaxPathLen + 1];
+        _manager->SetBasePath(FwPath::GetTempDir(tempDir, FW_ARRAY_SIZEOF(tempDir)));
+        FwPath::Combine(_filePath, FW_ARRAY_SIZEOF(_filePath), tempDir, s_fileName);
+        FwFileDelete(_filePath);
+    }
+
+    ~FwBenchFileManager() {
+        // 破棄する関数は無いので、スレッドを止めるだけにする
+        _manager->Shutdown();
+        FwFileDelete(_filePath);
+    }
+
+
+private:
+    FwFileManager * _manager;
+    char_t          _filePath[FwPath::kMaxPathLen + 1];
+};
+
+/**
+ * @brief 決まった値で埋めたファイルを書いておく
+ */
+bool WritePatternFile(FwBenchFileManager & manager, const uint32_t fileSize) {
+    std::vector<uint8_t> data(fileSize);
+    for (uint32_t i = 0; i < fileSize; ++i) {
+        data[i] = GetPattern(i);
+    }
+    FwFileStream * stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessWrite);
+    if (stream == nullptr) {
+        return false;
+    }
+    stream->Write(data.data(), fileSize, fileSize);
+    stream->Submit();
+    const sint32_t result = stream->Wait();
+    stream->Close();
+    return result == FW_OK;
+}
+
+/**
+ * @brief ランダムに読むページの位置
+ */
+std::vector<uint64_t> MakePageOffsets(const uint32_t fileSize) {
+    std::vector<uint64_t> offsets(s_numPageReads);
+    const uint32_t numPages = fileSize / s_pageSize;
+    uint32_t seed = 1;
+    for (uint64_t & offset : offsets) {
+        seed = seed * 1103515245 + 12345;
+        offset = static_cast<uint64_t>((seed >> 8) % numPages) * s_pageSize;
+    }
+    return offsets;
+}
+
+/**
+ * @struct FwReadSpeed
+ */
+struct FwReadSpeed {
+    double  sequentialSeconds;      ///< ファイル全体を先頭から読んだ時間
+    double  randomSeconds;          ///< ページをランダムに読んだ時間
+    bool    valid;                  ///< 読んだ内容が全て正しかったか
+};
+
+/**
+ * @brief ストリームへ読み込みを全て積んでから送出し、完了を待つ
+ */
+FwReadSpeed ReadWithStream(FwBenchFileManager & manager, const uint32_t fileSize, const std::vector<uint64_t> & pageOffsets) {
+    FwReadSpeed speed = {};
+    FwFileStream * stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessRead);
+    if (stream == nullptr) {
+        return speed;
+    }
+
+    std::vector<uint8_t> buffer(fileSize);
+    FwBenchTimer timer;
+    for (uint32_t offset = 0; offset < fileSize; offset += s_chunkSize) {
+        stream->ReadAt(&buffer[offset], s_chunkSize, s_chunkSize, offset);
+    }
+    stream->Submit();
+    speed.valid = (stream->Wait() == FW_OK);
+    speed.sequentialSeconds = timer.GetSeconds();
+    speed.valid &= IsPattern(buffer.data(), fileSize, 0);
+
+    std::vector<uint8_t> pages(static_cast<size_t>(s_numPageReads) * s_pageSize);
+    timer.Reset();
+    for (uint32_t i = 0; i < s_numPageReads; ++i) {
+        stream->ReadAt(&pages[static_cast<size_t>(i) * s_pageSize], s_pageSize, s_pageSize, pageOffsets[i]);
+    }
+    stream->Submit();
+    speed.valid &= (stream->Wait() == FW_OK);
+    speed.randomSeconds = timer.GetSeconds();
+    for (uint32_t i = 0; i < s_numPageReads; ++i) {
+        speed.valid &= IsPattern(&pages[static_cast<size_t>(i) * s_pageSize], s_pageSize, pageOffsets[i]);
+    }
+
+    stream->Close();
+    return speed;
+}
+
+/**
+ * @brief ファイルをマップし、読み込みと同じくバッファへ写す
+ * @note  マップとヒントを与える時間も含める
+ */
+FwReadSpeed ReadWithMapping(const str_t filePath, const uint32_t fileSize, const std::vector<uint64_t> & pageOffsets) {
+    FwReadSpeed speed = {};
+    std::vector<uint8_t> buffer(fileSize);
+    FwFileMapping mapping;
+
+    FwBenchTimer timer;
+    if (FwFileMapByName(filePath, FwFileMapModeReadOnly, mapping) != FW_OK || mapping.GetSize() != fileSize) {
+        return speed;
+    }
+    FwFileMapAdvise(mapping, 0, 0, FwFileMapAdviceSequential);
+    memcpy(buffer.data(), mapping.GetData(), fileSize);
+    speed.sequentialSeconds = timer.GetSeconds();
+    speed.valid = IsPattern(buffer.data(), fileSize, 0);
+
+    std::vector<uint8_t> pages(static_cast<size_t>(s_numPageReads) * s_pageSize);
+    const uint8_t * data = reinterpret_cast<const uint8_t *>(mapping.GetData());
+    timer.Reset();
+    FwFileMapAdvise(mapping, 0, 0, FwFileMapAdviceRandom);
+    for (uint32_t i = 0; i < s_numPageReads; ++i) {
+        memcpy(&pages[static_cast<size_t>(i) * s_pageSize], data + pageOffsets[i], s_pageSize);
+    }
+    speed.randomSeconds = timer.GetSeconds();
+    for (uint32_t i = 0; i < s_numPageReads; ++i) {
+        speed.valid &= IsPattern(&pages[static_cast<size_t>(i) * s_pageSize], s_pageSize, pageOffsets[i]);
+    }
+
+    speed.valid &= (FwFileUnmap(mapping) == FW_OK);
+    return speed;
+}
+
+/**
+ * @struct FwMergeResult
+ */
+struct FwMergeResult {
+    double          seconds;
+    FwFileIOStats   stats;
+    bool            valid;          ///< 読んだ内容が全て正しかったか
+};
+
+/**
+ * @brief アーカイブのレコードをばらばらの順に積んで、まとめて送出する
+ */
+FwMergeResult ReadRecords(FwBenchFileManager & manager, const uint32_t numRecords) {
+    FwMergeResult result = {};
+    std::vector<uint32_t> order(numRecords);
+    for (uint32_t i = 0; i < numRecords; ++i) {
+        order[i] = i;
+    }
+    uint32_t seed = 1;
+    for (uint32_t i = numRecords - 1; 0 < i; --i) {
+        seed = seed * 1103515245 + 12345;
+        std::swap(order[i], order[(seed >> 8) % (i + 1)]);
+    }
+
+    FwFileStream * stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessRead);
+    if (stream == nullptr) {
+        return result;
+    }
+    std::vector<uint8_t> records(static_cast<size_t>(numRecords) * s_recordSize);
+    const uint32_t numSlots = s_archiveSize / s_recordStride;
+    manager->ResetIOStats();
+
+    FwBenchTimer timer;
+    for (const uint32_t record : order) {
+        const uint64_t offset = static_cast<uint64_t>(record % numSlots) * s_recordStride;
+        stream->ReadAt(&records[static_cast<size_t>(record) * s_recordSize], s_recordSize, s_recordSize, offset);
+    }
+    stream->Submit();
+    result.valid = (stream->Wait() == FW_OK);
+    result.seconds = timer.GetSeconds();
+    manager->GetIOStats(result.stats);
+
+    for (uint32_t record = 0; record < numRecords; ++record) {
+        const uint64_t offset = static_cast<uint64_t>(record % numSlots) * s_recordStride;
+        result.valid &= IsPattern(&records[static_cast<size_t>(record) * s_recordSize], s_recordSize, offset);
+    }
+    stream->Close();
+    return result;
+}
+
+/**
+ * @brief 書き込みを挟んだ読み込みが、積んだ順序どおりの内容を読むか
+ * @note  位置指定の書き込みは末尾へ書き足す（読み書きアクセスはPOSIXでは追記で開く）
+ *        書き足したブロックを直後に読めば書いた値、現在位置からの読み込みは先頭から順に続きを読む
+ *        その間の書き込みと重ならない位置指定の読み込みは、合体や並べ替えをしても元の内容を読む
+ */
+bool CheckOrdering(FwBenchFileManager & manager, const uint32_t fileSize) {
+    FwFileStream * stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessRW);
+    if (stream == nullptr) {
+        return false;
+    }
+
+    std::vector<uint8_t> written(static_cast<size_t>(s_numRounds) * s_blockSize);
+    std::vector<uint8_t> readBack(written.size());
+    std::vector<uint8_t> sequential(written.size());
+    std::vector<uint8_t> unrelated(written.size());
+    std::vector<uint64_t> unrelatedOffsets(s_numRounds);
+    uint32_t seed = 1;
+    for (uint32_t round = 0; round < s_numRounds; ++round) {
+        const size_t block = static_cast<size_t>(round) * s_blockSize;
+        seed = seed * 1103515245 + 12345;
+        unrelatedOffsets[round] = static_cast<uint64_t>((seed >> 8) % (fileSize / s_blockSize)) * s_blockSize;
+        memset(&written[block], static_cast<int>(round + 1), s_blockSize);
+
+        stream->ReadAt(&unrelated[block], s_blockSize, s_blockSize, unrelatedOffsets[round]);
+        stream->WriteAt(&written[block], s_blockSize, s_blockSize, fileSize + block);
+        stream->ReadAt(&readBack[block], s_blockSize, s_blockSize, fileSize + block);
+        stream->Read(&sequential[block], s_blockSize, s_blockSize);
+    }
+    stream->Submit();
+    bool valid = (stream->Wait() == FW_OK);
+    stream->Close();
+
+    for (uint32_t round = 0; round < s_numRounds; ++round) {
+        const size_t block = static_cast<size_t>(round) * s_blockSize;
+        valid &= IsPattern(&unrelated[block], s_blockSize, unrelatedOffsets[round]);
+        valid &= IsFilled(&readBack[block], s_blockSize, static_cast<uint8_t>(round + 1));
+        valid &= IsPattern(&sequential[block], s_blockSize, block);
+    }
+    return valid;
+}
+
+/**
+ * @enum FwDeliveryMode
+ * @brief 完了の受け取り方
+ */
+enum FwDeliveryMode {
+    FwDeliveryWait,         ///< ストリーム毎にWaitで待つ
+    FwDeliveryPoll,         ///< 読み込み毎にPollCompletionsで受け取る
+    FwDeliveryCallback,     ///< 読み込み毎のコールバック
+    FwDeliverySubmitGroup,  ///< ストリーム毎にSubmitへ渡したコールバック
+};
+
+/**
+ * @struct FwDeliveryState
+ * @brief 届いた完了の数
+ */
+struct FwDeliveryState {
+    std::vector<std::atomic<uint32_t>>  numDelivered;   ///< 読み込みまたはストリーム毎に届いた回数
+    std::vector<FwFileRequestToken>     tokens;         ///< 読み込み毎に発行された番号
+    std::atomic<uint32_t>               numTotal;
+    std::atomic<uint32_t>               numFailed;
+
+    explicit FwDeliveryState(const uint32_t numSlots)
+    : numDelivered(numSlots)
+    , tokens(numSlots, FwInvalidFileRequestToken)
+    , numTotal(0)
+    , numFailed(0) {
+    }
+};
+
+/**
+ * @struct FwDeliverySlot
+ * @brief 読み込みまたはストリーム1つに渡すユーザデータ
+ */
+struct FwDeliverySlot {
+    FwDeliveryState *   state;
+    uint32_t            index;
+};
+
+/**
+ * @brief 届いた完了を記録する
+ */
+static void Deliver(const FwDeliverySlot * slot, const FwFileRequestToken token, const sint32_t result) {
+    FwDeliveryState * state = slot->state;
+    state->numDelivered[slot->index].fetch_add(1, std::memory_order_relaxed);
+    if (result != FW_OK || (token != FwInvalidFileRequestToken && token != state->tokens[slot->index])) {
+        state->numFailed.fetch_add(1, std::memory_order_relaxed);
+    }
+    state->numTotal.fetch_add(1, std::memory_order_release);
+}
+
+static void OnRequestCompleted(const FwFileCompletion & completion) {
+    Deliver(reinterpret_cast<const FwDeliverySlot *>(completion.userData), completion.token, completion.result);
+}
+
+static void OnStreamCompleted(void * context, sint32_t result) {
+    Deliver(reinterpret_cast<const FwDeliverySlot *>(context), FwInvalidFileRequestToken, result);
+}
+
+/**
+ * @struct FwDeliveryResult
+ */
+struct FwDeliveryResult {
+    double      seconds;
+    uint32_t    numPolls;       ///< PollCompletionsを呼んだ回数
+    bool        valid;          ///< 全ての完了がちょうど1回ずつ正しい番号で届き、読んだ内容が正しかったか
+};
+
+/**
+ * @brief 1つのスレッドから多数のストリームへ読み込みを積み、完了を受け取る
+ */
+FwDeliveryResult ReadManyStreams(FwBenchFileManager & manager, const FwDeliveryMode mode, const uint32_t readsPerStream) {
+    FwDeliveryResult result = {};
+    const uint32_t numReads = s_numStreams * readsPerStream;
+    const uint32_t numSlots = (mode == FwDeliverySubmitGroup) ? s_numStreams : numReads;
+    FwDeliveryState state(numSlots);
+    std::vector<FwDeliverySlot> slots(numSlots);
+    for (uint32_t i = 0; i < numSlots; ++i) {
+        slots[i].state = &state;
+        slots[i].index = i;
+    }
+
+    std::vector<FwFileStream *> streams(s_numStreams, nullptr);
+    for (FwFileStream *& stream : streams) {
+        stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessRead);
+        if (stream == nullptr) {
+            return result;
+        }
+    }
+    std::vector<uint8_t> buffer(static_cast<size_t>(numReads) * s_pageSize);
+    const uint32_t numPages = s_largeFileSize / s_pageSize;
+
+    FwBenchTimer timer;
+    for (uint32_t i = 0; i < s_numStreams; ++i) {
+        FwFileStream * stream = streams[i];
+        for (uint32_t j = 0; j < readsPerStream; ++j) {
+            const uint32_t read = i * readsPerStream + j;
+            const uint64_t offset = static_cast<uint64_t>(read % numPages) * s_pageSize;
+            uint8_t * dst = &buffer[static_cast<size_t>(read) * s_pageSize];
+            if (mode == FwDeliveryPoll || mode == FwDeliveryCallback) {
+                FwFileRequestDesc desc;
+                desc.Init();
+                desc._userData = &slots[read];
+                desc._postCompletion = (mode == FwDeliveryPoll);
+                desc._callback = (mode == FwDeliveryCallback) ? &OnRequestCompleted : nullptr;
+                stream->ReadAt(dst, s_pageSize, s_pageSize, offset, desc, &state.tokens[read]);
+            } else {
+                stream->ReadAt(dst, s_pageSize, s_pageSize, offset);
+            }
+        }
+        if (mode == FwDeliverySubmitGroup) {
+            stream->Submit(&OnStreamCompleted, &slots[i]);
+        } else {
+            stream->Submit();
+        }
+    }
+
+    // 完了を受け取る。Waitはストリーム毎に順に待つ
+    result.valid = true;
+    if (mode == FwDeliveryWait) {
+        for (FwFileStream * stream : streams) {
+            result.valid &= (stream->Wait() == FW_OK);
+        }
+    } else {
+        FwFileCompletion completions[64];
+        FwBenchTimer timeout;
+        while (state.numTotal.load(std::memory_order_acquire) < numSlots && timeout.GetSeconds() < s_deadlockTimeout) {
+            if (mode != FwDeliveryPoll) {
+                std::this_thread::yield();
+                continue;
+            }
+            const uint32_t numCompletions = manager->PollCompletions(completions, FW_ARRAY_SIZEOF(completions));
+            ++result.numPolls;
+            for (uint32_t i = 0; i < numCompletions; ++i) {
+                Deliver(reinterpret_cast<const FwDeliverySlot *>(completions[i].userData), completions[i].token, completions[i].result);
+            }
+            if (numCompletions == 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    result.seconds = timer.GetSeconds();
+
+    for (FwFileStream * stream : streams) {
+        stream->Close();
+    }
+    // 閉じた後に余分な完了が届いていない
+    if (mode == FwDeliveryPoll) {
+        FwFileCompletion completion;
+        result.valid &= (manager->PollCompletions(&completion, 1) == 0);
+    }
+
+    if (mode != FwDeliveryWait) {
+        result.valid &= (state.numTotal.load() == numSlots) && (state.numFailed.load() == 0);
+        for (uint32_t i = 0; i < numSlots; ++i) {
+            result.valid &= (state.numDelivered[i].load() == 1);
+        }
+    }
+    for (uint32_t read = 0; read < numReads; ++read) {
+        const uint64_t offset = static_cast<uint64_t>(read % numPages) * s_pageSize;
+        result.valid &= IsPattern(&buffer[static_cast<size_t>(read) * s_pageSize], s_pageSize, offset);
+    }
+    return result;
+}
+
+static void PrintReadSpeed(const char * name, const FwReadSpeed & speed, const uint32_t fileSize) {
+    printf("  %-12s %12.1f %12.1f %12.2f\n", name,
+        static_cast<double>(fileSize) / (1024.0 * 1024.0) / speed.sequentialSeconds,
+        s_numPageReads / speed.randomSeconds * 1e-3,
+        speed.randomSeconds / s_numPageReads * 1e6);
+}
+
+} // namespace
+
+
+FW_BENCH(file_io_keep_seek, "sync backend: merged ReadAt between stream Read/Write keeps the stdio buffer and file position") {
+    FwFileManagerDesc desc;
+    desc.Init();
+    desc._ioBackend = FwFileIOBackendSync;
+    FwBenchFileManager manager(desc);
+    FW_BENCH_CHECK(manager->GetIOBackend() == FwFileIOBackendSync);
+
+    // 決まった値を書いておく
+    std::vector<uint8_t> data(s_fileSize);
+    for (uint32_t i = 0; i < s_fileSize; ++i) {
+        data[i] = GetPattern(i);
+    }
+    FwFileStream * stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessWrite);
+    FW_BENCH_CHECK(stream != nullptr);
+    stream->Write(data.data(), s_fileSize, s_fileSize);
+    stream->Submit();
+    FW_BENCH_CHECK(stream->Wait() == FW_OK);
+    stream->Close();
+
+    stream = manager->FileStreamOpen(s_fileName, FwFileOptAccessRW);
+    FW_BENCH_CHECK(stream != nullptr);
+    manager->ResetIOStats();
+
+    std::vector<uint8_t> tail(s_tailSize, 'w');
+    std::vector<uint8_t> mark(s_markSize, 'x');
+    uint8_t head[2][s_headSize] = {};
+    uint8_t middle[2][s_readAtSize] = {};
+    uint8_t appended[2][s_readAtSize] = {};
+
+    // 現在位置からの読み込みの間に、隣り合う位置指定の読み込みを挟む
+    FW_BENCH_CHECK(stream->Read(head[0], s_headSize, s_headSize) == FW_OK);
+    FW_BENCH_CHECK(stream->ReadAt(middle[0], s_readAtSize, s_readAtSize, s_fileSize / 2) == FW_OK);
+    FW_BENCH_CHECK(stream->ReadAt(middle[1], s_readAtSize, s_readAtSize, s_fileSize / 2 + s_readAtSize) == FW_OK);
+    FW_BENCH_CHECK(stream->Read(head[1], s_headSize, s_headSize) == FW_OK);
+
+    // 末尾へ書き足した直後に位置指定で読み、さらに現在位置から書き足す
+    stream->Seek(0, FwSeekOriginEnd);
+    FW_BENCH_CHECK(stream->Write(tail.data(), s_tailSize, s_tailSize) == FW_OK);
+    FW_BENCH_CHECK(stream->ReadAt(appended[0], s_readAtSize, s_readAtSize, s_fileSize) == FW_OK);
+    FW_BENCH_CHECK(stream->ReadAt(appended[1], s_readAtSize, s_readAtSize, s_fileSize + s_readAtSize) == FW_OK);
+    FW_BENCH_CHECK(stream->Write(mark.data(), s_markSize, s_markSize) == FW_OK);
+    stream->Submit();
+    FW_BENCH_CHECK(stream->Wait() == FW_OK);
+
+    uint8_t written[s_markSize] = {};
+    uint8_t skipped[s_markSize] = {};
+    FW_BENCH_CHECK(stream->ReadAt(written, s_markSize, s_markSize, s_fileSize + s_tailSize) == FW_OK);
+    FW_BENCH_CHECK(stream->ReadAt(skipped, s_markSize, s_markSize, s_fileSize + 2 * s_readAtSize) == FW_OK);
+    stream->Submit();
+    FW_BENCH_CHECK(stream->Wait() == FW_OK);
+    stream->Close();
+
+    FwFileIOStats stats;
+    manager->GetIOStats(stats);
+    printf("  %-10s %10s %10s %10s\n", "backend", "commands", "issued", "merged");
+    printf("  %-10s %10llu %10llu %10llu\n", "sync",
+        static_cast<unsigned long long>(stats.numCommands), static_cast<unsigned long long>(stats.numIssued), static_cast<unsigned long long>(stats.numMerged));
+
+    FW_BENCH_CHECK(0 < stats.numMerged);
+    FW_BENCH_CHECK(IsPattern(head[0], s_headSize, 0));
+    FW_BENCH_CHECK(IsPattern(middle[0], s_readAtSize, s_fileSize / 2));
+    FW_BENCH_CHECK(IsPattern(middle[1], s_readAtSize, s_fileSize / 2 + s_readAtSize));
+    // 位置指定の読み込みで現在位置が動いていれば、合体して読んだ範囲の続きを読んでしまう
+    FW_BENCH_CHECK(IsPattern(head[1], s_headSize, s_headSize));
+    // libcのバッファに残っていれば、書き足す前の内容（ファイルの末尾）を読んでしまう
+    FW_BENCH_CHECK(IsFilled(appended[0], s_readAtSize, 'w'));
+    FW_BENCH_CHECK(IsFilled(appended[1], s_readAtSize, 'w'));
+    FW_BENCH_CHECK(IsFilled(written, s_markSize, 'x'));
+    FW_BENCH_CHECK(IsFilled(skipped, s_markSize, 'w'));
+    return FW_OK;
+}
+
+
+FW_BENCH(file_read_backends, "reading a file: FwFileMapping vs. FwFileManager on the sync, thread-pool and io_uring backends") {
+    const uint32_t fileSize = s_largeFileSize * context.scale;
+    const std::vector<uint64_t> pageOffsets = MakePageOffsets(fileSize);
+
+    static const struct {
+        const char *        name;
+        FwFileIOBackend     backend;
+    } s_backends[] = {
+        { "sync",           FwFileIOBackendSync },
+        { "thread pool",    FwFileIOBackendThreadPool },
+        { "io_uring",       FwFileIOBackendIoUring },
+    };
+
+    printf("  file: %.1f MB, sequential reads: %u KB, random reads: %u x %u KB\n",
+        static_cast<double>(fileSize) / (1024.0 * 1024.0), s_chunkSize / 1024, s_numPageReads, s_pageSize / 1024);
+    printf("  %-12s %12s %12s %12s\n", "reader", "seq MB/s", "rand kIOPS", "rand us/op");
+
+    for (const auto & entry : s_backends) {
+        FwFileManagerDesc desc;
+        desc.Init();
+        desc._ioBackend = entry.backend;
+        // 合体させるとバックエンドへ渡す数が変わるので、1コマンドを1回の読み込みにする
+        desc._maxMergeSize = 0;
+        FwBenchFileManager manager(desc);
+        FW_BENCH_CHECK(WritePatternFile(manager, fileSize));
+
+        const FwReadSpeed speed = ReadWithStream(manager, fileSize, pageOffsets);
+        FW_BENCH_CHECK(speed.valid);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%s%s", entry.name, (manager->GetIOBackend() == entry.backend) ? "" : "*");
+        PrintReadSpeed(name, speed, fileSize);
+    }
+
+    // マップはファイルマネージャを通さずに読む
+    {
+        FwFileManagerDesc desc;
+        desc.Init();
+        desc._ioBackend = FwFileIOBackendSync;
+        FwBenchFileManager manager(desc);
+        FW_BENCH_CHECK(WritePatternFile(manager, fileSize));
+
+        const FwReadSpeed speed = ReadWithMapping(manager.GetFilePath(), fileSize, pageOffsets);
+        FW_BENCH_CHECK(speed.valid);
+        PrintReadSpeed("mapping", speed, fileSize);
+    }
+    printf("  *: the backend was not available, fell back to the thread pool\n");
+    printf("  the file was just written, so reads hit the page cache and show the per-request cost, not the device\n");
+    return FW_OK;
+}
+
+
+FW_BENCH(file_io_merge, "small ReadAt into one archive: elevator merging on vs. off, and read/write ordering across merged batches") {
+    const uint32_t numRecords = s_numRecords * context.scale;
+
+    static const struct {
+        const char *        name;
+        FwFileIOBackend     backend;
+    } s_backends[] = {
+        { "sync",           FwFileIOBackendSync },
+        { "thread pool",    FwFileIOBackendThreadPool },
+        { "io_uring",       FwFileIOBackendIoUring },
+    };
+
+    printf("  records: %u x %u bytes every %u bytes, submitted in random order\n", numRecords, s_recordSize, s_recordStride);
+    printf("  %-12s %6s %10s %10s %10s %10s %10s %10s\n", "backend", "merge", "MB/s", "issued", "merged", "avg us", "max us", "read amp");
+
+    for (const auto & entry : s_backends) {
+        for (uint32_t merge = 0; merge < 2; ++merge) {
+            FwFileManagerDesc desc;
+            desc.Init();
+            desc._ioBackend = entry.backend;
+            if (merge == 0) {
+                desc._maxMergeSize = 0;
+            }
+            FwBenchFileManager manager(desc);
+            FW_BENCH_CHECK(WritePatternFile(manager, s_archiveSize));
+
+            const FwMergeResult result = ReadRecords(manager, numRecords);
+            FW_BENCH_CHECK(result.valid);
+            FW_BENCH_CHECK(result.stats.numCommands == numRecords);
+            // 合体しなければ1コマンドを1回で読む。合体すれば隣り合うレコードをまとめて読む
+            // io_uringは合体せずに位置順に発行し、隣接する要求の合体はカーネルに任せる
+            const bool merged = (merge != 0) && (manager->GetIOBackend() != FwFileIOBackendIoUring);
+            FW_BENCH_CHECK(merged ? (result.stats.numIssued < numRecords) : (result.stats.numMerged == 0 && result.stats.numIssued == numRecords));
+
+            // 合体の有無に関わらず、積んだ順序どおりに読み書きする
+            FW_BENCH_CHECK(CheckOrdering(manager, s_archiveSize));
+
+            char name[32];
+            snprintf(name, sizeof(name), "%s%s", entry.name, (manager->GetIOBackend() == entry.backend) ? "" : "*");
+            const FwFileIOStats & stats = result.stats;
+            printf("  %-12s %6s %10.1f %10llu %10llu %10.1f %10llu %10.2f\n", name, (merge != 0) ? "on" : "off",
+                static_cast<double>(stats.bytesRequested) / (1024.0 * 1024.0) / result.seconds,
+                static_cast<unsigned long long>(stats.numIssued), static_cast<unsigned long long>(stats.numMerged),
+                static_cast<double>(stats.totalLatency) / Max<uint64_t>(stats.numCommands, 1),
+                static_cast<unsigned long long>(stats.maxLatency),
+                static_cast<double>(stats.bytesIssued) / Max<uint64_t>(stats.bytesRequested, 1));
+        }
+    }
+    printf("  *: the backend was not available, fell back to the thread pool\n");
+    printf("  read amp: bytes read including the gaps filled by merging, per byte requested\n");
+    return FW_OK;
+}
+
+
+FW_BENCH(file_io_completions, "one loader thread driving 256 streams: completions via Wait, PollCompletions, request callbacks and submit-group callbacks") {
+    const uint32_t readsPerStream = s_readsPerStream * context.scale;
+    const uint32_t numReads = s_numStreams * readsPerStream;
+
+    static const struct {
+        const char *        name;
+        FwFileIOBackend     backend;
+    } s_backends[] = {
+        { "thread pool",    FwFileIOBackendThreadPool },
+        { "io_uring",       FwFileIOBackendIoUring },
+    };
+    static const struct {
+        const char *        name;
+        FwDeliveryMode      mode;
+    } s_modes[] = {
+        { "wait",           FwDeliveryWait },
+        { "poll",           FwDeliveryPoll },
+        { "callback",       FwDeliveryCallback },
+        { "submit group",   FwDeliverySubmitGroup },
+    };
+
+    printf("  streams: %u, reads: %u x %u KB\n", s_numStreams, numReads, s_pageSize / 1024);
+    printf("  %-12s %-14s %14s %10s\n", "backend", "delivery", "kreads/s", "polls");
+    for (const auto & entry : s_backends) {
+        FwFileManagerDesc desc;
+        desc.Init();
+        desc._ioBackend = entry.backend;
+        FwBenchFileManager manager(desc);
+        FW_BENCH_CHECK(WritePatternFile(manager, s_largeFileSize));
+
+        char name[32];
+        snprintf(name, sizeof(name), "%s%s", entry.name, (manager->GetIOBackend() == entry.backend) ? "" : "*");
+        for (const auto & mode : s_modes) {
+            const FwDeliveryResult result = ReadManyStreams(manager, mode.mode, readsPerStream);
+            FW_BENCH_CHECK(result.valid);
+            printf("  %-12s %-14s %14.1f %10u\n", name, mode.name, numReads / result.seconds * 1e-3, result.numPolls);
+        }
+    }
+    printf("  *: the backend was not available, fell back to the thread pool\n");
+    printf("  every token, userData and submit-group callback is checked to arrive exactly once\n");
+    return FW_OK;
+}
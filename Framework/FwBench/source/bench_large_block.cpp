@@ -0,0 +1,226 @@
+﻿/**
+ * @file bench_large_block.cpp
+ * @brief 大きなメッシュバッファを走査した時の、FwLargeBlockAllocatorのヒュージページとTLBミス
+ */
+#include "stdafx.h"
+
+#if !defined(FW_PLATFORM_WIN32)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const sint32_t   s_benchTag          = FwMaxMemAllocatorTag;
+#if defined(FW_PLATFORM_WIN64) || defined(__LP64__)
+static const size_t     s_bufferSize        = static_cast<size_t>(2) * 1024 * 1024 * 1024; ///< scale倍したメッシュバッファのサイズ
+#else
+static const size_t     s_bufferSize        = 256 * 1024 * 1024;
+#endif
+static const uint32_t   s_numGathers        = 16 * 1024 * 1024;     ///< インデックスで頂点を引く回数
+
+/**
+ * @struct FwBenchVertex
+ */
+struct FwBenchVertex {
+    float   position[3];
+    float   normal[3];
+    float   uv[2];
+};
+
+/**
+ * @class FwBenchTlbCounter
+ * @brief データTLBのミス回数
+ * @note  Linuxのperf_event_openで数えます。使えなければIsValid()がfalse
+ */
+class FwBenchTlbCounter {
+public:
+    bool IsValid() const {
+        return _fd >= 0;
+    }
+
+    void Start() {
+#if !defined(FW_PLATFORM_WIN32)
+        if (IsValid()) {
+            ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t Stop() {
+        uint64_t count = 0;
+#if !defined(FW_PLATFORM_WIN32)
+        if (IsValid()) {
+            ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(_fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+    FwBenchTlbCounter()
+    : _fd(-1) {
+#if !defined(FW_PLATFORM_WIN32)
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~FwBenchTlbCounter() {
+#if !defined(FW_PLATFORM_WIN32)
+        if (IsValid()) {
+            close(_fd);
+        }
+#endif
+    }
+
+
+private:
+    int     _fd;
+};
+
+/**
+ * @struct FwMeshScanResult
+ */
+struct FwMeshScanResult {
+    double      fillSeconds;        ///< 最初に書き込む時間（ページフォルトを含む）
+    double      streamSeconds;      ///< 先頭から順に読む時間
+    double      gatherSeconds;      ///< インデックスで飛び飛びに読む時間
+    uint64_t    streamTlbMisses;
+    uint64_t    gatherTlbMisses;
+    double      checksum;
+    size_t      residentAfterFree;  ///< 解放した後に残った物理メモリの増分
+};
+
+/**
+ * @brief メッシュバッファを書き込み、順に読み、インデックスで引く
+ */
+FwMeshScanResult ScanMesh(const sint32_t tag, const size_t bufferSize, FwBenchTlbCounter & counter) {
+    FwMeshScanResult result = {};
+    const size_t numVertices = bufferSize / sizeof(FwBenchVertex);
+    const size_t baseResident = FwBenchGetResidentBytes();
+
+    FwBenchVertex * vertices = reinterpret_cast<FwBenchVertex *>(FwMallocAligned(numVertices * sizeof(FwBenchVertex), 64, tag));
+    if (vertices == nullptr) {
+        return result;
+    }
+
+    FwBenchTimer timer;
+    for (size_t i = 0; i < numVertices; ++i) {
+        FwBenchVertex & vertex = vertices[i];
+        const float value = static_cast<float>(i & 1023);
+        vertex.position[0] = value;
+        vertex.position[1] = value * 0.5f;
+        vertex.position[2] = value * 0.25f;
+        vertex.normal[0] = vertex.normal[1] = vertex.normal[2] = 0.0f;
+        vertex.uv[0] = vertex.uv[1] = 0.0f;
+    }
+    result.fillSeconds = timer.GetSeconds();
+
+    double streamSum = 0.0;
+    timer.Reset();
+    counter.Start();
+    for (size_t i = 0; i < numVertices; ++i) {
+        streamSum += vertices[i].position[0] + vertices[i].position[1] + vertices[i].position[2];
+    }
+    result.streamTlbMisses = counter.Stop();
+    result.streamSeconds = timer.GetSeconds();
+
+    // インデックスバッファを模した乱数で頂点を引く
+    double gatherSum = 0.0;
+    uint64_t seed = 1;
+    timer.Reset();
+    counter.Start();
+    for (uint32_t i = 0; i < s_numGathers; ++i) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        gatherSum += vertices[(seed >> 17) % numVertices].position[1];
+    }
+    result.gatherTlbMisses = counter.Stop();
+    result.gatherSeconds = timer.GetSeconds();
+    result.checksum = streamSum + gatherSum;
+
+    FwFree(vertices);
+    const size_t resident = FwBenchGetResidentBytes();
+    result.residentAfterFree = resident - Min(baseResident, resident);
+    return result;
+}
+
+static void PrintMeshScanResult(const char * name, const size_t bufferSize, const FwMeshScanResult & result, const bool hasCounter) {
+    const double gb = static_cast<double>(bufferSize) / (1024.0 * 1024.0 * 1024.0);
+    if (hasCounter) {
+        printf("  %-12s %10.2f %10.2f %10.1f %14llu %14llu %10.1f\n", name,
+            gb / result.fillSeconds, gb / result.streamSeconds, result.gatherSeconds / s_numGathers * 1e9,
+            static_cast<unsigned long long>(result.streamTlbMisses), static_cast<unsigned long long>(result.gatherTlbMisses),
+            static_cast<double>(result.residentAfterFree) / (1024.0 * 1024.0));
+    } else {
+        printf("  %-12s %10.2f %10.2f %10.1f %14s %14s %10.1f\n", name,
+            gb / result.fillSeconds, gb / result.streamSeconds, result.gatherSeconds / s_numGathers * 1e9,
+            "n/a", "n/a", static_cast<double>(result.residentAfterFree) / (1024.0 * 1024.0));
+    }
+}
+
+}   // namespace
+
+
+FW_BENCH(large_block, "streaming and gathering over a multi-GB mesh buffer: aligned_alloc vs. FwLargeBlockAllocator with and without huge pages") {
+    const size_t bufferSize = s_bufferSize * context.scale;
+    FwBenchTlbCounter counter;
+
+    static const struct {
+        const char *    name;
+        FwHugePageMode  hugePage;
+    } s_modes[] = {
+        { "none",           FwHugePageNone },
+        { "transparent",    FwHugePageTransparent },
+        { "explicit",       FwHugePageExplicit },
+    };
+
+    printf("  buffer: %.2f GB, gathers: %u\n", static_cast<double>(bufferSize) / (1024.0 * 1024.0 * 1024.0), s_numGathers);
+    printf("  %-12s %10s %10s %10s %14s %14s %10s\n", "allocator", "fill GB/s", "read GB/s", "gather ns", "read dTLB miss", "gather dTLB", "freed MB");
+
+    // 既定のアロケータ（aligned_alloc）で1つずつ確保した場合
+    const FwMeshScanResult defaultResult = ScanMesh(FwDefaultMemAllocatorTag, bufferSize, counter);
+    FW_BENCH_CHECK(defaultResult.checksum != 0.0);
+    PrintMeshScanResult("default", bufferSize, defaultResult, counter.IsValid());
+
+    for (const auto & mode : s_modes) {
+        FwLargeBlockAllocatorDesc desc;
+        desc.Init();
+        desc.reserveSize = Max(desc.reserveSize, bufferSize * 2);
+        desc.hugePage = mode.hugePage;
+        FwLargeBlockAllocator * allocator = FwCreateLargeBlockAllocator(&desc);
+        FW_BENCH_CHECK(allocator != nullptr);
+        FwMemAllocator * oldAllocator = FwSetMemAllocator(s_benchTag, allocator);
+
+        const FwMeshScanResult result = ScanMesh(s_benchTag, bufferSize, counter);
+        FwLargeBlockAllocatorStats stats;
+        allocator->GetStats(&stats);
+
+        FwSetMemAllocator(s_benchTag, oldAllocator);
+        FwDestroyLargeBlockAllocator(allocator);
+
+        // 同じ内容を読んでいるので結果は一致する。解放したブロックは物理メモリごと返している
+        FW_BENCH_CHECK(result.checksum == defaultResult.checksum);
+        FW_BENCH_CHECK(stats.numBlocks == 0 && stats.liveBytes == 0);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%s%s", mode.name, (stats.hugePage == mode.hugePage) ? "" : "*");
+        PrintMeshScanResult(name, bufferSize, result, counter.IsValid());
+    }
+    printf("  *: huge pages were not available, fell back to the next mode\n");
+    return FW_OK;
+}
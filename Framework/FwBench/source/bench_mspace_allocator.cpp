@@ -0,0 +1,227 @@
+﻿/**
+ * @file bench_mspace_allocator.cpp
+ * @brief FwMSpaceAllocatorとFwDefaultAllocatorの断片化とスループット
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const sint32_t   s_benchTag          = FwMaxMemAllocatorTag;
+static const size_t     s_touchStride       = 4096;
+
+/**
+ * @struct FwModelTraceResult
+ */
+struct FwModelTraceResult {
+    double      seconds;
+    uint64_t    numOps;
+    size_t      loadedResident;     ///< 半分のモデルを残した時点で増えた物理メモリ
+    size_t      loadedLiveBytes;    ///< その時点で使用中のバイト数
+    size_t      unloadedResident;   ///< 全て解放した後に残った物理メモリ
+};
+
+/**
+ * @class FwModelTrace
+ * @brief モデルの読み込みを模した確保と解放の並び
+ * @note  モデル毎に小さなノードや名前、中くらいのマテリアル、大きな頂点/インデックスバッファを確保して保持し、
+ *        読み込み中だけ使う作業バッファはその場で解放します。読み込みの合間に古いモデルを捨てるので穴が空きます
+ */
+class FwModelTrace {
+public:
+    /**
+     * @brief モデルを1つ読み込む
+     */
+    void Load(const sint32_t tag) {
+        Model model;
+
+        // 作業バッファは読み込みが終わると捨てる
+        Block scratch[4];
+        for (auto & block : scratch) {
+            block = Alloc(Range(64 * 1024, 512 * 1024), tag);
+        }
+
+        for (uint32_t i = 0; i < 1000; ++i) {
+            model.blocks.push_back(Alloc(Range(16, 256), tag));
+            // パース中の一時文字列
+            if ((i & 7) == 0) {
+                Free(Alloc(Range(16, 128), tag));
+            }
+        }
+        for (uint32_t i = 0; i < 100; ++i) {
+            model.blocks.push_back(Alloc(Range(1024, 16 * 1024), tag));
+        }
+        for (uint32_t i = 0; i < 4; ++i) {
+            model.blocks.push_back(Alloc(Range(64 * 1024, 1024 * 1024), tag));
+        }
+
+        for (auto & block : scratch) {
+            Free(block);
+        }
+        _models.push_back(std::move(model));
+    }
+
+    /**
+     * @brief 読み込んだモデルを1つ捨てる
+     */
+    void UnloadRandom() {
+        if (_models.empty()) {
+            return;
+        }
+        const size_t index = Next() % _models.size();
+        for (auto & block : _models[index].blocks) {
+            Free(block);
+        }
+        _models[index] = std::move(_models.back());
+        _models.pop_back();
+    }
+
+    /**
+     * @brief 全て捨てる
+     */
+    void UnloadAll() {
+        while (!_models.empty()) {
+            UnloadRandom();
+        }
+    }
+
+    uint64_t GetNumOps() const {
+        return _numOps;
+    }
+
+    size_t GetLiveBytes() const {
+        return _liveBytes;
+    }
+
+    explicit FwModelTrace(const uint32_t seed)
+    : _seed(seed)
+    , _numOps(0)
+    , _liveBytes(0) {
+    }
+
+
+private:
+    using Block = std::pair<void *, size_t>;
+
+    struct Model {
+        std::vector<Block>      blocks;
+    };
+
+    uint32_t Next() {
+        _seed = _seed * 1103515245 + 12345;
+        return _seed >> 8;
+    }
+
+    size_t Range(const size_t minSize, const size_t maxSize) {
+        return minSize + Next() % (maxSize - minSize + 1);
+    }
+
+    Block Alloc(const size_t size, const sint32_t tag) {
+        uint8_t * ptr = reinterpret_cast<uint8_t *>(FwMalloc(size, tag));
+        // ページに触れて物理メモリを割り当てさせる
+        for (size_t offset = 0; offset < size; offset += s_touchStride) {
+            ptr[offset] = 1;
+        }
+        _liveBytes += size;
+        ++_numOps;
+        return Block(ptr, size);
+    }
+
+    void Free(const Block & block) {
+        FwFree(block.first);
+        _liveBytes -= block.second;
+        ++_numOps;
+    }
+
+
+    uint32_t                _seed;
+    uint64_t                _numOps;
+    size_t                  _liveBytes;
+    std::vector<Model>      _models;
+};
+
+/**
+ * @brief スレッド毎にモデルを読み込んでは捨て、半分残した時点と全て捨てた後の物理メモリを計る
+ */
+template<class _Trim>
+static FwModelTraceResult RunModelTrace(const uint32_t numThreads, const uint32_t numModels, const sint32_t tag, _Trim trim) {
+    FwModelTraceResult result = {};
+
+    std::vector<FwModelTrace> traces;
+    for (uint32_t i = 0; i < numThreads; ++i) {
+        traces.emplace_back(i * 7919 + 1);
+    }
+
+    const size_t baseResident = FwBenchGetResidentBytes();
+    result.seconds = FwBenchRunThreads(numThreads, [&](uint32_t index) {
+        FwModelTrace & trace = traces[index];
+        for (uint32_t i = 0; i < numModels; ++i) {
+            trace.Load(tag);
+            // 2つ読む毎に1つ捨てる
+            if ((i & 1) != 0) {
+                trace.UnloadRandom();
+            }
+        }
+    });
+
+    trim();
+    result.loadedResident = FwBenchGetResidentBytes() - Min(baseResident, FwBenchGetResidentBytes());
+    for (auto & trace : traces) {
+        result.numOps += trace.GetNumOps();
+        result.loadedLiveBytes += trace.GetLiveBytes();
+    }
+
+    for (auto & trace : traces) {
+        trace.UnloadAll();
+    }
+    trim();
+    result.unloadedResident = FwBenchGetResidentBytes() - Min(baseResident, FwBenchGetResidentBytes());
+    return result;
+}
+
+static void PrintModelTraceResult(const char * name, const FwModelTraceResult & result) {
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    printf("  %-10s %10.2f %12.1f %12.1f %10.2f %14.1f\n", name,
+        static_cast<double>(result.numOps) / result.seconds * 1e-6,
+        static_cast<double>(result.loadedLiveBytes) * mb,
+        static_cast<double>(result.loadedResident) * mb,
+        static_cast<double>(result.loadedResident) / Max<double>(1.0, static_cast<double>(result.loadedLiveBytes)),
+        static_cast<double>(result.unloadedResident) * mb);
+}
+
+}   // namespace
+
+
+FW_BENCH(mspace_allocator, "fragmentation and throughput of FwMSpaceAllocator vs. FwDefaultAllocator on a model-load trace") {
+    const uint32_t numModels = 32 * context.scale;
+
+    FwMSpaceAllocatorDesc desc;
+    desc.Init();
+    desc.reserveSize = (sizeof(void *) == 8) ? static_cast<size_t>(4) * 1024 * 1024 * 1024 : 512 * 1024 * 1024;
+
+    // CRTは解放したメモリを持ち続けるので、物理メモリの増分は1回ずつしか比べられない
+    const uint32_t numThreads = context.maxThreads;
+    printf("  threads: %u, models per thread: %u\n", numThreads, numModels);
+    printf("  %-10s %10s %12s %12s %10s %14s\n", "allocator", "Mops/s", "live MB", "resident MB", "overhead", "after free MB");
+
+    // mspaceは破棄すると予約領域ごと返却するので先に計る
+    FwMSpaceAllocator * mspace = FwCreateMSpaceAllocator(&desc);
+    FW_BENCH_CHECK(mspace != nullptr);
+    FwMemAllocator * oldAllocator = FwSetMemAllocator(s_benchTag, mspace);
+    const FwModelTraceResult mspaceResult = RunModelTrace(numThreads, numModels, s_benchTag, [mspace]() { mspace->Trim(0); });
+
+    FwMSpaceAllocatorStats stats;
+    mspace->GetStats(&stats);
+    FW_BENCH_CHECK(stats.numBlocks == 0 && stats.liveBytes == 0);
+
+    FwSetMemAllocator(s_benchTag, oldAllocator);
+    FwDestroyMSpaceAllocator(mspace);
+
+    const FwModelTraceResult defaultResult = RunModelTrace(numThreads, numModels, FwDefaultMemAllocatorTag, []() {});
+
+    PrintModelTraceResult("mspace", mspaceResult);
+    PrintModelTraceResult("default", defaultResult);
+    printf("  mspace: %.1f MB committed at peak, %.1f MB after Trim\n", static_cast<double>(stats.maxFootprint) / (1024.0 * 1024.0), static_cast<double>(stats.footprint) / (1024.0 * 1024.0));
+    return FW_OK;
+}
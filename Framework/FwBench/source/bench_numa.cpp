@@ -0,0 +1,247 @@
+﻿/**
+ * @file bench_numa.cpp
+ * @brief CPUを分けた2つのスレッドグループで、FwNumaAllocatorのノード内とノード間のメモリ帯域
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const sint32_t   s_benchTag          = FwMaxMemAllocatorTag;
+static const size_t     s_bufferSize        = 64 * 1024 * 1024;     ///< スレッド毎に確保するメッシュデータのサイズ
+static const uint32_t   s_numPasses         = 8;                    ///< scale倍したバッファを読み書きする回数
+static const sint32_t   s_numGroups         = 2;
+
+/**
+ * @class FwNumaWorker
+ * @brief 優先ノードから確保したバッファを、開始の合図で読み書きし続けるワーカー
+ * @note  アロケータを渡さなければ、実行中のCPUのノードを調べるだけで終わる
+ */
+class FwNumaWorker : public FwThread {
+public:
+    virtual sint32_t ThreadFunc(void *) FW_OVERRIDE {
+        _cpuNode = FwGetCurrentNumaNode();
+        if (_allocator == nullptr) {
+            return 0;
+        }
+
+        // FwThreadDesc::numaNodeが優先ノードになっているので、タグを指定するだけでそのノードから確保される
+        uint32_t * buffer = reinterpret_cast<uint32_t *>(FwMallocAligned(s_bufferSize, 64, s_benchTag));
+        if (buffer == nullptr) {
+            _numReady->fetch_add(1, std::memory_order_release);
+            return 0;
+        }
+        _blockNode = _allocator->GetBlockNode(buffer);
+
+        const size_t numWords = s_bufferSize / sizeof(uint32_t);
+        for (size_t i = 0; i < numWords; ++i) {
+            buffer[i] = static_cast<uint32_t>(i);
+        }
+        _numReady->fetch_add(1, std::memory_order_release);
+        while (!_start->load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        FwBenchTimer timer;
+        uint64_t sum = 0;
+        for (uint32_t pass = 0; pass < _numPasses; ++pass) {
+            for (size_t i = 0; i < numWords; ++i) {
+                sum += buffer[i];
+                buffer[i] += 1;
+            }
+        }
+        _seconds = timer.GetSeconds();
+        _checksum = sum;
+
+        FwFree(buffer);
+        return 0;
+    }
+
+    /**
+     * @brief 実行中のCPUのノードを調べる
+     */
+    void Probe(const FwThreadAffinity affinity) {
+        FwThreadDesc desc;
+        desc.Init();
+        desc.affinity = affinity;
+        Start(&desc);
+        WaitThread();
+        Shutdown();
+    }
+
+    /**
+     * @brief 確保と初期化を始める
+     */
+    void Run(const FwThreadAffinity affinity, const sint32_t node, FwNumaAllocator * allocator, const uint32_t numPasses, std::atomic<uint32_t> * numReady, const std::atomic<bool> * start) {
+        _allocator = allocator;
+        _numPasses = numPasses;
+        _numReady = numReady;
+        _start = start;
+
+        FwThreadDesc desc;
+        desc.Init();
+        desc.affinity = affinity;
+        desc.numaNode = node;
+        Start(&desc);
+    }
+
+    sint32_t GetCpuNode() const {
+        return _cpuNode;
+    }
+
+    sint32_t GetBlockNode() const {
+        return _blockNode;
+    }
+
+    double GetSeconds() const {
+        return _seconds;
+    }
+
+    uint64_t GetChecksum() const {
+        return _checksum;
+    }
+
+    FwNumaWorker()
+    : _allocator(nullptr)
+    , _numPasses(0)
+    , _numReady(nullptr)
+    , _start(nullptr)
+    , _cpuNode(FwNumaNodeAny)
+    , _blockNode(FwNumaNodeAny)
+    , _seconds(0.0)
+    , _checksum(0) {
+    }
+
+
+private:
+    FwNumaAllocator *               _allocator;
+    uint32_t                        _numPasses;
+    std::atomic<uint32_t> *         _numReady;
+    const std::atomic<bool> *       _start;
+    sint32_t                        _cpuNode;
+    sint32_t                        _blockNode;
+    double                          _seconds;
+    uint64_t                        _checksum;
+};
+
+/**
+ * @struct FwNumaRunResult
+ */
+struct FwNumaRunResult {
+    double      bandwidth;          ///< 全スレッドの合計（GB/s）
+    sint32_t    blockNodes[s_numGroups];
+    bool        valid;              ///< 全スレッドが確保できて、期待したノードに載ったか
+};
+
+/**
+ * @brief グループ毎に優先ノードを指定して確保し、一斉に読み書きする
+ */
+FwNumaRunResult RunGroups(FwNumaAllocator * allocator, const FwThreadAffinity * groupMasks, const sint32_t * groupNodes, const uint32_t threadsPerGroup, const uint32_t numPasses) {
+    FwNumaRunResult result = {};
+    result.valid = true;
+
+    const uint32_t numThreads = threadsPerGroup * s_numGroups;
+    std::vector<FwNumaWorker> workers(numThreads);
+    std::atomic<uint32_t> numReady(0);
+    std::atomic<bool> start(false);
+    for (uint32_t i = 0; i < numThreads; ++i) {
+        const uint32_t group = i / threadsPerGroup;
+        workers[i].Run(groupMasks[group], groupNodes[group], allocator, numPasses, &numReady, &start);
+    }
+    while (numReady.load(std::memory_order_acquire) != numThreads) {
+        std::this_thread::yield();
+    }
+
+    FwBenchTimer timer;
+    start.store(true, std::memory_order_release);
+    for (FwNumaWorker & worker : workers) {
+        worker.WaitThread();
+        worker.Shutdown();
+    }
+    const double seconds = timer.GetSeconds();
+
+    // 全スレッドが同じ内容を同じ回数だけ読むので、合計は一致する
+    for (uint32_t i = 0; i < numThreads; ++i) {
+        const FwNumaWorker & worker = workers[i];
+        const uint32_t group = i / threadsPerGroup;
+        result.blockNodes[group] = worker.GetBlockNode();
+        result.valid &= (worker.GetSeconds() != 0.0) && (worker.GetChecksum() == workers[0].GetChecksum());
+        result.valid &= (worker.GetBlockNode() == groupNodes[group]);
+    }
+    result.bandwidth = static_cast<double>(s_bufferSize) * numPasses * 2 * numThreads / seconds / (1024.0 * 1024.0 * 1024.0);
+    return result;
+}
+
+}   // namespace
+
+
+FW_BENCH(numa, "cross-node traffic: two thread groups pinned to different CPUs streaming node-local vs. remote FwNumaAllocator memory") {
+    FwCpuTopology topology;
+    FW_BENCH_CHECK(FwGetCpuTopology(&topology) == FW_OK);
+    const sint32_t numNodes = FwGetNumaNodeCount();
+    const uint32_t numCpus = Min(topology.numLogicalCpus, FwMaxCpus);
+    const uint32_t threadsPerGroup = Max(1u, Min(context.maxThreads, numCpus) / s_numGroups);
+    const uint32_t numPasses = s_numPasses * context.scale;
+
+    // 論理CPUを前後半に分ける。多くの2ソケット機では前半と後半が別のノードになる
+    FwThreadAffinity groupMasks[s_numGroups] = {};
+    for (uint32_t cpu = 0; cpu < numCpus; ++cpu) {
+        const uint32_t group = (numCpus < s_numGroups) ? 0 : cpu * s_numGroups / numCpus;
+        groupMasks[group] |= static_cast<FwThreadAffinity>(1) << cpu;
+    }
+    if (groupMasks[1] == 0) {
+        groupMasks[1] = groupMasks[0];
+    }
+
+    sint32_t cpuNodes[s_numGroups];
+    for (sint32_t group = 0; group < s_numGroups; ++group) {
+        FwNumaWorker probe;
+        probe.Probe(groupMasks[group]);
+        cpuNodes[group] = Max(0, probe.GetCpuNode());
+    }
+    // CPUを分けても同じノードだった場合は、他方のグループに次のノードを使わせる
+    const sint32_t remoteNodes[s_numGroups] = {
+        (cpuNodes[1] != cpuNodes[0]) ? cpuNodes[1] : (cpuNodes[0] + 1) % numNodes,
+        (cpuNodes[0] != cpuNodes[1]) ? cpuNodes[0] : (cpuNodes[1] + 1) % numNodes,
+    };
+
+    printf("  nodes: %d, cpus: %u, threads per group: %u, group cpu nodes: %d/%d\n", numNodes, numCpus, threadsPerGroup, cpuNodes[0], cpuNodes[1]);
+    if (numNodes < 2) {
+        printf("  single NUMA node: local and remote use the same memory\n");
+    }
+    printf("  %-10s %14s %14s %10s\n", "placement", "memory nodes", "GB/s", "vs local");
+
+    static const struct {
+        const char *    name;
+        bool            remote;
+    } s_placements[] = {
+        { "local",  false },
+        { "remote", true },
+    };
+
+    double localBandwidth = 0.0;
+    for (const auto & placement : s_placements) {
+        FwNumaAllocatorDesc desc;
+        desc.Init();
+        // 全スレッドが1つのノードから確保しても足りるように予約する
+        desc.reserveSizePerNode = (s_bufferSize + FwDefaultMSpaceReserveSize) * threadsPerGroup * s_numGroups;
+        FwNumaAllocator * allocator = FwCreateNumaAllocator(&desc);
+        FW_BENCH_CHECK(allocator != nullptr);
+        FwMemAllocator * oldAllocator = FwSetMemAllocator(s_benchTag, allocator);
+
+        const FwNumaRunResult result = RunGroups(allocator, groupMasks, placement.remote ? remoteNodes : cpuNodes, threadsPerGroup, numPasses);
+
+        FwSetMemAllocator(s_benchTag, oldAllocator);
+        FwDestroyNumaAllocator(allocator);
+        FW_BENCH_CHECK(result.valid);
+
+        if (!placement.remote) {
+            localBandwidth = result.bandwidth;
+        }
+        char nodes[32];
+        snprintf(nodes, sizeof(nodes), "%d/%d", result.blockNodes[0], result.blockNodes[1]);
+        printf("  %-10s %14s %14.2f %9.2fx\n", placement.name, nodes, result.bandwidth, result.bandwidth / localBandwidth);
+    }
+    return FW_OK;
+}
@@ -0,0 +1,103 @@
+﻿/**
+ * @file bench_parallel.cpp
+ * @brief FwParallelFor/FwParallelReduceの参加者数に対するスケーリング
+ */
+#include "stdafx.h"
+
+#include <math.h>
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numElements   = 4 * 1024 * 1024;
+
+/**
+ * @brief 要素毎の計算（メモリ帯域ではなく演算で律速させる）
+ */
+FW_INLINE double Compute(const uint32_t i) {
+    const double x = static_cast<double>(i) * 1e-3;
+    return sqrt(x + 1.0) * sin(x);
+}
+
+/**
+ * @brief 参加者数に合わせたファクトリを生成
+ * @note  呼び出し元も参加するので、ワーカーは参加者-1。1人ならnullptrでその場で実行させる
+ */
+FwTaskFactory * CreateFactory(const uint32_t numParticipants) {
+    if (numParticipants <= 1) {
+        return nullptr;
+    }
+    FwTaskFactoryDesc desc;
+    desc.Init();
+    desc.numWorkers = static_cast<sint32_t>(numParticipants - 1);
+    return FwCreateTaskFactory(&desc);
+}
+
+}   // namespace
+
+
+FW_BENCH(parallel, "FwParallelFor and FwParallelReduce scaling over 1..N participants") {
+    const uint32_t numElements = s_numElements * context.scale;
+    double * output = reinterpret_cast<double *>(FwMalloc(sizeof(double) * numElements, FwDefaultMemAllocatorTag));
+    FW_BENCH_CHECK(output != nullptr);
+
+    double baseFor = 0.0;
+    double baseReduce = 0.0;
+    double deterministicResult = 0.0;
+    bool deterministic = true;
+
+    printf("  %8s %10s %8s %12s %8s %16s %8s\n", "threads", "for ms", "speedup", "reduce ms", "speedup", "ordered reduce ms", "speedup");
+    for (uint32_t numThreads = FwBenchNextThreadCount(0, context.maxThreads); numThreads != 0; numThreads = FwBenchNextThreadCount(numThreads, context.maxThreads)) {
+        FwTaskFactory * factory = CreateFactory(numThreads);
+        FW_BENCH_CHECK(numThreads <= 1 || factory != nullptr);
+
+        FwBenchTimer timer;
+        FwParallelFor(factory, 0u, numElements, 0u, [output](uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; ++i) {
+                output[i] = Compute(i);
+            }
+        });
+        const double forSeconds = timer.GetSeconds();
+
+        auto sum = [](uint32_t first, uint32_t last, const double & value) {
+            double result = value;
+            for (uint32_t i = first; i < last; ++i) {
+                result += Compute(i);
+            }
+            return result;
+        };
+        auto add = [](const double & lhs, const double & rhs) { return lhs + rhs; };
+
+        timer.Reset();
+        const double anyResult = FwParallelReduce(factory, 0u, numElements, 0u, 0.0, sum, add, FwParallelReduceOrderAny);
+        const double reduceSeconds = timer.GetSeconds();
+
+        timer.Reset();
+        const double orderedResult = FwParallelReduce(factory, 0u, numElements, 0u, 0.0, sum, add, FwParallelReduceOrderDeterministic);
+        const double orderedSeconds = timer.GetSeconds();
+
+        if (factory != nullptr) {
+            FwDestroyTaskFactory(factory);
+        }
+
+        // 決定的な集計は参加者数に関わらずビット単位で同じ値になる
+        if (numThreads == 1) {
+            baseFor = forSeconds;
+            baseReduce = reduceSeconds;
+            deterministicResult = orderedResult;
+        } else if (memcmp(&orderedResult, &deterministicResult, sizeof(double)) != 0) {
+            deterministic = false;
+        }
+        FW_BENCH_CHECK(fabs(anyResult - orderedResult) <= fabs(orderedResult) * 1e-9 + 1e-9);
+
+        printf("  %8u %10.1f %7.2fx %12.1f %7.2fx %16.1f %7.2fx\n", numThreads,
+            forSeconds * 1e3, baseFor / forSeconds,
+            reduceSeconds * 1e3, baseReduce / reduceSeconds,
+            orderedSeconds * 1e3, baseReduce / orderedSeconds);
+    }
+    FwFree(output);
+
+    FW_BENCH_CHECK(deterministic);
+    return FW_OK;
+}
@@ -0,0 +1,147 @@
+﻿/**
+ * @file bench_pool.cpp
+ * @brief FwPool/FwSharedPoolとFwNewの1オブジェクトあたりのコストとメモリ量
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numLiveObjects        = 1024;         ///< スレッド毎に保持しておくオブジェクト数
+static const uint32_t   s_numFootprintObjects   = 256 * 1024;   ///< メモリ量を計るときに確保するオブジェクト数
+static const sint32_t   s_objectsPerSlab        = 256;
+static const sint32_t   s_taggedAllocatorTag    = 1;            ///< ヘッダ付きで確保される既定タグ以外のタグ
+
+/**
+ * @struct FwPoolBenchObject
+ * @brief ストリームやスレッド情報程度の大きさのオブジェクト
+ */
+struct FwPoolBenchObject {
+    uint64_t    value;
+    uint8_t     payload[40];
+
+    explicit FwPoolBenchObject(const uint64_t v) : value(v) {}
+};
+
+/**
+ * @brief 一定数のオブジェクトを保持したまま生成と破棄を繰り返す
+ * @return 保持していたオブジェクトの値が壊れていなければtrue
+ */
+template<class _New, class _Delete>
+static bool RunChurn(const uint32_t threadIndex, const uint32_t numOps, _New create, _Delete destroy) {
+    FwPoolBenchObject * objects[s_numLiveObjects] = {};
+    uint32_t seed = threadIndex * 7919 + 1;
+    bool valid = true;
+    for (uint32_t i = 0; i < numOps; ++i) {
+        seed = seed * 1103515245 + 12345;
+        const uint32_t slot = (seed >> 8) % s_numLiveObjects;
+        if (objects[slot] != nullptr) {
+            valid &= (objects[slot]->value == slot);
+            destroy(objects[slot]);
+        }
+        objects[slot] = create(slot);
+    }
+    for (uint32_t slot = 0; slot < s_numLiveObjects; ++slot) {
+        if (objects[slot] != nullptr) {
+            valid &= (objects[slot]->value == slot);
+            destroy(objects[slot]);
+        }
+    }
+    return valid;
+}
+
+/**
+ * @brief オブジェクトをまとめて生成した時の1つあたりの物理メモリ
+ * @note  ページに触れるのは生成したオブジェクトだけなので、ヘッダや詰め物の分がそのまま増える
+ */
+template<class _New, class _Delete>
+static double MeasureBytesPerObject(_New create, _Delete destroy) {
+    std::vector<FwPoolBenchObject *> objects(s_numFootprintObjects);
+    const size_t baseResident = FwBenchGetResidentBytes();
+    for (uint32_t i = 0; i < s_numFootprintObjects; ++i) {
+        objects[i] = create(i);
+    }
+    const size_t resident = FwBenchGetResidentBytes();
+    for (FwPoolBenchObject * object : objects) {
+        destroy(object);
+    }
+    return static_cast<double>(resident - Min(baseResident, resident)) / s_numFootprintObjects;
+}
+
+}   // namespace
+
+
+FW_BENCH(pool, "per-object new/delete cost and memory of FwPool/FwSharedPool vs. FwNew") {
+    const uint32_t numOps = 2000000 * context.scale;
+
+    // 既定タグ以外のFwAllocatorNewはヘッダとフッタ、アライメントの詰め物が付く。プールはスロットの大きさだけ
+    {
+        FwPool<FwPoolBenchObject> pool(s_objectsPerSlab);
+        const double poolBytes = MeasureBytesPerObject(
+            [&pool](uint32_t i) { return pool.New(i); },
+            [&pool](FwPoolBenchObject * object) { pool.Delete(object); });
+        FW_BENCH_CHECK(pool.GetNumUsed() == 0);
+        FW_BENCH_CHECK(pool.GetNumSlabs() == static_cast<sint32_t>((s_numFootprintObjects + s_objectsPerSlab - 1) / s_objectsPerSlab));
+        const double newBytes = MeasureBytesPerObject(
+            [](uint32_t i) { return FwNew<FwPoolBenchObject>(i); },
+            [](FwPoolBenchObject * object) { FwDelete(object); });
+        FwMemAllocator * oldTaggedAllocator = FwSetMemAllocator(s_taggedAllocatorTag, FwGetMemAllocator(FwDefaultMemAllocatorTag));
+        const double taggedBytes = MeasureBytesPerObject(
+            [](uint32_t i) { return FwAllocatorNew<FwPoolBenchObject, s_taggedAllocatorTag>(i); },
+            [](FwPoolBenchObject * object) { FwDelete(object); });
+        FwSetMemAllocator(s_taggedAllocatorTag, oldTaggedAllocator);
+
+        printf("  object size: %u bytes, %u objects\n", static_cast<uint32_t>(sizeof(FwPoolBenchObject)), s_numFootprintObjects);
+        printf("  %-12s %16s\n", "allocator", "resident B/obj");
+        printf("  %-12s %16.1f\n", "FwNew", newBytes);
+        printf("  %-12s %16.1f\n", "tagged", taggedBytes);
+        printf("  %-12s %16.1f\n", "FwPool", poolBytes);
+    }
+
+    // 単一スレッドではロックの無いFwPoolと、CASを使うFwSharedPoolを比べる
+    {
+        FwPool<FwPoolBenchObject> pool(s_objectsPerSlab);
+        FwSharedPool<FwPoolBenchObject> sharedPool(s_objectsPerSlab);
+        FwBenchTimer timer;
+        FW_BENCH_CHECK(RunChurn(0, numOps, [](uint32_t i) { return FwNew<FwPoolBenchObject>(i); }, [](FwPoolBenchObject * object) { FwDelete(object); }));
+        const double newSeconds = timer.GetSeconds();
+        timer.Reset();
+        FW_BENCH_CHECK(RunChurn(0, numOps, [&pool](uint32_t i) { return pool.New(i); }, [&pool](FwPoolBenchObject * object) { pool.Delete(object); }));
+        const double poolSeconds = timer.GetSeconds();
+        timer.Reset();
+        FW_BENCH_CHECK(RunChurn(0, numOps, [&sharedPool](uint32_t i) { return sharedPool.New(i); }, [&sharedPool](FwPoolBenchObject * object) { sharedPool.Delete(object); }));
+        const double sharedSeconds = timer.GetSeconds();
+        FW_BENCH_CHECK(pool.GetNumUsed() == 0 && sharedPool.GetNumUsed() == 0);
+
+        printf("  %-12s %16s\n", "allocator", "ns/new+delete");
+        printf("  %-12s %16.1f\n", "FwNew", newSeconds / numOps * 1e9);
+        printf("  %-12s %16.1f\n", "FwPool", poolSeconds / numOps * 1e9);
+        printf("  %-12s %16.1f\n", "FwSharedPool", sharedSeconds / numOps * 1e9);
+    }
+
+    // 複数スレッドから1つのFwSharedPoolを使う
+    printf("  %8s %16s %16s %8s\n", "threads", "FwNew Mops/s", "shared Mops/s", "speedup");
+    for (uint32_t numThreads = FwBenchNextThreadCount(0, context.maxThreads); numThreads != 0; numThreads = FwBenchNextThreadCount(numThreads, context.maxThreads)) {
+        FwSharedPool<FwPoolBenchObject> sharedPool(s_objectsPerSlab);
+        std::atomic<bool> valid(true);
+        const double newSeconds = FwBenchRunThreads(numThreads, [&](uint32_t index) {
+            if (!RunChurn(index, numOps, [](uint32_t i) { return FwNew<FwPoolBenchObject>(i); }, [](FwPoolBenchObject * object) { FwDelete(object); })) {
+                valid.store(false);
+            }
+        });
+        const double sharedSeconds = FwBenchRunThreads(numThreads, [&](uint32_t index) {
+            if (!RunChurn(index, numOps, [&sharedPool](uint32_t i) { return sharedPool.New(i); }, [&sharedPool](FwPoolBenchObject * object) { sharedPool.Delete(object); })) {
+                valid.store(false);
+            }
+        });
+        FW_BENCH_CHECK(valid.load());
+        FW_BENCH_CHECK(sharedPool.GetNumUsed() == 0);
+        // 各スレッドが保持する数を超えてスラブが増えていない
+        FW_BENCH_CHECK(sharedPool.GetNumSlabs() <= static_cast<sint32_t>((s_numLiveObjects * numThreads + s_objectsPerSlab - 1) / s_objectsPerSlab + numThreads));
+
+        const double totalOps = static_cast<double>(numOps) * numThreads;
+        printf("  %8u %16.2f %16.2f %7.2fx\n", numThreads, totalOps / newSeconds * 1e-6, totalOps / sharedSeconds * 1e-6, newSeconds / sharedSeconds);
+    }
+    return FW_OK;
+}
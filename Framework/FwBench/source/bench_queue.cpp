@@ -0,0 +1,244 @@
+﻿/**
+ * @file bench_queue.cpp
+ * @brief FwMpmcQueue/FwSpscQueue/FwMpscQueueの取りこぼしと重複の検査、およびスループット
+ */
+#include "stdafx.h"
+
+#include <deque>
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numItems      = 2000000;  ///< 全生産者で積む合計数
+static const uint32_t   s_queueCapacity = 1024;
+
+/**
+ * @brief 生産者の番号と生産者毎の通し番号を詰めた値
+ */
+FW_INLINE uint64_t PackItem(const uint32_t producer, const uint32_t sequence) {
+    return (static_cast<uint64_t>(producer) << 32) | sequence;
+}
+
+/**
+ * @class FwItemChecker
+ * @brief 全ての値がちょうど1回ずつ、生産者毎に積んだ順で取り出されたかを調べる
+ */
+class FwItemChecker {
+public:
+    /**
+     * @brief 取り出した値を記録
+     * @param[in] lastSequences 消費者毎に保持する、生産者毎の直前の通し番号
+     */
+    void Record(const uint64_t item, std::vector<sint64_t> & lastSequences) {
+        const uint32_t producer = static_cast<uint32_t>(item >> 32);
+        const uint32_t sequence = static_cast<uint32_t>(item);
+        if (_numProducers <= producer || _numPerProducer <= sequence) {
+            _valid.store(false, std::memory_order_relaxed);
+            return;
+        }
+        // 1つの消費者から見た同じ生産者の値は積んだ順に並ぶ
+        if (static_cast<sint64_t>(sequence) <= lastSequences[producer]) {
+            _valid.store(false, std::memory_order_relaxed);
+        }
+        lastSequences[producer] = sequence;
+        if (_seen[producer * _numPerProducer + sequence].fetch_add(1, std::memory_order_relaxed) != 0) {
+            _valid.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 全て1回ずつ取り出されたか
+     */
+    bool IsValid() const {
+        if (!_valid.load()) {
+            return false;
+        }
+        for (const auto & seen : _seen) {
+            if (seen.load(std::memory_order_relaxed) != 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<sint64_t> CreateLastSequences() const {
+        return std::vector<sint64_t>(_numProducers, -1);
+    }
+
+    FwItemChecker(const uint32_t numProducers, const uint32_t numPerProducer)
+    : _numProducers(numProducers)
+    , _numPerProducer(numPerProducer)
+    , _seen(static_cast<size_t>(numProducers) * numPerProducer)
+    , _valid(true) {
+        for (auto & seen : _seen) {
+            seen.store(0, std::memory_order_relaxed);
+        }
+    }
+
+
+private:
+    uint32_t                            _numProducers;
+    uint32_t                            _numPerProducer;
+    std::vector<std::atomic<uint8_t>>   _seen;
+    std::atomic<bool>                   _valid;
+};
+
+/**
+ * @class FwMutexQueue
+ * @brief 比較用のミューテックスで守った固定長キュー
+ */
+class FwMutexQueue {
+public:
+    bool Push(const uint64_t value) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (s_queueCapacity <= _queue.size()) {
+            return false;
+        }
+        _queue.push_back(value);
+        return true;
+    }
+
+    bool Pop(uint64_t & value) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_queue.empty()) {
+            return false;
+        }
+        value = _queue.front();
+        _queue.pop_front();
+        return true;
+    }
+
+
+private:
+    std::mutex              _mutex;
+    std::deque<uint64_t>    _queue;
+};
+
+/**
+ * @brief 生産者と消費者を同数走らせて全ての値を受け渡す
+ * @return 経過秒数。値に不整合があれば負
+ */
+template<class _Queue>
+double RunMultiConsumer(_Queue & queue, const uint32_t numThreads, const uint32_t numPerProducer) {
+    FwItemChecker checker(numThreads, numPerProducer);
+    std::atomic<uint64_t> numPopped(0);
+    const uint64_t total = static_cast<uint64_t>(numThreads) * numPerProducer;
+
+    const double seconds = FwBenchRunThreads(numThreads * 2, [&](uint32_t index) {
+        if (index < numThreads) {
+            for (uint32_t i = 0; i < numPerProducer; ++i) {
+                while (!queue.Push(PackItem(index, i))) {
+                    std::this_thread::yield();
+                }
+            }
+            return;
+        }
+        std::vector<sint64_t> lastSequences = checker.CreateLastSequences();
+        uint64_t value = 0;
+        while (numPopped.load(std::memory_order_relaxed) < total) {
+            if (queue.Pop(value)) {
+                checker.Record(value, lastSequences);
+                numPopped.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    return checker.IsValid() ? seconds : -1.0;
+}
+
+/**
+ * @struct FwMpscItem
+ */
+struct FwMpscItem : public FwMpscQueueNode {
+    uint64_t    value;
+};
+
+}   // namespace
+
+
+FW_BENCH(queue, "lock-free queues: lost/duplicate/order checks and throughput vs. a mutex-protected deque") {
+    const uint32_t numItems = s_numItems * context.scale;
+
+    // MPMC: 生産者と消費者を同数
+    printf("  %-6s %10s %14s %14s\n", "queue", "producers", "Mops/s", "mutex Mops/s");
+    for (uint32_t numThreads = FwBenchNextThreadCount(0, context.maxThreads); numThreads != 0; numThreads = FwBenchNextThreadCount(numThreads, context.maxThreads)) {
+        const uint32_t numPerProducer = numItems / numThreads;
+        const double total = static_cast<double>(numPerProducer) * numThreads;
+
+        FwMpmcQueue<uint64_t> mpmc;
+        FW_BENCH_CHECK(mpmc.Init(s_queueCapacity));
+        const double mpmcSeconds = RunMultiConsumer(mpmc, numThreads, numPerProducer);
+        FW_BENCH_CHECK(0.0 <= mpmcSeconds && mpmc.IsEmpty());
+        mpmc.Term();
+
+        FwMutexQueue mutexQueue;
+        const double mutexSeconds = RunMultiConsumer(mutexQueue, numThreads, numPerProducer);
+        FW_BENCH_CHECK(0.0 <= mutexSeconds);
+
+        printf("  %-6s %10u %14.2f %14.2f\n", "mpmc", numThreads, total / mpmcSeconds * 1e-6, total / mutexSeconds * 1e-6);
+    }
+
+    // SPSC: 全体の順序がそのまま保たれる
+    {
+        FwSpscQueue<uint64_t> spsc;
+        FW_BENCH_CHECK(spsc.Init(s_queueCapacity));
+        bool ordered = true;
+        const double seconds = FwBenchRunThreads(2, [&](uint32_t index) {
+            if (index == 0) {
+                for (uint32_t i = 0; i < numItems; ++i) {
+                    while (!spsc.Push(static_cast<uint64_t>(i))) {
+                        std::this_thread::yield();
+                    }
+                }
+                return;
+            }
+            uint64_t value = 0;
+            for (uint32_t i = 0; i < numItems;) {
+                if (spsc.Pop(value)) {
+                    ordered = ordered && (value == i);
+                    ++i;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        FW_BENCH_CHECK(ordered && spsc.IsEmpty());
+        spsc.Term();
+        printf("  %-6s %10u %14.2f\n", "spsc", 1u, numItems / seconds * 1e-6);
+    }
+
+    // MPSC: 消費者は1つ
+    for (uint32_t numThreads = FwBenchNextThreadCount(0, context.maxThreads); numThreads != 0; numThreads = FwBenchNextThreadCount(numThreads, context.maxThreads)) {
+        const uint32_t numPerProducer = numItems / numThreads;
+        const uint32_t total = numPerProducer * numThreads;
+        std::vector<FwMpscItem> items(total);
+        FwMpscQueue<FwMpscItem> mpsc;
+        FwItemChecker checker(numThreads, numPerProducer);
+
+        const double seconds = FwBenchRunThreads(numThreads + 1, [&](uint32_t index) {
+            if (index < numThreads) {
+                for (uint32_t i = 0; i < numPerProducer; ++i) {
+                    FwMpscItem & item = items[static_cast<size_t>(index) * numPerProducer + i];
+                    item.value = PackItem(index, i);
+                    mpsc.Push(&item);
+                }
+                return;
+            }
+            std::vector<sint64_t> lastSequences = checker.CreateLastSequences();
+            for (uint32_t i = 0; i < total;) {
+                FwMpscItem * item = mpsc.Pop();
+                if (item != nullptr) {
+                    checker.Record(item->value, lastSequences);
+                    ++i;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        FW_BENCH_CHECK(checker.IsValid() && mpsc.IsEmpty());
+        printf("  %-6s %10u %14.2f\n", "mpsc", numThreads, total / seconds * 1e-6);
+    }
+    return FW_OK;
+}
@@ -0,0 +1,168 @@
+﻿/**
+ * @file bench_realloc.cpp
+ * @brief 頂点を追加し続けた時の、fw::vectorの伸長とFwReallocでの伸長のコピー量
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const sint32_t   s_benchTag          = FwMaxMemAllocatorTag;
+#if defined(FW_PLATFORM_WIN64) || defined(__LP64__)
+static const uint32_t   s_numVertices       = 100 * 1000 * 1000;    ///< scale倍して追加する頂点数
+#else
+static const uint32_t   s_numVertices       = 10 * 1000 * 1000;
+#endif
+
+/**
+ * @struct FwBenchFloat3
+ */
+struct FwBenchFloat3 {
+    float   x, y, z;
+};
+
+/**
+ * @struct FwAppendResult
+ */
+struct FwAppendResult {
+    double      seconds;
+    uint32_t    numGrows;       ///< 容量を増やした回数
+    uint32_t    numMoves;       ///< そのうち先頭アドレスが変わった回数
+    uint64_t    movedBytes;     ///< アドレスが変わった時に引き継いだバイト数（fw::vectorは全てコピー）
+    double      checksum;
+};
+
+static FW_INLINE FwBenchFloat3 MakeVertex(const uint32_t i) {
+    const float value = static_cast<float>(i & 1023);
+    FwBenchFloat3 vertex = { value, value * 0.5f, value * 0.25f };
+    return vertex;
+}
+
+static double SumVertices(const FwBenchFloat3 * vertices, const size_t numVertices) {
+    double sum = 0.0;
+    for (size_t i = 0; i < numVertices; i += 4093) {
+        sum += vertices[i].x + vertices[i].y + vertices[i].z;
+    }
+    return sum + vertices[numVertices - 1].x;
+}
+
+/**
+ * @brief fw::vectorへpush_backし続ける
+ * @note  std::vectorは伸長の度に新しい領域を確保して要素を移し、古い領域を解放する
+ */
+template<uint32_t _Tag>
+FwAppendResult AppendToVector(const uint32_t numVertices) {
+    FwAppendResult result = {};
+    FwBenchTimer timer;
+    {
+        vector<FwBenchFloat3, _Tag> vertices;
+        const FwBenchFloat3 * data = vertices.data();
+        size_t capacity = vertices.capacity();
+        for (uint32_t i = 0; i < numVertices; ++i) {
+            vertices.push_back(MakeVertex(i));
+            if (capacity != vertices.capacity()) {
+                ++result.numGrows;
+                if (data != nullptr && data != vertices.data()) {
+                    ++result.numMoves;
+                    result.movedBytes += static_cast<uint64_t>(i) * sizeof(FwBenchFloat3);
+                }
+                data = vertices.data();
+                capacity = vertices.capacity();
+            }
+        }
+        result.checksum = SumVertices(vertices.data(), vertices.size());
+    }
+    result.seconds = timer.GetSeconds();
+    return result;
+}
+
+/**
+ * @brief FwReallocで容量を倍にしながら追加し続ける
+ * @note  その場で伸ばせればアドレスは変わらない。大きなブロックはmremapでページごと移すのでコピーしない
+ */
+FwAppendResult AppendWithRealloc(const sint32_t tag, const uint32_t numVertices) {
+    FwAppendResult result = {};
+    FwBenchTimer timer;
+
+    FwBenchFloat3 * vertices = nullptr;
+    size_t capacity = 0;
+    for (uint32_t i = 0; i < numVertices; ++i) {
+        if (capacity <= i) {
+            const size_t newCapacity = Max<size_t>(capacity * 2, 16);
+            FwBenchFloat3 * grown = (vertices == nullptr)
+                ? reinterpret_cast<FwBenchFloat3 *>(FwMalloc(newCapacity * sizeof(FwBenchFloat3), tag))
+                : reinterpret_cast<FwBenchFloat3 *>(FwRealloc(vertices, newCapacity * sizeof(FwBenchFloat3)));
+            if (grown == nullptr) {
+                FwFree(vertices);
+                return FwAppendResult();
+            }
+            ++result.numGrows;
+            if (vertices != nullptr && grown != vertices) {
+                ++result.numMoves;
+                result.movedBytes += static_cast<uint64_t>(i) * sizeof(FwBenchFloat3);
+            }
+            vertices = grown;
+            capacity = newCapacity;
+        }
+        vertices[i] = MakeVertex(i);
+    }
+
+    // 余った容量を返す
+    FwBenchFloat3 * shrunk = reinterpret_cast<FwBenchFloat3 *>(FwRealloc(vertices, numVertices * sizeof(FwBenchFloat3)));
+    if (shrunk != nullptr) {
+        vertices = shrunk;
+    }
+    result.checksum = SumVertices(vertices, numVertices);
+    FwFree(vertices);
+
+    result.seconds = timer.GetSeconds();
+    return result;
+}
+
+static void PrintAppendResult(const char * name, const FwAppendResult & result, const uint32_t numVertices) {
+    printf("  %-16s %10.2f %8u %8u %14.1f %12.2f\n", name,
+        result.seconds, result.numGrows, result.numMoves,
+        static_cast<double>(result.movedBytes) / (1024.0 * 1024.0),
+        static_cast<double>(result.movedBytes) / (static_cast<double>(numVertices) * sizeof(FwBenchFloat3)));
+}
+
+}   // namespace
+
+
+FW_BENCH(realloc_growth, "appending 100M float3 vertices: fw::vector growth vs. FwRealloc growing in place") {
+    const uint32_t numVertices = s_numVertices * context.scale;
+
+    printf("  vertices: %u (%.1f MB)\n", numVertices, static_cast<double>(numVertices) * sizeof(FwBenchFloat3) / (1024.0 * 1024.0));
+    printf("  %-16s %10s %8s %8s %14s %12s\n", "container", "seconds", "grows", "moves", "moved MB", "moved/final");
+
+    const FwAppendResult vectorResult = AppendToVector<FwDefaultMemAllocatorTag>(numVertices);
+    PrintAppendResult("fw::vector", vectorResult, numVertices);
+
+    const FwAppendResult reallocResult = AppendWithRealloc(FwDefaultMemAllocatorTag, numVertices);
+    FW_BENCH_CHECK(reallocResult.checksum == vectorResult.checksum);
+    PrintAppendResult("FwRealloc", reallocResult, numVertices);
+
+    // 大きなブロックのアロケータは、隣の空きを使うかページを付け替えて伸ばす
+    FwLargeBlockAllocatorDesc desc;
+    desc.Init();
+    FwLargeBlockAllocator * allocator = FwCreateLargeBlockAllocator(&desc);
+    FW_BENCH_CHECK(allocator != nullptr);
+    FwMemAllocator * oldAllocator = FwSetMemAllocator(s_benchTag, allocator);
+
+    const FwAppendResult largeVectorResult = AppendToVector<s_benchTag>(numVertices);
+    const FwAppendResult largeReallocResult = AppendWithRealloc(s_benchTag, numVertices);
+    FwLargeBlockAllocatorStats stats;
+    allocator->GetStats(&stats);
+
+    FwSetMemAllocator(s_benchTag, oldAllocator);
+    FwDestroyLargeBlockAllocator(allocator);
+
+    FW_BENCH_CHECK(largeVectorResult.checksum == vectorResult.checksum);
+    FW_BENCH_CHECK(largeReallocResult.checksum == vectorResult.checksum);
+    FW_BENCH_CHECK(stats.numBlocks == 0 && stats.liveBytes == 0);
+    PrintAppendResult("large vector", largeVectorResult, numVertices);
+    PrintAppendResult("large realloc", largeReallocResult, numVertices);
+    printf("  moved MB counts bytes carried over when the address changed; mremap moves pages without copying them\n");
+    return FW_OK;
+}
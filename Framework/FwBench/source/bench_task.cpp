@@ -0,0 +1,56 @@
+﻿/**
+ * @file bench_task.cpp
+ * @brief 空のタスクを大量に流した時のスケジューラのスループット
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numTasks      = 1000000;
+static const uint32_t   s_numRounds     = 3;        ///< 最も速かった回を採用する
+
+}   // namespace
+
+
+FW_BENCH(task, "add, submit and run 1M empty tasks in one FwTaskGroup") {
+    const uint32_t numTasks = s_numTasks * context.scale;
+
+    printf("  %8s %12s %12s %14s\n", "workers", "add ms", "run ms", "Mtasks/s");
+    for (uint32_t numWorkers = FwBenchNextThreadCount(0, context.maxThreads); numWorkers != 0; numWorkers = FwBenchNextThreadCount(numWorkers, context.maxThreads)) {
+        FwTaskFactoryDesc desc;
+        desc.Init();
+        desc.numWorkers = static_cast<sint32_t>(numWorkers);
+        FwTaskFactory * factory = FwCreateTaskFactory(&desc);
+        FW_BENCH_CHECK(factory != nullptr);
+
+        FwTaskGroup * group = factory->CreateTaskGroup(numTasks);
+        double bestAdd = 0.0;
+        double bestRun = 0.0;
+        for (uint32_t round = 0; round < s_numRounds; ++round) {
+            FwBenchTimer timer;
+            for (uint32_t i = 0; i < numTasks; ++i) {
+                group->AddTask([](FwTaskArgType) {});
+            }
+            const double addSeconds = timer.GetSeconds();
+
+            timer.Reset();
+            group->Submit();
+            group->Wait();
+            const double runSeconds = timer.GetSeconds();
+            FW_BENCH_CHECK(group->IsCompleted());
+
+            if (round == 0 || addSeconds + runSeconds < bestAdd + bestRun) {
+                bestAdd = addSeconds;
+                bestRun = runSeconds;
+            }
+            group->Reset();
+        }
+        factory->DestroyTaskGroup(group);
+        FwDestroyTaskFactory(factory);
+
+        printf("  %8u %12.1f %12.1f %14.2f\n", numWorkers, bestAdd * 1e3, bestRun * 1e3, numTasks / (bestAdd + bestRun) * 1e-6);
+    }
+    return FW_OK;
+}
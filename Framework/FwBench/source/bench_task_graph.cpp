@@ -0,0 +1,166 @@
+﻿/**
+ * @file bench_task_graph.cpp
+ * @brief 500ノードのフレームグラフを毎フレーム実行した時のオーバーヘッド
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numNodes          = 500;
+static const uint32_t   s_maxPredecessors   = 3;
+static const uint32_t   s_nodeWork          = 200;      ///< ノード毎の空回し回数
+static const uint32_t   s_numFrames         = 1000;
+static const uint32_t   s_numVerifyFrames   = 10;
+
+/**
+ * @struct FwFrameGraphShape
+ * @brief 乱数で決めた依存関係（毎回同じ形にする）
+ */
+struct FwFrameGraphShape {
+    std::vector<std::vector<FwTaskNode>>    predecessors;
+
+    FwFrameGraphShape() : predecessors(s_numNodes) {
+        uint32_t seed = 1;
+        for (uint32_t i = 1; i < s_numNodes; ++i) {
+            seed = seed * 1103515245 + 12345;
+            const uint32_t count = 1 + (seed >> 16) % s_maxPredecessors;
+            for (uint32_t j = 0; j < count; ++j) {
+                seed = seed * 1103515245 + 12345;
+                const FwTaskNode from = static_cast<FwTaskNode>((seed >> 8) % i);
+                auto & list = predecessors[i];
+                if (std::find(list.begin(), list.end(), from) == list.end()) {
+                    list.push_back(from);
+                }
+            }
+        }
+    }
+};
+
+/**
+ * @struct FwFrameGraphState
+ * @brief ノードが実行された順番の記録
+ */
+struct FwFrameGraphState {
+    std::atomic<uint32_t>               clock;
+    std::vector<std::atomic<uint32_t>>  stamps;
+
+    FwFrameGraphState() : clock(0), stamps(s_numNodes) {
+        Clear();
+    }
+
+    void Clear() {
+        clock.store(0);
+        for (auto & stamp : stamps) {
+            stamp.store(0);
+        }
+    }
+
+    void RunNode(const uint32_t index) {
+        volatile uint32_t work = 0;
+        for (uint32_t i = 0; i < s_nodeWork; ++i) {
+            work += i;
+        }
+        stamps[index].store(clock.fetch_add(1) + 1, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief グラフを組み立てて変換する
+ */
+FwTaskGraph * BuildGraph(FwTaskFactory * factory, const FwFrameGraphShape & shape, FwFrameGraphState & state) {
+    FwTaskGraphDesc desc;
+    desc.Init();
+    desc.maxNodes = s_numNodes;
+    desc.maxEdges = s_numNodes * s_maxPredecessors;
+    FwTaskGraph * graph = FwCreateTaskGraph(factory, &desc);
+    if (graph == nullptr) {
+        return nullptr;
+    }
+
+    FwFrameGraphState * statePtr = &state;
+    for (uint32_t i = 0; i < s_numNodes; ++i) {
+        graph->AddNode([statePtr, i](FwTaskArgType) { statePtr->RunNode(i); });
+    }
+    for (uint32_t i = 0; i < s_numNodes; ++i) {
+        for (FwTaskNode from : shape.predecessors[i]) {
+            graph->AddEdge(from, static_cast<FwTaskNode>(i));
+        }
+    }
+    if (graph->Compile() != FW_OK) {
+        FwDestroyTaskGraph(graph);
+        return nullptr;
+    }
+    return graph;
+}
+
+/**
+ * @brief 全てのノードが先行ノードより後に実行されたか
+ */
+bool VerifyOrder(const FwFrameGraphShape & shape, const FwFrameGraphState & state) {
+    for (uint32_t i = 0; i < s_numNodes; ++i) {
+        const uint32_t stamp = state.stamps[i].load();
+        if (stamp == 0) {
+            return false;
+        }
+        for (FwTaskNode from : shape.predecessors[i]) {
+            if (stamp <= state.stamps[from].load()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}   // namespace
+
+
+FW_BENCH(task_graph, "run a 500-node frame graph every frame: precompiled FwTaskGraph vs. rebuilding it") {
+    const uint32_t numFrames = s_numFrames * context.scale;
+    const uint32_t numRebuildFrames = Max<uint32_t>(numFrames / 10, 1);
+    FwFrameGraphShape shape;
+    FwFrameGraphState state;
+
+    printf("  %8s %18s %18s\n", "workers", "precompiled us", "rebuilt us");
+    for (uint32_t numWorkers = FwBenchNextThreadCount(0, context.maxThreads); numWorkers != 0; numWorkers = FwBenchNextThreadCount(numWorkers, context.maxThreads)) {
+        FwTaskFactoryDesc desc;
+        desc.Init();
+        desc.numWorkers = static_cast<sint32_t>(numWorkers);
+        FwTaskFactory * factory = FwCreateTaskFactory(&desc);
+        FW_BENCH_CHECK(factory != nullptr);
+
+        FwTaskGraph * graph = BuildGraph(factory, shape, state);
+        FW_BENCH_CHECK(graph != nullptr);
+
+        for (uint32_t frame = 0; frame < s_numVerifyFrames; ++frame) {
+            state.Clear();
+            graph->Run();
+            graph->Wait();
+            FW_BENCH_CHECK(VerifyOrder(shape, state));
+        }
+
+        FwBenchTimer timer;
+        for (uint32_t frame = 0; frame < numFrames; ++frame) {
+            graph->Run();
+            graph->Wait();
+        }
+        const double precompiledSeconds = timer.GetSeconds();
+        FwDestroyTaskGraph(graph);
+
+        // 比較用に毎フレーム組み立て直す
+        timer.Reset();
+        for (uint32_t frame = 0; frame < numRebuildFrames; ++frame) {
+            FwTaskGraph * rebuilt = BuildGraph(factory, shape, state);
+            FW_BENCH_CHECK(rebuilt != nullptr);
+            rebuilt->Run();
+            rebuilt->Wait();
+            FwDestroyTaskGraph(rebuilt);
+        }
+        const double rebuiltSeconds = timer.GetSeconds();
+        FwDestroyTaskFactory(factory);
+
+        printf("  %8u %18.1f %18.1f\n", numWorkers, precompiledSeconds / numFrames * 1e6, rebuiltSeconds / numRebuildFrames * 1e6);
+    }
+    return FW_OK;
+}
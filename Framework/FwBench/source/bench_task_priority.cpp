@@ -0,0 +1,270 @@
+﻿/**
+ * @file bench_task_priority.cpp
+ * @brief 裏でタスクが溢れている時に、優先度毎に積んだタスクが実行されるまでの遅延
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numFloodTasks     = 100000;   ///< 優先度毎に積んでおく裏のタスク数
+static const uint64_t   s_floodTaskNs       = 20000;    ///< 裏のタスク1つの実行時間
+static const uint32_t   s_numProbes         = 200;
+static const uint32_t   s_probeIntervalUs   = 500;
+static const double     s_deadlockTimeout   = 5.0;      ///< 完了しなければ止まったとみなす秒数
+
+/**
+ * @struct FwFloodState
+ */
+struct FwFloodState {
+    std::atomic<bool>       stop;
+    std::atomic<uint64_t>   probeStart;
+
+    FwFloodState() : stop(false), probeStart(0) {}
+
+    void Spin() const {
+        const uint64_t end = FwBenchGetTimeNanoseconds() + s_floodTaskNs;
+        while (!stop.load(std::memory_order_relaxed) && FwBenchGetTimeNanoseconds() < end) {
+        }
+    }
+};
+
+/**
+ * @brief 呼び出し元では手伝わずに完了を待つ
+ * @return 時間内に完了しなければfalse
+ */
+bool PollUntilCompleted(const FwTaskGroup * group, const double timeout) {
+    FwBenchTimer timer;
+    while (!group->IsCompleted()) {
+        if (timeout < timer.GetSeconds()) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+/**
+ * @brief 裏のタスクを流しながら、指定した優先度のタスクが実行され始めるまでの遅延を計る
+ * @return 昇順に並べた遅延（ナノ秒）。計れなければ空
+ */
+std::vector<uint64_t> MeasureProbeLatency(const uint32_t numWorkers, const FwTaskPriority probePriority, const uint32_t numProbes) {
+    FwTaskFactoryDesc desc;
+    desc.Init();
+    desc.numWorkers = static_cast<sint32_t>(numWorkers);
+    FwTaskFactory * factory = FwCreateTaskFactory(&desc);
+    if (factory == nullptr) {
+        return std::vector<uint64_t>();
+    }
+
+    FwFloodState state;
+    const FwFloodState * statePtr = &state;
+    FwTaskGroup * floods[] = { factory->CreateTaskGroup(s_numFloodTasks), factory->CreateTaskGroup(s_numFloodTasks) };
+    floods[0]->SetPriority(FwTaskPriorityNormal);
+    floods[1]->SetPriority(FwTaskPriorityLow);
+    for (FwTaskGroup * flood : floods) {
+        for (uint32_t i = 0; i < s_numFloodTasks; ++i) {
+            flood->AddTask([statePtr](FwTaskArgType) { statePtr->Spin(); });
+        }
+        flood->Submit();
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(numProbes);
+    FwFloodState * probeState = &state;
+    FwTaskGroup * probe = factory->CreateTaskGroup(1);
+    probe->SetPriority(probePriority);
+    for (uint32_t i = 0; i < numProbes; ++i) {
+        std::this_thread::sleep_for(std::chrono::microseconds(s_probeIntervalUs));
+
+        probe->AddTask([probeState](FwTaskArgType) { probeState->probeStart.store(FwBenchGetTimeNanoseconds(), std::memory_order_relaxed); });
+        const uint64_t submitTime = FwBenchGetTimeNanoseconds();
+        probe->Submit();
+        if (!PollUntilCompleted(probe, s_deadlockTimeout)) {
+            break;
+        }
+        latencies.push_back(state.probeStart.load(std::memory_order_relaxed) - submitTime);
+        probe->Reset();
+    }
+
+    state.stop.store(true);
+    for (FwTaskGroup * flood : floods) {
+        flood->Wait();
+        factory->DestroyTaskGroup(flood);
+    }
+    factory->DestroyTaskGroup(probe);
+    FwDestroyTaskFactory(factory);
+
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+/**
+ * @brief 優先度の高いグループが、低い優先度の子グループを待つ
+ * @note  ワーカー1つ、ファイバー無しで、ワーカー上のタスクから待つ
+ *        待っている側が低い優先度のタスクを手伝わないと子グループが進まずに止まる
+ * @return 時間内に完了したか
+ */
+bool RunHighWaitsOnNormalChildren() {
+    FwTaskFactoryDesc desc;
+    desc.Init();
+    desc.numWorkers = 1;
+    desc.numFibers = 0;
+    FwTaskFactory * factory = FwCreateTaskFactory(&desc);
+    if (factory == nullptr) {
+        return false;
+    }
+
+    FwTaskGroup * outer = factory->CreateTaskGroup(1);
+    outer->AddTask([factory](FwTaskArgType) {
+        FwTaskGroup * high = factory->CreateTaskGroup(1, 1);
+        FwTaskGroup * child = factory->CreateTaskGroup(4);
+        high->SetPriority(FwTaskPriorityHigh);
+        child->SetPriority(FwTaskPriorityNormal);
+        high->AddTask([](FwTaskArgType) {});
+        for (uint32_t i = 0; i < 4; ++i) {
+            child->AddTask([](FwTaskArgType) {});
+        }
+        high->AddChildGroup(child);
+        high->Submit();
+        high->Wait();
+        factory->DestroyTaskGroup(child);
+        factory->DestroyTaskGroup(high);
+    });
+    outer->Submit();
+
+    // 呼び出し元が手伝うと止まらないので、まずはワーカーだけに実行させる
+    const bool completed = PollUntilCompleted(outer, s_deadlockTimeout);
+
+    // 止まっていても、呼び出し元が子グループのタスクを代わりに実行すれば抜けられる
+    outer->Wait();
+    factory->DestroyTaskGroup(outer);
+    FwDestroyTaskFactory(factory);
+    return completed;
+}
+
+/**
+ * @brief 優先度の低いタスクが、優先度の低い子グループを待つ
+ * @note  優先度の低いタスクを実行できるワーカーを1つに絞り、ワーカー上のタスクから待つ
+ *        待っている側が枠を手放さないと、子グループのタスクを誰も実行できずに止まる
+ * @return 時間内に完了したか
+ */
+bool RunLowWaitsOnLowChildren(const sint32_t numFibers) {
+    FwTaskFactoryDesc desc;
+    desc.Init();
+    desc.numWorkers = 2;
+    desc.numFibers = numFibers;
+    desc.maxLowPriorityWorkers = 1;
+    FwTaskFactory * factory = FwCreateTaskFactory(&desc);
+    if (factory == nullptr) {
+        return false;
+    }
+
+    FwTaskGroup * outer = factory->CreateTaskGroup(1);
+    outer->SetPriority(FwTaskPriorityLow);
+    outer->AddTask([factory](FwTaskArgType) {
+        FwTaskGroup * child = factory->CreateTaskGroup(4);
+        child->SetPriority(FwTaskPriorityLow);
+        for (uint32_t i = 0; i < 4; ++i) {
+            child->AddTask([](FwTaskArgType) {});
+        }
+        child->Submit();
+        child->Wait();
+        factory->DestroyTaskGroup(child);
+    });
+    outer->Submit();
+
+    // 止まった場合は呼び出し元からも枠を取れずに抜けられないので、破棄せずに返す
+    if (!PollUntilCompleted(outer, s_deadlockTimeout)) {
+        return false;
+    }
+    factory->DestroyTaskGroup(outer);
+    FwDestroyTaskFactory(factory);
+    return true;
+}
+
+/**
+ * @brief 通常の優先度のグループを待つ間に、呼び出し元が優先度の低いタスクを実行しないか
+ * @note  待っている側が低い優先度のタスクを代わりに実行すると、グループが完了してもそのタスクが終わるまで戻らない
+ * @return 呼び出し元で実行した優先度の低いタスクの数
+ */
+uint32_t CountLowTasksRunByWaiter() {
+    FwTaskFactoryDesc desc;
+    desc.Init();
+    desc.numWorkers = 1;
+    desc.numFibers = 0;
+    FwTaskFactory * factory = FwCreateTaskFactory(&desc);
+    if (factory == nullptr) {
+        return ~0u;
+    }
+
+    FwFloodState state;
+    const FwFloodState * statePtr = &state;
+    const std::thread::id waiterId = std::this_thread::get_id();
+    std::atomic<uint32_t> numRunByWaiter(0);
+    std::atomic<uint32_t> * numRunByWaiterPtr = &numRunByWaiter;
+    FwTaskGroup * flood = factory->CreateTaskGroup(s_numFloodTasks);
+    flood->SetPriority(FwTaskPriorityLow);
+    for (uint32_t i = 0; i < s_numFloodTasks; ++i) {
+        flood->AddTask([statePtr, waiterId, numRunByWaiterPtr](FwTaskArgType) {
+            if (std::this_thread::get_id() == waiterId && !statePtr->stop.load(std::memory_order_relaxed)) {
+                numRunByWaiterPtr->fetch_add(1, std::memory_order_relaxed);
+            }
+            statePtr->Spin();
+        });
+    }
+    flood->Submit();
+
+    // ワーカーと呼び出し元で1つずつ取り、先に終わった側が残りを待つ
+    FwTaskGroup * group = factory->CreateTaskGroup(2);
+    for (uint32_t frame = 0; frame < 20; ++frame) {
+        for (uint32_t i = 0; i < 2; ++i) {
+            group->AddTask([](FwTaskArgType) {
+                const uint64_t end = FwBenchGetTimeNanoseconds() + s_floodTaskNs * 100;
+                while (FwBenchGetTimeNanoseconds() < end) {
+                }
+            });
+        }
+        group->Submit();
+        group->Wait();
+        group->Reset();
+    }
+
+    state.stop.store(true);
+    flood->Wait();
+    factory->DestroyTaskGroup(group);
+    factory->DestroyTaskGroup(flood);
+    FwDestroyTaskFactory(factory);
+    return numRunByWaiter.load();
+}
+
+}   // namespace
+
+
+FW_BENCH(task_priority, "latency of a probe task per priority while Normal and Low tasks flood the workers") {
+    FW_BENCH_CHECK(RunHighWaitsOnNormalChildren());
+    FW_BENCH_CHECK(RunLowWaitsOnLowChildren(0));
+    FW_BENCH_CHECK(RunLowWaitsOnLowChildren(32));
+    FW_BENCH_CHECK(CountLowTasksRunByWaiter() == 0);
+
+    static const struct {
+        const char *    name;
+        FwTaskPriority  priority;
+    } s_probes[] = {
+        { "high",   FwTaskPriorityHigh },
+        { "normal", FwTaskPriorityNormal },
+    };
+    const uint32_t numProbes = s_numProbes * context.scale;
+
+    printf("  %8s %8s %12s %12s %12s\n", "workers", "probe", "p50 us", "p99 us", "max us");
+    for (uint32_t numWorkers = FwBenchNextThreadCount(0, context.maxThreads); numWorkers != 0; numWorkers = FwBenchNextThreadCount(numWorkers, context.maxThreads)) {
+        for (const auto & probe : s_probes) {
+            const std::vector<uint64_t> latencies = MeasureProbeLatency(numWorkers, probe.priority, numProbes);
+            FW_BENCH_CHECK(latencies.size() == numProbes);
+            printf("  %8u %8s %12.1f %12.1f %12.1f\n", numWorkers, probe.name,
+                FwBenchPercentile(latencies, 50.0) * 1e-3, FwBenchPercentile(latencies, 99.0) * 1e-3, latencies.back() * 1e-3);
+        }
+    }
+    return FW_OK;
+}
@@ -0,0 +1,126 @@
+﻿/**
+ * @file bench_thread_wake.cpp
+ * @brief FwThreadのワーカーを起こすまでの遅延と、待機中に消費するCPU時間
+ */
+#include "stdafx.h"
+
+USING_NAMESPACE_FW
+
+namespace {
+
+static const uint32_t   s_numBurstWakes     = 20000;
+static const uint32_t   s_numIdleWakes      = 300;
+static const uint32_t   s_idleIntervalMs    = 2;
+
+/**
+ * @class FwWakeWorker
+ * @brief 起こされてから実行されるまでの時間を記録するワーカー
+ */
+class FwWakeWorker : public FwThread {
+public:
+    virtual sint32_t ThreadFunc(void *) FW_OVERRIDE {
+        const uint64_t now = FwBenchGetTimeNanoseconds();
+        const uint64_t wakeTime = _wakeTime.load(std::memory_order_acquire);
+        if (wakeTime != 0) {
+            _latencies.push_back(now - wakeTime);
+        }
+        _numRuns.fetch_add(1, std::memory_order_release);
+        return 0;
+    }
+
+    /**
+     * @brief 起こして、実行し終わるまで待つ
+     */
+    void Wake() {
+        const uint32_t numRuns = _numRuns.load(std::memory_order_acquire);
+        _wakeTime.store(FwBenchGetTimeNanoseconds(), std::memory_order_release);
+        RestartThread();
+        while (_numRuns.load(std::memory_order_acquire) == numRuns) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief 最初の実行が終わるまで待つ
+     */
+    void WaitFirstRun() {
+        while (_numRuns.load(std::memory_order_acquire) == 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief 記録した遅延を昇順に並べて取り出す
+     */
+    std::vector<uint64_t> TakeLatencies() {
+        std::vector<uint64_t> latencies;
+        latencies.swap(_latencies);
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    }
+
+    FwWakeWorker()
+    : _wakeTime(0)
+    , _numRuns(0) {
+        _latencies.reserve(s_numBurstWakes);
+    }
+
+
+private:
+    std::atomic<uint64_t>   _wakeTime;
+    std::atomic<uint32_t>   _numRuns;
+    std::vector<uint64_t>   _latencies;     ///< ワーカーだけが書き、呼び出し元は実行完了を見てから読む
+};
+
+}   // namespace
+
+
+FW_BENCH(thread_wake, "FwThread worker wake latency and CPU burn under bursty and idle load per wait mode") {
+    static const struct {
+        const char *    name;
+        uint32_t        flags;
+    } s_modes[] = {
+        { "park",       0 },
+        { "spin",       FwThreadFlagSpinWait },
+        { "yield",      FwThreadFlagYieldWait },
+        { "adaptive",   FwThreadFlagAdaptiveWait },
+    };
+    const uint32_t numBurstWakes = s_numBurstWakes * context.scale;
+
+    printf("  %-10s %14s %14s %12s %14s %14s %10s\n", "mode", "burst p50 us", "burst p99 us", "burst cpu %", "idle p50 us", "idle p99 us", "idle cpu %");
+    for (const auto & mode : s_modes) {
+        FwWakeWorker worker;
+        FwThreadDesc desc;
+        desc.Init();
+        desc.flags = mode.flags;
+        worker.StartWorker(&desc);
+        worker.WaitFirstRun();
+
+        // 連続して起こす
+        double cpuStart = FwBenchGetProcessCpuSeconds();
+        FwBenchTimer timer;
+        for (uint32_t i = 0; i < numBurstWakes; ++i) {
+            worker.Wake();
+        }
+        const double burstCpu = (FwBenchGetProcessCpuSeconds() - cpuStart) / timer.GetSeconds();
+        const std::vector<uint64_t> burst = worker.TakeLatencies();
+
+        // 間を空けて起こす。待っている間のCPU時間が待機方法の消費分になる
+        cpuStart = FwBenchGetProcessCpuSeconds();
+        timer.Reset();
+        for (uint32_t i = 0; i < s_numIdleWakes; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(s_idleIntervalMs));
+            worker.Wake();
+        }
+        const double idleCpu = (FwBenchGetProcessCpuSeconds() - cpuStart) / timer.GetSeconds();
+        const std::vector<uint64_t> idle = worker.TakeLatencies();
+
+        worker.Shutdown();
+        FW_BENCH_CHECK(burst.size() == numBurstWakes && idle.size() == s_numIdleWakes);
+
+        printf("  %-10s %14.2f %14.2f %12.1f %14.2f %14.2f %10.1f\n", mode.name,
+            FwBenchPercentile(burst, 50.0) * 1e-3, FwBenchPercentile(burst, 99.0) * 1e-3, burstCpu * 100.0,
+            FwBenchPercentile(idle, 50.0) * 1e-3, FwBenchPercentile(idle, 99.0) * 1e-3, idleCpu * 100.0);
+    }
+    return FW_OK;
+}
@@ -0,0 +1,222 @@
+﻿/**
+ * @file fw_bench.h
+ * @brief ベンチマークの登録と計測の補助
+ */
+#ifndef FW_BENCH_H_
+#define FW_BENCH_H_
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <functional>
+
+#if defined(FW_PLATFORM_WIN32)
+    #include <psapi.h>
+    #pragma comment(lib, "psapi.lib")
+#else
+    #include <unistd.h>
+    #include <sys/resource.h>
+#endif
+
+
+BEGIN_NAMESPACE_FW
+
+/**
+ * @struct FwBenchContext
+ * @brief コマンドラインで指定した計測条件
+ */
+struct FwBenchContext {
+    uint32_t    maxThreads;     ///< 計測に使う最大スレッド数（-threads、既定は論理CPU数）
+    uint32_t    scale;          ///< 繰り返し回数の倍率（-scale、既定は1）
+};
+
+using FwBenchFunction = sint32_t (*)(const FwBenchContext & context);
+
+/**
+ * @class FwBenchEntry
+ * @brief 登録したベンチマーク
+ * @note  FW_BENCHで静的に生成され、起動前に一覧へ繋がります
+ */
+class FwBenchEntry {
+public:
+    FwBenchEntry(const char * name, const char * description, FwBenchFunction function)
+    : _name(name)
+    , _description(description)
+    , _function(function)
+    , _next(s_head) {
+        s_head = this;
+    }
+
+    static FwBenchEntry * GetHead() {
+        return s_head;
+    }
+
+
+    const char *        _name;
+    const char *        _description;
+    FwBenchFunction     _function;
+    FwBenchEntry *      _next;
+
+
+private:
+    static FwBenchEntry *   s_head;
+};
+
+/**
+ * @brief ベンチマークを定義して登録する
+ * @note  本体はFW_OKか、結果が正しくなければERR_FAILEDを返します
+ */
+#define FW_BENCH(name, description)                                                                 \
+    static sint32_t FwBench_##name(const NAMESPACE_FW FwBenchContext & context);                   \
+    static NAMESPACE_FW FwBenchEntry s_benchEntry_##name(#name, description, FwBench_##name);      \
+    static sint32_t FwBench_##name(const NAMESPACE_FW FwBenchContext & context)
+
+/**
+ * @brief 条件を満たさなければメッセージを出して失敗を返す
+ */
+#define FW_BENCH_CHECK(cond)                                                                        \
+    do {                                                                                            \
+        if (!(cond)) {                                                                              \
+            printf("  FAILED: %s (%s:%d)\n", #cond, __FILE__, __LINE__);                            \
+            return ERR_FAILED;                                                                      \
+        }                                                                                           \
+    } while (0)
+
+
+/**
+ * @class FwBenchTimer
+ * @brief 経過時間の計測
+ */
+class FwBenchTimer {
+public:
+    void Reset() {
+        _start = std::chrono::steady_clock::now();
+    }
+
+    double GetSeconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    }
+
+    FwBenchTimer() {
+        Reset();
+    }
+
+
+private:
+    std::chrono::steady_clock::time_point   _start;
+};
+
+/**
+ * @brief 現在時刻（ナノ秒）
+ */
+FW_INLINE uint64_t FwBenchGetTimeNanoseconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @brief プロセスが物理メモリに載せているサイズ
+ * @return 取得できなければ0
+ */
+FW_INLINE size_t FwBenchGetResidentBytes() {
+#if defined(FW_PLATFORM_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return static_cast<size_t>(counters.WorkingSetSize);
+#else
+    FILE * fp = fopen("/proc/self/statm", "r");
+    if (fp == nullptr) {
+        return 0;
+    }
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    const int numRead = fscanf(fp, "%lu %lu", &size, &resident);
+    fclose(fp);
+    return (numRead == 2) ? static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+/**
+ * @brief プロセスが消費したCPU時間（ユーザ＋カーネル、秒）
+ */
+FW_INLINE double FwBenchGetProcessCpuSeconds() {
+#if defined(FW_PLATFORM_WIN32)
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0.0;
+    }
+    const uint64_t kernel = (static_cast<uint64_t>(kernelTime.dwHighDateTime) << 32) | kernelTime.dwLowDateTime;
+    const uint64_t user = (static_cast<uint64_t>(userTime.dwHighDateTime) << 32) | userTime.dwLowDateTime;
+    return static_cast<double>(kernel + user) * 1e-7;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+/**
+ * @brief 複数のスレッドで同時に実行して、全員が終わるまでの時間を計る
+ * @param[in] numThreads スレッド数
+ * @param[in] function   スレッド番号を受け取る処理
+ * @return 経過秒数（全スレッドの準備が揃ってから計測）
+ */
+FW_INLINE double FwBenchRunThreads(const uint32_t numThreads, const std::function<void(uint32_t)> & function) {
+    std::atomic<uint32_t>   numReady(0);
+    std::atomic<bool>       start(false);
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (uint32_t i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&, i]() {
+            numReady.fetch_add(1);
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            function(i);
+        });
+    }
+    while (numReady.load() != numThreads) {
+        std::this_thread::yield();
+    }
+
+    FwBenchTimer timer;
+    start.store(true, std::memory_order_release);
+    for (auto & thread : threads) {
+        thread.join();
+    }
+    return timer.GetSeconds();
+}
+
+/**
+ * @brief 1, 2, 4, ..., maxThreadsの順にスレッド数を返す
+ * @return 次のスレッド数。maxThreadsを超えたら0
+ */
+FW_INLINE uint32_t FwBenchNextThreadCount(const uint32_t numThreads, const uint32_t maxThreads) {
+    if (numThreads == 0) {
+        return 1;
+    }
+    if (maxThreads <= numThreads) {
+        return 0;
+    }
+    return Min(numThreads * 2, maxThreads);
+}
+
+/**
+ * @brief 昇順に並べたサンプルからパーセンタイルを取得
+ */
+template<class _Type>
+FW_INLINE _Type FwBenchPercentile(const std::vector<_Type> & sorted, const double percentile) {
+    if (sorted.empty()) {
+        return _Type();
+    }
+    const size_t index = Min(sorted.size() - 1, static_cast<size_t>(percentile * 0.01 * static_cast<double>(sorted.size())));
+    return sorted[index];
+}
+
+END_NAMESPACE_FW
+
+#endif  // FW_BENCH_H_
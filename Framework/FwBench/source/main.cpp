@@ -0,0 +1,68 @@
+﻿/**
+ * @file main.cpp
+ * @brief FwCoreのベンチマーク
+ * @note  FwBench [-threads N] [-scale N] [-list] [名前...]
+ *        名前を指定しなければ登録した全てのベンチマークを実行します
+ */
+#include "stdafx.h"
+
+BEGIN_NAMESPACE_FW
+FwBenchEntry * FwBenchEntry::s_head = nullptr;
+END_NAMESPACE_FW
+
+USING_NAMESPACE_FW
+
+int main(int argc, char * argv[]) {
+    FwBenchContext context;
+    context.maxThreads = Max<uint32_t>(1, std::thread::hardware_concurrency());
+    context.scale = 1;
+
+    bool list = false;
+    std::vector<const char *> names;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            context.maxThreads = Max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-scale") == 0 && i + 1 < argc) {
+            context.scale = Max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-list") == 0) {
+            list = true;
+        } else {
+            names.push_back(argv[i]);
+        }
+    }
+
+    // 登録と逆順に繋がっているので並べ直す
+    std::vector<FwBenchEntry *> entries;
+    for (FwBenchEntry * entry = FwBenchEntry::GetHead(); entry != nullptr; entry = entry->_next) {
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const FwBenchEntry * a, const FwBenchEntry * b) {
+        return strcmp(a->_name, b->_name) < 0;
+    });
+
+    if (list) {
+        for (auto entry : entries) {
+            printf("%-24s %s\n", entry->_name, entry->_description);
+        }
+        return 0;
+    }
+
+    printf("threads: %u, scale: %u\n", context.maxThreads, context.scale);
+
+    int numFailed = 0;
+    for (auto entry : entries) {
+        if (!names.empty() && std::none_of(names.begin(), names.end(), [entry](const char * name) { return strcmp(name, entry->_name) == 0; })) {
+            continue;
+        }
+        printf("\n[%s] %s\n", entry->_name, entry->_description);
+        if (entry->_function(context) != FW_OK) {
+            ++numFailed;
+        }
+    }
+
+    if (numFailed != 0) {
+        printf("\n%d benchmark(s) failed\n", numFailed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,4 @@
+﻿/**
+ * @file stdafx.cpp
+ */
+#include "stdafx.h"
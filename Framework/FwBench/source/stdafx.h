@@ -0,0 +1,25 @@
+﻿/**
+ * @file stdafx.h
+ */
+#pragma once
+
+#if defined(WIN32) || defined(WIN64)
+    #define WIN32_LEAN_AND_MEAN     // Windows ヘッダーから使用されていない部分を除外します。
+    #define NOSHLWAPI               // Shlwapi.hを読み込まないように
+    #include <Windows.h>
+#endif
+
+// C ランタイム ヘッダー ファイル
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tchar.h>
+
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "fw_core.h"
+
+#include "fw_bench.h"
@@ -59,7 +59,7 @@ public:
     }
 
     void deallocate(pointer _Ptr, size_type) {
-        _Ptr->~_Ty(); FwFree(_Ptr);
+        FwFree(_Ptr);
     }
 
     template<class _Other>
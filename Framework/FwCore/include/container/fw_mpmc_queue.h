@@ -0,0 +1,183 @@
+﻿/**
+ * @file fw_mpmc_queue.h
+ * @brief 複数の生産者と複数の消費者で使える固定長のロックフリーキュー
+ */
+#ifndef FW_MPMC_QUEUE_H_
+#define FW_MPMC_QUEUE_H_
+
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "core/fw_allocator.h"
+#include "misc/fw_noncopyable.h"
+
+BEGIN_NAMESPACE_FW
+
+/**
+ * @class FwMpmcQueue
+ * @brief Vyukov方式の固定長MPMCキュー
+ * @note  各スロットに書き込み順の番号を持たせ、番号を見て空きか使用中かを判断します
+ *        Push/Popはそれぞれ1回のCASで済み、生産者同士・消費者同士以外では競合しません
+ * @tparam T   要素の型
+ * @tparam Tag スロットを確保するタグ
+ */
+template<class T, sint32_t Tag = FwDefaultMemAllocatorTag>
+class FwMpmcQueue : public NonCopyable<FwMpmcQueue<T, Tag>> {
+public:
+    /**
+     * @brief 初期化
+     * @param[in] capacity 容量（2の累乗）
+     * @return 失敗時はfalse
+     */
+    bool Init(const uint32_t capacity) {
+        FwAssert(_slots == nullptr);
+        if (capacity < 2 || !IsPowerOfTwo(capacity)) {
+            return false;
+        }
+        _slots = reinterpret_cast<Slot *>(FwMallocAligned(sizeof(Slot) * capacity, 64, Tag));
+        if (_slots == nullptr) {
+            return false;
+        }
+        for (uint32_t i = 0; i < capacity; ++i) {
+            new(&_slots[i].sequence) std::atomic<size_t>(i);
+        }
+        _mask = capacity - 1;
+        _enqueuePos.store(0, std::memory_order_relaxed);
+        _dequeuePos.store(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief 破棄
+     * @note  残っている要素は破棄されます
+     */
+    void Term() {
+        if (_slots == nullptr) {
+            return;
+        }
+        const size_t enqueuePos = _enqueuePos.load(std::memory_order_acquire);
+        for (size_t pos = _dequeuePos.load(std::memory_order_relaxed); pos != enqueuePos; ++pos) {
+            reinterpret_cast<T *>(_slots[pos & _mask].storage)->~T();
+        }
+        FwFree(_slots);
+        _slots = nullptr;
+        _mask = 0;
+    }
+
+    /**
+     * @brief 末尾へ積む
+     * @return 満杯ならfalse
+     */
+    template<class U>
+    bool Push(U && value) {
+        size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        Slot * slot;
+        for (;;) {
+            slot = &_slots[pos & _mask];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                // 空きスロット。取れたら書き込む
+                if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // 一周前の要素がまだ取り出されていない
+                return false;
+            } else {
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        new(slot->storage) T(std::forward<U>(value));
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 先頭から取り出す
+     * @return 空ならfalse
+     */
+    bool Pop(T & value) {
+        size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+        Slot * slot;
+        for (;;) {
+            slot = &_slots[pos & _mask];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // まだ書き込まれていない
+                return false;
+            } else {
+                pos = _dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        T * item = reinterpret_cast<T *>(slot->storage);
+        value = std::move(*item);
+        item->~T();
+
+        // 次の周回の生産者へ渡す
+        slot->sequence.store(pos + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 空かどうか（目安）
+     */
+    FW_INLINE bool IsEmpty() const {
+        return GetCount() == 0;
+    }
+
+    /**
+     * @brief 積まれている数（目安）
+     */
+    FW_INLINE size_t GetCount() const {
+        const size_t dequeuePos = _dequeuePos.load(std::memory_order_relaxed);
+        const size_t enqueuePos = _enqueuePos.load(std::memory_order_relaxed);
+        return (enqueuePos > dequeuePos) ? enqueuePos - dequeuePos : 0;
+    }
+
+    /**
+     * @brief 容量
+     */
+    FW_INLINE size_t GetCapacity() const {
+        return (_slots != nullptr) ? _mask + 1 : 0;
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwMpmcQueue()
+    : _slots(nullptr)
+    , _mask(0)
+    , _enqueuePos(0)
+    , _dequeuePos(0) {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FwMpmcQueue() {
+        Term();
+    }
+
+
+private:
+    struct Slot {
+        std::atomic<size_t>     sequence;
+        alignas(T) uint8_t      storage[sizeof(T)];
+    };
+
+    Slot *                              _slots;
+    size_t                              _mask;
+    FW_ALIGN64 std::atomic<size_t>      _enqueuePos;
+    FW_ALIGN64 std::atomic<size_t>      _dequeuePos;
+};
+
+END_NAMESPACE_FW
+
+#endif  // FW_MPMC_QUEUE_H_
@@ -0,0 +1,113 @@
+﻿/**
+ * @file fw_mpsc_queue.h
+ * @brief 複数の生産者と1つの消費者で使う上限の無い侵入型キュー
+ */
+#ifndef FW_MPSC_QUEUE_H_
+#define FW_MPSC_QUEUE_H_
+
+#include <atomic>
+
+#include "misc/fw_noncopyable.h"
+
+BEGIN_NAMESPACE_FW
+
+/**
+ * @struct FwMpscQueueNode
+ * @brief FwMpscQueueに積む要素の基底
+ * @note  ノードはキューに積んでいる間、キューが所有します
+ */
+struct FwMpscQueueNode {
+    std::atomic<FwMpscQueueNode *>  next;
+
+    FwMpscQueueNode()
+    : next(nullptr) {
+    }
+};
+
+/**
+ * @class FwMpscQueue
+ * @brief Vyukov方式の侵入型MPSCキュー
+ * @note  Pushは交換1回で終わるので待ちが発生しません。ノードを埋め込むのでメモリ確保もありません
+ *        生産者がPushの途中で止まっている間は、後ろに積まれた要素も取り出せずPopはnullptrを返します
+ * @attention Popは1つのスレッドからだけ呼んでください
+ * @tparam T FwMpscQueueNodeを継承した要素の型
+ */
+template<class T>
+class FwMpscQueue : public NonCopyable<FwMpscQueue<T>> {
+public:
+    /**
+     * @brief 末尾へ積む（任意のスレッド）
+     */
+    void Push(T * value) {
+        PushNode(static_cast<FwMpscQueueNode *>(value));
+    }
+
+    /**
+     * @brief 先頭から取り出す（消費者のみ）
+     * @return 空か、積んでいる途中の生産者がいればnullptr
+     */
+    T * Pop() {
+        FwMpscQueueNode * tail = _tail;
+        FwMpscQueueNode * next = tail->next.load(std::memory_order_acquire);
+
+        // 番兵を読み飛ばす
+        if (tail == &_stub) {
+            if (next == nullptr) {
+                return nullptr;
+            }
+            _tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr) {
+            _tail = next;
+            return static_cast<T *>(tail);
+        }
+
+        // 積んでいる途中の生産者がいる
+        if (tail != _head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        // 最後の1つを取り出すために番兵を積み直す
+        PushNode(&_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            _tail = next;
+            return static_cast<T *>(tail);
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 空かどうか（目安）
+     */
+    FW_INLINE bool IsEmpty() const {
+        return _head.load(std::memory_order_relaxed) == &_stub;
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwMpscQueue()
+    : _head(&_stub)
+    , _tail(&_stub) {
+    }
+
+
+private:
+    void PushNode(FwMpscQueueNode * node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        FwMpscQueueNode * prev = _head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    FW_ALIGN64 std::atomic<FwMpscQueueNode *>   _head;  ///< 生産者が積む側
+    FW_ALIGN64 FwMpscQueueNode *                _tail;  ///< 消費者が取り出す側
+    FwMpscQueueNode                             _stub;
+};
+
+END_NAMESPACE_FW
+
+#endif  // FW_MPSC_QUEUE_H_
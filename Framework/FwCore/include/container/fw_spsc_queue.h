@@ -0,0 +1,176 @@
+﻿/**
+ * @file fw_spsc_queue.h
+ * @brief 生産者1つと消費者1つで使う固定長のリングバッファ
+ */
+#ifndef FW_SPSC_QUEUE_H_
+#define FW_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "core/fw_allocator.h"
+#include "misc/fw_noncopyable.h"
+
+BEGIN_NAMESPACE_FW
+
+/**
+ * @class FwSpscQueue
+ * @brief ロックフリーのSPSCリングバッファ
+ * @note  読み書きの位置は別のキャッシュラインに置き、相手の位置は手元に覚えておいて
+ *        足りなくなった時だけ読み直すので、通常は相手のキャッシュラインに触れません
+ * @attention Pushは1つのスレッドから、Popは1つのスレッドからだけ呼んでください
+ * @tparam T   要素の型
+ * @tparam Tag バッファを確保するタグ
+ */
+template<class T, sint32_t Tag = FwDefaultMemAllocatorTag>
+class FwSpscQueue : public NonCopyable<FwSpscQueue<T, Tag>> {
+public:
+    /**
+     * @brief 初期化
+     * @param[in] capacity 容量（2の累乗）
+     * @return 失敗時はfalse
+     */
+    bool Init(const uint32_t capacity) {
+        FwAssert(_buffer == nullptr);
+        if (capacity == 0 || !IsPowerOfTwo(capacity)) {
+            return false;
+        }
+        _buffer = reinterpret_cast<T *>(FwMallocAligned(sizeof(T) * capacity, Max<size_t>(alignof(T), 64), Tag));
+        if (_buffer == nullptr) {
+            return false;
+        }
+        _mask = capacity - 1;
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+        _cachedHead = 0;
+        _cachedTail = 0;
+        return true;
+    }
+
+    /**
+     * @brief 破棄
+     * @note  残っている要素は破棄されます
+     */
+    void Term() {
+        if (_buffer == nullptr) {
+            return;
+        }
+        const size_t tail = _tail.load(std::memory_order_acquire);
+        for (size_t head = _head.load(std::memory_order_relaxed); head != tail; ++head) {
+            _buffer[head & _mask].~T();
+        }
+        FwFree(_buffer);
+        _buffer = nullptr;
+        _mask = 0;
+    }
+
+    /**
+     * @brief 末尾へ積む（生産者のみ）
+     * @return 満杯ならfalse
+     */
+    template<class U>
+    bool Push(U && value) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _cachedHead > _mask) {
+            _cachedHead = _head.load(std::memory_order_acquire);
+            if (tail - _cachedHead > _mask) {
+                return false;
+            }
+        }
+        new(&_buffer[tail & _mask]) T(std::forward<U>(value));
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 先頭から取り出す（消費者のみ）
+     * @return 空ならfalse
+     */
+    bool Pop(T & value) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _cachedTail) {
+            _cachedTail = _tail.load(std::memory_order_acquire);
+            if (head == _cachedTail) {
+                return false;
+            }
+        }
+        T * item = &_buffer[head & _mask];
+        value = std::move(*item);
+        item->~T();
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 先頭の要素を参照する（消費者のみ）
+     * @return 空ならnullptr
+     */
+    T * Front() {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _cachedTail) {
+            _cachedTail = _tail.load(std::memory_order_acquire);
+            if (head == _cachedTail) {
+                return nullptr;
+            }
+        }
+        return &_buffer[head & _mask];
+    }
+
+    /**
+     * @brief 空かどうか（目安）
+     */
+    FW_INLINE bool IsEmpty() const {
+        return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 積まれている数（目安）
+     */
+    FW_INLINE size_t GetCount() const {
+        return _tail.load(std::memory_order_relaxed) - _head.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 容量
+     */
+    FW_INLINE size_t GetCapacity() const {
+        return (_buffer != nullptr) ? _mask + 1 : 0;
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwSpscQueue()
+    : _buffer(nullptr)
+    , _mask(0)
+    , _head(0)
+    , _cachedTail(0)
+    , _tail(0)
+    , _cachedHead(0) {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FwSpscQueue() {
+        Term();
+    }
+
+
+private:
+    T *                                 _buffer;
+    size_t                              _mask;
+
+    // 消費者が触るもの
+    FW_ALIGN64 std::atomic<size_t>      _head;
+    size_t                              _cachedTail;
+
+    // 生産者が触るもの
+    FW_ALIGN64 std::atomic<size_t>      _tail;
+    size_t                              _cachedHead;
+};
+
+END_NAMESPACE_FW
+
+#endif  // FW_SPSC_QUEUE_H_
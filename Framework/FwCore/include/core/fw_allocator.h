@@ -10,6 +10,7 @@ BEGIN_NAMESPACE_FW
 static const sint32_t FwMinMemAllocatorTag      = 0;
 static const sint32_t FwMaxMemAllocatorTag      = 0x3ff;
 static const sint32_t FwDefaultMemAllocatorTag  = FwMinMemAllocatorTag;
+static const sint32_t FwNumaNodeAny             = -1;   ///< NUMAノードを指定しない
 
 /**
  * @class FwMemAllocator
@@ -23,6 +24,8 @@ public:
 
     /**
      * @brief 動的メモリを再確保
+     * @note  可能な限りその場で伸縮し、移動する場合は内容を引き継ぎます
+     *        失敗した場合はnullptrを返し、元のブロックはそのまま使えます
      */
     virtual void * Realloc(void *ptr, size_t size) = 0;
 
@@ -67,14 +70,20 @@ FW_DLL_FUNC FwMemAllocator* FwGetMemAllocator(sint32_t tag);
 // 内部使用関数
 //-----------------------------------------------------------
 FW_DLL_FUNC void * FwMalloc(size_t size, sint32_t tag);
+FW_DLL_FUNC void * FwMallocAligned(size_t size, size_t alignment, sint32_t tag);
+FW_DLL_FUNC void * FwRealloc(void * ptr, size_t size);
 FW_DLL_FUNC void FwFree(void * ptr);
 
 FW_DLL_FUNC void * FwMallocDebug(size_t size, sint32_t tag, const char * file, int line);
+FW_DLL_FUNC void * FwMallocAlignedDebug(size_t size, size_t alignment, sint32_t tag, const char * file, int line);
+FW_DLL_FUNC void * FwReallocDebug(void * ptr, size_t size, const char * file, int line);
 FW_DLL_FUNC void FwFreeDebug(void * ptr);
 
 #if defined(FW_DEBUG)
-    #define FwMalloc(__size, __tag)     FwMallocDebug(__size, __tag, __FILE__, __LINE__)
-    #define FwFree(__ptr)               FwFreeDebug(__ptr)
+    #define FwMalloc(__size, __tag)                         FwMallocDebug(__size, __tag, __FILE__, __LINE__)
+    #define FwMallocAligned(__size, __alignment, __tag)     FwMallocAlignedDebug(__size, __alignment, __tag, __FILE__, __LINE__)
+    #define FwRealloc(__ptr, __size)                        FwReallocDebug(__ptr, __size, __FILE__, __LINE__)
+    #define FwFree(__ptr)                                   FwFreeDebug(__ptr)
 #endif
 
 
@@ -72,6 +72,23 @@
         #define FW_BIG_ENDIAN           (1)
     #endif
 #elif defined(__linux__)
+    #define FW_PLATFORM_LINUX           (1)
+
+    #if defined(__x86_64__)
+        #define FW_ARCH_X64             (1)
+    #elif defined(__i386__)
+        #define FW_ARCH_X86             (1)
+    #elif defined(__arm__) || defined(__aarch64__)
+        #define FW_ARCH_ARM             (1)
+    #else
+        #error Unsupported architecture
+    #endif
+
+    #if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        #define FW_BIG_ENDIAN           (1)
+    #else
+        #define FW_LITTLE_ENDIAN        (1)
+    #endif
 #else
     #error Unsupported platform
 #endif
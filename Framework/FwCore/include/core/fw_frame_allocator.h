@@ -0,0 +1,99 @@
+﻿/**
+ * @file fw_frame_allocator.h
+ */
+#ifndef FW_FRAME_ALLOCATOR_H_
+#define FW_FRAME_ALLOCATOR_H_
+
+#include "core/fw_allocator.h"
+
+BEGIN_NAMESPACE_FW
+
+static const sint32_t FwFrameMemAllocatorTag        = FwMaxMemAllocatorTag;
+static const sint32_t FwDefaultFrameBufferCount     = 2;
+static const sint32_t FwMaxFrameBufferCount         = 4;
+static const size_t   FwDefaultFrameBufferSize      = 4 * 1024 * 1024;
+
+/**
+ * @struct FwFrameAllocatorDesc
+ */
+struct FwFrameAllocatorDesc {
+    size_t      bufferSize;     ///< 1フレーム分のバッファサイズ
+    sint32_t    numBuffers;     ///< バッファ数（確保したメモリはnumBuffersフレームの間有効）
+    sint32_t    tag;            ///< 登録するタグ
+
+    /**
+     * @brief 初期化
+     */
+    FW_INLINE void Init() {
+        bufferSize  = FwDefaultFrameBufferSize;
+        numBuffers  = FwDefaultFrameBufferCount;
+        tag         = FwFrameMemAllocatorTag;
+    }
+};
+
+/**
+ * @class FwFrameAllocator
+ * @brief フレーム単位で一括解放する線形アロケータ
+ * @note  Allocはロックフリーで複数スレッドから呼び出せます
+ *        Freeは何もしません。確保したメモリはEndFrameでまとめて破棄されます
+ */
+class FwFrameAllocator : public FwMemAllocator {
+public:
+    /**
+     * @brief フレームの終端
+     * @attention 他のスレッドがAllocしていない状態で呼び出してください
+     */
+    virtual void EndFrame() = 0;
+
+    /**
+     * @brief 現在のフレームで使用中のサイズを取得
+     */
+    virtual size_t GetUsedSize() const = 0;
+
+    /**
+     * @brief これまでの1フレームの最大使用サイズを取得
+     */
+    virtual size_t GetPeakSize() const = 0;
+
+    /**
+     * @brief 1フレーム分のバッファサイズを取得
+     */
+    virtual size_t GetBufferSize() const = 0;
+
+
+protected:
+    /**
+     * @brief コンストラクタ
+     */
+    FwFrameAllocator() {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwFrameAllocator() {
+    }
+};
+
+/**
+ * @brief FwFrameAllocatorを生成
+ * @param[in] desc 詳細
+ * @return 生成したアロケータ。失敗した場合はnullptr
+ */
+FW_DLL_FUNC FwFrameAllocator * FwCreateFrameAllocator(const FwFrameAllocatorDesc * desc);
+
+/**
+ * @brief FwFrameAllocatorを破棄
+ * @param[in] allocator 破棄するアロケータ
+ */
+FW_DLL_FUNC void FwDestroyFrameAllocator(FwFrameAllocator * allocator);
+
+
+template<class T, class... Args>
+T* FwFrameNew(Args... args) {
+    return FwAllocatorNew<T, FwFrameMemAllocatorTag>(args...);
+}
+
+END_NAMESPACE_FW
+
+#endif  // FW_FRAME_ALLOCATOR_H_
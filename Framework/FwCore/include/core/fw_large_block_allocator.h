@@ -0,0 +1,95 @@
+﻿/**
+ * @file fw_large_block_allocator.h
+ */
+#ifndef FW_LARGE_BLOCK_ALLOCATOR_H_
+#define FW_LARGE_BLOCK_ALLOCATOR_H_
+
+#include "core/fw_allocator.h"
+
+BEGIN_NAMESPACE_FW
+
+using FwHugePageMode = uint32_t;
+
+static const FwHugePageMode FwHugePageNone          = 0;    ///< 通常のページを使う
+static const FwHugePageMode FwHugePageTransparent   = 1;    ///< OSにヒュージページの使用を促す（LinuxのTHP）
+static const FwHugePageMode FwHugePageExplicit      = 2;    ///< ヒュージページで予約する（使えなければFwHugePageTransparent）
+
+#if defined(FW_PLATFORM_WIN64) || defined(__LP64__)
+static const size_t FwDefaultLargeBlockReserveSize  = static_cast<size_t>(16) * 1024 * 1024 * 1024;
+#else
+static const size_t FwDefaultLargeBlockReserveSize  = 512 * 1024 * 1024;
+#endif
+static const size_t FwLargeBlockGranularity         = 64 * 1024;
+
+/**
+ * @struct FwLargeBlockAllocatorDesc
+ */
+struct FwLargeBlockAllocatorDesc {
+    size_t          reserveSize;    ///< 予約する仮想アドレス空間のサイズ
+    FwHugePageMode  hugePage;       ///< ヒュージページの使い方
+
+    /**
+     * @brief 初期化
+     */
+    FW_INLINE void Init() {
+        reserveSize = FwDefaultLargeBlockReserveSize;
+        hugePage    = FwHugePageTransparent;
+    }
+};
+
+/**
+ * @struct FwLargeBlockAllocatorStats
+ */
+struct FwLargeBlockAllocatorStats {
+    size_t          reserveSize;    ///< 予約済みサイズ
+    size_t          committedSize;  ///< 使用可能にしているサイズ
+    size_t          liveBytes;      ///< 使用中のバイト数（要求サイズの合計）
+    size_t          numBlocks;      ///< 使用中のブロック数
+    FwHugePageMode  hugePage;       ///< 実際に使われているヒュージページの使い方
+};
+
+/**
+ * @class FwLargeBlockAllocator
+ * @brief 頂点バッファやテクスチャなどの大きなブロック向けのアロケータ
+ * @note  起動時にアドレス空間をまとめて予約し、確保したブロックの分だけ使用可能にします
+ *        解放したブロックの物理メモリはすぐにOSへ返却します
+ *        ヒュージページ以上のブロックはヒュージページ境界に配置します
+ */
+class FwLargeBlockAllocator : public FwMemAllocator {
+public:
+    /**
+     * @brief 統計情報を取得
+     */
+    virtual void GetStats(FwLargeBlockAllocatorStats * stats) = 0;
+
+
+protected:
+    /**
+     * @brief コンストラクタ
+     */
+    FwLargeBlockAllocator() {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwLargeBlockAllocator() {
+    }
+};
+
+/**
+ * @brief FwLargeBlockAllocatorを生成
+ * @param[in] desc 詳細
+ * @return 生成したアロケータ。仮想アドレス空間の予約に失敗した場合はnullptr
+ */
+FW_DLL_FUNC FwLargeBlockAllocator * FwCreateLargeBlockAllocator(const FwLargeBlockAllocatorDesc * desc);
+
+/**
+ * @brief FwLargeBlockAllocatorを破棄
+ * @param[in] allocator 破棄するアロケータ
+ */
+FW_DLL_FUNC void FwDestroyLargeBlockAllocator(FwLargeBlockAllocator * allocator);
+
+END_NAMESPACE_FW
+
+#endif  // FW_LARGE_BLOCK_ALLOCATOR_H_
@@ -0,0 +1,147 @@
+﻿/**
+ * @file fw_mem_stats.h
+ * @brief FwMallocDebugで記録したメモリ使用量の取得
+ */
+#ifndef FW_MEM_STATS_H_
+#define FW_MEM_STATS_H_
+
+#include "core/fw_allocator.h"
+#include "misc/fw_noncopyable.h"
+
+BEGIN_NAMESPACE_FW
+
+//! サイズ毎の確保回数を数えるバケット数（16バイト以下, 32バイト以下, ... , 256KB超）
+static const sint32_t FwMemStatsHistogramBuckets = 16;
+
+/**
+ * @struct FwMemTagStats
+ */
+struct FwMemTagStats {
+    sint64_t    liveBytes;      ///< 使用中のバイト数
+    sint64_t    peakBytes;      ///< 使用中のバイト数の最大値
+    uint64_t    allocCount;     ///< 確保回数
+    uint64_t    freeCount;      ///< 解放回数
+    uint64_t    histogram[FwMemStatsHistogramBuckets];  ///< サイズ毎の確保回数
+
+    /**
+     * @brief 初期化
+     */
+    FW_INLINE void Init() {
+        liveBytes = 0;
+        peakBytes = 0;
+        allocCount = 0;
+        freeCount = 0;
+        for (sint32_t i = 0; i < FwMemStatsHistogramBuckets; ++i) {
+            histogram[i] = 0;
+        }
+    }
+};
+
+/**
+ * @struct FwMemCallsiteStats
+ */
+struct FwMemCallsiteStats {
+    const char *    file;       ///< 確保したファイル
+    sint32_t        line;       ///< 確保した行
+    sint32_t        tag;        ///< タグ
+    sint64_t        liveBytes;  ///< 使用中のバイト数
+    sint64_t        liveCount;  ///< 使用中のブロック数
+    uint64_t        allocCount; ///< 確保回数
+};
+
+/**
+ * @class FwMemSnapshot
+ * @brief ある時点のメモリ使用量
+ */
+class FwMemSnapshot : public NonCopyable<FwMemSnapshot> {
+public:
+    /**
+     * @brief 自身を破棄
+     */
+    FW_INLINE void Release() {
+        DoRelease();
+    }
+
+    /**
+     * @brief タグ毎の統計を取得
+     */
+    FW_INLINE const FwMemTagStats & GetTagStats(const sint32_t tag) const {
+        return DoGetTagStats(tag);
+    }
+
+    /**
+     * @brief 記録されている確保場所の数を取得
+     */
+    FW_INLINE sint32_t GetNumCallsites() const {
+        return DoGetNumCallsites();
+    }
+
+    /**
+     * @brief 確保場所毎の統計を取得
+     */
+    FW_INLINE const FwMemCallsiteStats & GetCallsite(const sint32_t index) const {
+        return DoGetCallsite(index);
+    }
+
+    /**
+     * @brief 使用中のバイト数が多い順にデバッグログへ出力
+     * @param[in] maxCallsites 出力する確保場所の最大数
+     */
+    FW_INLINE void Dump(const sint32_t maxCallsites = 32) const {
+        DoDump(maxCallsites);
+    }
+
+
+protected:
+    /**
+     * @brief 自身を破棄
+     */
+    virtual void DoRelease() = 0;
+
+    /**
+     * @brief タグ毎の統計を取得
+     */
+    virtual const FwMemTagStats & DoGetTagStats(const sint32_t tag) const = 0;
+
+    /**
+     * @brief 記録されている確保場所の数を取得
+     */
+    virtual sint32_t DoGetNumCallsites() const = 0;
+
+    /**
+     * @brief 確保場所毎の統計を取得
+     */
+    virtual const FwMemCallsiteStats & DoGetCallsite(const sint32_t index) const = 0;
+
+    /**
+     * @brief デバッグログへ出力
+     */
+    virtual void DoDump(const sint32_t maxCallsites) const = 0;
+
+    virtual ~FwMemSnapshot() {}
+};
+
+/**
+ * @brief タグ毎の現在の統計を取得
+ * @param[in]  tag   タグ
+ * @param[out] stats 統計
+ */
+FW_DLL_FUNC void FwGetMemTagStats(const sint32_t tag, FwMemTagStats * stats);
+
+/**
+ * @brief 現在のメモリ使用量を記録
+ * @return 記録したスナップショット。不要になったらRelease()してください
+ */
+FW_DLL_FUNC FwMemSnapshot * FwTakeMemSnapshot();
+
+/**
+ * @brief 2つのスナップショットの差分を作成
+ * @param[in] from 比較元
+ * @param[in] to   比較先
+ * @return toからfromを引いたスナップショット。変化の無い確保場所は含みません
+ */
+FW_DLL_FUNC FwMemSnapshot * FwDiffMemSnapshot(const FwMemSnapshot * from, const FwMemSnapshot * to);
+
+END_NAMESPACE_FW
+
+#endif  // FW_MEM_STATS_H_
@@ -0,0 +1,107 @@
+﻿/**
+ * @file fw_mspace_allocator.h
+ */
+#ifndef FW_MSPACE_ALLOCATOR_H_
+#define FW_MSPACE_ALLOCATOR_H_
+
+#include "core/fw_allocator.h"
+
+BEGIN_NAMESPACE_FW
+
+static const size_t FwDefaultMSpaceReserveSize = 64 * 1024 * 1024;
+
+/**
+ * @struct FwMSpaceAllocatorDesc
+ */
+struct FwMSpaceAllocatorDesc {
+    size_t      reserveSize;    ///< 予約する仮想アドレス空間のサイズ
+    bool        threadSafe;     ///< mspace単位でロックを取るか
+    sint32_t    numaNode;       ///< 物理メモリを割り当てるNUMAノード（FwNumaNodeAnyなら指定しない）
+    bool        growable;       ///< 予約領域を使い切った後、領域外にヒープを伸ばすか
+
+    /**
+     * @brief 初期化
+     */
+    FW_INLINE void Init() {
+        reserveSize = FwDefaultMSpaceReserveSize;
+        threadSafe  = true;
+        numaNode    = FwNumaNodeAny;
+        growable    = true;
+    }
+};
+
+/**
+ * @struct FwMSpaceAllocatorStats
+ */
+struct FwMSpaceAllocatorStats {
+    size_t  reserveSize;    ///< 予約済みサイズ
+    size_t  footprint;      ///< 物理メモリをコミットしているサイズ（予約領域外に伸びたセグメントを含む）
+    size_t  maxFootprint;   ///< コミットしたサイズの最大値
+    size_t  usedBytes;      ///< 使用中のチャンクの合計（ヘッダなどのオーバーヘッドを含む）
+    size_t  liveBytes;      ///< 使用中のバイト数（要求サイズの合計）
+    size_t  numBlocks;      ///< 使用中のブロック数
+    bool    numaBound;      ///< 指定したNUMAノードに割り当てられているか
+};
+
+/**
+ * @class FwMSpaceAllocator
+ * @brief 同梱のdlmallocのmspaceを1つ保持するアロケータ
+ * @note  複数のタグに同じインスタンスを登録すればタググループ単位のヒープとして扱える
+ */
+class FwMSpaceAllocator : public FwMemAllocator {
+public:
+    /**
+     * @brief 末尾の未使用領域をOSへ返却する
+     * @note  予約領域は使う分だけコミットしているので、topの未使用ページをデコミットします
+     * @param[in] pad 返却せずに残すサイズ
+     * @return 返却できたらtrue
+     */
+    virtual bool Trim(size_t pad) = 0;
+
+    /**
+     * @brief 全ブロックを一括で破棄してヒープを初期状態に戻す
+     * @attention 確保済みのブロックは全て無効になります
+     */
+    virtual void ReleaseAll() = 0;
+
+    /**
+     * @brief 統計情報を取得
+     */
+    virtual void GetStats(FwMSpaceAllocatorStats * stats) = 0;
+
+    /**
+     * @brief このアロケータで確保したブロックか
+     */
+    virtual bool Contains(const void * ptr) const = 0;
+
+
+protected:
+    /**
+     * @brief コンストラクタ
+     */
+    FwMSpaceAllocator() {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwMSpaceAllocator() {
+    }
+};
+
+/**
+ * @brief FwMSpaceAllocatorを生成
+ * @param[in] desc 詳細
+ * @return 生成したアロケータ。仮想アドレス空間の予約に失敗した場合はnullptr
+ */
+FW_DLL_FUNC FwMSpaceAllocator * FwCreateMSpaceAllocator(const FwMSpaceAllocatorDesc * desc);
+
+/**
+ * @brief FwMSpaceAllocatorを破棄
+ * @param[in] allocator 破棄するアロケータ
+ */
+FW_DLL_FUNC void FwDestroyMSpaceAllocator(FwMSpaceAllocator * allocator);
+
+END_NAMESPACE_FW
+
+#endif  // FW_MSPACE_ALLOCATOR_H_
@@ -0,0 +1,113 @@
+﻿/**
+ * @file fw_numa_allocator.h
+ */
+#ifndef FW_NUMA_ALLOCATOR_H_
+#define FW_NUMA_ALLOCATOR_H_
+
+#include "core/fw_allocator.h"
+#include "core/fw_mspace_allocator.h"
+
+BEGIN_NAMESPACE_FW
+
+static const sint32_t FwMaxNumaNodes = 64;
+
+/**
+ * @struct FwNumaAllocatorDesc
+ */
+struct FwNumaAllocatorDesc {
+    size_t  reserveSizePerNode;     ///< ノード毎に予約する仮想アドレス空間のサイズ（ノードのヒープはこれ以上伸びない）
+    bool    threadSafe;             ///< ノード単位でロックを取るか
+
+    /**
+     * @brief 初期化
+     */
+    FW_INLINE void Init() {
+        reserveSizePerNode  = FwDefaultMSpaceReserveSize;
+        threadSafe          = true;
+    }
+};
+
+/**
+ * @class FwNumaAllocator
+ * @brief NUMAノード毎にヒープを持つアロケータ
+ * @note  確保したスレッドの優先ノード（FwThreadDesc::numaNode）、指定が無ければ実行中のCPUのノードから確保します
+ *        ノードのヒープが足りない場合は他のノードから確保します
+ *        NUMAに対応していない環境では1ノードのFwMSpaceAllocatorと同じです
+ */
+class FwNumaAllocator : public FwMemAllocator {
+public:
+    /**
+     * @brief ノードを指定して確保
+     * @param[in] size      サイズ
+     * @param[in] alignment アライメント
+     * @param[in] tag       タグ
+     * @param[in] node      NUMAノード
+     */
+    virtual void * AllocOnNode(size_t size, size_t alignment, sint32_t tag, sint32_t node) = 0;
+
+    /**
+     * @brief ノード数を取得
+     */
+    virtual sint32_t GetNumNodes() const = 0;
+
+    /**
+     * @brief ブロックを確保したノードを取得
+     * @return このアロケータで確保したブロックでなければFwNumaNodeAny
+     */
+    virtual sint32_t GetBlockNode(const void * ptr) const = 0;
+
+    /**
+     * @brief ノード毎の統計情報を取得
+     */
+    virtual void GetStats(sint32_t node, FwMSpaceAllocatorStats * stats) = 0;
+
+
+protected:
+    /**
+     * @brief コンストラクタ
+     */
+    FwNumaAllocator() {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwNumaAllocator() {
+    }
+};
+
+/**
+ * @brief FwNumaAllocatorを生成
+ * @param[in] desc 詳細
+ * @return 生成したアロケータ。仮想アドレス空間の予約に失敗した場合はnullptr
+ */
+FW_DLL_FUNC FwNumaAllocator * FwCreateNumaAllocator(const FwNumaAllocatorDesc * desc);
+
+/**
+ * @brief FwNumaAllocatorを破棄
+ * @param[in] allocator 破棄するアロケータ
+ */
+FW_DLL_FUNC void FwDestroyNumaAllocator(FwNumaAllocator * allocator);
+
+/**
+ * @brief NUMAノード数を取得
+ * @return NUMAに対応していない環境では1
+ */
+FW_DLL_FUNC sint32_t FwGetNumaNodeCount();
+
+/**
+ * @brief 現在のスレッドが確保に使うNUMAノードを取得
+ * @return 優先ノードが設定されていればそのノード、無ければ実行中のCPUのノード
+ */
+FW_DLL_FUNC sint32_t FwGetCurrentNumaNode();
+
+/**
+ * @brief 現在のスレッドの優先NUMAノードを設定
+ * @note  FwNumaAllocatorの確保先に加えて、OSから新たに割り当てるページもこのノードを優先します
+ * @param[in] node NUMAノード。FwNumaNodeAnyなら設定を解除する
+ */
+FW_DLL_FUNC void FwSetThreadNumaNode(sint32_t node);
+
+END_NAMESPACE_FW
+
+#endif  // FW_NUMA_ALLOCATOR_H_
@@ -0,0 +1,386 @@
+﻿/**
+ * @file fw_pool.h
+ * @brief 固定サイズオブジェクトのプールアロケータ
+ */
+#ifndef FW_POOL_H_
+#define FW_POOL_H_
+
+#include <atomic>
+#include <mutex>
+
+#include "core/fw_allocator.h"
+#include "misc/fw_noncopyable.h"
+
+BEGIN_NAMESPACE_FW
+
+static const size_t   FwPoolSlabAlignment           = 64;
+static const sint32_t FwDefaultPoolObjectsPerSlab   = 64;
+static const sint32_t FwMaxSharedPoolSlabs          = 1024;
+
+/**
+ * @class FwPool
+ * @brief スラブ単位でメモリを確保し、空きオブジェクトを侵入型リストで管理するプール
+ * @tparam T   オブジェクトの型
+ * @tparam Tag スラブを確保するタグ
+ * @attention スレッドセーフではありません。複数スレッドから使う場合はFwSharedPoolを使用してください
+ */
+template<class T, sint32_t Tag = FwDefaultMemAllocatorTag>
+class FwPool : public NonCopyable<FwPool<T, Tag>> {
+public:
+    /**
+     * @brief オブジェクトを生成
+     */
+    template<class... Args>
+    FW_INLINE T * New(Args... args) {
+        void * p = Alloc();
+        if (p == nullptr) {
+            return nullptr;
+        }
+        return new(p) T(args...);
+    }
+
+    /**
+     * @brief オブジェクトを破棄
+     */
+    FW_INLINE void Delete(T * ptr) {
+        if (ptr != nullptr) {
+            ptr->~T();
+            Free(ptr);
+        }
+    }
+
+    /**
+     * @brief オブジェクト1つ分のメモリを確保
+     */
+    FW_INLINE void * Alloc() {
+        if (_freeList == nullptr && !AddSlab()) {
+            return nullptr;
+        }
+        FwPoolNode * node = _freeList;
+        _freeList = node->next;
+        ++_numUsed;
+        return node;
+    }
+
+    /**
+     * @brief オブジェクト1つ分のメモリを解放
+     */
+    FW_INLINE void Free(void * ptr) {
+        if (ptr == nullptr) {
+            return;
+        }
+        FwPoolNode * node = reinterpret_cast<FwPoolNode *>(ptr);
+        node->next = _freeList;
+        _freeList = node;
+        --_numUsed;
+    }
+
+    /**
+     * @brief 全スラブを解放
+     * @attention 使用中のオブジェクトが残っていてはいけません
+     */
+    void Clear() {
+        FwAssert(_numUsed == 0);
+
+        while (_slabs != nullptr) {
+            FwPoolSlab * slab = _slabs;
+            _slabs = slab->next;
+            FwFree(slab);
+        }
+        _freeList = nullptr;
+        _numSlabs = 0;
+    }
+
+    /**
+     * @brief 使用中のオブジェクト数を取得
+     */
+    FW_INLINE sint32_t GetNumUsed() const {return _numUsed;}
+
+    /**
+     * @brief 確保済みのスラブ数を取得
+     */
+    FW_INLINE sint32_t GetNumSlabs() const {return _numSlabs;}
+
+    /**
+     * @brief コンストラクタ
+     * @param[in] objectsPerSlab 1スラブあたりのオブジェクト数
+     */
+    explicit FwPool(const sint32_t objectsPerSlab = FwDefaultPoolObjectsPerSlab)
+    : _freeList(nullptr)
+    , _slabs(nullptr)
+    , _objectsPerSlab(objectsPerSlab)
+    , _numSlabs(0)
+    , _numUsed(0) {
+        FwAssert(0 < objectsPerSlab);
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FwPool() {
+        Clear();
+    }
+
+
+private:
+    union FwPoolNode {
+        FwPoolNode *    next;
+    };
+
+    struct FwPoolSlab {
+        FwPoolSlab *    next;
+    };
+
+    static const size_t kSlotAlignment  = Max(alignof(T), alignof(FwPoolNode));
+    static const size_t kSlotSize       = RoundUp(Max(sizeof(T), sizeof(FwPoolNode)), kSlotAlignment);
+    static const size_t kSlabHeaderSize = RoundUp(sizeof(FwPoolSlab), kSlotAlignment);
+
+    /**
+     * @brief スラブを追加して空きリストへつなぐ
+     */
+    bool AddSlab() {
+        const size_t slabSize = kSlabHeaderSize + kSlotSize * _objectsPerSlab;
+        FwPoolSlab * slab = reinterpret_cast<FwPoolSlab *>(FwMallocAligned(slabSize, Max(kSlotAlignment, FwPoolSlabAlignment), Tag));
+        if (slab == nullptr) {
+            return false;
+        }
+        slab->next = _slabs;
+        _slabs = slab;
+        ++_numSlabs;
+
+        // 先頭から順に取り出されるように後ろからつなぐ
+        uint8_t * slots = reinterpret_cast<uint8_t *>(slab) + kSlabHeaderSize;
+        for (sint32_t i = _objectsPerSlab - 1; i >= 0; --i) {
+            FwPoolNode * node = reinterpret_cast<FwPoolNode *>(slots + kSlotSize * i);
+            node->next = _freeList;
+            _freeList = node;
+        }
+        return true;
+    }
+
+
+    FwPoolNode *    _freeList;
+    FwPoolSlab *    _slabs;
+    sint32_t        _objectsPerSlab;
+    sint32_t        _numSlabs;
+    sint32_t        _numUsed;
+};
+
+
+/**
+ * @class FwSharedPool
+ * @brief 複数スレッドから使えるロックフリーなプール
+ * @note  空きリストの先頭を{更新カウンタ, スロット番号}の64bitで管理してABA問題を避けます
+ *        スロット番号からアドレスを引くためにスラブは固定長のテーブルで管理し、プールを破棄するまで解放しません
+ *        各オブジェクトの直前にスロット番号を置くため、FwPoolよりアライメント1つ分大きくなります
+ *        ロックを取るのはスラブを追加するときだけです
+ * @tparam T   オブジェクトの型
+ * @tparam Tag スラブを確保するタグ
+ */
+template<class T, sint32_t Tag = FwDefaultMemAllocatorTag>
+class FwSharedPool : public NonCopyable<FwSharedPool<T, Tag>> {
+public:
+    /**
+     * @brief オブジェクトを生成
+     */
+    template<class... Args>
+    FW_INLINE T * New(Args... args) {
+        void * p = Alloc();
+        if (p == nullptr) {
+            return nullptr;
+        }
+        return new(p) T(args...);
+    }
+
+    /**
+     * @brief オブジェクトを破棄
+     */
+    FW_INLINE void Delete(T * ptr) {
+        if (ptr != nullptr) {
+            ptr->~T();
+            Free(ptr);
+        }
+    }
+
+    /**
+     * @brief オブジェクト1つ分のメモリを確保
+     */
+    void * Alloc() {
+        uint64_t head = _head.load(std::memory_order_acquire);
+        for (;;) {
+            const uint32_t index = GetIndex(head);
+            if (index == kInvalidIndex) {
+                if (!AddSlab()) {
+                    return nullptr;
+                }
+                head = _head.load(std::memory_order_acquire);
+                continue;
+            }
+
+            // 他のスレッドが先に取り出していた場合はnextが壊れていてもCASが失敗する
+            FwPoolNode * node = GetNode(index);
+            const uint32_t next = node->next.load(std::memory_order_relaxed);
+            if (_head.compare_exchange_weak(head, MakeHead(GetCounter(head) + 1, next), std::memory_order_acquire, std::memory_order_acquire)) {
+                _numUsed.fetch_add(1, std::memory_order_relaxed);
+                return node;
+            }
+        }
+    }
+
+    /**
+     * @brief オブジェクト1つ分のメモリを解放
+     */
+    void Free(void * ptr) {
+        if (ptr == nullptr) {
+            return;
+        }
+        const uint32_t index = *reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(ptr) - kSlotPrefixSize);
+        FwPoolNode * node = new(ptr) FwPoolNode();
+        Push(index, node);
+        _numUsed.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 使用中のオブジェクト数を取得
+     */
+    FW_INLINE sint32_t GetNumUsed() const {return _numUsed.load(std::memory_order_relaxed);}
+
+    /**
+     * @brief 確保済みのスラブ数を取得
+     */
+    FW_INLINE sint32_t GetNumSlabs() const {return _numSlabs.load(std::memory_order_acquire);}
+
+    /**
+     * @brief コンストラクタ
+     * @param[in] objectsPerSlab 1スラブあたりのオブジェクト数
+     */
+    explicit FwSharedPool(const sint32_t objectsPerSlab = FwDefaultPoolObjectsPerSlab)
+    : _head(MakeHead(0, kInvalidIndex))
+    , _objectsPerSlab(objectsPerSlab)
+    , _numSlabs(0)
+    , _numUsed(0)
+    , _slabMtx() {
+        FwAssert(0 < objectsPerSlab);
+        for (sint32_t i = 0; i < FwMaxSharedPoolSlabs; ++i) {
+            _slabs[i] = nullptr;
+        }
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FwSharedPool() {
+        FwAssert(GetNumUsed() == 0);
+
+        const sint32_t numSlabs = _numSlabs.load(std::memory_order_acquire);
+        for (sint32_t i = 0; i < numSlabs; ++i) {
+            FwFree(_slabs[i]);
+            _slabs[i] = nullptr;
+        }
+    }
+
+
+private:
+    static const uint32_t kInvalidIndex = 0xffffffff;
+
+    /**
+     * @struct FwPoolNode
+     * @brief 空きスロットに書き込むリンク情報
+     */
+    struct FwPoolNode {
+        std::atomic<uint32_t>   next;
+    };
+
+    static const size_t kSlotAlignment  = Max(alignof(T), alignof(FwPoolNode));
+    static const size_t kSlotPrefixSize = RoundUp(sizeof(uint32_t), kSlotAlignment);
+    static const size_t kSlotSize       = kSlotPrefixSize + RoundUp(Max(sizeof(T), sizeof(FwPoolNode)), kSlotAlignment);
+
+    static FW_INLINE uint64_t MakeHead(const uint32_t counter, const uint32_t index) {
+        return (static_cast<uint64_t>(counter) << 32) | index;
+    }
+    static FW_INLINE uint32_t GetCounter(const uint64_t head) {
+        return static_cast<uint32_t>(head >> 32);
+    }
+    static FW_INLINE uint32_t GetIndex(const uint64_t head) {
+        return static_cast<uint32_t>(head);
+    }
+
+    /**
+     * @brief スロット番号からノードを取得
+     */
+    FW_INLINE FwPoolNode * GetNode(const uint32_t index) const {
+        const uint32_t slab = index / _objectsPerSlab;
+        const uint32_t slot = index % _objectsPerSlab;
+        return reinterpret_cast<FwPoolNode *>(_slabs[slab] + kSlotSize * slot + kSlotPrefixSize);
+    }
+
+    /**
+     * @brief firstIndex～lastの連結済みリストを空きリストの先頭に積む
+     */
+    void Push(const uint32_t firstIndex, FwPoolNode * last) {
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        for (;;) {
+            last->next.store(GetIndex(head), std::memory_order_relaxed);
+            if (_head.compare_exchange_weak(head, MakeHead(GetCounter(head) + 1, firstIndex), std::memory_order_release, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief スラブを追加して空きリストへつなぐ
+     */
+    bool AddSlab() {
+        std::lock_guard<std::mutex> lock(_slabMtx);
+
+        // 待っている間に他のスレッドが追加していれば何もしない
+        if (GetIndex(_head.load(std::memory_order_acquire)) != kInvalidIndex) {
+            return true;
+        }
+
+        const sint32_t slabIndex = _numSlabs.load(std::memory_order_relaxed);
+        if (FwMaxSharedPoolSlabs <= slabIndex) {
+            FwAssertMessage(false, "shared pool exhausted");
+            return false;
+        }
+
+        const size_t slabSize = kSlotSize * _objectsPerSlab;
+        uint8_t * slab = reinterpret_cast<uint8_t *>(FwMallocAligned(slabSize, Max(kSlotAlignment, FwPoolSlabAlignment), Tag));
+        if (slab == nullptr) {
+            return false;
+        }
+        _slabs[slabIndex] = slab;
+        _numSlabs.store(slabIndex + 1, std::memory_order_release);
+
+        // スラブ内のスロットを連結してからまとめて積む
+        const uint32_t baseIndex = static_cast<uint32_t>(slabIndex * _objectsPerSlab);
+        FwPoolNode * last = nullptr;
+        uint32_t next = kInvalidIndex;
+        for (sint32_t i = _objectsPerSlab - 1; i >= 0; --i) {
+            uint8_t * slot = slab + kSlotSize * i;
+            *reinterpret_cast<uint32_t *>(slot) = baseIndex + i;
+
+            FwPoolNode * node = new(slot + kSlotPrefixSize) FwPoolNode();
+            node->next.store(next, std::memory_order_relaxed);
+            if (last == nullptr) {
+                last = node;
+            }
+            next = baseIndex + i;
+        }
+        Push(baseIndex, last);
+
+        return true;
+    }
+
+
+    std::atomic<uint64_t>   _head;
+    sint32_t                _objectsPerSlab;
+    std::atomic<sint32_t>   _numSlabs;
+    std::atomic<sint32_t>   _numUsed;
+    std::mutex              _slabMtx;
+    uint8_t *               _slabs[FwMaxSharedPoolSlabs];
+};
+
+END_NAMESPACE_FW
+
+#endif  // FW_POOL_H_
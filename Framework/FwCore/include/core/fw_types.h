@@ -50,6 +50,10 @@
     #define FW_ALIGN(__x)           __declspec(align(__x))
 #endif
 
+#if !defined(FW_TLS)
+    #define FW_TLS                  thread_local
+#endif
+
 #define FW_ALIGN4                   FW_ALIGN(4)
 #define FW_ALIGN8                   FW_ALIGN(8)
 #define FW_ALIGN16                  FW_ALIGN(16)
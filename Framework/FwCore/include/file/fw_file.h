@@ -68,6 +68,31 @@ FW_DLL_FUNC sint32_t FwFileRead(FwFile & fp, void * dst, const uint64_t toReadSi
  */
 FW_DLL_FUNC sint32_t FwFileWrite(FwFile & fp, const void * src, const uint64_t toWriteSize, uint64_t * writeSize);
 
+/**
+ * @brief 位置を指定してファイルを読み込む
+ * @note  ファイルの現在位置を使わないので、同じファイルに複数のスレッドから同時に呼べます
+ *        POSIXではpread、Win32ではOVERLAPPEDで位置を指定したReadFileを使います
+ * @attention Win32では現在位置も読み込んだ位置の後ろへ移動します。FwFileReadと混ぜる場合はFwFileSeekで位置を指定し直してください
+ *            libcのバッファを経由しないので、FwFileWriteで書き込んだ内容は先にFwFileFlushBufferしてください
+ * @param[in]  fp           ファイルディスクリプタ
+ * @param[in]  dst          読み込み先バッファ
+ * @param[in]  toReadSize   読み込みサイズ
+ * @param[in]  offset       ファイルの先頭からの位置
+ * @param[out] readSize     読み込まれたサイズを格納する変数へのポインタ
+ */
+FW_DLL_FUNC sint32_t FwFileReadAt(FwFile & fp, void * dst, const uint64_t toReadSize, const uint64_t offset, uint64_t * readSize);
+
+/**
+ * @brief 位置を指定してファイルへ書き込む
+ * @note  FwFileReadAtと同じく、同じファイルに複数のスレッドから同時に呼べます
+ * @param[in]  fp           ファイルディスクリプタ
+ * @param[in]  src          書き込み元バッファ
+ * @param[in]  toWriteSize  書き込みサイズ
+ * @param[in]  offset       ファイルの先頭からの位置
+ * @param[out] writeSize    書き込まれたサイズを格納する変数へのポインタ
+ */
+FW_DLL_FUNC sint32_t FwFileWriteAt(FwFile & fp, const void * src, const uint64_t toWriteSize, const uint64_t offset, uint64_t * writeSize);
+
 /**
  * @brief ファイルのサイズを取得する
  * @param[in]  name     ファイル名
@@ -97,6 +122,13 @@ FW_DLL_FUNC bool FwFileIsExist(const str_t name);
  */
 FW_DLL_FUNC sint32_t FwFileSeek(FwFile & fp, const sint64_t offset, const FwSeekOrigin origin);
 
+/**
+ * @brief ファイルポインタの位置を取得する
+ * @param[in]  fp       ファイルディスクリプタ
+ * @param[out] offset   ファイルの先頭からの位置
+ */
+FW_DLL_FUNC sint32_t FwFileTell(FwFile & fp, uint64_t * offset);
+
 /**
  * @brief キャッシュされたデータをフラッシュする
  * @param[in] fp ファイルディスクリプタ
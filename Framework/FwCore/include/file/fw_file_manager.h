@@ -8,11 +8,78 @@
 #include "threading/fw_thread.h"
 #include "file/fw_file_types.h"
 #include "file/fw_path.h"
+#include "file/fw_file_stream.h"
 #include "misc/fw_noncopyable.h"
 
 BEGIN_NAMESPACE_FW
 
-class FwFileStream;
+using FwFileIOBackend = uint32_t;
+
+static const FwFileIOBackend    FwFileIOBackendAuto         = 0;    ///< 使える中で最も速いもの
+static const FwFileIOBackend    FwFileIOBackendSync         = 1;    ///< 1つのスレッドで順に同期処理する
+static const FwFileIOBackend    FwFileIOBackendThreadPool   = 2;    ///< 複数のスレッドで位置指定の読み書き（pread/pwrite、OVERLAPPED）を並行に処理する
+static const FwFileIOBackend    FwFileIOBackendIoUring      = 3;    ///< io_uringで多数の要求を同時に発行する（Linux）
+
+static const uint32_t   FwMaxFileIOThreads              = 16;
+static const uint32_t   DefaultFwFileIOThreads          = 4;
+static const uint32_t   DefaultFwFileIOQueueDepth       = 128;
+static const uint32_t   DefaultFwFileIORegisteredFiles  = 256;
+static const uint64_t   DefaultFwFileIOMaxMergeSize     = 256 * 1024;
+static const uint64_t   DefaultFwFileIOMaxMergeGap      = 4 * 1024;
+
+//! 完了までの時間を数えるバケット数（16us以下, 32us以下, ... , 約262ms超）
+static const sint32_t   FwFileIOLatencyHistogramBuckets = 16;
+
+/**
+ * @struct FwFileIOStats
+ * @brief ファイルI/Oの統計
+ */
+struct FwFileIOStats {
+    uint64_t    numCommands;        ///< 完了したコマンド数
+    uint64_t    numFailed;          ///< 失敗したコマンド数
+    uint64_t    numIssued;          ///< 実際に発行した読み書きの数（合体すると減る）
+    uint64_t    numMerged;          ///< 他の読み込みと合体したコマンド数
+    uint64_t    bytesRequested;     ///< コマンドが要求したバイト数
+    uint64_t    bytesIssued;        ///< 実際に読み書きしたバイト数（隙間を埋めた分を含む）
+    uint64_t    totalLatency;       ///< 積んでから完了するまでの時間の合計（マイクロ秒）
+    uint64_t    maxLatency;         ///< 積んでから完了するまでの時間の最大値（マイクロ秒）
+    uint64_t    busyTime;           ///< 完了していないコマンドがあった時間（マイクロ秒）
+    uint64_t    elapsedTime;        ///< 統計を取り始めてからの時間（マイクロ秒）
+    uint64_t    latencyHistogram[FwFileIOLatencyHistogramBuckets];  ///< 完了までの時間毎のコマンド数
+
+    /**
+     * @brief 初期化
+     */
+    FW_INLINE void Init() {
+        numCommands = 0;
+        numFailed = 0;
+        numIssued = 0;
+        numMerged = 0;
+        bytesRequested = 0;
+        bytesIssued = 0;
+        totalLatency = 0;
+        maxLatency = 0;
+        busyTime = 0;
+        elapsedTime = 0;
+        for (sint32_t i = 0; i < FwFileIOLatencyHistogramBuckets; ++i) {
+            latencyHistogram[i] = 0;
+        }
+    }
+
+    /**
+     * @brief 平均の完了までの時間（マイクロ秒）
+     */
+    FW_INLINE uint64_t GetAverageLatency() const {
+        return (numCommands != 0) ? totalLatency / numCommands : 0;
+    }
+
+    /**
+     * @brief 処理していた間の帯域（バイト/秒）
+     */
+    FW_INLINE uint64_t GetBandwidth() const {
+        return (busyTime != 0) ? static_cast<uint64_t>(static_cast<double>(bytesRequested) * 1000000.0 / static_cast<double>(busyTime)) : 0;
+    }
+};
 
 
 /**
@@ -21,10 +88,26 @@ class FwFileStream;
 struct FwFileManagerDesc {
     FwThreadAffinity    _threadAffinity;
     FwThreadPriority    _threadPriority;
+    FwFileIOBackend     _ioBackend;             ///< 使えない場合はio_uring、スレッドプール、同期処理の順に代わりを使う
+    uint32_t            _numIOThreads;          ///< スレッドプールのスレッド数
+    uint32_t            _ioQueueDepth;          ///< io_uringで同時に発行する要求数
+    uint32_t            _maxRegisteredFiles;    ///< io_uringに登録して開いておけるファイル数（超えた分は登録せずに読み書きする）
+    void *              _registeredBuffer;      ///< io_uringに固定しておくバッファ（ストリーミング用のプールなど。nullptr可）
+    uint64_t            _registeredBufferSize;
+    uint64_t            _maxMergeSize;          ///< 近い位置の読み込みを合体する最大サイズ（0なら合体しない。io_uringは合体せずにカーネルに任せる）
+    uint64_t            _maxMergeGap;           ///< 合体する読み込みの間の隙間の最大サイズ（余分に読んで捨てる量）
 
     FW_INLINE void Init() {
         _threadAffinity = DefaultFwThreadAffinity;
         _threadPriority = FwThreadPriorityNormal;
+        _ioBackend = FwFileIOBackendAuto;
+        _numIOThreads = DefaultFwFileIOThreads;
+        _ioQueueDepth = DefaultFwFileIOQueueDepth;
+        _maxRegisteredFiles = DefaultFwFileIORegisteredFiles;
+        _registeredBuffer = nullptr;
+        _registeredBufferSize = 0;
+        _maxMergeSize = DefaultFwFileIOMaxMergeSize;
+        _maxMergeGap = DefaultFwFileIOMaxMergeGap;
     }
 };
 
@@ -80,6 +163,39 @@ public:
         return DoGetBasePath();
     }
 
+    /**
+     * @brief 実際に使っているI/Oのバックエンドを取得
+     */
+    FW_INLINE FwFileIOBackend GetIOBackend() const {
+        return DoGetIOBackend();
+    }
+
+    /**
+     * @brief 完了した読み書きを取り出す
+     * @note  FwFileRequestDesc::_postCompletionを指定した読み書きの完了が、完了した順に積まれています
+     *        待たずに返るので、1つのスレッドから多数のストリームの完了をまとめて受け取れます
+     * @param[out] completions    取り出した完了を格納する配列
+     * @param[in]  maxCompletions completionsの要素数
+     * @return 取り出した数
+     */
+    FW_INLINE uint32_t PollCompletions(FwFileCompletion * completions, const uint32_t maxCompletions) {
+        return DoPollCompletions(completions, maxCompletions);
+    }
+
+    /**
+     * @brief I/Oの統計を取得
+     */
+    FW_INLINE void GetIOStats(FwFileIOStats & stats) {
+        DoGetIOStats(stats);
+    }
+
+    /**
+     * @brief I/Oの統計をリセット
+     */
+    FW_INLINE void ResetIOStats() {
+        DoResetIOStats();
+    }
+
 
 protected:
     /**
@@ -102,6 +218,26 @@ protected:
      */
     virtual const str_t DoGetBasePath() = 0;
 
+    /**
+     * @brief 実際に使っているI/Oのバックエンドを取得
+     */
+    virtual FwFileIOBackend DoGetIOBackend() const = 0;
+
+    /**
+     * @brief 完了した読み書きを取り出す
+     */
+    virtual uint32_t DoPollCompletions(FwFileCompletion * completions, const uint32_t maxCompletions) = 0;
+
+    /**
+     * @brief I/Oの統計を取得
+     */
+    virtual void DoGetIOStats(FwFileIOStats & stats) = 0;
+
+    /**
+     * @brief I/Oの統計をリセット
+     */
+    virtual void DoResetIOStats() = 0;
+
 
     /**
      * @brief コンストラクタ
@@ -0,0 +1,127 @@
+﻿/**
+ * @file fw_file_mapping.h
+ * @brief ファイルのメモリマップ
+ */
+#ifndef FW_FILE_MAPPING_H_
+#define FW_FILE_MAPPING_H_
+
+#include "file/fw_file.h"
+#include "misc/fw_noncopyable.h"
+
+
+BEGIN_NAMESPACE_FW
+
+class FwFileMapping;
+
+using FwFileMapMode     = uint32_t;
+using FwFileMapAdvice   = uint32_t;
+
+//------------------------------------------------------------------------------------------------------
+// マップの種類
+static const FwFileMapMode FwFileMapModeReadOnly        = 0;    ///< 読み込み専用（書き込むとアクセス違反）
+static const FwFileMapMode FwFileMapModeCopyOnWrite     = 1;    ///< 書き込めるが、書き込んだページは複製されファイルには反映されない
+//------------------------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------------------------
+// アクセスのヒント
+static const FwFileMapAdvice FwFileMapAdviceNormal      = 0;    ///< 特になし
+static const FwFileMapAdvice FwFileMapAdviceSequential  = 1;    ///< 先頭から順にアクセスする（先読みを増やす）
+static const FwFileMapAdvice FwFileMapAdviceRandom      = 2;    ///< ランダムにアクセスする（先読みしない）
+static const FwFileMapAdvice FwFileMapAdviceWillNeed    = 3;    ///< すぐにアクセスするので読み込んでおく
+static const FwFileMapAdvice FwFileMapAdviceDontNeed    = 4;    ///< しばらくアクセスしないので手放してよい
+//------------------------------------------------------------------------------------------------------
+
+
+/**
+ * @brief ファイルの一部をメモリにマップする
+ * @note  mmap（Win32ではCreateFileMapping/MapViewOfFile）で、読み込み先へのコピー無しにファイルの内容を参照できます
+ *        offsetはページの境界でなくても構いません。マップした後はファイルを閉じても参照できます
+ *        すでにマップしていた場合は解除してからマップし直します
+ * @attention libcのバッファを経由しないので、FwFileWriteで書き込んだ内容は先にFwFileFlushBufferしてください
+ * @param[in]  fp       ファイルディスクリプタ（読み込みアクセスで開いたもの）
+ * @param[in]  offset   ファイルの先頭からの位置
+ * @param[in]  size     マップするサイズ。0ならファイルの末尾まで
+ * @param[in]  mode     マップの種類
+ * @param[out] mapping  マップした領域
+ */
+FW_DLL_FUNC sint32_t FwFileMap(FwFile & fp, const uint64_t offset, const uint64_t size, const FwFileMapMode mode, FwFileMapping & mapping);
+
+/**
+ * @brief ファイル全体をメモリにマップする
+ * @note  ファイルを開いてマップし、すぐに閉じます
+ * @param[in]  name     ファイル名
+ * @param[in]  mode     マップの種類
+ * @param[out] mapping  マップした領域
+ */
+FW_DLL_FUNC sint32_t FwFileMapByName(const str_t name, const FwFileMapMode mode, FwFileMapping & mapping);
+
+/**
+ * @brief マップを解除する
+ * @note  FwFileMappingのデストラクタからも呼ばれます
+ * @param[in] mapping マップした領域
+ */
+FW_DLL_FUNC sint32_t FwFileUnmap(FwFileMapping & mapping);
+
+/**
+ * @brief マップした領域の一部にアクセスのヒントを与える
+ * @note  Linuxではmadvise、Win32ではWillNeedだけPrefetchVirtualMemoryを使います。それ以外のヒントは無視されます
+ * @attention コピーオンライトの領域にDontNeedを指定すると、書き換えた内容は失われます
+ * @param[in] mapping   マップした領域
+ * @param[in] offset    GetDataからの位置
+ * @param[in] size      サイズ。0なら末尾まで
+ * @param[in] advice    アクセスのヒント
+ */
+FW_DLL_FUNC sint32_t FwFileMapAdvise(FwFileMapping & mapping, const uint64_t offset, const uint64_t size, const FwFileMapAdvice advice);
+
+
+/**
+ * @class FwFileMapping
+ * @brief メモリにマップしたファイルの領域
+ * @note  破棄する時にマップを解除します
+ */
+class FwFileMapping : public NonCopyable<FwFileMapping> {
+public:
+    /**
+     * @brief マップした内容の先頭を取得
+     * @note  FwFileMapに渡したoffsetの位置を指します。長さ0の範囲をマップした場合はnullptrです
+     */
+    FW_INLINE void * GetData() const {
+        return data;
+    }
+
+    /**
+     * @brief マップした内容のサイズを取得
+     */
+    FW_INLINE uint64_t GetSize() const {
+        return size;
+    }
+
+    /**
+     * @brief マップしているか
+     */
+    FW_INLINE bool IsMapped() const {
+        return base != nullptr;
+    }
+
+    FwFileMapping()
+    : data(nullptr)
+    , size(0)
+    , base(nullptr)
+    , baseSize(0) {
+    }
+
+    ~FwFileMapping() {
+        FwFileUnmap(*this);
+    }
+
+
+    void *      data;       ///< offsetの位置
+    uint64_t    size;
+    void *      base;       ///< マップした先頭（ページの境界）
+    uint64_t    baseSize;   ///< マップしたサイズ
+};
+
+END_NAMESPACE_FW
+
+#endif  // FW_FILE_MAPPING_H_
@@ -8,10 +8,89 @@
 #include "file/fw_file_types.h"
 #include "file/fw_path.h"
 #include "misc/fw_noncopyable.h"
+#include "threading/task/fw_coroutine.h"
 
 
 BEGIN_NAMESPACE_FW
 
+/**
+ * @brief 送出した処理が完了した時に呼ばれる関数
+ * @note  I/Oスレッドから呼ばれるので、重い処理は他のスレッドへ渡してください
+ * @param[in] context Submitに渡したユーザデータ
+ * @param[in] result  処理の結果（途中で失敗した場合は最初のエラー）
+ */
+using FwFileStreamCallback = void (*)(void * context, sint32_t result);
+
+class FwFileStream;
+
+/**
+ * @brief 読み書き1つ毎に発行される番号
+ */
+using FwFileRequestToken = uint64_t;
+
+static const FwFileRequestToken FwInvalidFileRequestToken = 0;
+
+/**
+ * @struct FwFileCompletion
+ * @brief 読み書き1つの完了
+ */
+struct FwFileCompletion {
+    FwFileRequestToken  token;      ///< 積んだ時に返した番号
+    FwFileStream *      stream;     ///< 積んだストリーム（取り出す前に閉じていた場合は触れないでください）
+    void *              userData;   ///< FwFileRequestDesc::_userData
+    sint32_t            result;     ///< 処理の結果
+};
+
+/**
+ * @brief 読み書き1つが完了した時に呼ばれる関数
+ * @note  I/Oスレッドから呼ばれるので、重い処理は他のスレッドへ渡してください
+ */
+using FwFileRequestCallback = void (*)(const FwFileCompletion & completion);
+
+/**
+ * @struct FwFileRequestDesc
+ * @brief 読み書き1つ毎の完了の受け取り方
+ */
+struct FwFileRequestDesc {
+    FwFileRequestCallback   _callback;          ///< 完了した時に呼ばれる関数（nullptr可）
+    void *                  _userData;          ///< FwFileCompletion::userDataに渡すユーザデータ
+    bool                    _postCompletion;    ///< 完了をFwFileManager::PollCompletionsで受け取るか
+
+    FW_INLINE void Init() {
+        _callback = nullptr;
+        _userData = nullptr;
+        _postCompletion = false;
+    }
+};
+
+#if FW_ENABLE_COROUTINE
+
+/**
+ * @struct FwFileStreamAwaiter
+ * @brief 積んだ処理を送出して完了を待つ
+ * @note  co_awaitの結果は処理の結果です
+ */
+struct FwFileStreamAwaiter {
+    FwFileStream *              stream;
+    sint32_t                    result;
+    FwTaskFactory *             factory;
+    std::coroutine_handle<>     handle;
+
+    bool await_ready() const noexcept { return result != FW_OK; }
+
+    template<class _Promise>
+    void await_suspend(std::coroutine_handle<_Promise> awaiting) noexcept;
+
+    sint32_t await_resume() const noexcept { return result; }
+
+    static void OnCompleted(void * context, sint32_t result) {
+        FwFileStreamAwaiter * self = reinterpret_cast<FwFileStreamAwaiter *>(context);
+        self->result = result;
+        FwResumeCoroutine(self->handle, self->factory);
+    }
+};
+#endif
+
 /**
 * @class FileStream
 */
@@ -28,14 +107,70 @@ public:
      * @brief ファイルを読み込む
      */
     FW_INLINE sint32_t Read(void * dst, const sint64_t dstSize, const sint64_t readSize) {
-        return DoRead(dst, dstSize, readSize);
+        return DoRead(dst, dstSize, readSize, nullptr, nullptr);
+    }
+
+    /**
+     * @brief ファイルを読み込み、完了を個別に受け取る
+     * @note  Waitやストリーム単位のコールバックとは別に、この読み込みだけの完了をdescの方法で通知します
+     * @param[in]  desc  完了の受け取り方
+     * @param[out] token 発行した番号（nullptr可）
+     */
+    FW_INLINE sint32_t Read(void * dst, const sint64_t dstSize, const sint64_t readSize, const FwFileRequestDesc & desc, FwFileRequestToken * token = nullptr) {
+        return DoRead(dst, dstSize, readSize, &desc, token);
     }
 
     /**
      * @brief ファイルへ書き込む
      */
     FW_INLINE sint32_t Write(const void * src, const sint64_t srcSize, const sint64_t writeSize) {
-        return DoWrite(src, srcSize, writeSize);
+        return DoWrite(src, srcSize, writeSize, nullptr, nullptr);
+    }
+
+    /**
+     * @brief ファイルへ書き込み、完了を個別に受け取る
+     * @param[in]  desc  完了の受け取り方
+     * @param[out] token 発行した番号（nullptr可）
+     */
+    FW_INLINE sint32_t Write(const void * src, const sint64_t srcSize, const sint64_t writeSize, const FwFileRequestDesc & desc, FwFileRequestToken * token = nullptr) {
+        return DoWrite(src, srcSize, writeSize, &desc, token);
+    }
+
+    /**
+     * @brief 位置を指定してファイルを読み込む
+     * @note  Seekした位置を使わず、変えもしません。位置を指定した読み書きは1つのファイルでも並行に処理されるので、
+     *        大きなアーカイブの別々の場所を一度に読み込めます
+     * @param[in] offset ファイルの先頭からの位置
+     */
+    FW_INLINE sint32_t ReadAt(void * dst, const sint64_t dstSize, const sint64_t readSize, const uint64_t offset) {
+        return DoReadAt(dst, dstSize, readSize, offset, nullptr, nullptr);
+    }
+
+    /**
+     * @brief 位置を指定してファイルを読み込み、完了を個別に受け取る
+     * @param[in]  desc  完了の受け取り方
+     * @param[out] token 発行した番号（nullptr可）
+     */
+    FW_INLINE sint32_t ReadAt(void * dst, const sint64_t dstSize, const sint64_t readSize, const uint64_t offset, const FwFileRequestDesc & desc, FwFileRequestToken * token = nullptr) {
+        return DoReadAt(dst, dstSize, readSize, offset, &desc, token);
+    }
+
+    /**
+     * @brief 位置を指定してファイルへ書き込む
+     * @note  ReadAtと同じく、Seekした位置を使わず、変えもしません
+     * @param[in] offset ファイルの先頭からの位置
+     */
+    FW_INLINE sint32_t WriteAt(const void * src, const sint64_t srcSize, const sint64_t writeSize, const uint64_t offset) {
+        return DoWriteAt(src, srcSize, writeSize, offset, nullptr, nullptr);
+    }
+
+    /**
+     * @brief 位置を指定してファイルへ書き込み、完了を個別に受け取る
+     * @param[in]  desc  完了の受け取り方
+     * @param[out] token 発行した番号（nullptr可）
+     */
+    FW_INLINE sint32_t WriteAt(const void * src, const sint64_t srcSize, const sint64_t writeSize, const uint64_t offset, const FwFileRequestDesc & desc, FwFileRequestToken * token = nullptr) {
+        return DoWriteAt(src, srcSize, writeSize, offset, &desc, token);
     }
 
     /**
@@ -54,13 +189,64 @@ public:
 
     /**
      * @brief 処理を送出する
+     * @note  前に送出した処理の完了を待たずに、続けて送出できます
      */
     FW_INLINE void Submit() {
-        DoSubmit();
+        DoSubmit(nullptr, nullptr);
     }
 
     /**
-     * @brief 実行中の処理が完了するまで待つ
+     * @brief 処理を送出して完了時に関数を呼ぶ
+     * @param[in] callback 完了した時に呼ばれる関数
+     * @param[in] context  callbackに渡すユーザデータ
+     */
+    FW_INLINE void Submit(FwFileStreamCallback callback, void * context) {
+        DoSubmit(callback, context);
+    }
+
+#if FW_ENABLE_COROUTINE
+    /**
+     * @brief 読み込みを送出して完了を待つ
+     * @note  co_await stream->ReadAsync(...) で待てます。完了後は待ったコルーチンのファクトリのワーカーで再開します
+     *        それまでに積んだ処理も一緒に送出します
+     */
+    FW_INLINE FwFileStreamAwaiter ReadAsync(void * dst, const sint64_t dstSize, const sint64_t readSize) {
+        return FwFileStreamAwaiter { this, Read(dst, dstSize, readSize), nullptr, nullptr };
+    }
+
+    /**
+     * @brief 書き込みを送出して完了を待つ
+     * @note  co_await stream->WriteAsync(...) で待てます
+     */
+    FW_INLINE FwFileStreamAwaiter WriteAsync(const void * src, const sint64_t srcSize, const sint64_t writeSize) {
+        return FwFileStreamAwaiter { this, Write(src, srcSize, writeSize), nullptr, nullptr };
+    }
+
+    /**
+     * @brief 位置を指定した読み込みを送出して完了を待つ
+     */
+    FW_INLINE FwFileStreamAwaiter ReadAtAsync(void * dst, const sint64_t dstSize, const sint64_t readSize, const uint64_t offset) {
+        return FwFileStreamAwaiter { this, ReadAt(dst, dstSize, readSize, offset), nullptr, nullptr };
+    }
+
+    /**
+     * @brief 位置を指定した書き込みを送出して完了を待つ
+     */
+    FW_INLINE FwFileStreamAwaiter WriteAtAsync(const void * src, const sint64_t srcSize, const sint64_t writeSize, const uint64_t offset) {
+        return FwFileStreamAwaiter { this, WriteAt(src, srcSize, writeSize, offset), nullptr, nullptr };
+    }
+
+    /**
+     * @brief 積んだ処理を送出して完了を待つ
+     * @note  co_await stream->SubmitAsync() で待てます
+     */
+    FW_INLINE FwFileStreamAwaiter SubmitAsync() {
+        return FwFileStreamAwaiter { this, FW_OK, nullptr, nullptr };
+    }
+#endif
+
+    /**
+     * @brief 送出した全ての処理が完了するまで待つ
      */
     FW_INLINE sint32_t Wait(const uint32_t milliseconds = FW_WAIT_INFINITE) {
         return DoWait(milliseconds);
@@ -83,12 +269,22 @@ protected:
     /**
      * @brief ファイルを読み込む
      */
-    virtual sint32_t DoRead(void * dst, const sint64_t dstSize, const sint64_t readSize) = 0;
+    virtual sint32_t DoRead(void * dst, const sint64_t dstSize, const sint64_t readSize, const FwFileRequestDesc * desc, FwFileRequestToken * token) = 0;
 
     /**
      * @brief ファイルへ書き込む
      */
-    virtual sint32_t DoWrite(const void * src, const sint64_t srcSize, const sint64_t writeSize) = 0;
+    virtual sint32_t DoWrite(const void * src, const sint64_t srcSize, const sint64_t writeSize, const FwFileRequestDesc * desc, FwFileRequestToken * token) = 0;
+
+    /**
+     * @brief 位置を指定してファイルを読み込む
+     */
+    virtual sint32_t DoReadAt(void * dst, const sint64_t dstSize, const sint64_t readSize, const uint64_t offset, const FwFileRequestDesc * desc, FwFileRequestToken * token) = 0;
+
+    /**
+     * @brief 位置を指定してファイルへ書き込む
+     */
+    virtual sint32_t DoWriteAt(const void * src, const sint64_t srcSize, const sint64_t writeSize, const uint64_t offset, const FwFileRequestDesc * desc, FwFileRequestToken * token) = 0;
 
     /**
      * @brief ファイルの長さを取得
@@ -103,7 +299,7 @@ protected:
     /** 
      * @brief 処理を送出する
      */
-    virtual void DoSubmit() = 0;
+    virtual void DoSubmit(FwFileStreamCallback callback, void * context) = 0;
 
     /**
      * @brief 実行中のジョブが完了するまで待つ
@@ -128,6 +324,17 @@ protected:
     char_t  fileName[FwPath::kMaxFNameLen];
 };
 
+#if FW_ENABLE_COROUTINE
+template<class _Promise>
+void FwFileStreamAwaiter::await_suspend(std::coroutine_handle<_Promise> awaiting) noexcept {
+    handle = awaiting;
+    factory = FwGetCoroutineFactory(awaiting);
+
+    // 完了はI/Oスレッドから通知される
+    stream->Submit(&FwFileStreamAwaiter::OnCompleted, this);
+}
+#endif
+
 END_NAMESPACE_FW
 
 #endif  // FW_FILE_STREAM_H_
@@ -8,8 +8,14 @@
 #include "core/fw_types.h"
 #include "core/fw_error.h"
 #include "core/fw_allocator.h"
+#include "core/fw_mspace_allocator.h"
+#include "core/fw_frame_allocator.h"
+#include "core/fw_large_block_allocator.h"
+#include "core/fw_numa_allocator.h"
+#include "core/fw_mem_stats.h"
 
 #include "threading/fw_thread.h"
+#include "threading/fw_fiber.h"
 
 #include "debug/fw_debug_log.h"
 #include "debug/fw_debug_log_listener.h"
@@ -17,14 +23,26 @@
 
 #include "misc/fw_noncopyable.h"
 
+#include "core/fw_pool.h"
+
 #include "container/fw_container_allocator.h"
 #include "container/fw_array.h"
 #include "container/fw_deque.h"
+#include "container/fw_mpmc_queue.h"
+#include "container/fw_mpsc_queue.h"
+#include "container/fw_spsc_queue.h"
 #include "container/fw_string.h"
 #include "container/fw_vector.h"
 
+#include "threading/fw_thread_context.h"
+#include "threading/task/fw_task.h"
+#include "threading/task/fw_parallel.h"
+#include "threading/task/fw_task_graph.h"
+#include "threading/task/fw_coroutine.h"
+
 #include "file/fw_file_types.h"
 #include "file/fw_file.h"
+#include "file/fw_file_mapping.h"
 #include "file/fw_file_stream.h"
 #include "file/fw_file_manager.h"
 
@@ -0,0 +1,100 @@
+﻿/**
+ * @file fw_fiber.h
+ */
+#ifndef FW_FIBER_H_
+#define FW_FIBER_H_
+
+#include "misc/fw_noncopyable.h"
+
+
+BEGIN_NAMESPACE_FW
+
+/**
+ * @brief ファイバーのエントリポイント
+ * @attention 戻ってはいけません。最後は他のファイバーへ切り替えてください
+ */
+using FwFiberFunc = void (*)(void * userArgs);
+
+static const size_t DefaultFwFiberStackSize = 64 * 1024;
+
+/**
+ * @class FwFiber
+ * @brief 協調的に切り替える実行コンテキスト
+ * @note  Win32はOSのファイバー、Linux(x64)は呼び出し先保存レジスタだけを退避する切り替え、それ以外はucontextを使います
+ *        スタックの末尾にはガードページを置くので、溢れた場合は即座に落ちます
+ *        切り替えはスレッドをまたげません。作成したスレッドと同じスレッドのファイバー間で切り替えてください
+ */
+class FwFiber : public NonCopyable<FwFiber> {
+public:
+    /**
+     * @brief 自前のスタックを持つファイバーを作成
+     * @param[in] func      エントリポイント
+     * @param[in] userArgs  funcに渡すユーザ引数
+     * @param[in] stackSize スタックサイズ（ページサイズへ切り上げる）
+     * @return 失敗時はfalse
+     */
+    bool Create(FwFiberFunc func, void * userArgs, const size_t stackSize = DefaultFwFiberStackSize);
+
+    /**
+     * @brief 現在のスレッドをファイバーとして扱う
+     * @note  他のファイバーから戻ってくる先になります。スレッドを抜ける前にDestroyしてください
+     * @return 失敗時はfalse
+     */
+    bool ConvertFromThread();
+
+    /**
+     * @brief 破棄
+     * @attention 実行中のファイバーは破棄できません
+     */
+    void Destroy();
+
+    /**
+     * @brief 実行中のこのファイバーを中断してnextへ切り替える
+     * @note  他のファイバーからこのファイバーへ切り替えられると戻ります
+     */
+    void SwitchTo(FwFiber * next);
+
+    /**
+     * @brief 作成済みかどうか
+     */
+    FW_INLINE bool IsValid() const { return context != nullptr || threadFiber; }
+
+    /**
+     * @brief スレッドから変換したファイバーかどうか
+     */
+    FW_INLINE bool IsThreadFiber() const { return threadFiber; }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwFiber();
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FwFiber();
+
+
+private:
+    /**
+     * @brief 全てのファイバーが最初に実行する関数
+     */
+    static void Entry(FwFiber * fiber);
+
+#if defined(FW_PLATFORM_WIN32)
+    static void __stdcall NativeEntry(void * userArgs);
+#elif !(defined(FW_PLATFORM_LINUX) && defined(FW_ARCH_X64))
+    static void NativeEntry(uint32_t high, uint32_t low);
+#endif
+
+    void *          context;    ///< Win32はファイバーのハンドル、x64は中断したスタックポインタ、それ以外はucontext_t
+    void *          stack;
+    size_t          stackSize;
+    FwFiberFunc     func;
+    void *          userArgs;
+    bool            threadFiber;
+};
+
+END_NAMESPACE_FW
+
+#endif  // FW_FIBER_H_
@@ -40,6 +40,11 @@ static const size_t             FwMaxThreadNameLen          = 255;
 static const uint32_t           DefaultFwThreadFlags        = 0;
 static const uint32_t           DefaultFwThreadStackSize    = 128 * 1024;
 static const FwThreadAffinity   DefaultFwThreadAffinity     = static_cast<FwThreadAffinity>(0xffffffffffffffff);
+static const sint32_t           DefaultFwThreadNumaNode     = FwNumaNodeAny;
+
+static const uint32_t           FwThreadFlagSpinWait        = 0x00000001;   ///< ワーカーの待機でまずpause命令を挟みながらスピンする
+static const uint32_t           FwThreadFlagYieldWait       = 0x00000002;   ///< ワーカーの待機で眠る前にタイムスライスを譲りながら待つ
+static const uint32_t           FwThreadFlagAdaptiveWait    = FwThreadFlagSpinWait | FwThreadFlagYieldWait;  ///< スピン、譲る、眠るの順に待つ
 
 static const FwThreadPriority   FwThreadPriorityMin         = 256;
 static const FwThreadPriority   FwThreadPriorityMax         = 1024;
@@ -49,6 +54,33 @@ static const FwThreadPriority   FwThreadPriorityNormal      = (FwThreadPriorityM
 static const FwThreadPriority   FwThreadPriorityAboveNormal = (FwThreadPriorityMax - FwThreadPriorityMin) * 4 / 6 + FwThreadPriorityMin;    ///< 基準より一段高い優先度
 static const FwThreadPriority   FwThreadPriorityHighest     = (FwThreadPriorityMax - FwThreadPriorityMin) * 5 / 6 + FwThreadPriorityMin;    ///< 最高の優先度
 
+static const uint32_t           FwMaxCpus                   = 64;   ///< FwThreadAffinityで表せる論理CPU数
+
+
+/**
+ * @struct FwCpuTopology
+ * @note  FwThreadAffinityで表せる先頭FwMaxCpus個の論理CPUだけを扱います
+ */
+struct FwCpuTopology {
+    uint32_t            numLogicalCpus;             ///< 論理CPU数
+    uint32_t            numCores;                   ///< 物理コア数
+    uint32_t            numL3Domains;               ///< L3キャッシュを共有する論理CPUのまとまりの数
+    FwThreadAffinity    coreMasks[FwMaxCpus];       ///< コア毎の論理CPU（SMTの兄弟）
+    FwThreadAffinity    l3DomainMasks[FwMaxCpus];   ///< L3ドメイン毎の論理CPU
+    sint32_t            cpuCores[FwMaxCpus];        ///< 論理CPU毎のコア番号（無効なCPUは-1）
+    sint32_t            cpuL3Domains[FwMaxCpus];    ///< 論理CPU毎のL3ドメイン番号（無効なCPUは-1）
+};
+
+/**
+ * @brief CPUのトポロジーを取得
+ * @note  OSから取得できなければ論理CPU毎に1コアとして返します
+ *        L3キャッシュの情報が無いCPUは、コア毎に別のL3ドメインとして返します
+ * @param[out] topology 取得したトポロジー
+ * @retval FW_OK             成功
+ * @retval ERR_INVALID_PARMS topologyがnullptr
+ */
+FW_DLL_FUNC sint32_t FwGetCpuTopology(FwCpuTopology * topology);
+
 
 /**
  * @struct ThreadDesc
@@ -60,6 +92,8 @@ public:
     uint32_t            stackSize;
     FwThreadPriority    priority;
     FwThreadAffinity    affinity;
+    sint32_t            numaNode;
+    size_t              scratchSize;    ///< FwThreadContextのスクラッチ領域のサイズ（0ならDefaultFwThreadScratchSize）
     char_t              name[FwMaxThreadNameLen + 1];
 
     /**
@@ -71,6 +105,8 @@ public:
         stackSize   = DefaultFwThreadStackSize;
         priority    = FwThreadPriorityNormal;
         affinity    = DefaultFwThreadAffinity;
+        numaNode    = DefaultFwThreadNumaNode;
+        scratchSize = 0;
         name[0]     = _T('\0');
     }
 };
@@ -107,6 +143,8 @@ public:
 
     /**
      * @brief スレッドを開始する
+     * @note  Linuxではアフィニティ、優先度、名前はスレッド自身が開始直後に設定します
+     *        優先度はFwThreadPriorityMinでSCHED_IDLE、FwThreadPriorityMaxでSCHED_FIFO、それ以外はnice値に対応します
      * @param[in] ThreadDesc スレッド詳細
      */
     void Start(const FwThreadDesc * desc);
@@ -124,6 +162,8 @@ public:
     
     /**
      * @brief ワーカースレッドを起こして再実行する
+     * @note  ワーカーが眠っている時だけOSの待機を解除します
+     *        FwThreadFlagSpinWaitやFwThreadFlagYieldWaitを指定したワーカーは、すぐに起こされれば眠らずに再実行します
      */
     void RestartThread();
     
@@ -0,0 +1,197 @@
+﻿/**
+ * @file fw_thread_context.h
+ * @brief スレッド毎のコンテキスト
+ */
+#ifndef FW_THREAD_CONTEXT_H_
+#define FW_THREAD_CONTEXT_H_
+
+#include "misc/fw_noncopyable.h"
+
+BEGIN_NAMESPACE_FW
+
+class FwThread;
+class FwTaskFactory;
+
+using FwThreadContextSlot       = sint32_t;
+using FwThreadContextDestructor = void (*)(void * value);
+
+static const sint32_t               FwMaxThreadContextSlots         = 32;
+static const FwThreadContextSlot    FwInvalidThreadContextSlot      = -1;
+static const size_t                 DefaultFwThreadScratchSize      = 64 * 1024;
+static const size_t                 DefaultFwThreadScratchAlignment = 16;
+
+/**
+ * @class FwThreadContext
+ * @brief スレッド毎に1つずつ用意されるコンテキスト
+ * @note  GetCurrentはthread_local変数を返すだけなので、ロックも検索もなく参照できます
+ *        FwThread以外で作られたスレッドにも用意されます。その場合GetThreadはnullptrです
+ *        スロットを確保すると、スレッド毎の値を持たせてスレッドの終了時に破棄できます
+ * @attention 他のスレッドのコンテキストに触れてはいけません
+ */
+class FW_DLL FwThreadContext : public NonCopyable<FwThreadContext> {
+public:
+    /**
+     * @brief 現在のスレッドのコンテキストを取得
+     */
+    static FwThreadContext * GetCurrent();
+
+    /**
+     * @brief 実行中のFwThreadを取得
+     * @return FwThread以外で作られたスレッドではnullptr
+     */
+    FW_INLINE FwThread * GetThread() const { return thread; }
+
+    /**
+     * @brief 所属しているタスクファクトリを取得
+     * @return ワーカーでなければnullptr
+     */
+    FW_INLINE FwTaskFactory * GetTaskFactory() const { return taskFactory; }
+
+    /**
+     * @brief タスクファクトリのワーカー番号を取得
+     * @return ワーカーでなければ-1
+     */
+    FW_INLINE sint32_t GetWorkerIndex() const { return workerIndex; }
+
+    /**
+     * @brief タスクファクトリのワーカーとして登録する
+     * @note  タスクファクトリが内部で使用します。解除する時はfactoryにnullptr、indexに-1を指定してください
+     */
+    FW_INLINE void SetTaskWorker(FwTaskFactory * factory, const sint32_t index) {
+        taskFactory = factory;
+        workerIndex = index;
+    }
+
+    /**
+     * @brief スレッド毎の乱数（xorshift32）
+     */
+    FW_INLINE uint32_t NextRandom() {
+        uint32_t x = randomState;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        randomState = x;
+        return x;
+    }
+
+    /**
+     * @brief スクラッチ領域から確保
+     * @note  確保したメモリはResetScratchで戻すまで有効です。個別には解放できません
+     *        領域は最初に使う時に確保します。大きさはFwThreadDesc::scratchSize（0ならDefaultFwThreadScratchSize）です
+     * @param[in] size      サイズ
+     * @param[in] alignment アライメント（2の累乗）
+     * @return 足りなければnullptr
+     */
+    void * AllocScratch(const size_t size, const size_t alignment = DefaultFwThreadScratchAlignment);
+
+    /**
+     * @brief スクラッチ領域の使用位置を取得
+     */
+    FW_INLINE size_t GetScratchMark() const { return scratchUsed; }
+
+    /**
+     * @brief スクラッチ領域をmarkの位置まで戻す
+     */
+    FW_INLINE void ResetScratch(const size_t mark = 0) {
+        FwAssert(mark <= scratchUsed);
+        scratchUsed = mark;
+    }
+
+    /**
+     * @brief スロットの値を取得
+     */
+    FW_INLINE void * GetSlot(const FwThreadContextSlot slot) const {
+        FwAssert(0 <= slot && slot < FwMaxThreadContextSlots);
+        return slots[slot];
+    }
+
+    /**
+     * @brief スロットに値を設定
+     * @note  スロットのデストラクタはスレッドの終了時に設定されている値に対して呼ばれます
+     */
+    FW_INLINE void SetSlot(const FwThreadContextSlot slot, void * value) {
+        FwAssert(0 <= slot && slot < FwMaxThreadContextSlots);
+        slots[slot] = value;
+    }
+
+    /**
+     * @brief FwThreadとして開始する
+     * @note  FwThreadがスレッドの開始時に呼びます
+     */
+    void Attach(FwThread * thread, const size_t scratchSize);
+
+    /**
+     * @brief 終了処理
+     * @note  スロットの値を破棄し、スクラッチ領域を解放します
+     *        FwThreadは終了時に、それ以外のスレッドはthread_local変数の破棄時に呼ばれます
+     */
+    void Term();
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwThreadContext();
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FwThreadContext();
+
+
+private:
+    FwThread *          thread;
+    FwTaskFactory *     taskFactory;
+    sint32_t            workerIndex;
+    uint32_t            randomState;
+
+    uint8_t *           scratch;
+    size_t              scratchSize;
+    size_t              scratchUsed;
+
+    void *              slots[FwMaxThreadContextSlots];
+};
+
+/**
+ * @class FwThreadScratchScope
+ * @brief スコープを抜ける時にスクラッチ領域を元の位置へ戻す
+ */
+class FwThreadScratchScope : public NonCopyable<FwThreadScratchScope> {
+public:
+    FwThreadScratchScope()
+    : context(FwThreadContext::GetCurrent())
+    , mark(context->GetScratchMark()) {
+    }
+
+    ~FwThreadScratchScope() {
+        context->ResetScratch(mark);
+    }
+
+    /**
+     * @brief スクラッチ領域から確保
+     */
+    FW_INLINE void * Alloc(const size_t size, const size_t alignment = DefaultFwThreadScratchAlignment) {
+        return context->AllocScratch(size, alignment);
+    }
+
+
+private:
+    FwThreadContext *   context;
+    size_t              mark;
+};
+
+/**
+ * @brief スレッド毎の値を持つスロットを確保
+ * @param[in] destructor スレッドの終了時に値を破棄する関数（不要ならnullptr）
+ * @return 空きが無ければFwInvalidThreadContextSlot
+ */
+FW_DLL_FUNC FwThreadContextSlot FwAllocThreadContextSlot(FwThreadContextDestructor destructor);
+
+/**
+ * @brief スロットを解放
+ * @attention 各スレッドに残っている値は破棄されません。先に各スレッドで片付けてください
+ */
+FW_DLL_FUNC void FwFreeThreadContextSlot(const FwThreadContextSlot slot);
+
+END_NAMESPACE_FW
+
+#endif  // FW_THREAD_CONTEXT_H_
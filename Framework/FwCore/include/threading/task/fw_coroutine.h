@@ -0,0 +1,228 @@
+﻿/**
+ * @file fw_coroutine.h
+ * @brief C++20のコルーチンでタスクとファイル処理を待つための型
+ * @note  FW_BUILD_CONFIG_ENABLE_COROUTINEが有効で、コンパイラがコルーチンに対応している場合だけ使えます
+ */
+#ifndef FW_COROUTINE_H_
+#define FW_COROUTINE_H_
+
+#include "threading/task/fw_task.h"
+
+#if FW_BUILD_CONFIG_ENABLE_COROUTINE && defined(__cpp_impl_coroutine)
+#define FW_ENABLE_COROUTINE     (1)
+#else
+#define FW_ENABLE_COROUTINE     (0)
+#endif
+
+#if FW_ENABLE_COROUTINE
+#include <coroutine>
+
+
+BEGIN_NAMESPACE_FW
+
+/**
+ * @brief 中断したコルーチンを再開する
+ * @note  factoryがあればワーカーで再開し、無いか積めなければ呼び出したスレッドでそのまま再開します
+ */
+FW_INLINE void FwResumeCoroutine(std::coroutine_handle<> handle, FwTaskFactory * factory) {
+    if (factory == nullptr || !factory->Post([handle](FwTaskArgType) { handle.resume(); })) {
+        handle.resume();
+    }
+}
+
+/**
+ * @brief コルーチンを再開するファクトリを取得
+ * @note  FwCoroutine以外のコルーチンから待った場合はnullptr
+ */
+template<class _Promise>
+FW_INLINE FwTaskFactory * FwGetCoroutineFactory(std::coroutine_handle<_Promise> handle) {
+    if constexpr (requires { handle.promise().factory; }) {
+        return handle.promise().factory;
+    } else {
+        return nullptr;
+    }
+}
+
+/**
+ * @class FwCoroutine
+ * @brief ジョブシステム上で実行するコルーチン
+ * @note  作成しただけでは実行されません。Startでワーカーへ積むか、他のFwCoroutineからco_awaitしてください
+ *        co_awaitで中断したコルーチンは、待っていた処理が完了するとfactoryのワーカーで再開します
+ *        co_awaitした場合は待った側と同じファクトリで実行し、終わると待った側をそのまま再開します
+ */
+class FwCoroutine : public NonCopyable<FwCoroutine> {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    /**
+     * @struct FinalAwaiter
+     * @brief 終了時に待っていたコルーチンへ切り替える
+     */
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(Handle handle) noexcept {
+            // 中断してからでないと破棄されても困らない状態にならないので、完了はここで公開する
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            handle.promise().done.store(true, std::memory_order_release);
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    /**
+     * @struct Awaiter
+     * @brief 他のコルーチンから終了を待つ
+     */
+    struct Awaiter {
+        Handle  handle;
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+
+        template<class _Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<_Promise> awaiting) noexcept {
+            // 待った側と同じファクトリで、待った側のスレッドからそのまま開始する
+            handle.promise().factory = FwGetCoroutineFactory(awaiting);
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    /**
+     * @struct promise_type
+     */
+    struct promise_type {
+        FwTaskFactory *             factory = nullptr;  ///< 再開するファクトリ
+        std::coroutine_handle<>     continuation;       ///< 終了時に再開するコルーチン
+        std::atomic<bool>           done { false };
+
+        FwCoroutine get_return_object() noexcept { return FwCoroutine(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept {
+            FwAssertMessage(false, "unhandled exception in coroutine");
+            std::terminate();
+        }
+    };
+
+    /**
+     * @brief ワーカーで実行を開始
+     * @param[in] factory 実行するファクトリ。nullptrなら呼び出したスレッドでそのまま実行する
+     */
+    void Start(FwTaskFactory * factory) {
+        FwAssert(handle && !started);
+        started = true;
+        handle.promise().factory = factory;
+        FwResumeCoroutine(handle, factory);
+    }
+
+    /**
+     * @brief 終了したかどうか
+     */
+    FW_INLINE bool IsDone() const {
+        return !handle || handle.promise().done.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 終了するまで待つ
+     * @note  待っている間は実行待ちのタスクを代わりに実行します
+     */
+    void Wait() {
+        FwAssert(started);
+        FwTaskFactory * factory = handle ? handle.promise().factory : nullptr;
+        while (!IsDone()) {
+            if (factory == nullptr || !factory->RunPendingTask()) {
+                FwThread::YieldThread();
+            }
+        }
+    }
+
+    /**
+     * @brief 他のコルーチンから終了を待つ
+     */
+    Awaiter operator co_await() && noexcept {
+        FwAssert(!started);
+        started = true;
+        return Awaiter { handle };
+    }
+
+    /**
+     * @name コンストラクタ
+     */
+    //! @{
+    FwCoroutine(FwCoroutine && value) noexcept
+    : handle(value.handle)
+    , started(value.started) {
+        value.handle = nullptr;
+    }
+    //! @}
+
+    /**
+     * @brief デストラクタ
+     * @attention 開始したコルーチンは終了してから破棄してください
+     */
+    ~FwCoroutine() {
+        if (handle) {
+            FwAssertMessage(!started || IsDone(), "coroutine destroyed while running");
+            handle.destroy();
+        }
+    }
+
+
+private:
+    explicit FwCoroutine(Handle _handle) noexcept
+    : handle(_handle)
+    , started(false) {
+    }
+
+    Handle  handle;
+    bool    started;
+};
+
+/**
+ * @struct FwTaskGroupAwaiter
+ * @brief 送出したタスクグループの完了を待つ
+ */
+struct FwTaskGroupAwaiter {
+    FwTaskGroup *               group;
+    FwTaskFactory *             factory;
+    std::coroutine_handle<>     handle;
+
+    bool await_ready() const noexcept { return group->IsCompleted(); }
+
+    template<class _Promise>
+    bool await_suspend(std::coroutine_handle<_Promise> awaiting) noexcept {
+        handle = awaiting;
+        factory = FwGetCoroutineFactory(awaiting);
+
+        // 既に完了していれば中断せずに続ける
+        return group->RegisterContinuation(&FwTaskGroupAwaiter::OnCompleted, this);
+    }
+
+    void await_resume() const noexcept {}
+
+    static void OnCompleted(void * context) {
+        FwTaskGroupAwaiter * self = reinterpret_cast<FwTaskGroupAwaiter *>(context);
+        FwResumeCoroutine(self->handle, self->factory);
+    }
+};
+
+/**
+ * @brief 送出したタスクグループの完了を待つ
+ * @note  co_await *group で待てます。完了後は待ったコルーチンのファクトリのワーカーで再開します
+ */
+FW_INLINE FwTaskGroupAwaiter operator co_await(FwTaskGroup & group) noexcept {
+    return FwTaskGroupAwaiter { &group, nullptr, nullptr };
+}
+
+END_NAMESPACE_FW
+
+#endif  // FW_ENABLE_COROUTINE
+
+#endif  // FW_COROUTINE_H_
@@ -0,0 +1,205 @@
+﻿/**
+ * @file fw_parallel.h
+ */
+#ifndef FW_PARALLEL_H_
+#define FW_PARALLEL_H_
+
+#include "threading/task/fw_task.h"
+
+BEGIN_NAMESPACE_FW
+
+using FwParallelReduceOrder = uint32_t;
+
+static const FwParallelReduceOrder FwParallelReduceOrderAny             = 0;    ///< 実行したスレッド毎に集計する（結合順は実行順に依存）
+static const FwParallelReduceOrder FwParallelReduceOrderDeterministic   = 1;    ///< 分割単位毎に集計して先頭から順に結合する
+
+static const uint32_t FwParallelChunksPerWorker         = 8;    ///< grainを自動で決める時の参加者1人あたりのチャンク数
+static const uint32_t FwParallelDeterministicNumChunks  = 256;  ///< 決定的な集計でgrainを自動で決める時のチャンク数（参加者数に依存させない）
+
+/**
+ * @brief 分割単位（チャンク）毎に呼ばれる関数
+ * @param[in] context   FwParallelForChunksに渡したユーザデータ
+ * @param[in] worker    実行している参加者の番号（0 〜 FwGetParallelWorkerCount()-1）
+ * @param[in] chunk     チャンク番号
+ */
+using FwParallelChunkFunc = void (*)(void * context, uint32_t worker, uint32_t chunk);
+
+/**
+ * @brief 並列実行に参加するスレッド数を取得
+ * @note  ワーカースレッドに加えて、待っている呼び出し元のスレッドも実行に参加します
+ */
+FW_INLINE uint32_t FwGetParallelWorkerCount(FwTaskFactory * factory) {
+    return (factory != nullptr) ? static_cast<uint32_t>(factory->GetNumWorkers()) + 1 : 1;
+}
+
+/**
+ * @brief チャンクを並列に実行
+ * @note  チャンクは参加者毎に等分して割り当て、手の空いた参加者が他の参加者の残りの後ろ半分を奪います
+ *        分割は手の空いた参加者が出た時にだけ行われるので、負荷が偏ってもタスクを細かくする必要はありません
+ *        全てのチャンクを実行し終えるまで戻りません
+ * @param[in] factory   タスクを実行するファクトリ。nullptrならその場で実行する
+ * @param[in] numChunks チャンク数
+ * @param[in] func      チャンク毎に呼ばれる関数
+ * @param[in] context   funcに渡すユーザデータ
+ */
+FW_DLL_FUNC void FwParallelForChunks(FwTaskFactory * factory, uint32_t numChunks, FwParallelChunkFunc func, void * context);
+
+
+/**
+ * @brief チャンクの大きさを決める
+ * @note  grainが0ならnumChunks個程度に分ける
+ * @param[in] count     要素数
+ * @param[in] grain     指定されたチャンクの大きさ
+ * @param[in] numChunks grainが0の時に目安とするチャンク数
+ */
+template<class _Index>
+FW_INLINE uint64_t FwParallelGrainSize(const uint64_t count, const _Index grain, const uint32_t numChunks) {
+    uint64_t size = (0 < grain) ? static_cast<uint64_t>(grain) : count / Max<uint64_t>(numChunks, 1);
+    size = Max<uint64_t>(size, 1);
+
+    // チャンク番号が32bitに収まるようにする
+    const uint64_t minSize = count / UINT32_MAX + 1;
+    return Max(size, minSize);
+}
+
+/**
+ * @struct FwParallelForContext
+ */
+template<class _Index, class _Func>
+struct FwParallelForContext {
+    _Index      begin;
+    _Index      end;
+    uint64_t    grain;
+    _Func *     func;
+
+    static void Run(void * context, uint32_t, uint32_t chunk) {
+        const FwParallelForContext * self = reinterpret_cast<const FwParallelForContext *>(context);
+        const uint64_t offset = static_cast<uint64_t>(chunk) * self->grain;
+        const _Index first = static_cast<_Index>(self->begin + offset);
+        const _Index last = static_cast<_Index>(Min<uint64_t>(offset + self->grain, static_cast<uint64_t>(self->end - self->begin)) + self->begin);
+        (*self->func)(first, last);
+    }
+};
+
+/**
+ * @struct FwParallelReduceSlot
+ * @brief  偽共有を避けるためキャッシュライン単位で置く集計値
+ */
+template<class _Ty>
+struct FW_ALIGN64 FwParallelReduceSlot {
+    _Ty value;
+
+    explicit FwParallelReduceSlot(const _Ty & _value) : value(_value) {}
+};
+
+/**
+ * @struct FwParallelReduceContext
+ */
+template<class _Index, class _Ty, class _Func>
+struct FwParallelReduceContext {
+    _Index                      begin;
+    _Index                      end;
+    uint64_t                    grain;
+    _Func *                     func;
+    FwParallelReduceSlot<_Ty> * slots;
+    bool                        perChunk;
+
+    static void Run(void * context, uint32_t worker, uint32_t chunk) {
+        FwParallelReduceContext * self = reinterpret_cast<FwParallelReduceContext *>(context);
+        const uint64_t offset = static_cast<uint64_t>(chunk) * self->grain;
+        const _Index first = static_cast<_Index>(self->begin + offset);
+        const _Index last = static_cast<_Index>(Min<uint64_t>(offset + self->grain, static_cast<uint64_t>(self->end - self->begin)) + self->begin);
+
+        _Ty & value = self->slots[self->perChunk ? chunk : worker].value;
+        value = (*self->func)(first, last, value);
+    }
+};
+
+
+/**
+ * @brief 範囲を分割して並列に実行
+ * @note  範囲がgrain以下ならその場で実行します
+ * @param[in] factory タスクを実行するファクトリ。nullptrならその場で実行する
+ * @param[in] begin   範囲の先頭
+ * @param[in] end     範囲の終端（含まない）
+ * @param[in] grain   一度に実行する最小の要素数。0なら自動で決める
+ * @param[in] func    void(_Index first, _Index last)で呼び出せる関数
+ */
+template<class _Index, class _Func>
+void FwParallelFor(FwTaskFactory * factory, const _Index begin, const _Index end, const _Index grain, _Func && func) {
+    if (end <= begin) {
+        return;
+    }
+
+    const uint64_t count = static_cast<uint64_t>(end - begin);
+    const uint32_t numWorkers = FwGetParallelWorkerCount(factory);
+    const uint64_t grainSize = FwParallelGrainSize(count, grain, numWorkers * FwParallelChunksPerWorker);
+    if (numWorkers <= 1 || count <= grainSize) {
+        func(begin, end);
+        return;
+    }
+
+    using FuncType = typename std::remove_reference<_Func>::type;
+    FwParallelForContext<_Index, FuncType> context = { begin, end, grainSize, &func };
+    FwParallelForChunks(factory, static_cast<uint32_t>((count + grainSize - 1) / grainSize), &FwParallelForContext<_Index, FuncType>::Run, &context);
+}
+
+/**
+ * @brief 範囲を分割して並列に集計
+ * @note  範囲がgrain以下ならその場で実行します
+ *        FwParallelReduceOrderDeterministicならチャンクの区切りと結合順が実行するスレッド数や順序に依存しないので、
+ *        浮動小数点の加算なども毎回同じ結果になります（チャンク数分の集計値を確保します）
+ *        grainが0の場合はFwParallelDeterministicNumChunks個に分けるので、異なるマシンの間でも同じ結果になります
+ * @param[in] factory   タスクを実行するファクトリ。nullptrならその場で実行する
+ * @param[in] begin     範囲の先頭
+ * @param[in] end       範囲の終端（含まない）
+ * @param[in] grain     一度に実行する最小の要素数。0なら自動で決める
+ * @param[in] identity  集計の初期値
+ * @param[in] func      _Ty(_Index first, _Index last, const _Ty & value)で呼び出せる関数。valueに範囲を集計した値を返す
+ * @param[in] reduce    _Ty(const _Ty & lhs, const _Ty & rhs)で呼び出せる関数。2つの集計値を結合した値を返す
+ * @param[in] order     結合順
+ * @return 集計値
+ */
+template<class _Index, class _Ty, class _Func, class _Reduce>
+_Ty FwParallelReduce(FwTaskFactory * factory, const _Index begin, const _Index end, const _Index grain, const _Ty & identity, _Func && func, _Reduce && reduce, const FwParallelReduceOrder order = FwParallelReduceOrderAny) {
+    if (end <= begin) {
+        return identity;
+    }
+
+    const uint64_t count = static_cast<uint64_t>(end - begin);
+    const uint32_t numWorkers = FwGetParallelWorkerCount(factory);
+    const bool perChunk = (order == FwParallelReduceOrderDeterministic);
+    const uint64_t grainSize = FwParallelGrainSize(count, grain, perChunk ? FwParallelDeterministicNumChunks : numWorkers * FwParallelChunksPerWorker);
+    const uint32_t numChunks = static_cast<uint32_t>((count + grainSize - 1) / grainSize);
+
+    // 決定的な順序ではチャンクの区切りを変えないため、1チャンクでなければ実行するスレッド数に関わらず分割する
+    if (numChunks <= 1 || (numWorkers <= 1 && !perChunk)) {
+        return func(begin, end, identity);
+    }
+
+    using SlotType = FwParallelReduceSlot<_Ty>;
+    const uint32_t numSlots = perChunk ? numChunks : numWorkers;
+    SlotType * slots = reinterpret_cast<SlotType *>(FwMallocAligned(sizeof(SlotType) * numSlots, alignof(SlotType), FwDefaultMemAllocatorTag));
+    if (slots == nullptr) {
+        return func(begin, end, identity);
+    }
+    for (uint32_t i = 0; i < numSlots; ++i) {
+        new(&slots[i]) SlotType(identity);
+    }
+
+    using FuncType = typename std::remove_reference<_Func>::type;
+    FwParallelReduceContext<_Index, _Ty, FuncType> context = { begin, end, grainSize, &func, slots, perChunk };
+    FwParallelForChunks((numWorkers <= 1) ? nullptr : factory, numChunks, &FwParallelReduceContext<_Index, _Ty, FuncType>::Run, &context);
+
+    _Ty result = identity;
+    for (uint32_t i = 0; i < numSlots; ++i) {
+        result = reduce(result, slots[i].value);
+        slots[i].~SlotType();
+    }
+    FwFree(slots);
+    return result;
+}
+
+END_NAMESPACE_FW
+
+#endif  // FW_PARALLEL_H_
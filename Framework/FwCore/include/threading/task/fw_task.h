@@ -5,7 +5,9 @@
 #ifndef FW_TASK_H_
 #define FW_TASK_H_
 
+#include "threading/fw_thread.h"
 #include "container/fw_vector.h"
+#include "misc/fw_noncopyable.h"
 
 
 BEGIN_NAMESPACE_FW
@@ -27,13 +29,69 @@ enum class FwTaskGroupState : sint32_t {
 };
 
 
+using FwTaskPriority        = sint32_t;
 using FwTaskArgType         = void *;
 using FwTaskRetType         = void;
-using FwTaskFunctionType    = std::function<FwTaskRetType(FwTaskArgType)>;
+using FwTaskFunctionType    = FwTaskRetType (*)(FwTaskArgType);
 
 class FwTask;
 class FwTaskGroup;
 class FwTaskFactory;
+class FwTaskGraph;
+
+/**
+ * @brief ^XNxɌĂ΂֐
+ * @note  O[v̊ɐOɌĂ΂܂
+ */
+using FwTaskCompletionHook  = void (*)(void * context, FwTask * task);
+
+/**
+ * @brief O[vɌĂ΂֐
+ * @note  XbhAO[vԂɂȂɌĂ΂܂
+ */
+using FwTaskGroupContinuation = void (*)(void * context);
+
+static const sint32_t   FwMaxTaskWorkers                = 64;
+static const uint32_t   DefaultFwTaskQueueSize          = 4096;
+static const uint32_t   DefaultFwTaskWorkerStackSize    = 256 * 1024;
+static const size_t     FwTaskRecordSize                = 64;   ///< ^XN1̃TCYiLbVCTCYj
+static const size_t     FwTaskInlineStorageSize         = 32;   ///< ^XNɒڕێłĂяo\IuWFNg̃TCY
+static const uint32_t   DefaultFwTaskFiberStackSize     = 64 * 1024;
+
+static const FwTaskPriority FwTaskPriorityHigh      = 0;    ///< t[ɊԂɍ킹鏈BɍŏɎs
+static const FwTaskPriority FwTaskPriorityNormal    = 1;    ///< ʏ̏
+static const FwTaskPriority FwTaskPriorityLow       = 2;    ///< Ői߂鏈B̗Dx̃^XNs
+static const FwTaskPriority FwTaskPriorityCount     = 3;
+
+/**
+ * @struct FwTaskFactoryDesc
+ */
+struct FwTaskFactoryDesc {
+    sint32_t            numWorkers;     ///< [J[Xbhi0Ȃn[hEFAXbh-1j
+    uint32_t            queueSize;      ///< [J[̃^XNL[̗eʁi2̗ݏj
+    uint32_t            stackSize;      ///< [J[Xbh̃X^bNTCY
+    FwThreadPriority    priority;       ///< [J[Xbh̗Dx
+    FwThreadAffinity    affinity;       ///< [J[Xbh̃AtBjeB
+    bool                pinWorkers;     ///< [J[Xbh𕨗RAɌŒ肷邩iaffinity͈͓̔Ő擪̃RA珇Ɋ蓖Ăj
+    uint32_t            numFibers;      ///< [J[ɗpӂt@Co[i0Ȃt@Co[gȂj
+    uint32_t            fiberStackSize; ///< t@Co[̃X^bNTCY
+    sint32_t            maxLowPriorityWorkers;  ///< FwTaskPriorityLow̃^XN𓯎Ɏsł郏[J[i0Ȃ琧Ȃj
+
+    /**
+     * @brief 
+     */
+    FW_INLINE void Init() {
+        numWorkers  = 0;
+        queueSize   = DefaultFwTaskQueueSize;
+        stackSize   = DefaultFwTaskWorkerStackSize;
+        priority    = FwThreadPriorityNormal;
+        affinity    = DefaultFwThreadAffinity;
+        pinWorkers  = false;
+        numFibers       = 0;
+        fiberStackSize  = DefaultFwTaskFiberStackSize;
+        maxLowPriorityWorkers = 0;
+    }
+};
 
 
 /**
@@ -59,8 +117,9 @@ public:
 
     /**
      * @brief ^XNL҂ɂʒm
+     * @param[in] task ^XN
      */
-    void NotifyOwnerToCompletion();
+    void NotifyOwnerToCompletion(FwTask * task);
 
     /**
      * @name Zq
@@ -82,8 +141,11 @@ public:
 
 /**
  * @class FwTask
+ * @brief 1LbVCɎ܂^XN
+ * @note  Ăяo\IuWFNg̓^XÑobt@֒ڍ\ẑŁA^XÑq[vmۂ͂܂
+ *        FwTaskInlineStorageSizeɎ܂Ȃ傫ȃf[^argsoRœnĂ
  */
-class FwTask {
+class FW_ALIGN64 FwTask {
 public:
     /**
      * @brief Ԃ擾
@@ -98,39 +160,90 @@ public:
     /**
      * @brief O擾
      */
-    FW_INLINE str_t GetName() const { return name; }
-    
+    const char_t * GetName() const;
+
     /**
-     * @name Zq
+     * @name Rs[֎~iĂяo\IuWFNg̏ɍ\z邽߁j
      */
     //! @{
-    const FwTask & operator =(const FwTask & value);
-    FwTask & operator =(FwTask && value);
+    FwTask(const FwTask & value) = delete;
+    FwTask(FwTask && value) = delete;
+    const FwTask & operator =(const FwTask & value) = delete;
+    FwTask & operator =(FwTask && value) = delete;
     //! @}
 
+
+private:
+    enum class Operation : sint32_t {
+        kRun,       ///< s
+        kDestroy,   ///< Ăяo\IuWFNg̔j
+    };
+
+    using Trampoline = void (*)(FwTask * task, const Operation op);
+
+    /**
+     * @brief Ăяo\IuWFNǧ^̌Ăяo
+     */
+    template<class _Func>
+    static void InvokeTrampoline(FwTask * task, const Operation op) {
+        _Func * func = reinterpret_cast<_Func *>(task->storage);
+        if (op == Operation::kRun) {
+            (*func)(task->args);
+        } else {
+            func->~_Func();
+        }
+    }
+
+    /**
+     * @brief Ăяo\IuWFNgݒ
+     */
+    template<class _Func>
+    void Bind(_Func && func) {
+        using FuncType = typename std::decay<_Func>::type;
+        static_assert(sizeof(FuncType) <= FwTaskInlineStorageSize, "task function is too large. pass the data through args");
+        static_assert(alignof(FuncType) <= 16, "task function is over-aligned");
+
+        new(storage) FuncType(std::forward<_Func>(func));
+        trampoline = &InvokeTrampoline<FuncType>;
+    }
+
+    /**
+     * @brief s
+     */
+    void Run();
+
+    /**
+     * @brief Ăяo\IuWFNgj
+     */
+    void Destroy();
+
     /**
      * @name RXgN^
      */
     //! @{
-    FwTask();
-    FwTask(const FwTask & value);
-    FwTask(FwTask && value);
+    FwTask(FwTaskGroupSharedData * _sharedData, FwTaskArgType * _args, const sint32_t _index);
     //! @}
 
-private:
-    FwTaskState             state;
-    FwTaskGroupSharedData * sharedData;
+    /**
+     * @brief fXgN^
+     */
+    ~FwTask();
 
-    FwTaskFunctionType  func;
-    FwTaskArgType *     args;
 
-    sint32_t    index;
-    str_t       name;
+    Trampoline              trampoline;
+    FwTaskGroupSharedData * sharedData;
+    FwTaskArgType *         args;
+    sint32_t                index;
+    FwTaskState             state;
+
+    FW_ALIGN16 uint8_t      storage[FwTaskInlineStorageSize];
 
     friend class FwTaskGroup;
     friend class FwTaskFactory;
 };
 
+static_assert(sizeof(FwTask) == FwTaskRecordSize, "FwTask must fit in a cache line");
+
 /**
  * @class FwTaskGroup
  */
@@ -139,23 +252,61 @@ public:
     /**
      * @brief ^XNǉ
      * @param[in] args ^XNɓn[U
-     * @param[in] func ^XÑGg|Cg
+     * @param[in] func ^XÑGg|CgBvoid(FwTaskArgType)ŌĂяoFwTaskInlineStorageSizeȉ̃IuWFNg
      */
-    FwTask * AddTask(FwTaskArgType * args, FwTaskFunctionType & func);
-    
+    template<class _Func>
+    FwTask * AddTask(FwTaskArgType * args, _Func && func) {
+        FwTask * task = AllocTask(args);
+        if (task != nullptr) {
+            task->Bind(std::forward<_Func>(func));
+        }
+        return task;
+    }
+
     /**
      * @brief ^XNǉ
      * @param[in] func ^XÑGg|Cg
      */
-    FW_INLINE FwTask * AddTask(FwTaskFunctionType & func) { return AddTask(nullptr, func); }
+    template<class _Func>
+    FW_INLINE FwTask * AddTask(_Func && func) { return AddTask(nullptr, std::forward<_Func>(func)); }
+
+    /**
+     * @brief qO[vǉ
+     * @note  qO[v͂̃O[vƈꏏɑoÃO[v͎qO[vSĊĂ犮܂
+     * @param[in] group 󂯓\Ԃ̎qO[v
+     * @return ǉłȂfalse
+     */
+    bool AddChildGroup(FwTaskGroup * group);
+
+    /**
+     * @brief `FCO[vǉ
+     * @note  `FCO[v͂̃O[vƑo܂
+     * @param[in] group 󂯓\Ԃ̃`FCO[v
+     * @return ǉłȂfalse
+     */
+    bool AddChainGroup(FwTaskGroup * group);
 
     /**
      * @brief o^^XNXPW[֑o
      */
     void Submit();
 
+    /**
+     * @brief ɌĂ΂֐o^
+     * @note  oォo^ł܂BƓo^͉̂ŁAo1o^Ă
+     *        ֐̒ŃO[vjĂ\܂
+     * @param[in] func    ɌĂ΂֐
+     * @param[in] context funcɓn[Uf[^
+     * @return ɊĂΓo^falseifunc͌Ă΂Ȃ̂ŁAĂяoőĂj
+     */
+    bool RegisterContinuation(FwTaskGroupContinuation func, void * context);
+
     /**
      * @brief SẴ^XNI܂ő҂
+     * @note  t@Co[g[J[Ă΂ꂽꍇ́AĂяo^XN𒆒fă[J[ɑ̃^XNsA
+     *        ɓ[J[ōĊJ܂BȊO͑҂ĂԂɎs҂̃^XNɎs܂
+     *        Ɏs^XŃÃO[v𑗏o̗Dxȏ̂̂ɒT܂
+     *        ҂ĂԂ́AĂяo^XNgĂDx̒Ⴂ^XN̎sgimaxLowPriorityWorkersj܂
      */
     void Wait();
 
@@ -179,14 +330,45 @@ public:
     FW_INLINE FwTaskGroupState GetState(const std::memory_order order = std::memory_order_seq_cst) const { return state.load(order); }
 
     /**
-     * @brief 
+     * @brief ǂ
+     */
+    FW_INLINE bool IsCompleted() const { return GetState(std::memory_order_acquire) == FwTaskGroupState::kRanToCompletion; }
+
+    /**
+     * @brief O擾
+     */
+    FW_INLINE const char_t * GetName() const { return name; }
+
+    /**
+     * @brief Dxݒ
+     * @note  oOɐݒ肵ĂBResetĂς܂
+     *        qO[v͐eႢDxł͐ς܂ꂸAo鎞ɐe̗Dx܂ňグ܂iݒ肵l͕ς܂j
+     *        `FCO[vɂ͈p܂
+     */
+    FW_INLINE void SetPriority(const FwTaskPriority _priority) {
+        FwAssert(FwTaskPriorityHigh <= _priority && _priority < FwTaskPriorityCount);
+        priority = _priority;
+    }
+
+    /**
+     * @brief Dx擾
+     */
+    FW_INLINE FwTaskPriority GetPriority() const { return priority; }
+
+    /**
+     * @brief LĂt@Ng擾
      */
-    const FwTaskGroup & operator =(const FwTaskGroup & value);
+    FW_INLINE FwTaskFactory * GetFactory() const { return owner; }
 
     /**
-     * @brief ړ
+     * @name Rs[֎~i^XNAhXŎQƂ邽߁j
      */
-    FwTaskGroup & operator =(FwTaskGroup && value);
+    //! @{
+    FwTaskGroup(const FwTaskGroup & value) = delete;
+    FwTaskGroup(FwTaskGroup && value) = delete;
+    const FwTaskGroup & operator =(const FwTaskGroup & value) = delete;
+    FwTaskGroup & operator =(FwTaskGroup && value) = delete;
+    //! @}
 
 
 private:
@@ -202,14 +384,69 @@ private:
      */
     void ChangeState(const FwTaskGroupState newState, const std::memory_order order = std::memory_order_seq_cst);
 
+    /**
+     * @brief ^XN1蓖Ă
+     */
+    FwTask * AllocTask(FwTaskArgType * args);
+
+    /**
+     * @brief ȍĎqO[v𑗏o
+     * @return ^XN΂̏Ŋfalse
+     */
+    bool BeginSubmit();
+
+    /**
+     * @brief w肵^XNXPW[֑o
+     * @note  c̃^XNScheduleTaskőoĂ
+     * @param[in] indices  o^XNԍ
+     * @param[in] count    indices̐
+     */
+    void SubmitPartial(const sint32_t * indices, const uint32_t count);
+
+    /**
+     * @brief ^XNXPW[֐ς
+     */
+    void ScheduleTask(FwTask * task);
+
+    /**
+     * @brief ^XNc܂܍ēxt\Ԃɂ
+     */
+    void Rearm();
+
+    /**
+     * @brief ^XNɌĂ΂֐ݒ
+     */
+    FW_INLINE void SetCompletionHook(FwTaskCompletionHook hook, void * context) {
+        completionHook = hook;
+        completionHookContext = context;
+    }
+
+    /**
+     * @brief 蓖Ă^XNSĔj
+     */
+    void DestroyTasks();
+
+    /**
+     * @brief g̃^XNSĊ
+     */
+    void OnTasksCompleted();
+
+    /**
+     * @brief qO[v
+     */
+    void OnChildGroupCompleted();
+
+    /**
+     * @brief ^XNƎqO[vSĊĂΊԂɂ
+     */
+    void TryComplete();
+
     /**
      * @name RXgN^
      */
     //! @{
     FwTaskGroup();
-    FwTaskGroup(const uint32_t _maxTasks, const uint32_t _maxChildren, const uint32_t _maxChains, const str_t _name);
-    FwTaskGroup(const FwTaskGroup & value);
-    FwTaskGroup(FwTaskGroup && value);
+    FwTaskGroup(FwTaskFactory * factory, const uint32_t _maxTasks, const uint32_t _maxChildren, const uint32_t _maxChains, const char_t * _name);
     //! @}
 
     /**
@@ -218,10 +455,23 @@ private:
     ~FwTaskGroup();
 
     FwTaskFactory *                     owner;
+    FwTaskGroup *                       parentGroup;
+    FwTaskPriority                      priority;
+    FwTaskPriority                      schedulePriority;       ///< oɐe̗Dx܂ňグDx
     std::atomic<FwTaskGroupState>       state;
     FwTaskGroupSharedData               sharedData;
-
-    NAMESPACE_FW vector<FwTask>         taskPool;
+    uint32_t                            maxTasks;
+    uint32_t                            maxChildren;
+    uint32_t                            maxChains;
+    std::atomic<bool>                   completing;
+    FwTaskCompletionHook                completionHook;
+    void *                              completionHookContext;
+    std::atomic<sint32_t>               continuationState;      ///< ɌĂԊ֐̓o^
+    FwTaskGroupContinuation             continuation;
+    void *                              continuationContext;
+
+    FwTask *                            taskPool;
+    uint32_t                            numTasks;
     NAMESPACE_FW vector<FwTaskGroup *>  childGroups;
     NAMESPACE_FW vector<FwTaskGroup *>  chainGroups;
 
@@ -230,9 +480,194 @@ private:
 
     friend class FwTask;
     friend class FwTaskGroupSharedData;
+    friend class FwTaskFactory;
+    friend class FwTaskGraph;
+};
+
+/**
+ * @class FwTaskFactory
+ * @brief [J[Xbh̃^XNL[Ƒ̃[J[̓ݏoŃ^XNsXPW[
+ */
+class FwTaskFactory : public NonCopyable<FwTaskFactory> {
+public:
+    /**
+     * @brief ^XNO[v𐶐
+     * @param[in] maxTasks    ێ\ȍő^XN
+     * @param[in] maxChildren ێ\ȍőqO[v
+     * @param[in] maxChains   ێ\ȍő`FCO[v
+     * @param[in] name        O
+     * @return 󂯓\Ԃ̃^XNO[v
+     */
+    FW_INLINE FwTaskGroup * CreateTaskGroup(const uint32_t maxTasks, const uint32_t maxChildren = 0, const uint32_t maxChains = 0, const char_t * name = nullptr) {
+        return DoCreateTaskGroup(maxTasks, maxChildren, maxChains, name);
+    }
+
+    /**
+     * @brief ^XNO[vj
+     * @attention s̃O[v͊҂ĂjĂ
+     */
+    FW_INLINE void DestroyTaskGroup(FwTaskGroup * group) {
+        DoDestroyTaskGroup(group);
+    }
+
+    /**
+     * @brief O[vɑȂ^XN1o
+     * @note  ҂î͖ŁAmKvfunc̒ŒʒmĂ
+     * @param[in] args     ^XNɓn[U
+     * @param[in] func     ^XÑGg|CgBvoid(FwTaskArgType)ŌĂяoFwTaskInlineStorageSizeȉ̃IuWFNg
+     * @param[in] priority Dx
+     * @return ^XNmۂłȂfalse
+     */
+    template<class _Func>
+    bool Post(FwTaskArgType * args, _Func && func, const FwTaskPriority priority = FwTaskPriorityNormal) {
+        void * ptr = DoAllocDetachedTask();
+        if (ptr == nullptr) {
+            return false;
+        }
+        FwTask * task = new(ptr) FwTask(nullptr, args, -1);
+        task->Bind(std::forward<_Func>(func));
+        task->state = FwTaskState::kWaitingToRun;
+        DoSchedule(task, priority);
+        return true;
+    }
+
+    /**
+     * @brief O[vɑȂ^XN1o
+     * @param[in] func ^XÑGg|Cg
+     */
+    template<class _Func>
+    FW_INLINE bool Post(_Func && func) { return Post(nullptr, std::forward<_Func>(func)); }
+
+    /**
+     * @brief s҂̃^XN1s
+     * @param[in] lowest s^XN̍Œ̗Dx
+     * @return s^XNfalse
+     */
+    FW_INLINE bool RunPendingTask(const FwTaskPriority lowest = FwTaskPriorityLow) {
+        return DoRunPendingTask(lowest);
+    }
+
+    /**
+     * @brief [J[Xbh擾
+     */
+    FW_INLINE sint32_t GetNumWorkers() const {
+        return DoGetNumWorkers();
+    }
+
+
+protected:
+    /**
+     * @brief ^XNO[v𐶐
+     */
+    virtual FwTaskGroup * DoCreateTaskGroup(const uint32_t maxTasks, const uint32_t maxChildren, const uint32_t maxChains, const char_t * name) = 0;
+
+    /**
+     * @brief ^XNO[vj
+     */
+    virtual void DoDestroyTaskGroup(FwTaskGroup * group) = 0;
+
+    /**
+     * @brief s҂̃^XN1s
+     */
+    virtual bool DoRunPendingTask(const FwTaskPriority lowest) = 0;
+
+    /**
+     * @brief [J[Xbh擾
+     */
+    virtual sint32_t DoGetNumWorkers() const = 0;
+
+    /**
+     * @brief ^XNL[֐ς
+     */
+    virtual void DoSchedule(FwTask * task, const FwTaskPriority priority) = 0;
+
+    /**
+     * @brief s̃^XNO[v܂Œf
+     * @return fłȂ΁i[J[ȊOĂ΂ꂽA󂢂Ăt@Co[Ȃǁjfalse
+     */
+    virtual bool DoSuspendUntilCompleted(FwTaskGroup * group) = 0;
+
+    /**
+     * @brief O[v̊҂n߂
+     * @note  ҂ĂԂ͐i܂Ȃ̂ŁAs̃^XNgĂDx̒Ⴂ^XN̎sg܂
+     * @return gꍇtrueiDoEndWait֓nĂj
+     */
+    virtual bool DoBeginWait() = 0;
+
+    /**
+     * @brief O[v̊҂I
+     * @param[in] released DoBeginWait̖߂l
+     */
+    virtual void DoEndWait(const bool released) = 0;
+
+    /**
+     * @brief O[v
+     * @note  O[v͊ɔjĂ\̂œn܂
+     */
+    virtual void DoNotifyGroupCompleted() = 0;
+
+    /**
+     * @brief O[vɑȂ^XN̗̈m
+     */
+    virtual void * DoAllocDetachedTask() = 0;
+
+    /**
+     * @brief O[vɑȂ^XN̗̈
+     */
+    virtual void DoFreeDetachedTask(void * ptr) = 0;
+
+
+    /**
+     * @brief ^XNO[v𐶐ipj
+     */
+    FwTaskGroup * NewTaskGroup(const uint32_t maxTasks, const uint32_t maxChildren, const uint32_t maxChains, const char_t * name);
+
+    /**
+     * @brief ^XNO[vjipj
+     */
+    void DeleteTaskGroup(FwTaskGroup * group);
+
+    /**
+     * @brief ^XNsipj
+     */
+    FW_INLINE void RunTask(FwTask * task) {
+        // O[vɑȂ^XN͎sŔj
+        const bool detached = (task->sharedData == nullptr);
+        task->Run();
+        if (detached) {
+            task->~FwTask();
+            DoFreeDetachedTask(task);
+        }
+    }
+
+
+    /**
+     * @brief RXgN^
+     */
+    FwTaskFactory() {
+    }
+
+    /**
+     * @brief fXgN^
+     */
+    virtual ~FwTaskFactory() {
+    }
+
+    friend class FwTaskGroup;
 };
 
+/**
+ * @brief FwTaskFactory𐶐
+ * @param[in] desc ڍ
+ * @return t@NgB[J[XbhNłȂꍇnullptr
+ */
+FW_DLL_FUNC FwTaskFactory * FwCreateTaskFactory(const FwTaskFactoryDesc * desc);
 
+/**
+ * @brief FwTaskFactoryj
+ * @attention ^XNO[v͑SĔjĂĂł
+ */
+FW_DLL_FUNC void FwDestroyTaskFactory(FwTaskFactory * factory);
 
 
 END_NAMESPACE_FW
@@ -0,0 +1,170 @@
+﻿/**
+ * @file fw_task_graph.h
+ */
+#ifndef FW_TASK_GRAPH_H_
+#define FW_TASK_GRAPH_H_
+
+#include "threading/task/fw_task.h"
+
+BEGIN_NAMESPACE_FW
+
+using FwTaskNode = sint32_t;
+
+static const FwTaskNode FwInvalidTaskNode               = -1;
+static const uint32_t   DefaultFwTaskGraphMaxNodes      = 256;
+static const uint32_t   DefaultFwTaskGraphMaxEdges      = 1024;
+
+/**
+ * @struct FwTaskGraphDesc
+ */
+struct FwTaskGraphDesc {
+    uint32_t        maxNodes;   ///< 保持可能な最大ノード数
+    uint32_t        maxEdges;   ///< 保持可能な最大エッジ数
+    const char_t *  name;       ///< 名前
+
+    /**
+     * @brief 初期化
+     */
+    FW_INLINE void Init() {
+        maxNodes    = DefaultFwTaskGraphMaxNodes;
+        maxEdges    = DefaultFwTaskGraphMaxEdges;
+        name        = nullptr;
+    }
+};
+
+/**
+ * @brief FwTaskGraphを生成
+ * @param[in] factory タスクを実行するファクトリ
+ * @param[in] desc    詳細
+ * @return 生成したグラフ。メモリが足りなければnullptr
+ */
+FW_DLL_FUNC FwTaskGraph * FwCreateTaskGraph(FwTaskFactory * factory, const FwTaskGraphDesc * desc);
+
+/**
+ * @brief FwTaskGraphを破棄
+ * @attention 実行中のグラフは完了を待ってから破棄してください
+ */
+FW_DLL_FUNC void FwDestroyTaskGraph(FwTaskGraph * graph);
+
+/**
+ * @class FwTaskGraph
+ * @brief 依存関係を持つタスクのグラフ
+ * @note  ノードとエッジを一度だけ登録してCompileし、以降は毎フレームRunするだけで同じグラフを実行します
+ *        Run毎のメモリ確保やグラフの組み直しはありません
+ *        先行ノードが全て完了したノードから順にスケジューラへ積まれます
+ */
+class FwTaskGraph : public NonCopyable<FwTaskGraph> {
+public:
+    /**
+     * @brief ノードを追加
+     * @param[in] args ノードに渡すユーザ引数
+     * @param[in] func ノードのエントリポイント
+     * @return 追加したノード。追加できなければFwInvalidTaskNode
+     */
+    template<class _Func>
+    FwTaskNode AddNode(FwTaskArgType * args, _Func && func) {
+        FwAssert(!compiled);
+        FwTask * task = group->AddTask(args, std::forward<_Func>(func));
+        return (task != nullptr) ? task->GetIndex() : FwInvalidTaskNode;
+    }
+
+    /**
+     * @brief ノードを追加
+     * @param[in] func ノードのエントリポイント
+     */
+    template<class _Func>
+    FW_INLINE FwTaskNode AddNode(_Func && func) { return AddNode(nullptr, std::forward<_Func>(func)); }
+
+    /**
+     * @brief エッジを追加
+     * @note  toはfromが完了してから実行されます
+     * @return 追加できなければfalse
+     */
+    bool AddEdge(const FwTaskNode from, const FwTaskNode to);
+
+    /**
+     * @brief 実行できる形に変換
+     * @retval FW_OK             成功
+     * @retval ERR_INVALID_PARMS 循環している
+     */
+    sint32_t Compile();
+
+    /**
+     * @brief グラフを実行
+     * @attention 前回の実行が完了してから呼んでください
+     */
+    void Run();
+
+    /**
+     * @brief 全てのノードが終了するまで待つ
+     * @note  待っている間は実行待ちのタスクを代わりに実行します
+     */
+    void Wait();
+
+    /**
+     * @brief 完了したかどうか
+     */
+    FW_INLINE bool IsCompleted() const { return group->IsCompleted(); }
+
+    /**
+     * @brief 変換済みかどうか
+     */
+    FW_INLINE bool IsCompiled() const { return compiled; }
+
+    /**
+     * @brief ノード数を取得
+     */
+    FW_INLINE uint32_t GetNumNodes() const { return group->numTasks; }
+
+    /**
+     * @brief トポロジカル順に並べたノードを取得
+     * @note  Compileした後に有効です
+     */
+    FW_INLINE const FwTaskNode * GetTopologicalOrder() const { return order; }
+
+
+private:
+    /**
+     * @brief ノードが完了した
+     */
+    static void OnNodeCompleted(void * context, FwTask * task);
+
+    /**
+     * @brief 初期化
+     */
+    sint32_t Init(FwTaskFactory * factory, const FwTaskGraphDesc * desc);
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwTaskGraph();
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FwTaskGraph();
+
+
+    FwTaskFactory *         factory;
+    FwTaskGroup *           group;
+    bool                    compiled;
+
+    uint32_t                maxEdges;
+    uint32_t                numEdges;
+    FwTaskNode *            edges;              ///< 登録したエッジ（from, toの組）
+
+    FwTaskNode *            order;              ///< トポロジカル順のノード
+    FwTaskNode *            roots;              ///< 先行ノードの無いノード
+    uint32_t                numRoots;
+    uint32_t *              successorOffsets;   ///< ノード毎の後続ノードの開始位置
+    FwTaskNode *            successors;         ///< 後続ノード
+    sint32_t *              numPredecessors;    ///< ノード毎の先行ノード数
+    std::atomic<sint32_t> * pendingCounts;      ///< 完了を待っている先行ノード数
+
+    friend FwTaskGraph * FwCreateTaskGraph(FwTaskFactory * factory, const FwTaskGraphDesc * desc);
+    friend void FwDestroyTaskGraph(FwTaskGraph * graph);
+};
+
+END_NAMESPACE_FW
+
+#endif  // FW_TASK_GRAPH_H_
@@ -6,42 +6,407 @@
 #include "core/fw_allocator.h"
 
 #include <malloc.h>
+#include <string.h>
 #include <crtdbg.h>
+#include <atomic>
 #include <mutex>
 
+#include "fw_mem_block.h"
+#include "fw_mem_tracker.h"
+#include "fw_virtual_memory.h"
+
+// ガードを付けない場合、既定タグの小サイズブロックはヘッダ/フッタを持たない
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE && !FW_ENABLE_MEM_GUARD
+    #define FW_ENABLE_HEADERLESS_SMALL_BLOCK    (1)
+#endif
+
 
 BEGIN_NAMESPACE_FW
 BEGIN_NAMESPACE_NONAME
+
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE
 //-------------------------------------------------------------------------------------------
-// FwMemBlock
+// FwSmallBlockCache
 //-------------------------------------------------------------------------------------------
+static const size_t     s_smallBlockGranularity     = 16;                                           ///< サイズクラスの刻み幅
+static const size_t     s_smallBlockMaxSize         = 1024;                                         ///< キャッシュ対象とする最大ブロックサイズ
+static const sint32_t   s_numSmallBlockClasses      = s_smallBlockMaxSize / s_smallBlockGranularity;
+static const sint32_t   s_threadCacheBatchCount     = 32;                                           ///< 共有プールとの一括受け渡し数
+static const sint32_t   s_threadCacheMaxCount       = s_threadCacheBatchCount * 2;                  ///< スレッドキャッシュに保持する最大数
+static const size_t     s_smallBlockChunkSize       = 64 * 1024;                                    ///< 共有プールが一度に確保するサイズ
+static const size_t     s_smallBlockChunkAlign      = 64;
+
 /**
- * @struct FwMemBlockHeader
+ * @struct FwFreeBlock
+ * @brief 未使用ブロックの侵入型リンク
  */
-struct FwMemBlockHeader {
-    size_t      blockSize;      ///< メモリブロックサイズ
-    size_t      alignment;      ///< アライメントサイズ
-    uint16_t    offsetBytes;    ///< 実アドレスへのオフセット
-    uint16_t    tag;            ///< タグ情報
-    uint32_t    magic;          ///< オーバーラン識別用マジック
+struct FwFreeBlock {
+    FwFreeBlock *   next;
 };
 
 /**
- * @struct FwMemBlockFooter
+ * @brief ブロックサイズからサイズクラスを取得
+ * @return キャッシュ対象外なら-1
+ */
+FW_INLINE sint32_t FwGetSmallBlockClass(const size_t realSize, const size_t alignment) {
+    if (alignment > s_smallBlockGranularity || realSize > s_smallBlockMaxSize) {
+        return -1;
+    }
+    return static_cast<sint32_t>((realSize + s_smallBlockGranularity - 1) / s_smallBlockGranularity) - 1;
+}
+
+/**
+ * @brief サイズクラスからブロックサイズを取得
  */
-struct FwMemBlockFooter {
-    uint32_t    magic;          ///< オーバーラン識別用マジック
+FW_INLINE size_t FwGetSmallBlockClassSize(const sint32_t sizeClass) {
+    return static_cast<size_t>(sizeClass + 1) * s_smallBlockGranularity;
+}
+
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+#if defined(FW_PLATFORM_WIN64) || defined(__LP64__)
+static const size_t     s_smallBlockRegionSize      = static_cast<size_t>(16) * 1024 * 1024 * 1024;   ///< ヘッダ無しブロック用に予約するサイズ
+#else
+static const size_t     s_smallBlockRegionSize      = 256 * 1024 * 1024;
+#endif
+static const size_t     s_numSmallBlockRegionChunks = s_smallBlockRegionSize / s_smallBlockChunkSize;
+
+/**
+ * @class FwSmallBlockRegion
+ * @brief ヘッダを持たない小サイズブロックのチャンクを切り出す予約領域
+ * @note  チャンク毎にサイズクラスを記録しておき、ブロックのアドレスから引けるようにします
+ *        この領域のブロックはすべて既定タグのものです
+ */
+class FwSmallBlockRegion {
+public:
+    /**
+     * @brief チャンクを使用可能にする
+     * @param[in] sizeClass 切り分けるサイズクラス
+     * @return チャンクの先頭。予約領域を使い切った場合はnullptr
+     */
+    void * AllocChunk(const sint32_t sizeClass) {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        uint8_t * base = _base.load(std::memory_order_relaxed);
+        if (base == nullptr) {
+            base = reinterpret_cast<uint8_t *>(FwVirtualMemoryReserve(s_smallBlockRegionSize));
+            if (base == nullptr) {
+                return nullptr;
+            }
+            _base.store(base, std::memory_order_release);
+        }
+
+        if (s_numSmallBlockRegionChunks <= _numChunks) {
+            return nullptr;
+        }
+        uint8_t * chunk = base + _numChunks * s_smallBlockChunkSize;
+        if (!FwVirtualMemoryCommit(chunk, s_smallBlockChunkSize)) {
+            return nullptr;
+        }
+        _chunkClasses[_numChunks] = static_cast<uint8_t>(sizeClass);
+        ++_numChunks;
+        return chunk;
+    }
+
+    /**
+     * @brief ブロックのサイズクラスを取得
+     * @return この領域のブロックでなければ-1
+     */
+    FW_INLINE sint32_t GetSizeClass(const void * ptr) const {
+        const uint8_t * base = _base.load(std::memory_order_acquire);
+        const uintptr_t offset = reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(base);
+        if (base == nullptr || s_smallBlockRegionSize <= offset) {
+            return -1;
+        }
+        return _chunkClasses[offset / s_smallBlockChunkSize];
+    }
+
+
+private:
+    std::mutex              _mutex;
+    std::atomic<uint8_t *>  _base;
+    size_t                  _numChunks;
+    uint8_t                 _chunkClasses[s_numSmallBlockRegionChunks];
 };
 
-// メモリオーバーラン検出用マジック
-static const sint32_t   s_memBlockMagic = 0xdeadbeef;
+// ヘッダ無しブロックの予約領域
+static FwSmallBlockRegion   s_smallBlockRegion;
+#endif
+
+/**
+ * @class FwSmallBlockCentralPool
+ * @brief 全スレッドで共有するサイズクラス毎の未使用ブロック
+ */
+class FwSmallBlockCentralPool {
+public:
+    /**
+     * @brief 未使用ブロックをまとめて取り出す
+     * @param[in]  sizeClass サイズクラス
+     * @param[out] head      取り出したリストの先頭
+     * @return 取り出した数
+     */
+    sint32_t Fetch(const sint32_t sizeClass, FwFreeBlock ** head) {
+        FwClassList & list = _classes[sizeClass];
+        std::lock_guard<std::mutex> lock(list.mutex);
+
+        if (list.head == nullptr) {
+            Carve(sizeClass, list);
+        }
+
+        sint32_t count = 0;
+        FwFreeBlock * first = list.head;
+        FwFreeBlock * last = nullptr;
+        while (list.head != nullptr && count < s_threadCacheBatchCount) {
+            last = list.head;
+            list.head = list.head->next;
+            ++count;
+        }
+        if (last != nullptr) {
+            last->next = nullptr;
+        }
+        list.count -= count;
+
+        *head = (count > 0) ? first : nullptr;
+        return count;
+    }
+
+    /**
+     * @brief 未使用ブロックをまとめて返却する
+     * @param[in] sizeClass サイズクラス
+     * @param[in] head      返却するリストの先頭
+     * @param[in] tail      返却するリストの末尾
+     * @param[in] count     返却する数
+     */
+    void Release(const sint32_t sizeClass, FwFreeBlock * head, FwFreeBlock * tail, const sint32_t count) {
+        FwClassList & list = _classes[sizeClass];
+        std::lock_guard<std::mutex> lock(list.mutex);
+
+        tail->next = list.head;
+        list.head = head;
+        list.count += count;
+    }
+
+    /**
+     * @brief コンストラクタ
+     * @param[in] headerless ヘッダ無しブロックの予約領域からチャンクを切り出すか
+     */
+    explicit FwSmallBlockCentralPool(const bool headerless)
+    : _headerless(headerless) {
+        for (auto & list : _classes) {
+            list.head = nullptr;
+            list.count = 0;
+        }
+    }
+
+
+private:
+    /**
+     * @struct FwClassList
+     */
+    struct FW_ALIGN64 FwClassList {
+        std::mutex      mutex;
+        FwFreeBlock *   head;
+        sint32_t        count;
+    };
+
+    /**
+     * @brief チャンクを確保してサイズクラスのブロックに切り分ける
+     */
+    void Carve(const sint32_t sizeClass, FwClassList & list) {
+        void * chunk = nullptr;
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+        if (_headerless) {
+            chunk = s_smallBlockRegion.AllocChunk(sizeClass);
+        } else {
+            chunk = AllocHeapChunk();
+        }
+#else
+        chunk = AllocHeapChunk();
+#endif
+        if (chunk == nullptr) {
+            return;
+        }
+
+        const size_t blockSize = FwGetSmallBlockClassSize(sizeClass);
+        const size_t numBlocks = s_smallBlockChunkSize / blockSize;
+
+        uintptr_t top = reinterpret_cast<uintptr_t>(chunk);
+        for (size_t i = 0; i < numBlocks; ++i) {
+            FwFreeBlock * block = reinterpret_cast<FwFreeBlock *>(top + blockSize * i);
+            block->next = list.head;
+            list.head = block;
+        }
+        list.count += static_cast<sint32_t>(numBlocks);
+    }
+
+    /**
+     * @brief ヘッダ付きブロック用のチャンクをヒープから確保
+     */
+    static void * AllocHeapChunk() {
+#if defined(_ISOC11_SOURCE)
+        return aligned_alloc(s_smallBlockChunkAlign, s_smallBlockChunkSize);
+#else
+        return _aligned_malloc(s_smallBlockChunkSize, s_smallBlockChunkAlign);
+#endif
+    }
+
+
+    FwClassList     _classes[s_numSmallBlockClasses];
+    bool            _headerless;
+};
+
+/**
+ * @class FwSmallBlockThreadCache
+ * @brief スレッド毎に保持する未使用ブロック
+ */
+class FwSmallBlockThreadCache {
+public:
+    /**
+     * @brief ブロックを取得
+     */
+    FW_INLINE void * Pop(const sint32_t sizeClass) {
+        if (_destroyed) {
+            return FetchShared(sizeClass);
+        }
+        if (_heads[sizeClass] == nullptr) {
+            _counts[sizeClass] = _centralPool->Fetch(sizeClass, &_heads[sizeClass]);
+            if (_heads[sizeClass] == nullptr) {
+                return nullptr;
+            }
+        }
+        FwFreeBlock * block = _heads[sizeClass];
+        _heads[sizeClass] = block->next;
+        --_counts[sizeClass];
+        return block;
+    }
+
+    /**
+     * @brief ブロックを返却
+     */
+    FW_INLINE void Push(const sint32_t sizeClass, void * ptr) {
+        FwFreeBlock * block = reinterpret_cast<FwFreeBlock *>(ptr);
+        if (_destroyed) {
+            _centralPool->Release(sizeClass, block, block, 1);
+            return;
+        }
+        block->next = _heads[sizeClass];
+        _heads[sizeClass] = block;
+
+        if (++_counts[sizeClass] >= s_threadCacheMaxCount) {
+            Flush(sizeClass, s_threadCacheBatchCount);
+        }
+    }
+
+    /**
+     * @brief 共有プールを設定
+     */
+    FW_INLINE void Attach(FwSmallBlockCentralPool * centralPool) {
+        _centralPool = centralPool;
+    }
+
+    /**
+     * @brief 保持しているかどうか
+     */
+    FW_INLINE bool IsAttached() const {
+        return _centralPool != nullptr;
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwSmallBlockThreadCache()
+    : _centralPool(nullptr)
+    , _destroyed(false) {
+        for (sint32_t i = 0; i < s_numSmallBlockClasses; ++i) {
+            _heads[i] = nullptr;
+            _counts[i] = 0;
+        }
+    }
+
+    /**
+     * @brief デストラクタ
+     * @note スレッド終了時に保持していたブロックを共有プールへ戻す
+     *       この後に他のthread_localや静的オブジェクトのデストラクタから呼ばれた場合は、共有プールと直接やり取りする
+     */
+    ~FwSmallBlockThreadCache() {
+        if (_centralPool != nullptr) {
+            for (sint32_t i = 0; i < s_numSmallBlockClasses; ++i) {
+                Flush(i, _counts[i]);
+            }
+        }
+        _destroyed = true;
+    }
+
+
+private:
+    /**
+     * @brief 先頭から指定数を共有プールへ戻す
+     */
+    void Flush(const sint32_t sizeClass, const sint32_t count) {
+        if (count <= 0 || _heads[sizeClass] == nullptr) {
+            return;
+        }
+
+        FwFreeBlock * head = _heads[sizeClass];
+        FwFreeBlock * tail = head;
+        sint32_t numFlush = 1;
+        while (numFlush < count && tail->next != nullptr) {
+            tail = tail->next;
+            ++numFlush;
+        }
+
+        _heads[sizeClass] = tail->next;
+        _counts[sizeClass] -= numFlush;
+
+        _centralPool->Release(sizeClass, head, tail, numFlush);
+    }
+
+    /**
+     * @brief 共有プールから1つだけ取り出す
+     */
+    void * FetchShared(const sint32_t sizeClass) {
+        FwFreeBlock * head = nullptr;
+        const sint32_t count = _centralPool->Fetch(sizeClass, &head);
+        if (head == nullptr) {
+            return nullptr;
+        }
+
+        // 残りはすぐに戻す
+        if (1 < count) {
+            FwFreeBlock * tail = head->next;
+            while (tail->next != nullptr) {
+                tail = tail->next;
+            }
+            _centralPool->Release(sizeClass, head->next, tail, count - 1);
+        }
+        return head;
+    }
+
+
+    FwSmallBlockCentralPool *   _centralPool;
+    FwFreeBlock *               _heads[s_numSmallBlockClasses];
+    sint32_t                    _counts[s_numSmallBlockClasses];
+    bool                        _destroyed;     ///< スレッド終了時に破棄された
+};
+
+// スレッド毎のキャッシュ
+static thread_local FwSmallBlockThreadCache     s_threadCache;
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+// ヘッダ無しブロックのスレッド毎のキャッシュ
+static thread_local FwSmallBlockThreadCache     s_headerlessThreadCache;
+#endif
+#endif
+
 
 /**
  * @brief メモリブロックからタグを取得
  */
 sint32_t FwGetTagFromMemBlock(void *ptr) {
-    FwMemBlockHeader * header = reinterpret_cast<FwMemBlockHeader *>(reinterpret_cast<uintptr_t>(ptr) - sizeof(FwMemBlockHeader));
-    return header->tag;
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+    if (s_smallBlockRegion.GetSizeClass(ptr) >= 0) {
+        return FwDefaultMemAllocatorTag;
+    }
+#endif
+    return FwGetMemBlockHeader(ptr)->tag;
 }
 
 
@@ -58,38 +423,29 @@ public:
      */
     virtual void * Alloc(size_t size, size_t alignment, sint32_t tag) FW_OVERRIDE {
         const size_t numAligned = Max<size_t>(alignment, FW_PLATFORM_ALIGN_SIZE);
-        FwAssert(IsPowerOfTwo(numAligned) && (numAligned / sizeof(void *)) == 0);
-
-        const size_t realSize = size + sizeof(FwMemBlockHeader) + sizeof(FwMemBlockFooter) + numAligned;
-
-        void * ptr = nullptr;
-        {
-            std::lock_guard<std::recursive_mutex> lock(_mutex);
-
-            // メモリブロック取得
-#if defined(_ISOC11_SOURCE)
-            ptr = aligned_alloc(numAligned, realSize);
-#else
-            ptr = _aligned_malloc(realSize, numAligned);
-#endif
+        FwAssert(IsPowerOfTwo(numAligned) && (numAligned % sizeof(void *)) == 0);
+
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+        // 既定タグの小サイズはヘッダ無しでそのまま返す
+        if (tag == FwDefaultMemAllocatorTag) {
+            const sint32_t sizeClass = FwGetSmallBlockClass(size, numAligned);
+            if (sizeClass >= 0) {
+                void * block = PopHeaderlessBlock(sizeClass);
+                if (block != nullptr) {
+                    return block;
+                }
+            }
         }
+#endif
 
-        // 先頭アドレス算出
-        uintptr_t alignedPtr = RoundUp<uintptr_t>(reinterpret_cast<uintptr_t>(ptr) + sizeof(FwMemBlockHeader), numAligned);
-
-        // ヘッダ
-        FwMemBlockHeader * header = reinterpret_cast<FwMemBlockHeader *>(alignedPtr - sizeof(FwMemBlockHeader));
-        header->blockSize = size;
-        header->alignment = numAligned;
-        header->offsetBytes = static_cast<uint32_t>(alignedPtr - reinterpret_cast<uintptr_t>(ptr));
-        header->tag = static_cast<uint16_t>(tag);
-        header->magic = s_memBlockMagic;
+        const size_t realSize = FwGetMemBlockRealSize(size, numAligned);
 
-        // フッタ
-        FwMemBlockFooter * footer = reinterpret_cast<FwMemBlockFooter *>(alignedPtr + size);
-        footer->magic = s_memBlockMagic;
+        void * ptr = AllocRawBlock(realSize, numAligned);
+        if (ptr == nullptr) {
+            return nullptr;
+        }
 
-        return reinterpret_cast<void *>(alignedPtr);
+        return FwInitMemBlock(ptr, size, numAligned, tag);
     }
 
     /**
@@ -100,20 +456,54 @@ public:
             return nullptr;
         }
 
-        // ヘッダ
-        FwMemBlockHeader * header = reinterpret_cast<FwMemBlockHeader *>(reinterpret_cast<uintptr_t>(ptr) - sizeof(FwMemBlockHeader));
-        FwAssert(header->magic == s_memBlockMagic);
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+        const sint32_t sizeClass = s_smallBlockRegion.GetSizeClass(ptr);
+        if (sizeClass >= 0) {
+            // 要求サイズは残っていないので、サイズクラスの大きさ分を引き継ぐ
+            if (FwGetSmallBlockClass(size, FW_PLATFORM_ALIGN_SIZE) == sizeClass) {
+                return ptr;
+            }
+
+            void * newptr = Alloc(size, FW_PLATFORM_ALIGN_SIZE, FwDefaultMemAllocatorTag);
+            if (newptr == nullptr) {
+                return nullptr;
+            }
+            memcpy(newptr, ptr, Min(size, FwGetSmallBlockClassSize(sizeClass)));
+            PushHeaderlessBlock(sizeClass, ptr);
+            return newptr;
+        }
+#endif
+
+        // ヘッダ/フッタ
+        FwCheckMemBlock(ptr);
+        FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
 
-        // 現在のサイズより小さければ何もしない
-        if (size <= header->blockSize) {
+        const size_t numAligned = header->alignment;
+        const size_t offsetBytes = header->offsetBytes;
+        const size_t oldRealSize = FwGetMemBlockRealSize(header->blockSize, numAligned);
+        const size_t newRealSize = FwGetMemBlockRealSize(size, numAligned);
+
+        // 実ブロックに収まるならヘッダ/フッタを書き換えるだけ
+        if (IsSameRawBlock(oldRealSize, newRealSize, numAligned)) {
+            FwResizeMemBlock(ptr, size);
             return ptr;
         }
 
-        void * newptr = Alloc(size, header->alignment, header->tag);
-        FwAssert(newptr != nullptr);
+        // ヒープ上で伸縮できれば移動しても中身はコピーされている
+        void * origin = ReallocRawBlock(FwGetMemBlockOrigin(ptr), oldRealSize, newRealSize, numAligned);
+        if (origin != nullptr) {
+            void * newptr = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(origin) + offsetBytes);
+            FwResizeMemBlock(newptr, size);
+            return newptr;
+        }
+
+        void * newptr = Alloc(size, numAligned, header->tag);
+        if (newptr == nullptr) {
+            return nullptr;
+        }
 
         // 内容をコピー
-        memcpy(newptr, ptr, header->blockSize);
+        memcpy(newptr, ptr, Min(size, header->blockSize));
 
         // 旧ブロックを破棄
         Free(ptr);
@@ -129,32 +519,35 @@ public:
             return;
         }
 
-        // ヘッダ
-        FwMemBlockHeader * header = reinterpret_cast<FwMemBlockHeader *>(reinterpret_cast<uintptr_t>(ptr) - sizeof(FwMemBlockHeader));
-        FwAssert(header->magic == s_memBlockMagic);
-
-        // フッタ
-        FwMemBlockFooter * footer = reinterpret_cast<FwMemBlockFooter *>(reinterpret_cast<uintptr_t>(ptr) + header->blockSize);
-        FwAssert(footer->magic == s_memBlockMagic);
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+        const sint32_t sizeClass = s_smallBlockRegion.GetSizeClass(ptr);
+        if (sizeClass >= 0) {
+            PushHeaderlessBlock(sizeClass, ptr);
+            return;
+        }
+#endif
 
-        void * origin = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(ptr) - header->offsetBytes);
+        // ヘッダ/フッタ
+        FwCheckMemBlock(ptr);
+        FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
 
-        {
-            std::lock_guard<std::recursive_mutex> lock(_mutex);
+        void * origin = FwGetMemBlockOrigin(ptr);
+        const size_t realSize = FwGetMemBlockRealSize(header->blockSize, header->alignment);
 
-#if defined(_ISOC11_SOURCE)
-            free(origin);
-#else
-            _aligned_free(origin);
-#endif
-        }
+        FreeRawBlock(origin, realSize, header->alignment);
     }
 
     /**
      * @brief コンストラクタ
      */
-    FwDefaultAllocator() {
-        ;
+    FwDefaultAllocator()
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE
+    : _centralPool(false)
+#endif
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+    , _headerlessPool(true)
+#endif
+    {
     }
 
     /**
@@ -165,7 +558,146 @@ public:
     }
 
 private:
-    std::recursive_mutex    _mutex;
+    /**
+     * @brief 実ブロックを確保
+     */
+    void * AllocRawBlock(const size_t realSize, const size_t numAligned) {
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE
+        // 小サイズはスレッドキャッシュからロック無しで取得
+        // 解放時はサイズクラスのブロックとして再利用されるので、取れなくてもヒープへは回さない
+        const sint32_t sizeClass = FwGetSmallBlockClass(realSize, numAligned);
+        if (sizeClass >= 0) {
+            return PopSmallBlock(sizeClass);
+        }
+#endif
+
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        // メモリブロック取得
+#if defined(_ISOC11_SOURCE)
+        return aligned_alloc(numAligned, RoundUp(realSize, numAligned));
+#else
+        return _aligned_malloc(realSize, numAligned);
+#endif
+    }
+
+    /**
+     * @brief サイズを変えても同じ実ブロックのまま使えるか
+     */
+    bool IsSameRawBlock(const size_t oldRealSize, const size_t newRealSize, const size_t numAligned) const {
+        if (oldRealSize == newRealSize) {
+            return true;
+        }
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE
+        // 同じサイズクラスなら収まる
+        const sint32_t sizeClass = FwGetSmallBlockClass(oldRealSize, numAligned);
+        return sizeClass >= 0 && sizeClass == FwGetSmallBlockClass(newRealSize, numAligned);
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief ヒープ上で実ブロックを伸縮する
+     * @return 伸縮後の実ブロック。ヒープで扱えない場合はnullptr（元のブロックはそのまま）
+     */
+    void * ReallocRawBlock(void * origin, const size_t oldRealSize, const size_t newRealSize, const size_t numAligned) {
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE
+        // サイズクラスをまたぐ場合は移動させる
+        if (FwGetSmallBlockClass(oldRealSize, numAligned) >= 0 || FwGetSmallBlockClass(newRealSize, numAligned) >= 0) {
+            return nullptr;
+        }
+#endif
+
+#if defined(_ISOC11_SOURCE)
+        // reallocはmallocのアライメントしか保証しないので、それを超えると先頭からのオフセットが変わってしまう
+        if (numAligned > 2 * sizeof(void *)) {
+            return nullptr;
+        }
+
+        // 大きなブロックはmremapでページごと移動するのでコピーが発生しない
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        return realloc(origin, RoundUp(newRealSize, numAligned));
+#else
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        return _aligned_realloc(origin, newRealSize, numAligned);
+#endif
+    }
+
+    /**
+     * @brief 実ブロックを解放
+     */
+    void FreeRawBlock(void * origin, const size_t realSize, const size_t numAligned) {
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE
+        const sint32_t sizeClass = FwGetSmallBlockClass(realSize, numAligned);
+        if (sizeClass >= 0) {
+            PushSmallBlock(sizeClass, origin);
+            return;
+        }
+#endif
+
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+#if defined(_ISOC11_SOURCE)
+        free(origin);
+#else
+        _aligned_free(origin);
+#endif
+    }
+
+
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE
+    /**
+     * @brief スレッドキャッシュからサイズクラスのブロックを取得
+     */
+    FW_INLINE void * PopSmallBlock(const sint32_t sizeClass) {
+        if (!s_threadCache.IsAttached()) {
+            s_threadCache.Attach(&_centralPool);
+        }
+        return s_threadCache.Pop(sizeClass);
+    }
+
+    /**
+     * @brief スレッドキャッシュへサイズクラスのブロックを返却
+     */
+    FW_INLINE void PushSmallBlock(const sint32_t sizeClass, void * block) {
+        if (!s_threadCache.IsAttached()) {
+            s_threadCache.Attach(&_centralPool);
+        }
+        s_threadCache.Push(sizeClass, block);
+    }
+#endif
+
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+    /**
+     * @brief スレッドキャッシュからヘッダ無しブロックを取得
+     */
+    FW_INLINE void * PopHeaderlessBlock(const sint32_t sizeClass) {
+        if (!s_headerlessThreadCache.IsAttached()) {
+            s_headerlessThreadCache.Attach(&_headerlessPool);
+        }
+        return s_headerlessThreadCache.Pop(sizeClass);
+    }
+
+    /**
+     * @brief スレッドキャッシュへヘッダ無しブロックを返却
+     */
+    FW_INLINE void PushHeaderlessBlock(const sint32_t sizeClass, void * block) {
+        if (!s_headerlessThreadCache.IsAttached()) {
+            s_headerlessThreadCache.Attach(&_headerlessPool);
+        }
+        s_headerlessThreadCache.Push(sizeClass, block);
+    }
+#endif
+
+
+    std::recursive_mutex        _mutex;
+#if FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE
+    FwSmallBlockCentralPool     _centralPool;       ///< ヘッダ付きの小サイズブロック
+#endif
+#if FW_ENABLE_HEADERLESS_SMALL_BLOCK
+    FwSmallBlockCentralPool     _headerlessPool;    ///< 既定タグのヘッダ無しブロック
+#endif
 };
 
 
@@ -192,6 +724,8 @@ FwMemAllocator* FwGetMemAllocator(sint32_t tag) {
 // 内部使用関数
 //-----------------------------------------------------------
 #undef FwMalloc
+#undef FwMallocAligned
+#undef FwRealloc
 #undef FwFree
 
 void * FwMalloc(size_t size, sint32_t tag) {
@@ -202,8 +736,41 @@ void * FwMalloc(size_t size, sint32_t tag) {
     return nullptr;
 }
 
+void * FwMallocAligned(size_t size, size_t alignment, sint32_t tag) {
+    auto allocator = FwGetMemAllocator(tag);
+    if (allocator != nullptr) {
+        return allocator->Alloc(size, alignment, tag);
+    }
+    return nullptr;
+}
+
+void * FwRealloc(void * ptr, size_t size) {
+    if (ptr == nullptr) {
+        return nullptr;
+    }
+#if FW_ENABLE_MEM_TRACKING
+    // 移動や伸縮でサイズが変わるので一旦記録から外す
+    FwMemCallsite * callsite = FwGetMemBlockHeader(ptr)->callsite;
+    FwMemTrackFree(ptr);
+#endif
+    auto tag = FwGetTagFromMemBlock(ptr);
+    auto allocator = FwGetMemAllocator(tag);
+    void * newptr = allocator->Realloc(ptr, size);
+#if FW_ENABLE_MEM_TRACKING
+    // 失敗した場合は元のブロックが残っているので記録し直す
+    if (newptr == nullptr) {
+        FwMemTrackRestore(ptr, callsite);
+    }
+#endif
+    return newptr;
+}
+
 void FwFree(void * ptr) {
     if (ptr != nullptr) {
+#if FW_ENABLE_MEM_TRACKING
+        // FwMallocDebugで確保したブロックは記録から外す
+        FwMemTrackFree(ptr);
+#endif
         auto tag = FwGetTagFromMemBlock(ptr);
         auto allocator = FwGetMemAllocator(tag);
         allocator->Free(ptr);
@@ -211,12 +778,37 @@ void FwFree(void * ptr) {
 }
 
 void * FwMallocDebug(size_t size, sint32_t tag, const char * file, int line) {
-    //! @todo デバッグ情報収集
-    return FwMalloc(size, tag);
+    void * ptr = FwMalloc(size, tag);
+#if FW_ENABLE_MEM_TRACKING
+    if (ptr != nullptr) {
+        FwMemTrackAlloc(ptr, size, tag, file, line);
+    }
+#endif
+    return ptr;
+}
+
+void * FwMallocAlignedDebug(size_t size, size_t alignment, sint32_t tag, const char * file, int line) {
+    void * ptr = FwMallocAligned(size, alignment, tag);
+#if FW_ENABLE_MEM_TRACKING
+    if (ptr != nullptr) {
+        FwMemTrackAlloc(ptr, size, tag, file, line);
+    }
+#endif
+    return ptr;
+}
+
+void * FwReallocDebug(void * ptr, size_t size, const char * file, int line) {
+    void * newptr = FwRealloc(ptr, size);
+#if FW_ENABLE_MEM_TRACKING
+    if (newptr != nullptr) {
+        FwMemTrackAlloc(newptr, size, FwGetTagFromMemBlock(newptr), file, line);
+    }
+#endif
+    return newptr;
 }
 
 void FwFreeDebug(void * ptr) {
-    //! @todo デバッグ情報収集
+    // 記録の解除はFwFreeで行う
     FwFree(ptr);
 }
 //-----------------------------------------------------------
@@ -0,0 +1,35 @@
+﻿/**
+ * @file fw_dlmalloc.c
+ * @brief 同梱のdlmalloc(malloc.c)をmspace専用としてビルドする
+ */
+
+// mspace関数のみ有効にしてCRTのmalloc/freeと衝突させない
+#define ONLY_MSPACES        1
+
+// mspace毎にロックを持てるようにする
+#define USE_LOCKS           1
+
+#include "malloc.c"
+
+
+//------------------------------------------------------------------
+// FwMSpaceAllocatorが予約領域を少しずつコミットするための内部参照
+// どれもmspaceのロックを取らないので、呼び出し側で排他しておくこと
+//------------------------------------------------------------------
+
+// topチャンクの先頭とサイズを取得
+void * mspace_top(mspace msp, size_t * topSize) {
+    mstate ms = (mstate)msp;
+    *topSize = ms->topsize;
+    return ms->top;
+}
+
+// 要求サイズから切り出すチャンクのサイズを取得
+size_t mspace_request_size(size_t bytes) {
+    return (bytes >= MAX_REQUEST) ? MAX_SIZE_T : request2size(bytes);
+}
+
+// 使用中のチャンクの合計サイズ（全チャンクを辿るので遅い）
+size_t mspace_used_bytes(mspace msp) {
+    return mspace_mallinfo(msp).uordblks;
+}
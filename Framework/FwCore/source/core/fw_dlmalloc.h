@@ -0,0 +1,31 @@
+﻿/**
+ * @file fw_dlmalloc.h
+ * @brief 同梱のdlmalloc(malloc.c)のmspace関数宣言（内部使用）
+ */
+#ifndef FW_DLMALLOC_H_
+#define FW_DLMALLOC_H_
+
+extern "C" {
+    typedef void * mspace;
+
+    mspace  create_mspace_with_base(void * base, size_t capacity, int locked);
+    size_t  destroy_mspace(mspace msp);
+    void *  mspace_malloc(mspace msp, size_t bytes);
+    void *  mspace_memalign(mspace msp, size_t alignment, size_t bytes);
+    void    mspace_free(mspace msp, void * mem);
+    void *  mspace_realloc(mspace msp, void * mem, size_t newsize);
+    void *  mspace_realloc_in_place(mspace msp, void * mem, size_t newsize);
+    int     mspace_trim(mspace msp, size_t pad);
+    size_t  mspace_footprint(mspace msp);
+    size_t  mspace_max_footprint(mspace msp);
+    size_t  mspace_usable_size(const void * mem);
+    int     mspace_track_large_chunks(mspace msp, int enable);
+    size_t  mspace_set_footprint_limit(mspace msp, size_t bytes);
+
+    // fw_dlmalloc.cで追加した内部参照
+    void *  mspace_top(mspace msp, size_t * topSize);
+    size_t  mspace_request_size(size_t bytes);
+    size_t  mspace_used_bytes(mspace msp);
+}
+
+#endif  // FW_DLMALLOC_H_
@@ -0,0 +1,209 @@
+﻿/**
+ * @file fw_fiber.cpp
+ */
+#include "precompiled.h"
+#include "threading/fw_fiber.h"
+#include "fw_virtual_memory.h"
+
+#if !defined(FW_PLATFORM_WIN32) && !(defined(FW_PLATFORM_LINUX) && defined(FW_ARCH_X64))
+    #include <ucontext.h>
+#endif
+
+
+#if defined(FW_PLATFORM_LINUX) && defined(FW_ARCH_X64)
+/**
+ * 呼び出し先保存レジスタとFPU/SSEの制御ワードだけを退避してスタックを切り替える（System V AMD64 ABI）
+ *   void FwFiberSwitchContext(void ** from, void * to)
+ * 新しいファイバーは、r12にFwFiber、r13にエントリ関数を積んだスタックからFwFiberStartへ戻る形で開始する
+ */
+extern "C" void FwFiberSwitchContext(void ** from, void * to);
+extern "C" void FwFiberStart();
+
+__asm__(
+    ".text\n"
+    ".globl FwFiberSwitchContext\n"
+    ".type FwFiberSwitchContext, @function\n"
+    "FwFiberSwitchContext:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $16, %rsp\n"
+    "    fnstcw (%rsp)\n"
+    "    stmxcsr 8(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    fldcw (%rsp)\n"
+    "    ldmxcsr 8(%rsp)\n"
+    "    addq $16, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size FwFiberSwitchContext, .-FwFiberSwitchContext\n"
+
+    ".globl FwFiberStart\n"
+    ".type FwFiberStart, @function\n"
+    "FwFiberStart:\n"
+    "    pushq $0\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    ".size FwFiberStart, .-FwFiberStart\n"
+);
+#endif
+
+
+BEGIN_NAMESPACE_FW
+
+void FwFiber::Entry(FwFiber * fiber) {
+    fiber->func(fiber->userArgs);
+
+    // 戻ってくると行き先が無い
+    FwAssertMessage(false, "fiber function must not return");
+    std::abort();
+}
+
+#if defined(FW_PLATFORM_WIN32)
+void __stdcall FwFiber::NativeEntry(void * userArgs) {
+    Entry(reinterpret_cast<FwFiber *>(userArgs));
+}
+#elif !(defined(FW_PLATFORM_LINUX) && defined(FW_ARCH_X64))
+void FwFiber::NativeEntry(uint32_t high, uint32_t low) {
+    // makecontextにはintしか渡せないので分けて渡す
+    const uintptr_t address = (static_cast<uint64_t>(high) << 32) | low;
+    Entry(reinterpret_cast<FwFiber *>(address));
+}
+#endif
+
+bool FwFiber::Create(FwFiberFunc _func, void * _userArgs, const size_t _stackSize) {
+    FwAssert(!IsValid());
+    if (_func == nullptr) {
+        return false;
+    }
+    func = _func;
+    userArgs = _userArgs;
+
+#if defined(FW_PLATFORM_WIN32)
+    stackSize = _stackSize;
+    context = ::CreateFiberEx(stackSize, stackSize, FIBER_FLAG_FLOAT_SWITCH, reinterpret_cast<LPFIBER_START_ROUTINE>(&FwFiber::NativeEntry), this);
+    return context != nullptr;
+#else
+    // 先頭にガードページを置いて、スタックが溢れたら書き込みで落ちるようにする
+    const size_t pageSize = FwVirtualMemoryPageSize();
+    stackSize = (Max<size_t>(_stackSize, pageSize) + pageSize - 1) / pageSize * pageSize;
+    stack = FwVirtualMemoryReserve(stackSize + pageSize);
+    if (stack == nullptr) {
+        return false;
+    }
+    if (!FwVirtualMemoryCommit(reinterpret_cast<uint8_t *>(stack) + pageSize, stackSize)) {
+        Destroy();
+        return false;
+    }
+    uint8_t * stackBottom = reinterpret_cast<uint8_t *>(stack) + pageSize;
+
+#if defined(FW_PLATFORM_LINUX) && defined(FW_ARCH_X64)
+    // FwFiberSwitchContextが復元する並びで初期値を積む
+    uint64_t * frame = reinterpret_cast<uint64_t *>(stackBottom + stackSize) - 10;
+    frame[0] = 0x037f;                                          // x87制御ワード
+    frame[1] = 0x1f80;                                          // MXCSR
+    frame[2] = 0;                                               // r15
+    frame[3] = 0;                                               // r14
+    frame[4] = reinterpret_cast<uint64_t>(&FwFiber::Entry);     // r13
+    frame[5] = reinterpret_cast<uint64_t>(this);                // r12
+    frame[6] = 0;                                               // rbx
+    frame[7] = 0;                                               // rbp
+    frame[8] = reinterpret_cast<uint64_t>(&FwFiberStart);       // 戻り先
+    frame[9] = 0;
+    context = frame;
+#else
+    ucontext_t * uc = reinterpret_cast<ucontext_t *>(FwMalloc(sizeof(ucontext_t), FwDefaultMemAllocatorTag));
+    if (uc == nullptr || getcontext(uc) != 0) {
+        FwFree(uc);
+        Destroy();
+        return false;
+    }
+    uc->uc_stack.ss_sp = stackBottom;
+    uc->uc_stack.ss_size = stackSize;
+    uc->uc_link = nullptr;
+    const uint64_t address = reinterpret_cast<uintptr_t>(this);
+    makecontext(uc, reinterpret_cast<void (*)()>(&FwFiber::NativeEntry), 2, static_cast<uint32_t>(address >> 32), static_cast<uint32_t>(address));
+    context = uc;
+#endif
+    return true;
+#endif
+}
+
+bool FwFiber::ConvertFromThread() {
+    FwAssert(!IsValid());
+
+#if defined(FW_PLATFORM_WIN32)
+    context = ::IsThreadAFiber() ? ::GetCurrentFiber() : ::ConvertThreadToFiberEx(nullptr, FIBER_FLAG_FLOAT_SWITCH);
+    if (context == nullptr) {
+        return false;
+    }
+#elif !(defined(FW_PLATFORM_LINUX) && defined(FW_ARCH_X64))
+    // 中断する時に保存するので領域だけ用意する
+    context = FwMalloc(sizeof(ucontext_t), FwDefaultMemAllocatorTag);
+    if (context == nullptr) {
+        return false;
+    }
+#endif
+    threadFiber = true;
+    return true;
+}
+
+void FwFiber::Destroy() {
+#if defined(FW_PLATFORM_WIN32)
+    if (context != nullptr) {
+        if (threadFiber) {
+            ::ConvertFiberToThread();
+        } else {
+            ::DeleteFiber(context);
+        }
+    }
+#else
+    #if !(defined(FW_PLATFORM_LINUX) && defined(FW_ARCH_X64))
+    FwFree(context);
+    #endif
+    if (stack != nullptr) {
+        FwVirtualMemoryRelease(stack, stackSize + FwVirtualMemoryPageSize());
+    }
+#endif
+    context = nullptr;
+    stack = nullptr;
+    stackSize = 0;
+    threadFiber = false;
+}
+
+void FwFiber::SwitchTo(FwFiber * next) {
+    FwAssert(next != nullptr && next != this && next->IsValid());
+
+#if defined(FW_PLATFORM_WIN32)
+    ::SwitchToFiber(next->context);
+#elif defined(FW_PLATFORM_LINUX) && defined(FW_ARCH_X64)
+    FwFiberSwitchContext(&context, next->context);
+#else
+    swapcontext(reinterpret_cast<ucontext_t *>(context), reinterpret_cast<ucontext_t *>(next->context));
+#endif
+}
+
+FwFiber::FwFiber()
+: context(nullptr)
+, stack(nullptr)
+, stackSize(0)
+, func(nullptr)
+, userArgs(nullptr)
+, threadFiber(false) {
+}
+
+FwFiber::~FwFiber() {
+    Destroy();
+}
+
+END_NAMESPACE_FW
@@ -0,0 +1,256 @@
+﻿/**
+ * @file fw_frame_allocator.cpp
+ */
+#include "precompiled.h"
+#include "core/fw_frame_allocator.h"
+
+#include <atomic>
+
+#include "fw_mem_block.h"
+#include "fw_mem_tracker.h"
+#include "fw_virtual_memory.h"
+
+#if !defined(FW_NDEBUG) || FW_BUILD_CONFIG_FORCE_ENABLE_MEM_POISON
+    #define FW_ENABLE_FRAME_MEM_POISON      (1)
+#endif
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+// 破棄したフレームを埋める値
+static const uint8_t    s_frameMemPoison = 0xdd;
+
+#if FW_ENABLE_MEM_TRACKING
+/**
+ * @struct FwFrameChunk
+ * @brief フレーム終端で確保の記録を外すためにブロックの前に置く情報
+ */
+struct FwFrameChunk {
+    size_t      chunkSize;  ///< 次のブロックまでのサイズ（0なら終端）
+    void *      ptr;        ///< ユーザーに返したアドレス
+};
+
+static const size_t     s_frameChunkSize = RoundUp(sizeof(FwFrameChunk), FW_PLATFORM_ALIGN_SIZE);
+#else
+static const size_t     s_frameChunkSize = 0;
+#endif
+
+/**
+ * @struct FwFrameBuffer
+ */
+struct FW_ALIGN64 FwFrameBuffer {
+    uint8_t *               base;
+    std::atomic<size_t>     offset;
+};
+
+/**
+ * @class FwFrameAllocatorImpl
+ */
+class FwFrameAllocatorImpl : public FwFrameAllocator {
+public:
+    /**
+     * @brief 初期化
+     */
+    sint32_t Init(const FwFrameAllocatorDesc * desc) {
+        if (desc->numBuffers < 1 || FwMaxFrameBufferCount < desc->numBuffers) {
+            return ERR_INVALID_PARMS;
+        }
+
+        _bufferSize = RoundUp(desc->bufferSize, FwVirtualMemoryPageSize());
+        _numBuffers = desc->numBuffers;
+        _reserveSize = _bufferSize * _numBuffers;
+
+        _base = FwVirtualMemoryReserve(_reserveSize);
+        if (_base == nullptr) {
+            return ERR_OUT_OF_MEMORY;
+        }
+        if (!FwVirtualMemoryCommit(_base, _reserveSize)) {
+            FwVirtualMemoryRelease(_base, _reserveSize);
+            _base = nullptr;
+            return ERR_OUT_OF_MEMORY;
+        }
+
+        for (sint32_t i = 0; i < _numBuffers; ++i) {
+            _buffers[i].base = reinterpret_cast<uint8_t *>(_base) + _bufferSize * i;
+            _buffers[i].offset.store(0, std::memory_order_relaxed);
+        }
+        _current.store(0, std::memory_order_release);
+
+        return FW_OK;
+    }
+
+    /**
+     * @brief 動的なメモリ確保
+     */
+    virtual void * Alloc(size_t size, size_t alignment, sint32_t tag) FW_OVERRIDE {
+        const size_t numAligned = Max<size_t>(alignment, FW_PLATFORM_ALIGN_SIZE);
+        FwAssert(IsPowerOfTwo(numAligned) && (numAligned % sizeof(void *)) == 0);
+
+        const size_t realSize = s_frameChunkSize + RoundUp(FwGetMemBlockRealSize(size, numAligned), FW_PLATFORM_ALIGN_SIZE);
+
+        FwFrameBuffer & buffer = _buffers[_current.load(std::memory_order_acquire)];
+        const size_t offset = buffer.offset.fetch_add(realSize, std::memory_order_relaxed);
+        if (_bufferSize < offset + realSize) {
+#if FW_ENABLE_MEM_TRACKING
+            // バッファの末尾をまたいだブロックは1つだけなので、そこを終端にする
+            if (offset + s_frameChunkSize <= _bufferSize) {
+                reinterpret_cast<FwFrameChunk *>(buffer.base + offset)->chunkSize = 0;
+            }
+#endif
+            FwAssertMessage(false, "frame buffer overflow");
+            return nullptr;
+        }
+
+        void * ptr = FwInitMemBlock(buffer.base + offset + s_frameChunkSize, size, numAligned, tag);
+#if FW_ENABLE_MEM_TRACKING
+        FwFrameChunk * chunk = reinterpret_cast<FwFrameChunk *>(buffer.base + offset);
+        chunk->chunkSize = realSize;
+        chunk->ptr = ptr;
+#endif
+        return ptr;
+    }
+
+    /**
+     * @brief 動的メモリを再確保
+     */
+    virtual void * Realloc(void *ptr, size_t size) FW_OVERRIDE {
+        if (ptr == nullptr || size == 0) {
+            return nullptr;
+        }
+
+        FwCheckMemBlock(ptr);
+        FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
+
+        // 現在のサイズより小さければ何もしない
+        if (size <= header->blockSize) {
+            return ptr;
+        }
+
+        // 旧ブロックはフレーム終端でまとめて破棄される
+        void * newptr = Alloc(size, header->alignment, header->tag);
+        if (newptr != nullptr) {
+            memcpy(newptr, ptr, header->blockSize);
+        }
+        return newptr;
+    }
+
+    /**
+     * @brief 動的メモリを解放
+     */
+    virtual void Free(void *ptr) FW_OVERRIDE {
+        // フレーム終端でまとめて破棄するので何もしない
+        if (ptr != nullptr) {
+            FwAssert(_base <= ptr && ptr < reinterpret_cast<uint8_t *>(_base) + _reserveSize);
+            FwCheckMemBlock(ptr);
+        }
+    }
+
+    /**
+     * @brief フレームの終端
+     */
+    virtual void EndFrame() FW_OVERRIDE {
+        const uint32_t next = (_current.load(std::memory_order_relaxed) + 1) % _numBuffers;
+
+        // 最も古いフレームのバッファを破棄して次のフレームで使う
+        FwFrameBuffer & buffer = _buffers[next];
+        const size_t used = Min(buffer.offset.load(std::memory_order_relaxed), _bufferSize);
+        _peakSize = Max(_peakSize, used);
+
+#if FW_ENABLE_MEM_TRACKING
+        // FwMallocDebugで確保されたまま破棄されるブロックを記録から外す
+        for (size_t offset = 0; offset + s_frameChunkSize <= used; ) {
+            const FwFrameChunk * chunk = reinterpret_cast<const FwFrameChunk *>(buffer.base + offset);
+            if (chunk->chunkSize == 0) {
+                break;
+            }
+            FwMemTrackFree(chunk->ptr);
+            offset += chunk->chunkSize;
+        }
+#endif
+
+#if FW_ENABLE_FRAME_MEM_POISON
+        // 寿命が切れたポインタを使っていたら気付けるように埋めておく
+        memset(buffer.base, s_frameMemPoison, used);
+#endif
+        buffer.offset.store(0, std::memory_order_relaxed);
+
+        _current.store(next, std::memory_order_release);
+    }
+
+    /**
+     * @brief 現在のフレームで使用中のサイズを取得
+     */
+    virtual size_t GetUsedSize() const FW_OVERRIDE {
+        const FwFrameBuffer & buffer = _buffers[_current.load(std::memory_order_acquire)];
+        return Min(buffer.offset.load(std::memory_order_relaxed), _bufferSize);
+    }
+
+    /**
+     * @brief これまでの1フレームの最大使用サイズを取得
+     */
+    virtual size_t GetPeakSize() const FW_OVERRIDE {
+        return Max(_peakSize, GetUsedSize());
+    }
+
+    /**
+     * @brief 1フレーム分のバッファサイズを取得
+     */
+    virtual size_t GetBufferSize() const FW_OVERRIDE {
+        return _bufferSize;
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwFrameAllocatorImpl()
+    : _base(nullptr)
+    , _reserveSize(0)
+    , _bufferSize(0)
+    , _peakSize(0)
+    , _numBuffers(0)
+    , _current(0) {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwFrameAllocatorImpl() {
+        FwVirtualMemoryRelease(_base, _reserveSize);
+        _base = nullptr;
+    }
+
+
+private:
+    void *                  _base;
+    size_t                  _reserveSize;
+    size_t                  _bufferSize;
+    size_t                  _peakSize;
+    sint32_t                _numBuffers;
+    std::atomic<uint32_t>   _current;
+    FwFrameBuffer           _buffers[FwMaxFrameBufferCount];
+};
+
+END_NAMESPACE_NONAME
+
+
+// 生成
+FwFrameAllocator * FwCreateFrameAllocator(const FwFrameAllocatorDesc * desc) {
+    if (desc == nullptr) {
+        return nullptr;
+    }
+
+    FwFrameAllocatorImpl * allocator = FwNew<FwFrameAllocatorImpl>();
+    if (allocator->Init(desc) != FW_OK) {
+        FwDelete(allocator);
+        return nullptr;
+    }
+    return allocator;
+}
+
+// 破棄
+void FwDestroyFrameAllocator(FwFrameAllocator * allocator) {
+    FwDelete(static_cast<FwFrameAllocatorImpl *>(allocator));
+}
+
+END_NAMESPACE_FW
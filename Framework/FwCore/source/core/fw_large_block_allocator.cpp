@@ -0,0 +1,455 @@
+﻿/**
+ * @file fw_large_block_allocator.cpp
+ */
+#include "precompiled.h"
+#include "core/fw_large_block_allocator.h"
+
+#include <atomic>
+#include <mutex>
+
+#include "fw_mem_block.h"
+#include "fw_virtual_memory.h"
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+static const sint32_t   s_maxLargeBlockExtents = 1024;
+
+/**
+ * @struct FwLargeBlockExtent
+ * @brief 予約領域内の空き範囲
+ */
+struct FwLargeBlockExtent {
+    size_t  offset;
+    size_t  size;
+};
+
+/**
+ * @class FwLargeBlockAllocatorImpl
+ */
+class FwLargeBlockAllocatorImpl : public FwLargeBlockAllocator {
+public:
+    /**
+     * @brief 初期化
+     */
+    sint32_t Init(const FwLargeBlockAllocatorDesc * desc) {
+        _hugePageSize = FwVirtualMemoryHugePageSize();
+        _granularity = Max(FwVirtualMemoryPageSize(), FwLargeBlockGranularity);
+        _hugePage = (_hugePageSize != 0) ? desc->hugePage : FwHugePageNone;
+
+        // ヒュージページで予約できればコミット済みの状態で使う
+        if (_hugePage == FwHugePageExplicit) {
+            _reserveSize = RoundUp(desc->reserveSize, _hugePageSize);
+            _reserveBase = FwVirtualMemoryReserveHugePages(_reserveSize);
+            if (_reserveBase != nullptr) {
+                _base = reinterpret_cast<uint8_t *>(_reserveBase);
+                _reserveTotal = _reserveSize;
+                _granularity = _hugePageSize;
+                _committedUpFront = true;
+            } else {
+                _hugePage = FwHugePageTransparent;
+            }
+        }
+
+        if (_reserveBase == nullptr) {
+            // ヒュージページ境界に揃えるために余分に予約する
+            const size_t alignment = Max(_granularity, _hugePageSize);
+            _reserveSize = RoundUp(desc->reserveSize, alignment);
+            _reserveTotal = _reserveSize + alignment;
+            _reserveBase = FwVirtualMemoryReserve(_reserveTotal);
+            if (_reserveBase == nullptr) {
+                return ERR_OUT_OF_MEMORY;
+            }
+            _base = reinterpret_cast<uint8_t *>(RoundUp(reinterpret_cast<uintptr_t>(_reserveBase), alignment));
+
+            if (_hugePage == FwHugePageTransparent && !FwVirtualMemoryAdviseHugePages(_base, _reserveSize)) {
+                _hugePage = FwHugePageNone;
+            }
+        }
+
+        _freeExtents[0].offset = 0;
+        _freeExtents[0].size = _reserveSize;
+        _numFreeExtents = 1;
+
+        return FW_OK;
+    }
+
+    /**
+     * @brief 動的なメモリ確保
+     */
+    virtual void * Alloc(size_t size, size_t alignment, sint32_t tag) FW_OVERRIDE {
+        const size_t numAligned = Max<size_t>(alignment, FW_PLATFORM_ALIGN_SIZE);
+        FwAssert(IsPowerOfTwo(numAligned) && (numAligned % sizeof(void *)) == 0);
+
+        const size_t realSize = GetRealSize(size, numAligned);
+        const size_t placement = (_hugePage != FwHugePageNone && _hugePageSize <= realSize) ? _hugePageSize : _granularity;
+
+        size_t offset = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!AllocExtent(realSize, placement, &offset)) {
+                return nullptr;
+            }
+        }
+
+        uint8_t * origin = _base + offset;
+        if (!_committedUpFront && !FwVirtualMemoryCommit(origin, realSize)) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            FreeExtent(offset, realSize);
+            return nullptr;
+        }
+
+        _committedSize.fetch_add(realSize, std::memory_order_relaxed);
+        _liveBytes.fetch_add(size, std::memory_order_relaxed);
+        _numBlocks.fetch_add(1, std::memory_order_relaxed);
+
+        return FwInitMemBlock(origin, size, numAligned, tag);
+    }
+
+    /**
+     * @brief 動的メモリを再確保
+     */
+    virtual void * Realloc(void *ptr, size_t size) FW_OVERRIDE {
+        if (ptr == nullptr || size == 0) {
+            return nullptr;
+        }
+
+        FwCheckMemBlock(ptr);
+        FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
+
+        const size_t blockSize = header->blockSize;
+        const size_t numAligned = header->alignment;
+        const size_t offsetBytes = header->offsetBytes;
+        const size_t oldRealSize = GetRealSize(blockSize, numAligned);
+        const size_t newRealSize = GetRealSize(size, numAligned);
+
+        uint8_t * origin = reinterpret_cast<uint8_t *>(FwGetMemBlockOrigin(ptr));
+        const size_t offset = static_cast<size_t>(origin - _base);
+
+        // 同じ範囲に収まる
+        if (newRealSize == oldRealSize) {
+            ResizeBlock(ptr, blockSize, size);
+            return ptr;
+        }
+
+        // 縮小は末尾を空き範囲に戻す
+        if (newRealSize < oldRealSize) {
+            const size_t tailSize = oldRealSize - newRealSize;
+            ResizeBlock(ptr, blockSize, size);
+            ReleasePages(origin + newRealSize, tailSize);
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            FreeExtent(offset + newRealSize, tailSize);
+            return ptr;
+        }
+
+        // 直後の空き範囲を取り込めればその場で伸ばす
+        const size_t growSize = newRealSize - oldRealSize;
+        bool grown = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            grown = AllocExtentAt(offset + oldRealSize, growSize);
+        }
+        if (grown) {
+            if (!_committedUpFront && !FwVirtualMemoryCommit(origin + oldRealSize, growSize)) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                FreeExtent(offset + oldRealSize, growSize);
+                return nullptr;
+            }
+            _committedSize.fetch_add(growSize, std::memory_order_relaxed);
+            ResizeBlock(ptr, blockSize, size);
+            return ptr;
+        }
+
+        // 別の範囲へページごと付け替える（中身はコピーしない）
+        if (!_committedUpFront) {
+            const size_t placement = (_hugePage != FwHugePageNone && _hugePageSize <= newRealSize) ? _hugePageSize : _granularity;
+            size_t newOffset = 0;
+            bool allocated = false;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                allocated = AllocExtent(newRealSize, placement, &newOffset);
+            }
+            if (allocated) {
+                uint8_t * newOrigin = _base + newOffset;
+                if (FwVirtualMemoryRemap(newOrigin, newRealSize, origin, oldRealSize)) {
+                    _committedSize.fetch_add(growSize, std::memory_order_relaxed);
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        FreeExtent(offset, oldRealSize);
+                    }
+                    void * newptr = newOrigin + offsetBytes;
+                    ResizeBlock(newptr, blockSize, size);
+                    return newptr;
+                }
+                std::lock_guard<std::mutex> lock(_mutex);
+                FreeExtent(newOffset, newRealSize);
+            }
+        }
+
+        void * newptr = Alloc(size, numAligned, header->tag);
+        if (newptr == nullptr) {
+            return nullptr;
+        }
+
+        // 内容をコピー
+        memcpy(newptr, ptr, blockSize);
+
+        // 旧ブロックを破棄
+        Free(ptr);
+
+        return newptr;
+    }
+
+    /**
+     * @brief 動的メモリを解放
+     */
+    virtual void Free(void *ptr) FW_OVERRIDE {
+        if (ptr == nullptr) {
+            return;
+        }
+
+        FwCheckMemBlock(ptr);
+        FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
+
+        uint8_t * origin = reinterpret_cast<uint8_t *>(FwGetMemBlockOrigin(ptr));
+        FwAssert(_base <= origin && origin < _base + _reserveSize);
+
+        const size_t blockSize = header->blockSize;
+        const size_t realSize = GetRealSize(blockSize, header->alignment);
+
+        // 物理メモリはすぐにOSへ返す
+        ReleasePages(origin, realSize);
+
+        _liveBytes.fetch_sub(blockSize, std::memory_order_relaxed);
+        _numBlocks.fetch_sub(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        FreeExtent(static_cast<size_t>(origin - _base), realSize);
+    }
+
+    /**
+     * @brief 統計情報を取得
+     */
+    virtual void GetStats(FwLargeBlockAllocatorStats * stats) FW_OVERRIDE {
+        if (stats == nullptr) {
+            return;
+        }
+        stats->reserveSize      = _reserveSize;
+        stats->committedSize    = _committedUpFront ? _reserveSize : _committedSize.load(std::memory_order_relaxed);
+        stats->liveBytes        = _liveBytes.load(std::memory_order_relaxed);
+        stats->numBlocks        = _numBlocks.load(std::memory_order_relaxed);
+        stats->hugePage         = _hugePage;
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwLargeBlockAllocatorImpl()
+    : _reserveBase(nullptr)
+    , _reserveTotal(0)
+    , _base(nullptr)
+    , _reserveSize(0)
+    , _granularity(0)
+    , _hugePageSize(0)
+    , _hugePage(FwHugePageNone)
+    , _committedUpFront(false)
+    , _numFreeExtents(0)
+    , _committedSize(0)
+    , _liveBytes(0)
+    , _numBlocks(0) {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwLargeBlockAllocatorImpl() {
+        FwVirtualMemoryRelease(_reserveBase, _reserveTotal);
+        _reserveBase = nullptr;
+    }
+
+
+private:
+    /**
+     * @brief ヘッダ込みで予約領域から切り出すサイズを取得
+     */
+    FW_INLINE size_t GetRealSize(const size_t size, const size_t numAligned) const {
+        return RoundUp(FwGetMemBlockRealSize(size, numAligned), _granularity);
+    }
+
+    /**
+     * @brief ブロックのサイズを変更（予約領域内の範囲は変わらない）
+     */
+    void ResizeBlock(void * ptr, const size_t oldSize, const size_t newSize) {
+        FwResizeMemBlock(ptr, newSize);
+        if (oldSize < newSize) {
+            _liveBytes.fetch_add(newSize - oldSize, std::memory_order_relaxed);
+        } else {
+            _liveBytes.fetch_sub(oldSize - newSize, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 物理メモリをOSへ返す
+     */
+    void ReleasePages(uint8_t * ptr, const size_t size) {
+        if (_committedUpFront) {
+            FwVirtualMemoryDiscard(ptr, size);
+        } else {
+            FwVirtualMemoryDecommit(ptr, size);
+        }
+        _committedSize.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 指定した位置から始まる空き範囲を切り出す
+     */
+    bool AllocExtentAt(const size_t offset, const size_t size) {
+        for (sint32_t i = 0; i < _numFreeExtents; ++i) {
+            FwLargeBlockExtent & extent = _freeExtents[i];
+            if (offset < extent.offset) {
+                break;
+            }
+            if (extent.offset != offset) {
+                continue;
+            }
+            if (extent.size < size) {
+                return false;
+            }
+
+            if (extent.size == size) {
+                RemoveExtent(i);
+            } else {
+                extent.offset += size;
+                extent.size -= size;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 空き範囲から切り出す（先頭から最初に収まる範囲を使う）
+     */
+    bool AllocExtent(const size_t size, const size_t placement, size_t * offset) {
+        for (sint32_t i = 0; i < _numFreeExtents; ++i) {
+            FwLargeBlockExtent & extent = _freeExtents[i];
+            const size_t start = RoundUp(extent.offset, placement);
+            const size_t end = extent.offset + extent.size;
+            if (end < start || end - start < size) {
+                continue;
+            }
+
+            const size_t frontSize = start - extent.offset;
+            const size_t backSize = end - (start + size);
+            if (frontSize != 0 && backSize != 0) {
+                // 前後に分かれる場合は1つ増える
+                if (s_maxLargeBlockExtents <= _numFreeExtents) {
+                    FwAssertMessage(false, "large block extents exhausted");
+                    return false;
+                }
+                memmove(&_freeExtents[i + 2], &_freeExtents[i + 1], sizeof(FwLargeBlockExtent) * (_numFreeExtents - i - 1));
+                ++_numFreeExtents;
+                _freeExtents[i].size = frontSize;
+                _freeExtents[i + 1].offset = start + size;
+                _freeExtents[i + 1].size = backSize;
+            } else if (frontSize != 0) {
+                extent.size = frontSize;
+            } else if (backSize != 0) {
+                extent.offset = start + size;
+                extent.size = backSize;
+            } else {
+                RemoveExtent(i);
+            }
+
+            *offset = start;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 空き範囲に戻す（隣接する範囲とは結合する）
+     */
+    void FreeExtent(const size_t offset, const size_t size) {
+        // 挿入位置を探す
+        sint32_t index = 0;
+        while (index < _numFreeExtents && _freeExtents[index].offset < offset) {
+            ++index;
+        }
+
+        const bool mergePrev = (0 < index) && (_freeExtents[index - 1].offset + _freeExtents[index - 1].size == offset);
+        const bool mergeNext = (index < _numFreeExtents) && (offset + size == _freeExtents[index].offset);
+
+        if (mergePrev && mergeNext) {
+            _freeExtents[index - 1].size += size + _freeExtents[index].size;
+            RemoveExtent(index);
+        } else if (mergePrev) {
+            _freeExtents[index - 1].size += size;
+        } else if (mergeNext) {
+            _freeExtents[index].offset = offset;
+            _freeExtents[index].size += size;
+        } else {
+            // 結合できずに溢れた範囲は使えなくなるだけなので諦める
+            if (s_maxLargeBlockExtents <= _numFreeExtents) {
+                FwAssertMessage(false, "large block extents exhausted");
+                return;
+            }
+            memmove(&_freeExtents[index + 1], &_freeExtents[index], sizeof(FwLargeBlockExtent) * (_numFreeExtents - index));
+            ++_numFreeExtents;
+            _freeExtents[index].offset = offset;
+            _freeExtents[index].size = size;
+        }
+    }
+
+    /**
+     * @brief 空き範囲を削除
+     */
+    void RemoveExtent(const sint32_t index) {
+        memmove(&_freeExtents[index], &_freeExtents[index + 1], sizeof(FwLargeBlockExtent) * (_numFreeExtents - index - 1));
+        --_numFreeExtents;
+    }
+
+
+    void *                  _reserveBase;
+    size_t                  _reserveTotal;
+    uint8_t *               _base;
+    size_t                  _reserveSize;
+    size_t                  _granularity;
+    size_t                  _hugePageSize;
+    FwHugePageMode          _hugePage;
+    bool                    _committedUpFront;
+
+    std::mutex              _mutex;
+    FwLargeBlockExtent      _freeExtents[s_maxLargeBlockExtents];
+    sint32_t                _numFreeExtents;
+
+    std::atomic<size_t>     _committedSize;
+    std::atomic<size_t>     _liveBytes;
+    std::atomic<size_t>     _numBlocks;
+};
+
+END_NAMESPACE_NONAME
+
+
+// 生成
+FwLargeBlockAllocator * FwCreateLargeBlockAllocator(const FwLargeBlockAllocatorDesc * desc) {
+    if (desc == nullptr) {
+        return nullptr;
+    }
+
+    FwLargeBlockAllocatorImpl * allocator = FwNew<FwLargeBlockAllocatorImpl>();
+    if (allocator->Init(desc) != FW_OK) {
+        FwDelete(allocator);
+        return nullptr;
+    }
+    return allocator;
+}
+
+// 破棄
+void FwDestroyLargeBlockAllocator(FwLargeBlockAllocator * allocator) {
+    FwDelete(static_cast<FwLargeBlockAllocatorImpl *>(allocator));
+}
+
+END_NAMESPACE_FW
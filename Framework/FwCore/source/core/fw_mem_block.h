@@ -0,0 +1,123 @@
+﻿/**
+ * @file fw_mem_block.h
+ * @brief メモリブロックのヘッダ/フッタ操作（内部使用）
+ */
+#ifndef FW_MEM_BLOCK_H_
+#define FW_MEM_BLOCK_H_
+
+#if defined(FW_DEBUG) || FW_BUILD_CONFIG_FORCE_ENABLE_MEM_TRACKING
+    #define FW_ENABLE_MEM_TRACKING      (1)
+#endif
+
+// 記録先のポインタをヘッダに持つので、記録する場合はヘッダ/フッタを省かない
+#if defined(FW_DEBUG) || FW_BUILD_CONFIG_FORCE_ENABLE_MEM_GUARD || FW_ENABLE_MEM_TRACKING
+    #define FW_ENABLE_MEM_GUARD         (1)
+#endif
+
+BEGIN_NAMESPACE_FW
+
+struct FwMemCallsite;
+
+/**
+ * @struct FwMemBlockHeader
+ */
+struct FwMemBlockHeader {
+#if FW_ENABLE_MEM_TRACKING
+    FwMemCallsite * callsite;   ///< 確保した場所の記録（FwMallocDebug以外で確保した場合はnullptr）
+#endif
+    size_t      blockSize;      ///< メモリブロックサイズ
+    size_t      alignment;      ///< アライメントサイズ
+    uint16_t    offsetBytes;    ///< 実アドレスへのオフセット
+    uint16_t    tag;            ///< タグ情報
+    uint32_t    magic;          ///< オーバーラン識別用マジック
+};
+
+/**
+ * @struct FwMemBlockFooter
+ */
+struct FwMemBlockFooter {
+    uint32_t    magic;          ///< オーバーラン識別用マジック
+};
+
+// メモリオーバーラン検出用マジック
+static const uint32_t   s_memBlockMagic = 0xdeadbeef;
+
+/**
+ * @brief ヘッダ/フッタ込みで必要な実ブロックサイズを取得
+ * @param[in] size       要求サイズ
+ * @param[in] numAligned アライメント
+ */
+FW_INLINE size_t FwGetMemBlockRealSize(const size_t size, const size_t numAligned) {
+    return size + sizeof(FwMemBlockHeader) + sizeof(FwMemBlockFooter) + numAligned;
+}
+
+/**
+ * @brief 実ブロックにヘッダ/フッタを書き込む
+ * @param[in] origin     実ブロックの先頭
+ * @param[in] size       要求サイズ
+ * @param[in] numAligned アライメント
+ * @param[in] tag        タグ
+ * @return ユーザーに返すアドレス
+ */
+FW_INLINE void * FwInitMemBlock(void * origin, const size_t size, const size_t numAligned, const sint32_t tag) {
+    // 先頭アドレス算出
+    uintptr_t alignedPtr = RoundUp<uintptr_t>(reinterpret_cast<uintptr_t>(origin) + sizeof(FwMemBlockHeader), numAligned);
+
+    // ヘッダ
+    FwMemBlockHeader * header = reinterpret_cast<FwMemBlockHeader *>(alignedPtr - sizeof(FwMemBlockHeader));
+    header->blockSize = size;
+    header->alignment = numAligned;
+    header->offsetBytes = static_cast<uint16_t>(alignedPtr - reinterpret_cast<uintptr_t>(origin));
+    header->tag = static_cast<uint16_t>(tag);
+    header->magic = s_memBlockMagic;
+#if FW_ENABLE_MEM_TRACKING
+    header->callsite = nullptr;
+#endif
+
+    // フッタ
+    FwMemBlockFooter * footer = reinterpret_cast<FwMemBlockFooter *>(alignedPtr + size);
+    footer->magic = s_memBlockMagic;
+
+    return reinterpret_cast<void *>(alignedPtr);
+}
+
+/**
+ * @brief ユーザーアドレスからヘッダを取得
+ */
+FW_INLINE FwMemBlockHeader * FwGetMemBlockHeader(void * ptr) {
+    return reinterpret_cast<FwMemBlockHeader *>(reinterpret_cast<uintptr_t>(ptr) - sizeof(FwMemBlockHeader));
+}
+
+/**
+ * @brief ユーザーアドレスから実ブロックの先頭を取得
+ */
+FW_INLINE void * FwGetMemBlockOrigin(void * ptr) {
+    return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(ptr) - FwGetMemBlockHeader(ptr)->offsetBytes);
+}
+
+/**
+ * @brief 同じ実ブロックのままサイズを変更する
+ * @param[in] ptr  ユーザーアドレス
+ * @param[in] size 新しいサイズ
+ */
+FW_INLINE void FwResizeMemBlock(void * ptr, const size_t size) {
+    FwGetMemBlockHeader(ptr)->blockSize = size;
+
+    FwMemBlockFooter * footer = reinterpret_cast<FwMemBlockFooter *>(reinterpret_cast<uintptr_t>(ptr) + size);
+    footer->magic = s_memBlockMagic;
+}
+
+/**
+ * @brief ヘッダ/フッタが壊れていないか確認
+ */
+FW_INLINE void FwCheckMemBlock(void * ptr) {
+    FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
+    FwAssert(header->magic == s_memBlockMagic);
+
+    FwMemBlockFooter * footer = reinterpret_cast<FwMemBlockFooter *>(reinterpret_cast<uintptr_t>(ptr) + header->blockSize);
+    FwAssert(footer->magic == s_memBlockMagic);
+}
+
+END_NAMESPACE_FW
+
+#endif  // FW_MEM_BLOCK_H_
@@ -0,0 +1,449 @@
+﻿/**
+ * @file fw_mem_stats.cpp
+ */
+#include "precompiled.h"
+#include "core/fw_mem_stats.h"
+
+#include <atomic>
+#include <string.h>
+
+#include "fw_mem_tracker.h"
+
+
+BEGIN_NAMESPACE_FW
+
+#if FW_ENABLE_MEM_TRACKING
+/**
+ * @struct FwMemCallsite
+ * @brief 確保場所毎の記録
+ * @note  書き込むのは所有スレッドだけ。カウンタは解放したスレッドからも更新される
+ */
+struct FwMemCallsite {
+    std::atomic<const char *>   file;
+    sint32_t                    line;
+    sint32_t                    tag;
+    std::atomic<sint64_t>       liveBytes;
+    std::atomic<sint64_t>       liveCount;
+    std::atomic<uint64_t>       allocCount;
+};
+#endif
+
+BEGIN_NAMESPACE_NONAME
+
+#if FW_ENABLE_MEM_TRACKING
+static const sint32_t   s_callsiteTableSize = 1024;
+static const char *     s_overflowCallsiteName = "(overflow)";
+
+/**
+ * @struct FwMemCallsiteTable
+ * @brief スレッド毎の確保場所テーブル
+ * @note  スレッド終了後も確保したブロックから参照されるので破棄しない
+ */
+struct FwMemCallsiteTable {
+    FwMemCallsiteTable *    next;
+    FwMemCallsite           overflow;
+    FwMemCallsite           entries[s_callsiteTableSize];
+};
+
+/**
+ * @struct FwMemTagCounter
+ */
+struct FW_ALIGN64 FwMemTagCounter {
+    std::atomic<sint64_t>   liveBytes;
+    std::atomic<sint64_t>   peakBytes;
+    std::atomic<uint64_t>   allocCount;
+    std::atomic<uint64_t>   freeCount;
+    std::atomic<uint64_t>   histogram[FwMemStatsHistogramBuckets];
+};
+
+static std::atomic<FwMemCallsiteTable *>    s_callsiteTables(nullptr);
+static thread_local FwMemCallsiteTable *    s_threadCallsiteTable = nullptr;
+static FwMemTagCounter                      s_tagCounters[FwMaxMemAllocatorTag + 1];
+
+/**
+ * @brief 実行中のスレッドの確保場所テーブルを取得
+ */
+static FwMemCallsiteTable * GetThreadCallsiteTable() {
+    if (s_threadCallsiteTable != nullptr) {
+        return s_threadCallsiteTable;
+    }
+
+    // 記録の対象にならないようにアロケータから直接確保する
+    FwMemAllocator * allocator = FwGetMemAllocator(FwDefaultMemAllocatorTag);
+    void * p = allocator->Alloc(sizeof(FwMemCallsiteTable), FW_PLATFORM_ALIGN_SIZE, FwDefaultMemAllocatorTag);
+    if (p == nullptr) {
+        return nullptr;
+    }
+    FwMemCallsiteTable * table = new(p) FwMemCallsiteTable();
+    table->overflow.line = 0;
+    table->overflow.tag = -1;
+    table->overflow.file.store(s_overflowCallsiteName, std::memory_order_release);
+
+    // 全スレッドのテーブルをつないでおく
+    FwMemCallsiteTable * head = s_callsiteTables.load(std::memory_order_relaxed);
+    do {
+        table->next = head;
+    } while (!s_callsiteTables.compare_exchange_weak(head, table, std::memory_order_release, std::memory_order_relaxed));
+
+    s_threadCallsiteTable = table;
+    return table;
+}
+
+/**
+ * @brief 確保場所の記録を検索、無ければ追加
+ */
+static FwMemCallsite * FindCallsite(FwMemCallsiteTable * table, const char * file, const sint32_t line, const sint32_t tag) {
+    const uint32_t hash = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(file) >> 3) ^ (static_cast<uint32_t>(line) * 0x9e3779b1) ^ static_cast<uint32_t>(tag);
+
+    for (sint32_t i = 0; i < s_callsiteTableSize; ++i) {
+        FwMemCallsite & callsite = table->entries[(hash + i) & (s_callsiteTableSize - 1)];
+
+        const char * entryFile = callsite.file.load(std::memory_order_relaxed);
+        if (entryFile == nullptr) {
+            // 所有スレッドしか追加しないのでロックは不要
+            callsite.line = line;
+            callsite.tag = tag;
+            callsite.file.store(file, std::memory_order_release);
+            return &callsite;
+        }
+        if (entryFile == file && callsite.line == line && callsite.tag == tag) {
+            return &callsite;
+        }
+    }
+    return &table->overflow;
+}
+
+/**
+ * @brief サイズからヒストグラムのバケットを取得
+ */
+static sint32_t GetHistogramBucket(const size_t size) {
+    sint32_t bucket = 0;
+    size_t limit = 16;
+    while (bucket < FwMemStatsHistogramBuckets - 1 && limit < size) {
+        limit <<= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+#endif  // FW_ENABLE_MEM_TRACKING
+
+/**
+ * @brief 確保場所の並び順（ファイル、行、タグ）
+ */
+static bool LessCallsite(const FwMemCallsiteStats & a, const FwMemCallsiteStats & b) {
+    const int cmp = strcmp(a.file, b.file);
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+    if (a.line != b.line) {
+        return a.line < b.line;
+    }
+    return a.tag < b.tag;
+}
+
+/**
+ * @class FwMemSnapshotImpl
+ */
+class FwMemSnapshotImpl : public FwMemSnapshot {
+public:
+    FwMemTagStats           tags[FwMaxMemAllocatorTag + 1];
+    FwMemCallsiteStats *    callsites;
+    sint32_t                numCallsites;
+
+    /**
+     * @brief 確保場所の領域を確保
+     */
+    bool AllocCallsites(const sint32_t capacity) {
+        if (capacity == 0) {
+            return true;
+        }
+        callsites = reinterpret_cast<FwMemCallsiteStats *>(FwMalloc(sizeof(FwMemCallsiteStats) * capacity, FwDefaultMemAllocatorTag));
+        return callsites != nullptr;
+    }
+
+    /**
+     * @brief 確保場所を並べ替えて同じ場所の記録をまとめる
+     */
+    void MergeCallsites() {
+        if (numCallsites == 0) {
+            return;
+        }
+        std::sort(callsites, callsites + numCallsites, LessCallsite);
+
+        sint32_t n = 0;
+        for (sint32_t i = 1; i < numCallsites; ++i) {
+            FwMemCallsiteStats & dst = callsites[n];
+            const FwMemCallsiteStats & src = callsites[i];
+            if (!LessCallsite(dst, src)) {
+                dst.liveBytes += src.liveBytes;
+                dst.liveCount += src.liveCount;
+                dst.allocCount += src.allocCount;
+            } else {
+                callsites[++n] = src;
+            }
+        }
+        numCallsites = n + 1;
+    }
+
+    // 自身を破棄
+    virtual void DoRelease() FW_OVERRIDE {
+        FwDelete(this);
+    }
+
+    // タグ毎の統計を取得
+    virtual const FwMemTagStats & DoGetTagStats(const sint32_t tag) const FW_OVERRIDE {
+        FwAssert(FwMinMemAllocatorTag <= tag && tag <= FwMaxMemAllocatorTag);
+        return tags[tag];
+    }
+
+    // 記録されている確保場所の数を取得
+    virtual sint32_t DoGetNumCallsites() const FW_OVERRIDE {
+        return numCallsites;
+    }
+
+    // 確保場所毎の統計を取得
+    virtual const FwMemCallsiteStats & DoGetCallsite(const sint32_t index) const FW_OVERRIDE {
+        FwAssert(0 <= index && index < numCallsites);
+        return callsites[index];
+    }
+
+    // デバッグログへ出力
+    virtual void DoDump(const sint32_t maxCallsites) const FW_OVERRIDE {
+        for (sint32_t tag = FwMinMemAllocatorTag; tag <= FwMaxMemAllocatorTag; ++tag) {
+            const FwMemTagStats & stats = tags[tag];
+            if (stats.allocCount == 0 && stats.freeCount == 0 && stats.liveBytes == 0) {
+                continue;
+            }
+            DebugLog::Info((str_t)(_T("[mem] tag %d : live %lld bytes (peak %lld) alloc %llu free %llu\n")),
+                tag, stats.liveBytes, stats.peakBytes, stats.allocCount, stats.freeCount);
+        }
+
+        if (numCallsites == 0 || maxCallsites <= 0) {
+            return;
+        }
+
+        // 使用中のバイト数が多い順に並べる
+        const sint32_t numDump = Min(numCallsites, maxCallsites);
+        const FwMemCallsiteStats ** order = reinterpret_cast<const FwMemCallsiteStats **>(FwMalloc(sizeof(FwMemCallsiteStats *) * numCallsites, FwDefaultMemAllocatorTag));
+        if (order == nullptr) {
+            return;
+        }
+        for (sint32_t i = 0; i < numCallsites; ++i) {
+            order[i] = &callsites[i];
+        }
+        std::partial_sort(order, order + numDump, order + numCallsites, [](const FwMemCallsiteStats * a, const FwMemCallsiteStats * b) {
+            const sint64_t sizeA = a->liveBytes < 0 ? -a->liveBytes : a->liveBytes;
+            const sint64_t sizeB = b->liveBytes < 0 ? -b->liveBytes : b->liveBytes;
+            return sizeA > sizeB;
+        });
+
+        for (sint32_t i = 0; i < numDump; ++i) {
+            const FwMemCallsiteStats * callsite = order[i];
+            DebugLog::Info((str_t)(_T("[mem] %hs(%d) tag %d : %lld bytes in %lld blocks (%llu allocs)\n")),
+                callsite->file, callsite->line, callsite->tag, callsite->liveBytes, callsite->liveCount, callsite->allocCount);
+        }
+
+        FwFree(order);
+    }
+
+    FwMemSnapshotImpl()
+    : callsites(nullptr)
+    , numCallsites(0) {
+        for (sint32_t tag = FwMinMemAllocatorTag; tag <= FwMaxMemAllocatorTag; ++tag) {
+            tags[tag].Init();
+        }
+    }
+
+    virtual ~FwMemSnapshotImpl() {
+        FwFree(callsites);
+    }
+};
+
+END_NAMESPACE_NONAME
+
+
+#if FW_ENABLE_MEM_TRACKING
+// 確保したブロックを記録
+void FwMemTrackAlloc(void * ptr, const size_t size, const sint32_t tag, const char * file, const int line) {
+    FwMemCallsiteTable * table = GetThreadCallsiteTable();
+    if (table == nullptr) {
+        return;
+    }
+
+    FwMemCallsite * callsite = FindCallsite(table, file, line, tag);
+    callsite->liveBytes.fetch_add(static_cast<sint64_t>(size), std::memory_order_relaxed);
+    callsite->liveCount.fetch_add(1, std::memory_order_relaxed);
+    callsite->allocCount.fetch_add(1, std::memory_order_relaxed);
+
+    FwMemTagCounter & counter = s_tagCounters[tag];
+    const sint64_t liveBytes = counter.liveBytes.fetch_add(static_cast<sint64_t>(size), std::memory_order_relaxed) + static_cast<sint64_t>(size);
+    sint64_t peakBytes = counter.peakBytes.load(std::memory_order_relaxed);
+    while (peakBytes < liveBytes && !counter.peakBytes.compare_exchange_weak(peakBytes, liveBytes, std::memory_order_relaxed)) {
+    }
+    counter.allocCount.fetch_add(1, std::memory_order_relaxed);
+    counter.histogram[GetHistogramBucket(size)].fetch_add(1, std::memory_order_relaxed);
+
+    FwGetMemBlockHeader(ptr)->callsite = callsite;
+}
+
+// ブロックの解放を記録
+void FwMemTrackFree(void * ptr) {
+    FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
+    FwMemCallsite * callsite = header->callsite;
+    if (callsite == nullptr) {
+        return;
+    }
+    header->callsite = nullptr;
+
+    const sint64_t size = static_cast<sint64_t>(header->blockSize);
+    callsite->liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    callsite->liveCount.fetch_sub(1, std::memory_order_relaxed);
+
+    FwMemTagCounter & counter = s_tagCounters[header->tag];
+    counter.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    counter.freeCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 外した記録を元に戻す
+void FwMemTrackRestore(void * ptr, FwMemCallsite * callsite) {
+    if (callsite == nullptr) {
+        return;
+    }
+    FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
+    header->callsite = callsite;
+
+    const sint64_t size = static_cast<sint64_t>(header->blockSize);
+    callsite->liveBytes.fetch_add(size, std::memory_order_relaxed);
+    callsite->liveCount.fetch_add(1, std::memory_order_relaxed);
+
+    FwMemTagCounter & counter = s_tagCounters[header->tag];
+    counter.liveBytes.fetch_add(size, std::memory_order_relaxed);
+    counter.freeCount.fetch_sub(1, std::memory_order_relaxed);
+}
+#endif  // FW_ENABLE_MEM_TRACKING
+
+
+// タグ毎の現在の統計を取得
+void FwGetMemTagStats(const sint32_t tag, FwMemTagStats * stats) {
+    FwAssert(FwMinMemAllocatorTag <= tag && tag <= FwMaxMemAllocatorTag);
+    if (stats == nullptr) {
+        return;
+    }
+    stats->Init();
+
+#if FW_ENABLE_MEM_TRACKING
+    const FwMemTagCounter & counter = s_tagCounters[tag];
+    stats->liveBytes = counter.liveBytes.load(std::memory_order_relaxed);
+    stats->peakBytes = counter.peakBytes.load(std::memory_order_relaxed);
+    stats->allocCount = counter.allocCount.load(std::memory_order_relaxed);
+    stats->freeCount = counter.freeCount.load(std::memory_order_relaxed);
+    for (sint32_t i = 0; i < FwMemStatsHistogramBuckets; ++i) {
+        stats->histogram[i] = counter.histogram[i].load(std::memory_order_relaxed);
+    }
+#endif
+}
+
+// 現在のメモリ使用量を記録
+FwMemSnapshot * FwTakeMemSnapshot() {
+    FwMemSnapshotImpl * snapshot = FwNew<FwMemSnapshotImpl>();
+
+    for (sint32_t tag = FwMinMemAllocatorTag; tag <= FwMaxMemAllocatorTag; ++tag) {
+        FwGetMemTagStats(tag, &snapshot->tags[tag]);
+    }
+
+#if FW_ENABLE_MEM_TRACKING
+    // 先に数えてから領域を確保する
+    FwMemCallsiteTable * tables = s_callsiteTables.load(std::memory_order_acquire);
+    sint32_t capacity = 0;
+    for (FwMemCallsiteTable * table = tables; table != nullptr; table = table->next) {
+        capacity += 1;
+        for (sint32_t i = 0; i < s_callsiteTableSize; ++i) {
+            if (table->entries[i].file.load(std::memory_order_acquire) != nullptr) {
+                ++capacity;
+            }
+        }
+    }
+    if (!snapshot->AllocCallsites(capacity)) {
+        return snapshot;
+    }
+
+    // 領域の確保で増えた分は次のスナップショットに回す
+    for (FwMemCallsiteTable * table = tables; table != nullptr && snapshot->numCallsites < capacity; table = table->next) {
+        for (sint32_t i = -1; i < s_callsiteTableSize && snapshot->numCallsites < capacity; ++i) {
+            const FwMemCallsite & src = (i < 0) ? table->overflow : table->entries[i];
+            const char * file = src.file.load(std::memory_order_acquire);
+            if (file == nullptr || src.allocCount.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            FwMemCallsiteStats & dst = snapshot->callsites[snapshot->numCallsites++];
+            dst.file = file;
+            dst.line = src.line;
+            dst.tag = src.tag;
+            dst.liveBytes = src.liveBytes.load(std::memory_order_relaxed);
+            dst.liveCount = src.liveCount.load(std::memory_order_relaxed);
+            dst.allocCount = src.allocCount.load(std::memory_order_relaxed);
+        }
+    }
+    snapshot->MergeCallsites();
+#endif
+
+    return snapshot;
+}
+
+// 2つのスナップショットの差分を作成
+FwMemSnapshot * FwDiffMemSnapshot(const FwMemSnapshot * from, const FwMemSnapshot * to) {
+    if (from == nullptr || to == nullptr) {
+        return nullptr;
+    }
+    const FwMemSnapshotImpl * a = static_cast<const FwMemSnapshotImpl *>(from);
+    const FwMemSnapshotImpl * b = static_cast<const FwMemSnapshotImpl *>(to);
+
+    FwMemSnapshotImpl * diff = FwNew<FwMemSnapshotImpl>();
+
+    for (sint32_t tag = FwMinMemAllocatorTag; tag <= FwMaxMemAllocatorTag; ++tag) {
+        const FwMemTagStats & sa = a->tags[tag];
+        const FwMemTagStats & sb = b->tags[tag];
+        FwMemTagStats & dst = diff->tags[tag];
+        dst.liveBytes = sb.liveBytes - sa.liveBytes;
+        dst.peakBytes = sb.peakBytes;
+        dst.allocCount = sb.allocCount - sa.allocCount;
+        dst.freeCount = sb.freeCount - sa.freeCount;
+        for (sint32_t i = 0; i < FwMemStatsHistogramBuckets; ++i) {
+            dst.histogram[i] = sb.histogram[i] - sa.histogram[i];
+        }
+    }
+
+    if (!diff->AllocCallsites(a->numCallsites + b->numCallsites)) {
+        return diff;
+    }
+
+    // どちらも並べ替え済みなので先頭から突き合わせる
+    sint32_t ia = 0;
+    sint32_t ib = 0;
+    while (ia < a->numCallsites || ib < b->numCallsites) {
+        FwMemCallsiteStats entry;
+        if (ib == b->numCallsites || (ia < a->numCallsites && LessCallsite(a->callsites[ia], b->callsites[ib]))) {
+            entry = a->callsites[ia++];
+            entry.liveBytes = -entry.liveBytes;
+            entry.liveCount = -entry.liveCount;
+            entry.allocCount = 0;
+        } else if (ia == a->numCallsites || LessCallsite(b->callsites[ib], a->callsites[ia])) {
+            entry = b->callsites[ib++];
+        } else {
+            entry = b->callsites[ib];
+            entry.liveBytes -= a->callsites[ia].liveBytes;
+            entry.liveCount -= a->callsites[ia].liveCount;
+            entry.allocCount -= a->callsites[ia].allocCount;
+            ++ia;
+            ++ib;
+        }
+
+        if (entry.liveBytes != 0 || entry.liveCount != 0 || entry.allocCount != 0) {
+            diff->callsites[diff->numCallsites++] = entry;
+        }
+    }
+
+    return diff;
+}
+
+END_NAMESPACE_FW
@@ -0,0 +1,40 @@
+﻿/**
+ * @file fw_mem_tracker.h
+ * @brief FwMallocDebugによる確保の記録（内部使用）
+ */
+#ifndef FW_MEM_TRACKER_H_
+#define FW_MEM_TRACKER_H_
+
+#include "fw_mem_block.h"
+
+BEGIN_NAMESPACE_FW
+
+#if FW_ENABLE_MEM_TRACKING
+/**
+ * @brief 確保したブロックを記録
+ * @param[in] ptr  確保したブロック
+ * @param[in] size 要求サイズ
+ * @param[in] tag  タグ
+ * @param[in] file 確保したファイル
+ * @param[in] line 確保した行
+ */
+void FwMemTrackAlloc(void * ptr, const size_t size, const sint32_t tag, const char * file, const int line);
+
+/**
+ * @brief ブロックの解放を記録
+ * @note  FwMallocDebugで確保していないブロックは何もしない
+ */
+void FwMemTrackFree(void * ptr);
+
+/**
+ * @brief FwMemTrackFreeで外した記録を元に戻す
+ * @note  再確保に失敗して元のブロックが残った場合に使う。解放の回数も取り消す
+ * @param[in] ptr      ブロック
+ * @param[in] callsite FwMemTrackFreeを呼ぶ前にヘッダに記録されていた確保場所
+ */
+void FwMemTrackRestore(void * ptr, FwMemCallsite * callsite);
+#endif
+
+END_NAMESPACE_FW
+
+#endif  // FW_MEM_TRACKER_H_
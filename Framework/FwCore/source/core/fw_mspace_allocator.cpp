@@ -0,0 +1,409 @@
+﻿/**
+ * @file fw_mspace_allocator.cpp
+ */
+#include "precompiled.h"
+#include "core/fw_mspace_allocator.h"
+
+#include <atomic>
+
+#include "fw_mem_block.h"
+#include "fw_virtual_memory.h"
+#include "fw_dlmalloc.h"
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+static const size_t s_commitGranularity = 64 * 1024;            ///< 予約領域をコミットする単位
+static const size_t s_chunkHeaderSize   = 2 * sizeof(size_t);   ///< topから切り出した後ろに書かれる次のtopのヘッダ
+
+/**
+ * @class FwMSpaceAllocatorImpl
+ * @note  予約領域はmspaceのtopの手前までしかコミットしません
+ *        topから切り出す前に必要な分だけコミットし、Trimでtopの未使用ページを返却します
+ *        topの位置を見てからmspaceを操作するので、mspaceのロックではなくこのクラスのミューテックスで排他します
+ */
+class FwMSpaceAllocatorImpl : public FwMSpaceAllocator {
+public:
+    /**
+     * @brief 初期化
+     */
+    sint32_t Init(const FwMSpaceAllocatorDesc * desc) {
+        _pageSize = FwVirtualMemoryPageSize();
+        _reserveSize = RoundUp(Max(desc->reserveSize, 2 * s_commitGranularity), s_commitGranularity);
+        _threadSafe = desc->threadSafe;
+        _growable = desc->growable;
+
+        // アドレス空間を予約して物理メモリは触れたページから割り当てる
+        void * base = nullptr;
+        if (desc->numaNode != FwNumaNodeAny) {
+            base = FwVirtualMemoryReserveOnNode(_reserveSize, desc->numaNode, &_numaBound);
+        } else {
+            base = FwVirtualMemoryReserve(_reserveSize);
+        }
+        if (base == nullptr) {
+            return ERR_OUT_OF_MEMORY;
+        }
+        _base = reinterpret_cast<uint8_t *>(base);
+
+        const sint32_t result = InitHeap();
+        if (result != FW_OK) {
+            FwVirtualMemoryRelease(_base, _reserveSize);
+            _base = nullptr;
+        }
+        return result;
+    }
+
+    /**
+     * @brief 動的なメモリ確保
+     */
+    virtual void * Alloc(size_t size, size_t alignment, sint32_t tag) FW_OVERRIDE {
+        const size_t numAligned = Max<size_t>(alignment, FW_PLATFORM_ALIGN_SIZE);
+        FwAssert(IsPowerOfTwo(numAligned) && (numAligned % sizeof(void *)) == 0);
+
+        const size_t realSize = FwGetMemBlockRealSize(size, numAligned);
+        void * origin = nullptr;
+        {
+            ScopedLock lock(*this);
+            if (CommitForRequest(realSize)) {
+                origin = mspace_malloc(_mspace, realSize);
+            }
+        }
+        if (origin == nullptr) {
+            return nullptr;
+        }
+
+        _liveBytes.fetch_add(size, std::memory_order_relaxed);
+        _numBlocks.fetch_add(1, std::memory_order_relaxed);
+
+        return FwInitMemBlock(origin, size, numAligned, tag);
+    }
+
+    /**
+     * @brief 動的メモリを再確保
+     */
+    virtual void * Realloc(void *ptr, size_t size) FW_OVERRIDE {
+        if (ptr == nullptr || size == 0) {
+            return nullptr;
+        }
+
+        FwCheckMemBlock(ptr);
+        FwMemBlockHeader * header = FwGetMemBlockHeader(ptr);
+
+        const size_t blockSize = header->blockSize;
+        const size_t numAligned = header->alignment;
+        const size_t offsetBytes = header->offsetBytes;
+        const size_t realSize = FwGetMemBlockRealSize(size, numAligned);
+        void * origin = FwGetMemBlockOrigin(ptr);
+
+        {
+            ScopedLock lock(*this);
+            if (!CommitForRequest(realSize)) {
+                return nullptr;
+            }
+
+            // 隣接する空きチャンクとの間で伸縮できればそのまま使う
+            if (mspace_realloc_in_place(_mspace, origin, realSize) == origin) {
+                ResizeBlock(ptr, blockSize, size);
+                return ptr;
+            }
+
+            // mspaceの境界と同じアライメントなら、移動しても先頭からのオフセットは変わらない
+            if (numAligned <= 2 * sizeof(void *)) {
+                void * newOrigin = mspace_realloc(_mspace, origin, realSize);
+                if (newOrigin == nullptr) {
+                    return nullptr;
+                }
+                void * newptr = reinterpret_cast<uint8_t *>(newOrigin) + offsetBytes;
+                ResizeBlock(newptr, blockSize, size);
+                return newptr;
+            }
+        }
+
+        void * newptr = Alloc(size, numAligned, header->tag);
+        if (newptr == nullptr) {
+            return nullptr;
+        }
+
+        // 内容をコピー
+        memcpy(newptr, ptr, Min(size, blockSize));
+
+        // 旧ブロックを破棄
+        Free(ptr);
+
+        return newptr;
+    }
+
+    /**
+     * @brief 動的メモリを解放
+     */
+    virtual void Free(void *ptr) FW_OVERRIDE {
+        if (ptr == nullptr) {
+            return;
+        }
+
+        FwCheckMemBlock(ptr);
+
+        _liveBytes.fetch_sub(FwGetMemBlockHeader(ptr)->blockSize, std::memory_order_relaxed);
+        _numBlocks.fetch_sub(1, std::memory_order_relaxed);
+
+        ScopedLock lock(*this);
+        mspace_free(_mspace, FwGetMemBlockOrigin(ptr));
+    }
+
+    /**
+     * @brief 末尾の未使用領域をOSへ返却する
+     */
+    virtual bool Trim(size_t pad) FW_OVERRIDE {
+        ScopedLock lock(*this);
+
+        // 予約領域外に伸びたセグメントはdlmallocが返却する（予約領域はEXTERNなので対象外）
+        bool trimmed = mspace_trim(_mspace, pad) != 0;
+
+        // topが予約領域内にあれば、topのヘッダとpadを残して後ろのページをデコミットする
+        size_t topSize = 0;
+        uint8_t * top = reinterpret_cast<uint8_t *>(mspace_top(_mspace, &topSize));
+        if (Contains(top)) {
+            uint8_t * keepEnd = _base + RoundUp(static_cast<size_t>(top - _base) + s_chunkHeaderSize + pad, s_commitGranularity);
+            if (keepEnd < _commitEnd) {
+                FwVirtualMemoryDecommit(keepEnd, _commitEnd - keepEnd);
+                _commitEnd = keepEnd;
+                trimmed = true;
+            }
+        }
+        return trimmed;
+    }
+
+    /**
+     * @brief 全ブロックを一括で破棄してヒープを初期状態に戻す
+     */
+    virtual void ReleaseAll() FW_OVERRIDE {
+        ScopedLock lock(*this);
+
+        // 予約領域外に伸びたセグメントはdestroy_mspaceが解放する
+        // 大きなブロックもセグメント内に確保しているので取りこぼしは無い
+        destroy_mspace(_mspace);
+        _mspace = nullptr;
+
+        // 予約領域の物理メモリを返却してから作り直す
+        FwVirtualMemoryDecommit(_base, _reserveSize);
+        const sint32_t result = InitHeap();
+        FwAssert(result == FW_OK);
+        (void)result;
+
+        _liveBytes.store(0, std::memory_order_relaxed);
+        _numBlocks.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 統計情報を取得
+     */
+    virtual void GetStats(FwMSpaceAllocatorStats * stats) FW_OVERRIDE {
+        if (stats == nullptr) {
+            return;
+        }
+        ScopedLock lock(*this);
+
+        // mspaceは予約領域全体を確保済みとして数えるので、予約領域の分をコミット済みのサイズに置き換える
+        stats->reserveSize  = _reserveSize;
+        stats->footprint    = GetCommitSize() + (mspace_footprint(_mspace) - _reserveSize);
+        stats->maxFootprint = _maxCommitSize + (mspace_max_footprint(_mspace) - _reserveSize);
+        stats->usedBytes    = mspace_used_bytes(_mspace);
+        stats->liveBytes    = _liveBytes.load(std::memory_order_relaxed);
+        stats->numBlocks    = _numBlocks.load(std::memory_order_relaxed);
+        stats->numaBound    = _numaBound;
+    }
+
+    /**
+     * @brief このアロケータで確保したブロックか
+     */
+    virtual bool Contains(const void * ptr) const FW_OVERRIDE {
+        const uintptr_t offset = reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(_base);
+        return offset < _reserveSize;
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwMSpaceAllocatorImpl()
+    : _base(nullptr)
+    , _reserveSize(0)
+    , _pageSize(0)
+    , _commitEnd(nullptr)
+    , _maxCommitSize(0)
+    , _mspace(nullptr)
+    , _threadSafe(true)
+    , _growable(true)
+    , _numaBound(false)
+    , _liveBytes(0)
+    , _numBlocks(0) {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwMSpaceAllocatorImpl() {
+        if (_mspace != nullptr) {
+            destroy_mspace(_mspace);
+            _mspace = nullptr;
+        }
+        FwVirtualMemoryRelease(_base, _reserveSize);
+        _base = nullptr;
+    }
+
+
+private:
+    /**
+     * @class ScopedLock
+     * @brief threadSafeの場合だけミューテックスを取る
+     */
+    class ScopedLock {
+    public:
+        explicit ScopedLock(FwMSpaceAllocatorImpl & allocator)
+        : _mutex(allocator._threadSafe ? &allocator._mutex : nullptr) {
+            if (_mutex != nullptr) {
+                _mutex->lock();
+            }
+        }
+
+        ~ScopedLock() {
+            if (_mutex != nullptr) {
+                _mutex->unlock();
+            }
+        }
+
+
+    private:
+        std::mutex *    _mutex;
+    };
+
+    /**
+     * @brief 予約領域にmspaceを作る
+     * @note  mspaceの管理領域がある先頭と、topの番兵が書かれる末尾のページだけをコミットする
+     */
+    sint32_t InitHeap() {
+        _commitEnd = _base;
+        if (!FwVirtualMemoryCommit(GetTailPage(), _pageSize) || !CommitTo(_base + s_commitGranularity)) {
+            return ERR_OUT_OF_MEMORY;
+        }
+
+        _mspace = create_mspace_with_base(_base, _reserveSize, 0);
+        if (_mspace == nullptr) {
+            return ERR_FAILED;
+        }
+
+        // 大きなブロックを予約領域外に個別にmmapすると、destroy_mspaceで解放されない
+        mspace_track_large_chunks(_mspace, 1);
+
+        // 伸ばさない場合は予約領域のサイズ（作成直後のフットプリント）を上限にして、新たなセグメントを取らせない
+        if (!_growable) {
+            mspace_set_footprint_limit(_mspace, _reserveSize);
+        }
+        return FW_OK;
+    }
+
+    /**
+     * @brief mspace_mallocがtopから切り出しても触れるページがコミット済みになるようにする
+     * @param[in] realSize 要求サイズ
+     * @return コミットできなければfalse
+     */
+    bool CommitForRequest(const size_t realSize) {
+        size_t topSize = 0;
+        uint8_t * top = reinterpret_cast<uint8_t *>(mspace_top(_mspace, &topSize));
+
+        // 予約領域外のセグメントにtopが移った後は、予約領域はすべてコミット済み
+        if (!Contains(top)) {
+            return true;
+        }
+
+        const size_t chunkSize = mspace_request_size(realSize);
+        if (topSize < chunkSize + s_chunkHeaderSize) {
+            // topに収まらない場合、残りのtopは空きチャンクとして分割して使われるので全てコミットしておく
+            return CommitTo(GetTailPage());
+        }
+        return CommitTo(top + chunkSize + s_chunkHeaderSize);
+    }
+
+    /**
+     * @brief 予約領域の先頭から指定位置までをコミット済みにする
+     */
+    bool CommitTo(uint8_t * end) {
+        if (end <= _commitEnd) {
+            return true;
+        }
+        uint8_t * newEnd = Min(_base + RoundUp(static_cast<size_t>(end - _base), s_commitGranularity), GetTailPage());
+        if (_commitEnd < newEnd) {
+            if (!FwVirtualMemoryCommit(_commitEnd, newEnd - _commitEnd)) {
+                return false;
+            }
+            _commitEnd = newEnd;
+            _maxCommitSize = Max(_maxCommitSize, GetCommitSize());
+        }
+        return true;
+    }
+
+    /**
+     * @brief topの番兵が書かれる予約領域の末尾のページ
+     */
+    FW_INLINE uint8_t * GetTailPage() const {
+        return _base + _reserveSize - _pageSize;
+    }
+
+    /**
+     * @brief 予約領域でコミットしているサイズ
+     */
+    FW_INLINE size_t GetCommitSize() const {
+        return static_cast<size_t>(_commitEnd - _base) + _pageSize;
+    }
+
+    /**
+     * @brief ブロックのサイズを変更
+     */
+    void ResizeBlock(void * ptr, const size_t oldSize, const size_t newSize) {
+        FwResizeMemBlock(ptr, newSize);
+        if (oldSize < newSize) {
+            _liveBytes.fetch_add(newSize - oldSize, std::memory_order_relaxed);
+        } else {
+            _liveBytes.fetch_sub(oldSize - newSize, std::memory_order_relaxed);
+        }
+    }
+
+
+    uint8_t *               _base;
+    size_t                  _reserveSize;
+    size_t                  _pageSize;
+    uint8_t *               _commitEnd;         ///< 先頭からコミットしている範囲の末尾
+    size_t                  _maxCommitSize;
+    mspace                  _mspace;
+    std::mutex              _mutex;
+    bool                    _threadSafe;
+    bool                    _growable;
+    bool                    _numaBound;
+
+    std::atomic<size_t>     _liveBytes;
+    std::atomic<size_t>     _numBlocks;
+};
+
+END_NAMESPACE_NONAME
+
+
+// 生成
+FwMSpaceAllocator * FwCreateMSpaceAllocator(const FwMSpaceAllocatorDesc * desc) {
+    if (desc == nullptr) {
+        return nullptr;
+    }
+
+    FwMSpaceAllocatorImpl * allocator = FwNew<FwMSpaceAllocatorImpl>();
+    if (allocator->Init(desc) != FW_OK) {
+        FwDelete(allocator);
+        return nullptr;
+    }
+    return allocator;
+}
+
+// 破棄
+void FwDestroyMSpaceAllocator(FwMSpaceAllocator * allocator) {
+    FwDelete(static_cast<FwMSpaceAllocatorImpl *>(allocator));
+}
+
+END_NAMESPACE_FW
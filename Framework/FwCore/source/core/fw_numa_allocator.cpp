@@ -0,0 +1,198 @@
+﻿/**
+ * @file fw_numa_allocator.cpp
+ */
+#include "precompiled.h"
+#include "core/fw_numa_allocator.h"
+
+#include "fw_virtual_memory.h"
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+// スレッド毎の優先ノード
+static thread_local sint32_t    s_threadNumaNode = FwNumaNodeAny;
+
+/**
+ * @class FwNumaAllocatorImpl
+ */
+class FwNumaAllocatorImpl : public FwNumaAllocator {
+public:
+    /**
+     * @brief 初期化
+     */
+    sint32_t Init(const FwNumaAllocatorDesc * desc) {
+        _numNodes = Min(FwVirtualMemoryNumaNodeCount(), FwMaxNumaNodes);
+
+        for (sint32_t i = 0; i < _numNodes; ++i) {
+            FwMSpaceAllocatorDesc nodeDesc;
+            nodeDesc.Init();
+            nodeDesc.reserveSize = desc->reserveSizePerNode;
+            nodeDesc.threadSafe = desc->threadSafe;
+            nodeDesc.numaNode = (_numNodes > 1) ? i : FwNumaNodeAny;
+            // ノードの判定は予約領域で行うので、ブロックは全て予約領域内に置く
+            nodeDesc.growable = false;
+
+            _nodes[i] = FwCreateMSpaceAllocator(&nodeDesc);
+            if (_nodes[i] == nullptr) {
+                return ERR_OUT_OF_MEMORY;
+            }
+        }
+        return FW_OK;
+    }
+
+    /**
+     * @brief 動的なメモリ確保
+     */
+    virtual void * Alloc(size_t size, size_t alignment, sint32_t tag) FW_OVERRIDE {
+        return AllocOnNode(size, alignment, tag, FwGetCurrentNumaNode());
+    }
+
+    /**
+     * @brief ノードを指定して確保
+     */
+    virtual void * AllocOnNode(size_t size, size_t alignment, sint32_t tag, sint32_t node) FW_OVERRIDE {
+        const sint32_t first = (0 <= node && node < _numNodes) ? node : 0;
+
+        // 足りなければ次のノードから
+        for (sint32_t i = 0; i < _numNodes; ++i) {
+            void * ptr = _nodes[(first + i) % _numNodes]->Alloc(size, alignment, tag);
+            if (ptr != nullptr) {
+                return ptr;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 動的メモリを再確保
+     * @note  確保したノードの中で伸縮する
+     */
+    virtual void * Realloc(void *ptr, size_t size) FW_OVERRIDE {
+        if (ptr == nullptr || size == 0) {
+            return nullptr;
+        }
+
+        const sint32_t node = GetBlockNode(ptr);
+        if (node == FwNumaNodeAny) {
+            FwAssertMessage(false, "FwNumaAllocator : not allocated by this allocator");
+            return nullptr;
+        }
+        return _nodes[node]->Realloc(ptr, size);
+    }
+
+    /**
+     * @brief 動的メモリを解放
+     */
+    virtual void Free(void *ptr) FW_OVERRIDE {
+        if (ptr == nullptr) {
+            return;
+        }
+
+        const sint32_t node = GetBlockNode(ptr);
+        if (node == FwNumaNodeAny) {
+            FwAssertMessage(false, "FwNumaAllocator : not allocated by this allocator");
+            return;
+        }
+        _nodes[node]->Free(ptr);
+    }
+
+    /**
+     * @brief ノード数を取得
+     */
+    virtual sint32_t GetNumNodes() const FW_OVERRIDE {
+        return _numNodes;
+    }
+
+    /**
+     * @brief ブロックを確保したノードを取得
+     */
+    virtual sint32_t GetBlockNode(const void * ptr) const FW_OVERRIDE {
+        for (sint32_t i = 0; i < _numNodes; ++i) {
+            if (_nodes[i]->Contains(ptr)) {
+                return i;
+            }
+        }
+        return FwNumaNodeAny;
+    }
+
+    /**
+     * @brief ノード毎の統計情報を取得
+     */
+    virtual void GetStats(sint32_t node, FwMSpaceAllocatorStats * stats) FW_OVERRIDE {
+        if (stats == nullptr || node < 0 || _numNodes <= node) {
+            return;
+        }
+        _nodes[node]->GetStats(stats);
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwNumaAllocatorImpl()
+    : _numNodes(0) {
+        for (auto & node : _nodes) {
+            node = nullptr;
+        }
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwNumaAllocatorImpl() {
+        for (auto & node : _nodes) {
+            if (node != nullptr) {
+                FwDestroyMSpaceAllocator(node);
+                node = nullptr;
+            }
+        }
+    }
+
+
+private:
+    sint32_t                _numNodes;
+    FwMSpaceAllocator *     _nodes[FwMaxNumaNodes];
+};
+
+END_NAMESPACE_NONAME
+
+
+// 生成
+FwNumaAllocator * FwCreateNumaAllocator(const FwNumaAllocatorDesc * desc) {
+    if (desc == nullptr) {
+        return nullptr;
+    }
+
+    FwNumaAllocatorImpl * allocator = FwNew<FwNumaAllocatorImpl>();
+    if (allocator->Init(desc) != FW_OK) {
+        FwDelete(allocator);
+        return nullptr;
+    }
+    return allocator;
+}
+
+// 破棄
+void FwDestroyNumaAllocator(FwNumaAllocator * allocator) {
+    FwDelete(static_cast<FwNumaAllocatorImpl *>(allocator));
+}
+
+// NUMAノード数を取得
+sint32_t FwGetNumaNodeCount() {
+    return FwVirtualMemoryNumaNodeCount();
+}
+
+// 現在のスレッドが確保に使うNUMAノードを取得
+sint32_t FwGetCurrentNumaNode() {
+    if (s_threadNumaNode != FwNumaNodeAny) {
+        return s_threadNumaNode;
+    }
+    return FwVirtualMemoryCurrentNumaNode();
+}
+
+// 現在のスレッドの優先NUMAノードを設定
+void FwSetThreadNumaNode(sint32_t node) {
+    s_threadNumaNode = (0 <= node && node < FwGetNumaNodeCount()) ? node : FwNumaNodeAny;
+    FwVirtualMemorySetThreadNumaNode(s_threadNumaNode);
+}
+
+END_NAMESPACE_FW
@@ -0,0 +1,150 @@
+﻿/**
+ * @file fw_parallel.cpp
+ */
+#include "precompiled.h"
+#include "threading/task/fw_parallel.h"
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+/**
+ * @struct FwParallelRange
+ * @brief  参加者毎に残っているチャンクの範囲
+ * @note   先頭32bitに開始、末尾32bitに終端を詰めて、持ち主と盗む側の両方がCASで更新する
+ */
+struct FW_ALIGN64 FwParallelRange {
+    std::atomic<uint64_t>   range;
+};
+
+FW_INLINE uint64_t PackRange(const uint32_t first, const uint32_t last) {
+    return (static_cast<uint64_t>(first) << 32) | last;
+}
+
+FW_INLINE uint32_t RangeFirst(const uint64_t range) {
+    return static_cast<uint32_t>(range >> 32);
+}
+
+FW_INLINE uint32_t RangeLast(const uint64_t range) {
+    return static_cast<uint32_t>(range);
+}
+
+/**
+ * @class FwParallelContext
+ */
+class FwParallelContext {
+public:
+    /**
+     * @brief 参加者として実行
+     */
+    void Run(const uint32_t worker) {
+        FwParallelRange & own = _ranges[worker];
+
+        for (;;) {
+            // 自分の範囲を先頭から1チャンクずつ取り出す
+            uint64_t range = own.range.load(std::memory_order_acquire);
+            while (RangeFirst(range) < RangeLast(range)) {
+                const uint32_t chunk = RangeFirst(range);
+                if (own.range.compare_exchange_weak(range, PackRange(chunk + 1, RangeLast(range)), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    _func(_context, worker, chunk);
+                    range = own.range.load(std::memory_order_acquire);
+                }
+            }
+
+            if (!Steal(worker)) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief 他の参加者の残りの後ろ半分を奪って自分の範囲にする
+     */
+    bool Steal(const uint32_t worker) {
+        for (uint32_t i = 1; i < _numRanges; ++i) {
+            FwParallelRange & victim = _ranges[(worker + i) % _numRanges];
+
+            uint64_t range = victim.range.load(std::memory_order_acquire);
+            while (RangeFirst(range) < RangeLast(range)) {
+                const uint32_t first = RangeFirst(range);
+                const uint32_t last = RangeLast(range);
+                const uint32_t middle = first + (last - first) / 2;
+                if (victim.range.compare_exchange_weak(range, PackRange(first, middle), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    _ranges[worker].range.store(PackRange(middle, last), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwParallelContext(FwParallelRange * ranges, const uint32_t numRanges, const uint32_t numChunks, FwParallelChunkFunc func, void * context)
+    : _ranges(ranges)
+    , _numRanges(numRanges)
+    , _func(func)
+    , _context(context) {
+        // 最初は等分して割り当てる
+        for (uint32_t i = 0; i < _numRanges; ++i) {
+            const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(numChunks) * i / _numRanges);
+            const uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(numChunks) * (i + 1) / _numRanges);
+            _ranges[i].range.store(PackRange(first, last), std::memory_order_relaxed);
+        }
+    }
+
+
+private:
+    FwParallelRange *       _ranges;
+    uint32_t                _numRanges;
+    FwParallelChunkFunc     _func;
+    void *                  _context;
+};
+
+END_NAMESPACE_NONAME
+
+
+// チャンクを並列に実行
+void FwParallelForChunks(FwTaskFactory * factory, uint32_t numChunks, FwParallelChunkFunc func, void * context) {
+    if (numChunks == 0 || func == nullptr) {
+        return;
+    }
+
+    const uint32_t numWorkers = Min(FwGetParallelWorkerCount(factory), numChunks);
+    FwParallelRange * ranges = nullptr;
+    FwTaskGroup * group = nullptr;
+    if (1 < numWorkers) {
+        ranges = reinterpret_cast<FwParallelRange *>(FwMallocAligned(sizeof(FwParallelRange) * numWorkers, alignof(FwParallelRange), FwDefaultMemAllocatorTag));
+        group = (ranges != nullptr) ? factory->CreateTaskGroup(numWorkers, 0, 0, _T("Parallel")) : nullptr;
+    }
+
+    // 並列に実行できなければその場で実行
+    if (group == nullptr) {
+        FwFree(ranges);
+        for (uint32_t i = 0; i < numChunks; ++i) {
+            func(context, 0, i);
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i < numWorkers; ++i) {
+        new(&ranges[i]) FwParallelRange();
+    }
+    FwParallelContext parallel(ranges, numWorkers, numChunks, func, context);
+
+    // 呼び出し元もWaitの中で参加者として実行する
+    for (uint32_t i = 0; i < numWorkers; ++i) {
+        group->AddTask([&parallel, i](FwTaskArgType) { parallel.Run(i); });
+    }
+    group->Submit();
+    group->Wait();
+
+    factory->DestroyTaskGroup(group);
+    for (uint32_t i = 0; i < numWorkers; ++i) {
+        ranges[i].~FwParallelRange();
+    }
+    FwFree(ranges);
+}
+
+END_NAMESPACE_FW
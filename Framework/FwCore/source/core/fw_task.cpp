@@ -0,0 +1,1255 @@
+﻿/**
+ * @file fw_task.cpp
+ */
+#include "precompiled.h"
+#include "threading/task/fw_task.h"
+#include "threading/fw_fiber.h"
+#include "threading/fw_thread_context.h"
+
+#include "container/fw_deque.h"
+#include "core/fw_pool.h"
+
+
+BEGIN_NAMESPACE_FW
+
+//-------------------------------------------------------------------------------------------
+// FwTaskGroupSharedData
+//-------------------------------------------------------------------------------------------
+void FwTaskGroupSharedData::Init(FwTaskGroup * taskGroup, const sint32_t numTasks, const sint32_t numChildren) {
+    owner = taskGroup;
+    numSubmittedTasks = numTasks;
+    numSubmittedChildGroups = numChildren;
+    numRanToCompletionTasks.store(0, std::memory_order_relaxed);
+    numRanToCompletionChildGroups.store(0, std::memory_order_relaxed);
+}
+
+void FwTaskGroupSharedData::NotifyOwnerToRun() {
+    // 最初に実行されたタスクだけが状態を進める
+    FwTaskGroupState expected = FwTaskGroupState::kWaitingToRun;
+    owner->state.compare_exchange_strong(expected, FwTaskGroupState::kRunning, std::memory_order_acq_rel, std::memory_order_relaxed);
+}
+
+void FwTaskGroupSharedData::NotifyOwnerToCompletion(FwTask * task) {
+    // 完了数に数える前に呼ぶので、この中でタスクを積み足してもグループは完了しない
+    if (owner->completionHook != nullptr) {
+        owner->completionHook(owner->completionHookContext, task);
+    }
+    // 数えた後は他のスレッドで完了したグループが破棄されうるので、先に読んでおく
+    const sint32_t numTasks = numSubmittedTasks;
+    FwTaskGroup * group = owner;
+    if (numRanToCompletionTasks.fetch_add(1, std::memory_order_acq_rel) + 1 == numTasks) {
+        group->OnTasksCompleted();
+    }
+}
+
+const FwTaskGroupSharedData & FwTaskGroupSharedData::operator =(const FwTaskGroupSharedData & value) {
+    owner = value.owner;
+    numSubmittedTasks = value.numSubmittedTasks;
+    numSubmittedChildGroups = value.numSubmittedChildGroups;
+    numRanToCompletionTasks.store(value.numRanToCompletionTasks.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    numRanToCompletionChildGroups.store(value.numRanToCompletionChildGroups.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
+
+FwTaskGroupSharedData & FwTaskGroupSharedData::operator =(FwTaskGroupSharedData && value) {
+    *this = static_cast<const FwTaskGroupSharedData &>(value);
+    value.owner = nullptr;
+    return *this;
+}
+
+FwTaskGroupSharedData::FwTaskGroupSharedData()
+: owner(nullptr)
+, numSubmittedTasks(0)
+, numSubmittedChildGroups(0)
+, numRanToCompletionTasks(0)
+, numRanToCompletionChildGroups(0) {
+}
+
+FwTaskGroupSharedData::FwTaskGroupSharedData(const FwTaskGroupSharedData & value)
+: FwTaskGroupSharedData() {
+    *this = value;
+}
+
+FwTaskGroupSharedData::FwTaskGroupSharedData(FwTaskGroupSharedData && value)
+: FwTaskGroupSharedData() {
+    *this = std::move(value);
+}
+
+
+//-------------------------------------------------------------------------------------------
+// FwTask
+//-------------------------------------------------------------------------------------------
+void FwTask::Run() {
+    state = FwTaskState::kRunning;
+
+    // グループに属さないタスクは通知先が無い
+    if (sharedData == nullptr) {
+        trampoline(this, Operation::kRun);
+        state = FwTaskState::kRanToCompletion;
+        return;
+    }
+    sharedData->NotifyOwnerToRun();
+
+    trampoline(this, Operation::kRun);
+
+    // 完了を通知した後はグループが破棄されている可能性があるので触らない
+    state = FwTaskState::kRanToCompletion;
+    sharedData->NotifyOwnerToCompletion(this);
+}
+
+void FwTask::Destroy() {
+    if (trampoline != nullptr) {
+        trampoline(this, Operation::kDestroy);
+        trampoline = nullptr;
+    }
+}
+
+const char_t * FwTask::GetName() const {
+    return (sharedData != nullptr) ? sharedData->owner->GetName() : nullptr;
+}
+
+FwTask::FwTask(FwTaskGroupSharedData * _sharedData, FwTaskArgType * _args, const sint32_t _index)
+: trampoline(nullptr)
+, sharedData(_sharedData)
+, args(_args)
+, index(_index)
+, state(FwTaskState::kInit) {
+}
+
+FwTask::~FwTask() {
+    Destroy();
+}
+
+
+//-------------------------------------------------------------------------------------------
+// FwTaskGroup
+//-------------------------------------------------------------------------------------------
+BEGIN_NAMESPACE_NONAME
+// continuationStateの値
+static const sint32_t   s_continuationNone          = 0;    ///< 未登録
+static const sint32_t   s_continuationRegistered    = 1;    ///< 登録済み
+static const sint32_t   s_continuationCompleted     = 2;    ///< 完了処理済み
+END_NAMESPACE_NONAME
+
+FwTask * FwTaskGroup::AllocTask(FwTaskArgType * args) {
+    FwAssert(GetState(std::memory_order_relaxed) == FwTaskGroupState::kReady);
+    if (maxTasks <= numTasks) {
+        FwAssertMessage(false, "too many tasks");
+        return nullptr;
+    }
+
+    // 確保済みの領域にその場で構築する
+    FwTask * task = new(&taskPool[numTasks]) FwTask(&sharedData, args, static_cast<sint32_t>(numTasks));
+    ++numTasks;
+    return task;
+}
+
+void FwTaskGroup::DestroyTasks() {
+    for (uint32_t i = 0; i < numTasks; ++i) {
+        taskPool[i].~FwTask();
+    }
+    numTasks = 0;
+}
+
+bool FwTaskGroup::AddChildGroup(FwTaskGroup * group) {
+    FwAssert(GetState(std::memory_order_relaxed) == FwTaskGroupState::kReady);
+    if (group == nullptr || group == this || group->GetState() != FwTaskGroupState::kReady || group->parentGroup != nullptr) {
+        return false;
+    }
+    if (maxChildren <= childGroups.size()) {
+        FwAssertMessage(false, "too many child groups");
+        return false;
+    }
+
+    childGroups.push_back(group);
+    group->parentGroup = this;
+    return true;
+}
+
+bool FwTaskGroup::AddChainGroup(FwTaskGroup * group) {
+    FwAssert(GetState(std::memory_order_relaxed) == FwTaskGroupState::kReady);
+    if (group == nullptr || group == this || group->GetState() != FwTaskGroupState::kReady) {
+        return false;
+    }
+    if (maxChains <= chainGroups.size()) {
+        FwAssertMessage(false, "too many chain groups");
+        return false;
+    }
+
+    chainGroups.push_back(group);
+    return true;
+}
+
+void FwTaskGroup::Submit() {
+    const sint32_t numSubmitTasks = static_cast<sint32_t>(numTasks);
+    FwTask * tasks = taskPool;
+    if (!BeginSubmit()) {
+        return;
+    }
+
+    // 最後のタスクを積んだ直後に完了する可能性があるので、以降はメンバに触らない
+    for (sint32_t i = 0; i < numSubmitTasks; ++i) {
+        ScheduleTask(&tasks[i]);
+    }
+}
+
+void FwTaskGroup::SubmitPartial(const sint32_t * indices, const uint32_t count) {
+    FwTask * tasks = taskPool;
+    if (!BeginSubmit()) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        ScheduleTask(&tasks[indices[i]]);
+    }
+}
+
+bool FwTaskGroup::BeginSubmit() {
+    FwAssert(GetState(std::memory_order_relaxed) == FwTaskGroupState::kReady);
+
+    sharedData.Init(this, static_cast<sint32_t>(numTasks), static_cast<sint32_t>(childGroups.size()));
+    completing.store(false, std::memory_order_relaxed);
+    continuationState.store(s_continuationNone, std::memory_order_relaxed);
+    ChangeState(FwTaskGroupState::kWaitingToRun);
+
+    // 親が待っているタスクが親より後回しにならないように、親の優先度まで引き上げる
+    schedulePriority = (parentGroup != nullptr) ? Min(priority, parentGroup->schedulePriority) : priority;
+    for (auto child : childGroups) {
+        child->Submit();
+    }
+
+    if (numTasks == 0) {
+        OnTasksCompleted();
+        return false;
+    }
+    return true;
+}
+
+void FwTaskGroup::ScheduleTask(FwTask * task) {
+    task->state = FwTaskState::kWaitingToRun;
+    owner->DoSchedule(task, schedulePriority);
+}
+
+void FwTaskGroup::Rearm() {
+    const FwTaskGroupState current = GetState();
+    FwAssert(current == FwTaskGroupState::kReady || current == FwTaskGroupState::kRanToCompletion);
+    (void)current;
+
+    for (uint32_t i = 0; i < numTasks; ++i) {
+        taskPool[i].state = FwTaskState::kInit;
+    }
+    ChangeState(FwTaskGroupState::kReady);
+}
+
+bool FwTaskGroup::RegisterContinuation(FwTaskGroupContinuation func, void * context) {
+    FwAssert(func != nullptr);
+    if (IsCompleted()) {
+        return false;
+    }
+
+    continuation = func;
+    continuationContext = context;
+    if (continuationState.exchange(s_continuationRegistered, std::memory_order_acq_rel) == s_continuationCompleted) {
+        // 完了処理とすれ違ったので、完了状態になるのを待ってから呼び出し元で続ける
+        while (!IsCompleted()) {
+            FwThread::YieldThread();
+        }
+        return false;
+    }
+    return true;
+}
+
+void FwTaskGroup::Wait() {
+    FwAssert(GetState(std::memory_order_relaxed) != FwTaskGroupState::kInit && GetState(std::memory_order_relaxed) != FwTaskGroupState::kReady);
+
+    // 優先度の低いタスクから待つ場合は、進めるタスクが枠を使えるように手放しておく
+    const bool released = owner->DoBeginWait();
+    while (!IsCompleted()) {
+        // ファイバーで中断できれば完了してから戻ってくる
+        if (owner->DoSuspendUntilCompleted(this)) {
+            continue;
+        }
+        // 低い優先度のタスクを代わりに実行すると、その間このグループが後回しになる
+        // 子グループは送出時にこのグループ以上の優先度へ引き上げてあるので、待っているタスクは全て探す範囲に入る
+        if (!owner->DoRunPendingTask(schedulePriority)) {
+            FwThread::YieldThread();
+        }
+    }
+    owner->DoEndWait(released);
+}
+
+void FwTaskGroup::Reset() {
+    const FwTaskGroupState current = GetState();
+    FwAssert(current == FwTaskGroupState::kInit || current == FwTaskGroupState::kReady || current == FwTaskGroupState::kRanToCompletion);
+    (void)current;
+
+    DestroyTasks();
+    childGroups.clear();
+    chainGroups.clear();
+    parentGroup = nullptr;
+    sharedData.Init(this, 0, 0);
+    ChangeState(FwTaskGroupState::kReady);
+}
+
+void FwTaskGroup::Reset(const uint32_t _maxTasks, const uint32_t _maxChildren, const uint32_t _maxChains) {
+    // 容量を切り詰めてから確保し直す
+    DestroyTasks();
+    FwFree(taskPool);
+    taskPool = nullptr;
+    NAMESPACE_FW vector<FwTaskGroup *>().swap(childGroups);
+    NAMESPACE_FW vector<FwTaskGroup *>().swap(chainGroups);
+
+    maxTasks = _maxTasks;
+    maxChildren = _maxChildren;
+    maxChains = _maxChains;
+    if (0 < maxTasks) {
+        taskPool = reinterpret_cast<FwTask *>(FwMallocAligned(sizeof(FwTask) * maxTasks, alignof(FwTask), FwDefaultMemAllocatorTag));
+        if (taskPool == nullptr) {
+            maxTasks = 0;
+        }
+    }
+    childGroups.reserve(maxChildren);
+    chainGroups.reserve(maxChains);
+
+    Reset();
+}
+
+void FwTaskGroup::ChangeState(const FwTaskGroupState newState, const std::memory_order order) {
+    // 受け入れ可能状態へ戻す以外は先へ進むだけ
+    FwAssert(newState == FwTaskGroupState::kReady || GetState(std::memory_order_relaxed) < newState);
+    SetState(newState, order);
+}
+
+void FwTaskGroup::OnTasksCompleted() {
+    ChangeState(FwTaskGroupState::kWaitingForChildrenToComplete);
+    TryComplete();
+}
+
+void FwTaskGroup::OnChildGroupCompleted() {
+    sharedData.numRanToCompletionChildGroups.fetch_add(1, std::memory_order_acq_rel);
+    TryComplete();
+}
+
+void FwTaskGroup::TryComplete() {
+    if (GetState(std::memory_order_acquire) != FwTaskGroupState::kWaitingForChildrenToComplete) {
+        return;
+    }
+    if (sharedData.numRanToCompletionChildGroups.load(std::memory_order_acquire) != sharedData.numSubmittedChildGroups) {
+        return;
+    }
+
+    // 最後のタスクと最後の子グループが同時に来ても1度だけ完了させる
+    if (completing.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    for (auto chain : chainGroups) {
+        chain->Submit();
+    }
+
+    // 完了状態にした時点で破棄される可能性があるので、親とファクトリと継続は先に取り出しておく
+    FwTaskGroup * parent = parentGroup;
+    FwTaskFactory * factory = owner;
+    FwTaskGroupContinuation func = nullptr;
+    void * context = nullptr;
+    if (continuationState.exchange(s_continuationCompleted, std::memory_order_acq_rel) == s_continuationRegistered) {
+        func = continuation;
+        context = continuationContext;
+    }
+    ChangeState(FwTaskGroupState::kRanToCompletion, std::memory_order_release);
+
+    if (parent != nullptr) {
+        parent->OnChildGroupCompleted();
+    }
+    factory->DoNotifyGroupCompleted();
+    if (func != nullptr) {
+        func(context);
+    }
+}
+
+FwTaskGroup::FwTaskGroup()
+: owner(nullptr)
+, parentGroup(nullptr)
+, priority(FwTaskPriorityNormal)
+, schedulePriority(FwTaskPriorityNormal)
+, state(FwTaskGroupState::kInit)
+, sharedData()
+, maxTasks(0)
+, maxChildren(0)
+, maxChains(0)
+, completing(false)
+, completionHook(nullptr)
+, completionHookContext(nullptr)
+, continuationState(s_continuationNone)
+, continuation(nullptr)
+, continuationContext(nullptr)
+, taskPool(nullptr)
+, numTasks(0) {
+    name[0] = _T('\0');
+}
+
+FwTaskGroup::FwTaskGroup(FwTaskFactory * factory, const uint32_t _maxTasks, const uint32_t _maxChildren, const uint32_t _maxChains, const char_t * _name)
+: FwTaskGroup() {
+    owner = factory;
+    if (_name != nullptr) {
+        tstring::CopyN(name, FW_ARRAY_SIZEOF(name), _name, kMaxNameLen);
+    }
+    Reset(_maxTasks, _maxChildren, _maxChains);
+}
+
+FwTaskGroup::~FwTaskGroup() {
+    const FwTaskGroupState current = GetState();
+    FwAssertMessage(current == FwTaskGroupState::kInit || current == FwTaskGroupState::kReady || current == FwTaskGroupState::kRanToCompletion, "task group destroyed while running");
+    (void)current;
+
+    DestroyTasks();
+    FwFree(taskPool);
+}
+
+
+//-------------------------------------------------------------------------------------------
+// FwTaskFactory
+//-------------------------------------------------------------------------------------------
+FwTaskGroup * FwTaskFactory::NewTaskGroup(const uint32_t maxTasks, const uint32_t maxChildren, const uint32_t maxChains, const char_t * name) {
+    void * ptr = FwMalloc(sizeof(FwTaskGroup), FwDefaultMemAllocatorTag);
+    if (ptr == nullptr) {
+        return nullptr;
+    }
+    return new(ptr) FwTaskGroup(this, maxTasks, maxChildren, maxChains, name);
+}
+
+void FwTaskFactory::DeleteTaskGroup(FwTaskGroup * group) {
+    if (group != nullptr) {
+        group->~FwTaskGroup();
+        FwFree(group);
+    }
+}
+
+
+BEGIN_NAMESPACE_NONAME
+//-------------------------------------------------------------------------------------------
+// FwTaskDeque
+//-------------------------------------------------------------------------------------------
+/**
+ * @class FwTaskDeque
+ * @brief Chase-Levの固定長ワークスティーリングキュー
+ * @note  Push/Popは所有するワーカーだけが、Stealは任意のスレッドから呼べます
+ */
+class FwTaskDeque {
+public:
+    /**
+     * @brief 初期化
+     * @param[in] capacity 容量（2の累乗）
+     */
+    bool Init(const uint32_t capacity) {
+        FwAssert(IsPowerOfTwo(capacity));
+        _buffer = reinterpret_cast<std::atomic<FwTask *> *>(FwMallocAligned(sizeof(std::atomic<FwTask *>) * capacity, 64, FwDefaultMemAllocatorTag));
+        if (_buffer == nullptr) {
+            return false;
+        }
+        for (uint32_t i = 0; i < capacity; ++i) {
+            new(&_buffer[i]) std::atomic<FwTask *>(nullptr);
+        }
+        _mask = static_cast<sint64_t>(capacity) - 1;
+        return true;
+    }
+
+    /**
+     * @brief 末尾へ積む（所有者のみ）
+     * @return 満杯ならfalse
+     */
+    bool Push(FwTask * task) {
+        const sint64_t b = _bottom.load(std::memory_order_relaxed);
+        const sint64_t t = _top.load(std::memory_order_acquire);
+        if (_mask < b - t) {
+            return false;
+        }
+        _buffer[b & _mask].store(task, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief 末尾から取り出す（所有者のみ）
+     */
+    FwTask * Pop() {
+        const sint64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+        _bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        sint64_t t = _top.load(std::memory_order_relaxed);
+
+        if (b < t) {
+            // 空だった
+            _bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        FwTask * task = _buffer[b & _mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // 最後の1つは盗みと競合する
+            if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                task = nullptr;
+            }
+            _bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    /**
+     * @brief 先頭から盗む（任意のスレッド）
+     */
+    FwTask * Steal() {
+        sint64_t t = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const sint64_t b = _bottom.load(std::memory_order_acquire);
+        if (b <= t) {
+            return nullptr;
+        }
+
+        FwTask * task = _buffer[t & _mask].load(std::memory_order_relaxed);
+        if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return task;
+    }
+
+    /**
+     * @brief 空かどうか（目安）
+     */
+    FW_INLINE bool IsEmpty() const {
+        return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwTaskDeque()
+    : _top(0)
+    , _bottom(0)
+    , _buffer(nullptr)
+    , _mask(0) {
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~FwTaskDeque() {
+        FwFree(_buffer);
+        _buffer = nullptr;
+    }
+
+
+private:
+    FW_ALIGN64 std::atomic<sint64_t>    _top;
+    FW_ALIGN64 std::atomic<sint64_t>    _bottom;
+    std::atomic<FwTask *> *             _buffer;
+    sint64_t                            _mask;
+};
+
+
+class FwTaskFactoryImpl;
+
+/**
+ * @brief 実行中のタスクが優先度の低いタスクの実行枠を使っているファクトリ
+ * @note  ファイバーを切り替えても同じスレッドで続くので、スレッド毎に持つ
+ */
+static thread_local FwTaskFactoryImpl *     s_lowPriorityFactory = nullptr;
+
+/**
+ * @class FwTaskWorker
+ */
+class FwTaskWorker : public FwThread {
+public:
+    FwTaskFactoryImpl *     factory;
+    sint32_t                index;
+
+    virtual sint32_t ThreadFunc(void * userArgs) FW_OVERRIDE;
+};
+
+/**
+ * @struct FwTaskWaitingFiber
+ * @brief グループの完了を待って中断しているファイバー
+ */
+struct FwTaskWaitingFiber {
+    FwFiber *       fiber;
+    FwTaskGroup *   group;
+};
+
+/**
+ * @struct FwTaskWorkerData
+ * @note  ファイバーはスレッドをまたがないので、ファイバー関連のメンバは所有するワーカーだけが触る
+ */
+struct FW_ALIGN64 FwTaskWorkerData {
+    FwTaskDeque             deques[FwTaskPriorityCount];    ///< 優先度毎のキュー
+    FwTaskWorker            thread;
+
+    FwFiber                 threadFiber;        ///< ワーカースレッド自身のコンテキスト
+    FwFiber *               fibers;             ///< ワーカーループを実行するファイバー
+    FwFiber **              freeFibers;         ///< 空いているファイバー（threadFiberも含む）
+    uint32_t                numFreeFibers;
+    FwTaskWaitingFiber *    waitingFibers;
+    uint32_t                numWaitingFibers;
+    FwFiber *               currentFiber;       ///< 実行中のファイバー
+    FwFiber *               releaseFiber;       ///< 切り替え後に空きへ戻すファイバー
+
+    FwTaskWorkerData()
+    : fibers(nullptr)
+    , freeFibers(nullptr)
+    , numFreeFibers(0)
+    , waitingFibers(nullptr)
+    , numWaitingFibers(0)
+    , currentFiber(nullptr)
+    , releaseFiber(nullptr) {
+    }
+};
+
+
+//-------------------------------------------------------------------------------------------
+// FwTaskFactoryImpl
+//-------------------------------------------------------------------------------------------
+/**
+ * @class FwTaskFactoryImpl
+ */
+class FwTaskFactoryImpl : public FwTaskFactory {
+public:
+    /**
+     * @brief 初期化
+     */
+    sint32_t Init(const FwTaskFactoryDesc * desc) {
+        if (!IsPowerOfTwo(desc->queueSize)) {
+            return ERR_INVALID_PARMS;
+        }
+
+        if (desc->numWorkers > 0) {
+            _numWorkers = Min(desc->numWorkers, FwMaxTaskWorkers);
+        } else {
+            const sint32_t numHardwareThreads = static_cast<sint32_t>(std::thread::hardware_concurrency());
+            _numWorkers = Min(Max(numHardwareThreads - 1, 1), FwMaxTaskWorkers);
+        }
+
+        _workers = reinterpret_cast<FwTaskWorkerData *>(FwMallocAligned(sizeof(FwTaskWorkerData) * _numWorkers, 64, FwDefaultMemAllocatorTag));
+        if (_workers == nullptr) {
+            _numWorkers = 0;
+            return ERR_OUT_OF_MEMORY;
+        }
+        for (sint32_t i = 0; i < _numWorkers; ++i) {
+            new(&_workers[i]) FwTaskWorkerData();
+        }
+        for (sint32_t i = 0; i < _numWorkers; ++i) {
+            for (sint32_t lane = 0; lane < FwTaskPriorityCount; ++lane) {
+                if (!_workers[i].deques[lane].Init(desc->queueSize)) {
+                    return ERR_OUT_OF_MEMORY;
+                }
+            }
+        }
+        _maxLowPriorityWorkers = Max(desc->maxLowPriorityWorkers, 0);
+
+        _numFibers = desc->numFibers;
+        for (sint32_t i = 0; i < _numWorkers && 0 < _numFibers; ++i) {
+            if (!InitFibers(_workers[i], desc->fiberStackSize)) {
+                return ERR_OUT_OF_MEMORY;
+            }
+        }
+
+        FwThreadDesc threadDesc;
+        threadDesc.Init();
+        threadDesc.stackSize = desc->stackSize;
+        threadDesc.priority = desc->priority;
+        threadDesc.affinity = desc->affinity;
+        tstring::Copy(threadDesc.name, FW_ARRAY_SIZEOF(threadDesc.name), _T("Task Worker"));
+
+        // 固定するならaffinityに含まれるコアを集める
+        FwCpuTopology topology;
+        FwThreadAffinity coreMasks[FwMaxCpus];
+        uint32_t numCores = 0;
+        if (desc->pinWorkers && FwGetCpuTopology(&topology) == FW_OK) {
+            for (uint32_t i = 0; i < topology.numCores; ++i) {
+                const FwThreadAffinity mask = topology.coreMasks[i] & desc->affinity;
+                if (mask != 0) {
+                    coreMasks[numCores++] = mask;
+                }
+            }
+        }
+
+        for (sint32_t i = 0; i < _numWorkers; ++i) {
+            FwTaskWorkerData & worker = _workers[i];
+            worker.thread.factory = this;
+            worker.thread.index = i;
+
+            // 呼び出し元のスレッドが先頭のコアを使う前提で、次のコアから割り当てる
+            if (0 < numCores) {
+                threadDesc.affinity = coreMasks[(i + 1) % numCores];
+            }
+            worker.thread.Start(&threadDesc);
+        }
+        _started = true;
+        return FW_OK;
+    }
+
+    /**
+     * @brief ワーカースレッドの処理
+     */
+    void WorkerMain(const sint32_t index) {
+        FwThreadContext * context = FwThreadContext::GetCurrent();
+        context->SetTaskWorker(this, index);
+
+        FwTaskWorkerData & worker = _workers[index];
+        const bool useFibers = (0 < _numFibers) && worker.threadFiber.ConvertFromThread();
+        if (useFibers) {
+            worker.currentFiber = &worker.threadFiber;
+        }
+
+        WorkerLoop(index);
+
+        if (useFibers) {
+            FwAssertMessage(worker.numWaitingFibers == 0, "task factory destroyed while tasks are waiting");
+            worker.currentFiber = nullptr;
+            worker.threadFiber.Destroy();
+        }
+
+        context->SetTaskWorker(nullptr, -1);
+    }
+
+    /**
+     * @brief ワーカーのタスク実行ループ
+     * @note  ファイバーを使う場合はどのファイバーからも実行される
+     */
+    void WorkerLoop(const sint32_t index) {
+        while (!_terminate.load(std::memory_order_acquire)) {
+            if (0 < _workers[index].numWaitingFibers && ResumeFiber(index)) {
+                continue;
+            }
+            FwTaskPriority lane = FwTaskPriorityNormal;
+            FwTask * task = FindTask(index, FwTaskPriorityLow, &lane);
+            if (task != nullptr) {
+                RunTask(task, lane);
+                continue;
+            }
+            Sleep(index);
+        }
+    }
+
+    /**
+     * @brief ファイバーのエントリポイント
+     */
+    static void FiberMain(void * userArgs) {
+        FwTaskWorkerData * worker = reinterpret_cast<FwTaskWorkerData *>(userArgs);
+        worker->thread.factory->OnFiberSwitched(*worker);
+        worker->thread.factory->WorkerLoop(worker->thread.index);
+
+        // 終了時はスレッド自身のコンテキストへ戻る（このファイバーには二度と戻らない）
+        worker->thread.factory->SwitchFiber(*worker, &worker->threadFiber);
+    }
+
+    /**
+     * @brief タスクグループを生成
+     */
+    virtual FwTaskGroup * DoCreateTaskGroup(const uint32_t maxTasks, const uint32_t maxChildren, const uint32_t maxChains, const char_t * name) FW_OVERRIDE {
+        return NewTaskGroup(maxTasks, maxChildren, maxChains, name);
+    }
+
+    /**
+     * @brief タスクグループを破棄
+     */
+    virtual void DoDestroyTaskGroup(FwTaskGroup * group) FW_OVERRIDE {
+        DeleteTaskGroup(group);
+    }
+
+    /**
+     * @brief 実行待ちのタスクを1つ実行する
+     */
+    virtual bool DoRunPendingTask(const FwTaskPriority lowest) FW_OVERRIDE {
+        FwTaskPriority lane = FwTaskPriorityNormal;
+        FwTask * task = FindTask(GetCurrentWorkerIndex(), lowest, &lane);
+        if (task == nullptr) {
+            return false;
+        }
+        RunTask(task, lane);
+        return true;
+    }
+
+    /**
+     * @brief ワーカースレッド数を取得
+     */
+    virtual sint32_t DoGetNumWorkers() const FW_OVERRIDE {
+        return _numWorkers;
+    }
+
+    /**
+     * @brief 実行中のタスクをグループが完了するまで中断する
+     */
+    virtual bool DoSuspendUntilCompleted(FwTaskGroup * group) FW_OVERRIDE {
+        const sint32_t index = GetCurrentWorkerIndex();
+        if (index < 0 || _numFibers == 0) {
+            return false;
+        }
+        FwTaskWorkerData & worker = _workers[index];
+        if (worker.currentFiber == nullptr || worker.numFreeFibers == 0) {
+            return false;
+        }
+
+        // 中断を公開してから切り替える（DoNotifyGroupCompletedと順序を揃える）
+        FwTaskWaitingFiber & waiting = worker.waitingFibers[worker.numWaitingFibers++];
+        waiting.fiber = worker.currentFiber;
+        waiting.group = group;
+        _numWaitingFibers.fetch_add(1, std::memory_order_seq_cst);
+
+        // 空いているファイバーがワーカーループを続け、完了後にResumeFiberから戻ってくる
+        SwitchFiber(worker, worker.freeFibers[--worker.numFreeFibers]);
+        return true;
+    }
+
+    /**
+     * @brief グループの完了を待ち始める
+     */
+    virtual bool DoBeginWait() FW_OVERRIDE {
+        // 中断したタスクや代わりに実行している間のタスクが枠を使い続けると、枠が埋まった時に進まなくなる
+        if (s_lowPriorityFactory != this) {
+            return false;
+        }
+        s_lowPriorityFactory = nullptr;
+        ReleaseLowPriorityWorker();
+        return true;
+    }
+
+    /**
+     * @brief グループの完了を待ち終えた
+     */
+    virtual void DoEndWait(const bool released) FW_OVERRIDE {
+        // 続きを止めないように、枠の上限を超えても数え直すだけにする
+        if (released) {
+            _numLowPriorityWorkers.fetch_add(1, std::memory_order_acquire);
+            s_lowPriorityFactory = this;
+        }
+    }
+
+    /**
+     * @brief グループが完了した
+     */
+    virtual void DoNotifyGroupCompleted() FW_OVERRIDE {
+        // 中断しているファイバーの持ち主が寝ていれば起こす（Sleep側の確認と順序を揃える）
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_numWaitingFibers.load(std::memory_order_relaxed) > 0 && _numSleeping.load(std::memory_order_relaxed) > 0) {
+            {
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+                ++_wakeCount;
+            }
+            _sleepCV.notify_all();
+        }
+    }
+
+    /**
+     * @brief グループに属さないタスクの領域を確保
+     */
+    virtual void * DoAllocDetachedTask() FW_OVERRIDE {
+        return _detachedTaskPool.Alloc();
+    }
+
+    /**
+     * @brief グループに属さないタスクの領域を解放
+     */
+    virtual void DoFreeDetachedTask(void * ptr) FW_OVERRIDE {
+        _detachedTaskPool.Free(ptr);
+    }
+
+    /**
+     * @brief タスクをキューへ積む
+     */
+    virtual void DoSchedule(FwTask * task, const FwTaskPriority priority) FW_OVERRIDE {
+        const FwTaskPriority lane = Clamp(priority, FwTaskPriorityHigh, FwTaskPriorityLow);
+        if (lane != FwTaskPriorityNormal) {
+            _numQueued[lane].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // ワーカーからは自分のキューへ、それ以外は共有キューへ
+        const sint32_t index = GetCurrentWorkerIndex();
+        if (index < 0 || !_workers[index].deques[lane].Push(task)) {
+            std::lock_guard<std::mutex> lock(_injectionMutex);
+            _injectionQueues[lane].push_back(task);
+            _injectionCounts[lane].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // 寝ているワーカーがいれば起こす（Sleep側の確認と順序を揃える）
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_numSleeping.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            ++_wakeCount;
+            _sleepCV.notify_one();
+        }
+    }
+
+    /**
+     * @brief コンストラクタ
+     */
+    FwTaskFactoryImpl()
+    : _numWorkers(0)
+    , _workers(nullptr)
+    , _started(false)
+    , _terminate(false)
+    , _maxLowPriorityWorkers(0)
+    , _numLowPriorityWorkers(0)
+    , _numSleeping(0)
+    , _wakeCount(0)
+    , _numFibers(0)
+    , _numWaitingFibers(0) {
+        for (sint32_t i = 0; i < FwTaskPriorityCount; ++i) {
+            _injectionCounts[i].store(0, std::memory_order_relaxed);
+            _numQueued[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    virtual ~FwTaskFactoryImpl() {
+        _terminate.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            ++_wakeCount;
+        }
+        _sleepCV.notify_all();
+
+        if (_workers != nullptr) {
+            for (sint32_t i = 0; i < _numWorkers; ++i) {
+                if (_started) {
+                    _workers[i].thread.WaitThread();
+                }
+                _workers[i].thread.Shutdown();
+            }
+            for (sint32_t i = 0; i < _numWorkers; ++i) {
+                DestroyFibers(_workers[i]);
+                _workers[i].~FwTaskWorkerData();
+            }
+            FwFree(_workers);
+            _workers = nullptr;
+        }
+    }
+
+
+private:
+    /**
+     * @brief 現在のスレッドのワーカー番号を取得
+     * @return このファクトリのワーカーでなければ-1
+     */
+    FW_INLINE sint32_t GetCurrentWorkerIndex() const {
+        const FwThreadContext * context = FwThreadContext::GetCurrent();
+        return (context->GetTaskFactory() == this) ? context->GetWorkerIndex() : -1;
+    }
+
+    /**
+     * @brief タスクを実行
+     */
+    void RunTask(FwTask * task, const FwTaskPriority lane) {
+        if (lane != FwTaskPriorityLow || _maxLowPriorityWorkers <= 0) {
+            FwTaskFactory::RunTask(task);
+            return;
+        }
+
+        // 待つ間に手放せるように、枠を使っていることを覚えておく
+        FwTaskFactoryImpl * previous = s_lowPriorityFactory;
+        s_lowPriorityFactory = this;
+        FwTaskFactory::RunTask(task);
+        s_lowPriorityFactory = previous;
+
+        ReleaseLowPriorityWorker();
+    }
+
+    /**
+     * @brief 実行するタスクを探す
+     * @note  優先度の高い順に、自分のキュー、共有キュー、他のワーカーの順に探す
+     *        タスクの切れ目毎に探し直すので、優先度の低いタスクは高いタスクが積まれると後回しになる
+     * @param[in]  index  ワーカー番号（ワーカー以外は-1）
+     * @param[in]  lowest 探す最低の優先度
+     * @param[out] lane   見つけたタスクの優先度
+     */
+    FwTask * FindTask(const sint32_t index, const FwTaskPriority lowest, FwTaskPriority * lane) {
+        for (FwTaskPriority i = FwTaskPriorityHigh; i <= lowest; ++i) {
+            // 通常以外はほとんど空なので、積まれている時だけ探す
+            if (i != FwTaskPriorityNormal && _numQueued[i].load(std::memory_order_relaxed) <= 0) {
+                continue;
+            }
+            if (i == FwTaskPriorityLow && !AcquireLowPriorityWorker()) {
+                continue;
+            }
+
+            FwTask * task = FindTaskInLane(index, i);
+            if (task != nullptr) {
+                if (i != FwTaskPriorityNormal) {
+                    _numQueued[i].fetch_sub(1, std::memory_order_relaxed);
+                }
+                *lane = i;
+                return task;
+            }
+
+            if (i == FwTaskPriorityLow && 0 < _maxLowPriorityWorkers) {
+                _numLowPriorityWorkers.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 指定した優先度のタスクを探す
+     */
+    FwTask * FindTaskInLane(const sint32_t index, const FwTaskPriority lane) {
+        FwTask * task = nullptr;
+
+        // 自分のキュー
+        if (index >= 0) {
+            task = _workers[index].deques[lane].Pop();
+            if (task != nullptr) {
+                return task;
+            }
+        }
+
+        // 共有キュー
+        if (_injectionCounts[lane].load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(_injectionMutex);
+            if (!_injectionQueues[lane].empty()) {
+                task = _injectionQueues[lane].front();
+                _injectionQueues[lane].pop_front();
+                _injectionCounts[lane].fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+
+        // ランダムに選んだワーカーから順に盗む
+        const uint32_t start = FwThreadContext::GetCurrent()->NextRandom();
+        for (sint32_t i = 0; i < _numWorkers; ++i) {
+            const sint32_t victim = static_cast<sint32_t>((start + i) % _numWorkers);
+            if (victim == index) {
+                continue;
+            }
+            task = _workers[victim].deques[lane].Steal();
+            if (task != nullptr) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 優先度の低いタスクを実行する枠を取る
+     * @return 枠が無ければfalse
+     */
+    bool AcquireLowPriorityWorker() {
+        if (_maxLowPriorityWorkers <= 0) {
+            return true;
+        }
+        sint32_t current = _numLowPriorityWorkers.load(std::memory_order_relaxed);
+        while (current < _maxLowPriorityWorkers) {
+            if (_numLowPriorityWorkers.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 優先度の低いタスクを実行する枠を返す
+     */
+    void ReleaseLowPriorityWorker() {
+        _numLowPriorityWorkers.fetch_sub(1, std::memory_order_release);
+
+        // 枠が空くのを待って寝ているワーカーがいれば起こす
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_numQueued[FwTaskPriorityLow].load(std::memory_order_relaxed) > 0 && _numSleeping.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            ++_wakeCount;
+            _sleepCV.notify_one();
+        }
+    }
+
+    /**
+     * @brief ワーカーのファイバーを確保
+     */
+    bool InitFibers(FwTaskWorkerData & worker, const uint32_t stackSize) {
+        worker.fibers = reinterpret_cast<FwFiber *>(FwMalloc(sizeof(FwFiber) * _numFibers, FwDefaultMemAllocatorTag));
+        worker.freeFibers = reinterpret_cast<FwFiber **>(FwMalloc(sizeof(FwFiber *) * (_numFibers + 1), FwDefaultMemAllocatorTag));
+        worker.waitingFibers = reinterpret_cast<FwTaskWaitingFiber *>(FwMalloc(sizeof(FwTaskWaitingFiber) * (_numFibers + 1), FwDefaultMemAllocatorTag));
+        if (worker.fibers == nullptr || worker.freeFibers == nullptr || worker.waitingFibers == nullptr) {
+            FwFree(worker.fibers);
+            worker.fibers = nullptr;
+            return false;
+        }
+
+        for (uint32_t i = 0; i < _numFibers; ++i) {
+            new(&worker.fibers[i]) FwFiber();
+        }
+        for (uint32_t i = 0; i < _numFibers; ++i) {
+            if (!worker.fibers[i].Create(&FwTaskFactoryImpl::FiberMain, &worker, stackSize)) {
+                return false;
+            }
+            worker.freeFibers[worker.numFreeFibers++] = &worker.fibers[i];
+        }
+        return true;
+    }
+
+    /**
+     * @brief ワーカーのファイバーを破棄
+     */
+    void DestroyFibers(FwTaskWorkerData & worker) {
+        if (worker.fibers != nullptr) {
+            for (uint32_t i = 0; i < _numFibers; ++i) {
+                worker.fibers[i].~FwFiber();
+            }
+        }
+        FwFree(worker.fibers);
+        FwFree(worker.freeFibers);
+        FwFree(worker.waitingFibers);
+        worker.fibers = nullptr;
+        worker.freeFibers = nullptr;
+        worker.waitingFibers = nullptr;
+    }
+
+    /**
+     * @brief 実行中のファイバーを中断して切り替える
+     */
+    void SwitchFiber(FwTaskWorkerData & worker, FwFiber * next) {
+        FwFiber * current = worker.currentFiber;
+        worker.currentFiber = next;
+        current->SwitchTo(next);
+
+        // 他のファイバーから戻ってきた
+        OnFiberSwitched(worker);
+    }
+
+    /**
+     * @brief ファイバーへ切り替わった直後の処理
+     */
+    void OnFiberSwitched(FwTaskWorkerData & worker) {
+        if (worker.releaseFiber != nullptr) {
+            worker.freeFibers[worker.numFreeFibers++] = worker.releaseFiber;
+            worker.releaseFiber = nullptr;
+        }
+    }
+
+    /**
+     * @brief 待っていたグループが完了したファイバーを再開する
+     * @return 再開するファイバーが無ければfalse
+     */
+    bool ResumeFiber(const sint32_t index) {
+        FwTaskWorkerData & worker = _workers[index];
+        for (uint32_t i = 0; i < worker.numWaitingFibers; ++i) {
+            if (!worker.waitingFibers[i].group->IsCompleted()) {
+                continue;
+            }
+
+            FwFiber * fiber = worker.waitingFibers[i].fiber;
+            worker.waitingFibers[i] = worker.waitingFibers[--worker.numWaitingFibers];
+            _numWaitingFibers.fetch_sub(1, std::memory_order_relaxed);
+
+            // 実行中のファイバーは再開したファイバーが空きへ戻す
+            worker.releaseFiber = worker.currentFiber;
+            SwitchFiber(worker, fiber);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 再開できるファイバーがあるか
+     */
+    bool HasResumableFiber(const sint32_t index) const {
+        const FwTaskWorkerData & worker = _workers[index];
+        for (uint32_t i = 0; i < worker.numWaitingFibers; ++i) {
+            if (worker.waitingFibers[i].group->IsCompleted()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 実行できるタスクがありそうか
+     */
+    bool HasPendingTask() const {
+        // 枠が埋まっている間は優先度の低いタスクを数えない（実行できないのに起き続けてしまう）
+        const bool lowPriority = (_maxLowPriorityWorkers <= 0 || _numLowPriorityWorkers.load(std::memory_order_relaxed) < _maxLowPriorityWorkers);
+        if (_numQueued[FwTaskPriorityHigh].load(std::memory_order_relaxed) > 0) {
+            return true;
+        }
+        if (lowPriority && _numQueued[FwTaskPriorityLow].load(std::memory_order_relaxed) > 0) {
+            return true;
+        }
+        if (_injectionCounts[FwTaskPriorityNormal].load(std::memory_order_relaxed) > 0) {
+            return true;
+        }
+        for (sint32_t i = 0; i < _numWorkers; ++i) {
+            if (!_workers[i].deques[FwTaskPriorityNormal].IsEmpty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief タスクが積まれるまで眠る
+     */
+    void Sleep(const sint32_t index) {
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _numSleeping.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // 眠る直前に積まれていないか、待っていたグループが完了していないか確認
+        if (!HasPendingTask() && !HasResumableFiber(index) && !_terminate.load(std::memory_order_acquire)) {
+            const uint64_t wakeCount = _wakeCount;
+            _sleepCV.wait(lock, [&] { return _wakeCount != wakeCount; });
+        }
+        _numSleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+
+    sint32_t                        _numWorkers;
+    FwTaskWorkerData *              _workers;
+    bool                            _started;
+    std::atomic<bool>               _terminate;
+
+    std::mutex                      _injectionMutex;
+    NAMESPACE_FW deque<FwTask *>    _injectionQueues[FwTaskPriorityCount];
+    std::atomic<sint32_t>           _injectionCounts[FwTaskPriorityCount];
+    std::atomic<sint32_t>           _numQueued[FwTaskPriorityCount];    ///< 積まれている数（通常の優先度は数えない）
+
+    sint32_t                        _maxLowPriorityWorkers;
+    std::atomic<sint32_t>           _numLowPriorityWorkers;             ///< 優先度の低いタスクを実行しているワーカー数
+
+    std::mutex                      _sleepMutex;
+    std::condition_variable         _sleepCV;
+    std::atomic<sint32_t>           _numSleeping;
+    uint64_t                        _wakeCount;
+
+    FwSharedPool<FwTask>            _detachedTaskPool;      ///< グループに属さないタスク
+
+    uint32_t                        _numFibers;             ///< ワーカー毎のファイバー数
+    std::atomic<sint32_t>           _numWaitingFibers;      ///< 全ワーカーで中断しているファイバー数
+};
+
+
+sint32_t FwTaskWorker::ThreadFunc(void * userArgs) {
+    factory->WorkerMain(index);
+    return 0;
+}
+END_NAMESPACE_NONAME
+
+
+// 生成
+FwTaskFactory * FwCreateTaskFactory(const FwTaskFactoryDesc * desc) {
+    if (desc == nullptr) {
+        return nullptr;
+    }
+
+    FwTaskFactoryImpl * factory = FwNew<FwTaskFactoryImpl>();
+    if (factory->Init(desc) != FW_OK) {
+        FwDelete(factory);
+        return nullptr;
+    }
+    return factory;
+}
+
+// 破棄
+void FwDestroyTaskFactory(FwTaskFactory * factory) {
+    FwDelete(static_cast<FwTaskFactoryImpl *>(factory));
+}
+
+END_NAMESPACE_FW
@@ -0,0 +1,201 @@
+﻿/**
+ * @file fw_task_graph.cpp
+ */
+#include "precompiled.h"
+#include "threading/task/fw_task_graph.h"
+
+
+BEGIN_NAMESPACE_FW
+
+bool FwTaskGraph::AddEdge(const FwTaskNode from, const FwTaskNode to) {
+    FwAssert(!compiled);
+    const FwTaskNode numNodes = static_cast<FwTaskNode>(GetNumNodes());
+    if (from < 0 || numNodes <= from || to < 0 || numNodes <= to || from == to) {
+        return false;
+    }
+    if (maxEdges <= numEdges) {
+        FwAssertMessage(false, "too many edges");
+        return false;
+    }
+
+    edges[numEdges * 2 + 0] = from;
+    edges[numEdges * 2 + 1] = to;
+    ++numEdges;
+    return true;
+}
+
+sint32_t FwTaskGraph::Compile() {
+    FwAssert(!compiled);
+    const uint32_t numNodes = GetNumNodes();
+
+    // 先行ノード数と後続ノード数を数える
+    for (uint32_t i = 0; i <= numNodes; ++i) {
+        successorOffsets[i] = 0;
+    }
+    for (uint32_t i = 0; i < numNodes; ++i) {
+        numPredecessors[i] = 0;
+    }
+    for (uint32_t i = 0; i < numEdges; ++i) {
+        ++successorOffsets[edges[i * 2 + 0] + 1];
+        ++numPredecessors[edges[i * 2 + 1]];
+    }
+    for (uint32_t i = 0; i < numNodes; ++i) {
+        successorOffsets[i + 1] += successorOffsets[i];
+    }
+
+    // 後続ノードをノード毎に詰める（pendingCountsを書き込み位置に使う）
+    for (uint32_t i = 0; i < numNodes; ++i) {
+        pendingCounts[i].store(static_cast<sint32_t>(successorOffsets[i]), std::memory_order_relaxed);
+    }
+    for (uint32_t i = 0; i < numEdges; ++i) {
+        const FwTaskNode from = edges[i * 2 + 0];
+        const sint32_t pos = pendingCounts[from].fetch_add(1, std::memory_order_relaxed);
+        successors[pos] = edges[i * 2 + 1];
+    }
+
+    // 先行ノードの無いノードから順に並べる
+    numRoots = 0;
+    uint32_t numOrdered = 0;
+    for (uint32_t i = 0; i < numNodes; ++i) {
+        pendingCounts[i].store(numPredecessors[i], std::memory_order_relaxed);
+        if (numPredecessors[i] == 0) {
+            roots[numRoots++] = static_cast<FwTaskNode>(i);
+            order[numOrdered++] = static_cast<FwTaskNode>(i);
+        }
+    }
+    for (uint32_t head = 0; head < numOrdered; ++head) {
+        const FwTaskNode node = order[head];
+        for (uint32_t i = successorOffsets[node]; i < successorOffsets[node + 1]; ++i) {
+            const FwTaskNode next = successors[i];
+            if (pendingCounts[next].fetch_sub(1, std::memory_order_relaxed) == 1) {
+                order[numOrdered++] = next;
+            }
+        }
+    }
+
+    // 並べきれなければ循環している
+    if (numOrdered != numNodes) {
+        return ERR_INVALID_PARMS;
+    }
+
+    compiled = true;
+    return FW_OK;
+}
+
+void FwTaskGraph::Run() {
+    FwAssert(compiled);
+
+    if (group->GetState() == FwTaskGroupState::kRanToCompletion) {
+        group->Rearm();
+    }
+
+    const uint32_t numNodes = GetNumNodes();
+    for (uint32_t i = 0; i < numNodes; ++i) {
+        pendingCounts[i].store(numPredecessors[i], std::memory_order_relaxed);
+    }
+    group->SubmitPartial(roots, numRoots);
+}
+
+void FwTaskGraph::Wait() {
+    group->Wait();
+}
+
+void FwTaskGraph::OnNodeCompleted(void * context, FwTask * task) {
+    FwTaskGraph * graph = reinterpret_cast<FwTaskGraph *>(context);
+    const FwTaskNode node = task->GetIndex();
+
+    // 最後の先行ノードが後続ノードを積む
+    for (uint32_t i = graph->successorOffsets[node]; i < graph->successorOffsets[node + 1]; ++i) {
+        const FwTaskNode next = graph->successors[i];
+        if (graph->pendingCounts[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            graph->group->ScheduleTask(&graph->group->taskPool[next]);
+        }
+    }
+}
+
+sint32_t FwTaskGraph::Init(FwTaskFactory * _factory, const FwTaskGraphDesc * desc) {
+    factory = _factory;
+    maxEdges = desc->maxEdges;
+
+    group = factory->CreateTaskGroup(desc->maxNodes, 0, 0, desc->name);
+    if (group == nullptr) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    group->SetCompletionHook(&FwTaskGraph::OnNodeCompleted, this);
+
+    const size_t numNodes = desc->maxNodes;
+    edges = reinterpret_cast<FwTaskNode *>(FwMalloc(sizeof(FwTaskNode) * Max<size_t>(maxEdges * 2, 1), FwDefaultMemAllocatorTag));
+    order = reinterpret_cast<FwTaskNode *>(FwMalloc(sizeof(FwTaskNode) * Max<size_t>(numNodes, 1), FwDefaultMemAllocatorTag));
+    roots = reinterpret_cast<FwTaskNode *>(FwMalloc(sizeof(FwTaskNode) * Max<size_t>(numNodes, 1), FwDefaultMemAllocatorTag));
+    successorOffsets = reinterpret_cast<uint32_t *>(FwMalloc(sizeof(uint32_t) * (numNodes + 1), FwDefaultMemAllocatorTag));
+    successors = reinterpret_cast<FwTaskNode *>(FwMalloc(sizeof(FwTaskNode) * Max<size_t>(maxEdges, 1), FwDefaultMemAllocatorTag));
+    numPredecessors = reinterpret_cast<sint32_t *>(FwMalloc(sizeof(sint32_t) * Max<size_t>(numNodes, 1), FwDefaultMemAllocatorTag));
+    pendingCounts = reinterpret_cast<std::atomic<sint32_t> *>(FwMalloc(sizeof(std::atomic<sint32_t>) * Max<size_t>(numNodes, 1), FwDefaultMemAllocatorTag));
+    if (edges == nullptr || order == nullptr || roots == nullptr || successorOffsets == nullptr || successors == nullptr || numPredecessors == nullptr || pendingCounts == nullptr) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; i < numNodes; ++i) {
+        new(&pendingCounts[i]) std::atomic<sint32_t>(0);
+    }
+    return FW_OK;
+}
+
+FwTaskGraph::FwTaskGraph()
+: factory(nullptr)
+, group(nullptr)
+, compiled(false)
+, maxEdges(0)
+, numEdges(0)
+, edges(nullptr)
+, order(nullptr)
+, roots(nullptr)
+, numRoots(0)
+, successorOffsets(nullptr)
+, successors(nullptr)
+, numPredecessors(nullptr)
+, pendingCounts(nullptr) {
+}
+
+FwTaskGraph::~FwTaskGraph() {
+    if (group != nullptr) {
+        factory->DestroyTaskGroup(group);
+    }
+    FwFree(edges);
+    FwFree(order);
+    FwFree(roots);
+    FwFree(successorOffsets);
+    FwFree(successors);
+    FwFree(numPredecessors);
+    FwFree(pendingCounts);
+}
+
+
+// 生成
+FwTaskGraph * FwCreateTaskGraph(FwTaskFactory * factory, const FwTaskGraphDesc * desc) {
+    if (factory == nullptr || desc == nullptr) {
+        return nullptr;
+    }
+
+    void * ptr = FwMalloc(sizeof(FwTaskGraph), FwDefaultMemAllocatorTag);
+    if (ptr == nullptr) {
+        return nullptr;
+    }
+
+    FwTaskGraph * graph = new(ptr) FwTaskGraph();
+    if (graph->Init(factory, desc) != FW_OK) {
+        FwDestroyTaskGraph(graph);
+        return nullptr;
+    }
+    return graph;
+}
+
+// 破棄
+void FwDestroyTaskGraph(FwTaskGraph * graph) {
+    if (graph != nullptr) {
+        graph->~FwTaskGraph();
+        FwFree(graph);
+    }
+}
+
+END_NAMESPACE_FW
@@ -4,6 +4,20 @@
  */
 #include "precompiled.h"
 #include "threading/fw_thread.h"
+#include "threading/fw_thread_context.h"
+#include "core/fw_pool.h"
+#include "core/fw_numa_allocator.h"
+
+#if defined(FW_PLATFORM_LINUX)
+#include <climits>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 BEGIN_NAMESPACE_FW
 /**
@@ -11,12 +25,16 @@ BEGIN_NAMESPACE_FW
  */
 class FwThreadInfo {
 public:
-    volatile bool   terminate;
-    bool            raiseThread;
     bool            waitWorkerThread;
     bool            isWorkerThread;
     char            name[FwMaxThreadNameLen + 1];
     sint32_t        exitCode;
+    uint32_t        spinLimit;          ///< 次の待機でスピンする回数
+
+    std::atomic<bool>           terminate;          ///< ワーカーの実行後、起こされる前にも読むのでアトミックにする
+    std::atomic<bool>           raiseThread;
+    std::atomic<uint32_t>       parkEpoch;          ///< 眠っているスレッドを起こす度に進める
+    std::atomic<uint32_t>       numParkedThreads;   ///< 眠っている（眠ろうとしている）スレッド数
 
     std::mutex                  threadMtx;
     std::condition_variable     raiseThreadCV;
@@ -27,14 +45,23 @@ public:
 
     void Init(const bool worker = false) {
         terminate = false;
-        raiseThread = false;
         waitWorkerThread = false;
         isWorkerThread = worker;
 
         name[0] = '\0';
         exitCode = 0;
+        spinLimit = DefaultSpinCount;
+
+        raiseThread.store(false, std::memory_order_relaxed);
+        parkEpoch.store(0, std::memory_order_relaxed);
+        numParkedThreads.store(0, std::memory_order_relaxed);
     }
 
+    static const uint32_t   MinSpinCount        = 16;
+    static const uint32_t   MaxSpinCount        = 4096;
+    static const uint32_t   DefaultSpinCount    = 256;
+    static const uint32_t   YieldCount          = 16;
+
     FwThreadInfo()
     : threadMtx()
     , raiseThreadCV()
@@ -47,6 +74,12 @@ public:
 };
 
 BEGIN_NAMESPACE_NONAME
+static FwSharedPool<FwThreadInfo> & GetThreadInfoPool() {
+    // 終了時に他の静的オブジェクトのデストラクタからスレッドを破棄しても使えるように、わざと解放しない
+    static FwSharedPool<FwThreadInfo> * s_threadInfoPool = new FwSharedPool<FwThreadInfo>(16);
+    return *s_threadInfoPool;
+}
+
 static void SetThreadName(FwThread * thread) {
 #if defined(FW_PLATFORM_WIN32)
     const uint32_t MS_VC_EXCEPTION = 0x406d1388;
@@ -71,23 +104,269 @@ static void SetThreadName(FwThread * thread) {
     } __except (EXCEPTION_EXECUTE_HANDLER) {
         //! @todo 実装
     }
+#elif defined(FW_PLATFORM_LINUX)
+    // 名前は終端を含めて16文字まで
+    char name[16];
+    const char * src = thread->GetThreadInfo()->name;
+    size_t len = 0;
+    for (; len < sizeof(name) - 1 && src[len] != '\0'; ++len) {
+        name[len] = src[len];
+    }
+    name[len] = '\0';
+    if (0 < len) {
+        pthread_setname_np(pthread_self(), name);
+    }
+#endif
+}
+
+static sint32_t GetNativeThreadPriority(const FwThreadPriority priority) {
+#if defined(FW_PLATFORM_WIN32)
+    switch (priority) {
+    case FwThreadPriorityMin:            return THREAD_BASE_PRIORITY_IDLE;
+    case FwThreadPriorityLowest:         return THREAD_PRIORITY_LOWEST;
+    case FwThreadPriorityBelowNormal:    return THREAD_PRIORITY_BELOW_NORMAL;
+    case FwThreadPriorityNormal:         return THREAD_PRIORITY_NORMAL;
+    case FwThreadPriorityAboveNormal:    return THREAD_PRIORITY_ABOVE_NORMAL;
+    case FwThreadPriorityHighest:        return THREAD_PRIORITY_HIGHEST;
+    case FwThreadPriorityMax:            return THREAD_PRIORITY_TIME_CRITICAL;
+    }
+    return 0;
+#elif defined(FW_PLATFORM_LINUX)
+    // nice値に変換する（一段で5、FwThreadPriorityLowestで10、FwThreadPriorityHighestで-10）
+    const sint32_t nice = (FwThreadPriorityNormal - priority) * 10 / (FwThreadPriorityNormal - FwThreadPriorityLowest);
+    return Min(Max(nice, -20), 19);
+#else
+    return priority;
+#endif
+}
+
+#if defined(FW_PLATFORM_LINUX)
+/**
+ * @brief "0-3,8" の形式のCPUリストを読み取る
+ */
+static bool ReadCpuList(const char * path, FwThreadAffinity * mask) {
+    FILE * fp = fopen(path, "r");
+    if (fp == nullptr) {
+        return false;
+    }
+
+    *mask = 0;
+    int first = 0;
+    while (fscanf(fp, "%d", &first) == 1) {
+        int last = first;
+        int separator = fgetc(fp);
+        if (separator == '-') {
+            if (fscanf(fp, "%d", &last) != 1) {
+                break;
+            }
+            separator = fgetc(fp);
+        }
+        for (int i = Max(first, 0); i <= last && i < static_cast<int>(FwMaxCpus); ++i) {
+            *mask |= static_cast<FwThreadAffinity>(1) << i;
+        }
+        if (separator != ',') {
+            break;
+        }
+    }
+    fclose(fp);
+    return *mask != 0;
+}
+
+/**
+ * @brief 論理CPUのL3キャッシュを共有するCPUを読み取る
+ */
+static bool ReadL3SharedCpus(const uint32_t cpu, FwThreadAffinity * mask) {
+    char path[128];
+    for (uint32_t index = 0; ; ++index) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", cpu, index);
+        FILE * fp = fopen(path, "r");
+        if (fp == nullptr) {
+            return false;
+        }
+        int level = 0;
+        const bool valid = (fscanf(fp, "%d", &level) == 1);
+        fclose(fp);
+
+        if (valid && level == 3) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list", cpu, index);
+            return ReadCpuList(path, mask);
+        }
+    }
+}
+#endif
+
+/**
+ * @brief マスクを登録して番号を返す（登録済みならその番号）
+ */
+static sint32_t AddCpuMask(FwThreadAffinity * masks, uint32_t * numMasks, const FwThreadAffinity mask) {
+    for (uint32_t i = 0; i < *numMasks; ++i) {
+        if (masks[i] == mask) {
+            return static_cast<sint32_t>(i);
+        }
+    }
+    masks[*numMasks] = mask;
+    return static_cast<sint32_t>((*numMasks)++);
+}
+
+#if defined(FW_PLATFORM_LINUX)
+/**
+ * @brief 現在のスレッドにアフィニティと優先度を設定
+ * @note  権限が足りずに失敗した設定は無視します
+ */
+static void SetThreadSchedule(FwThread * thread) {
+    const FwThreadDesc & desc = thread->GetDesc();
+
+    if (desc.affinity != DefaultFwThreadAffinity && desc.affinity != 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (uint32_t i = 0; i < FwMaxCpus; ++i) {
+            if ((desc.affinity & (static_cast<FwThreadAffinity>(1) << i)) != 0) {
+                CPU_SET(i, &cpuSet);
+            }
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    }
+
+    if (desc.priority <= FwThreadPriorityMin) {
+        sched_param param = {};
+        if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0) {
+            return;
+        }
+    } else if (FwThreadPriorityMax <= desc.priority) {
+        sched_param param = {};
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+            return;
+        }
+    }
+
+    // niceはスレッド単位で効く
+    const sint32_t nice = GetNativeThreadPriority(desc.priority);
+    if (nice != 0) {
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), nice);
+    }
+}
+#endif
+
+static FW_FORCE_INLINE void CpuPause() {
+#if defined(FW_PLATFORM_WIN32)
+    YieldProcessor();
+#elif defined(FW_ARCH_X64) || defined(FW_ARCH_X86)
+    __builtin_ia32_pause();
+#elif defined(FW_ARCH_ARM)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * @brief parkEpochが進むまで眠る
+ */
+static void ParkThread(FwThreadInfo * threadInfo, const uint32_t epoch) {
+#if defined(FW_PLATFORM_LINUX)
+    // 既に進んでいればすぐに戻る
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&threadInfo->parkEpoch), FUTEX_WAIT_PRIVATE, epoch, nullptr, nullptr, 0);
 #else
-    //! @todo プラットフォーム対応
+    std::unique_lock<std::mutex> lock(threadInfo->threadMtx);
+    threadInfo->raiseThreadCV.wait(lock, [&] { return threadInfo->parkEpoch.load(std::memory_order_relaxed) != epoch; });
 #endif
 }
 
+/**
+ * @brief parkEpochを進めて眠っているスレッドを起こす
+ */
+static void UnparkThread(FwThreadInfo * threadInfo) {
+#if defined(FW_PLATFORM_LINUX)
+    threadInfo->parkEpoch.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&threadInfo->parkEpoch), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+    {
+        std::lock_guard<std::mutex> lock(threadInfo->threadMtx);
+        threadInfo->parkEpoch.fetch_add(1, std::memory_order_release);
+    }
+    threadInfo->raiseThreadCV.notify_all();
+#endif
+}
+
+/**
+ * @brief 起こされるまで待つ
+ * @note  flagsに従ってスピン、譲る、眠るの順に待ちます
+ *        スピン中に起こされればスピン回数を増やし、起こされなければ減らすので、暇な時はすぐに眠るようになります
+ */
+static void WaitForRaise(FwThreadInfo * threadInfo, const uint32_t flags) {
+    // CPUが1つしか無ければ起こす側が動けないのでスピンしない
+    static const bool s_canSpin = (1 < std::thread::hardware_concurrency());
+
+    if ((flags & FwThreadFlagSpinWait) != 0 && s_canSpin) {
+        for (uint32_t i = 0; i < threadInfo->spinLimit; ++i) {
+            if (threadInfo->raiseThread.load(std::memory_order_relaxed) && threadInfo->raiseThread.exchange(false, std::memory_order_acquire)) {
+                threadInfo->spinLimit = Min(threadInfo->spinLimit * 2, FwThreadInfo::MaxSpinCount);
+                return;
+            }
+            CpuPause();
+        }
+        threadInfo->spinLimit = Max(threadInfo->spinLimit / 2, FwThreadInfo::MinSpinCount);
+    }
+
+    if ((flags & FwThreadFlagYieldWait) != 0) {
+        for (uint32_t i = 0; i < FwThreadInfo::YieldCount; ++i) {
+            if (threadInfo->raiseThread.load(std::memory_order_relaxed) && threadInfo->raiseThread.exchange(false, std::memory_order_acquire)) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    for (;;) {
+        // 眠ることを先に公開してから確認するので、RestartThreadとすれ違っても必ずどちらかが気付く
+        const uint32_t epoch = threadInfo->parkEpoch.load(std::memory_order_acquire);
+        threadInfo->numParkedThreads.fetch_add(1, std::memory_order_seq_cst);
+        if (threadInfo->raiseThread.exchange(false, std::memory_order_seq_cst)) {
+            threadInfo->numParkedThreads.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+
+        ParkThread(threadInfo, epoch);
+        threadInfo->numParkedThreads.fetch_sub(1, std::memory_order_relaxed);
+
+        if (threadInfo->raiseThread.exchange(false, std::memory_order_acquire)) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 待っているスレッドを起こす
+ */
+static void RaiseThread(FwThreadInfo * threadInfo) {
+    threadInfo->raiseThread.store(true, std::memory_order_seq_cst);
+
+    // スピン中なら起こさなくても気付く
+    if (threadInfo->numParkedThreads.load(std::memory_order_seq_cst) != 0) {
+        UnparkThread(threadInfo);
+    }
+}
+
 static unsigned __stdcall ThreadEntryFunction(void * userArgs) {
     FwThread * thread = reinterpret_cast<FwThread *>(userArgs);
     FwThreadInfo * threadInfo = thread->GetThreadInfo();
 
+    FwThreadContext * context = FwThreadContext::GetCurrent();
+    context->Attach(thread, thread->GetDesc().scratchSize);
+
     SetThreadName(thread);
+#if defined(FW_PLATFORM_LINUX)
+    SetThreadSchedule(thread);
+#endif
+
+    // 確保したメモリがこのスレッドのノードに乗るように
+    if (thread->GetDesc().numaNode != FwNumaNodeAny) {
+        FwSetThreadNumaNode(thread->GetDesc().numaNode);
+    }
 
     // 起動後一旦ここで止める
+    WaitForRaise(threadInfo, 0);
     {
-        std::unique_lock<std::mutex> lock(threadInfo->threadMtx);
-
-        threadInfo->raiseThreadCV.wait(lock, [&] { return threadInfo->raiseThread; });
-        threadInfo->raiseThread = false;
+        std::lock_guard<std::mutex> lock(threadInfo->threadMtx);
         threadInfo->waitWorkerThread = false;
     }
 
@@ -106,10 +385,9 @@ static unsigned __stdcall ThreadEntryFunction(void * userArgs) {
             threadInfo->waitThreadCV.notify_all();
 
             if (!threadInfo->terminate) {
-                std::unique_lock<std::mutex> lock(threadInfo->threadMtx);
+                WaitForRaise(threadInfo, thread->GetDesc().flags);
 
-                threadInfo->raiseThreadCV.wait(lock, [&] { return threadInfo->raiseThread; });
-                threadInfo->raiseThread = false;
+                std::lock_guard<std::mutex> lock(threadInfo->threadMtx);
                 threadInfo->waitWorkerThread = false;
             }
         }
@@ -120,25 +398,12 @@ static unsigned __stdcall ThreadEntryFunction(void * userArgs) {
     // 終了処理
     thread->ShutdownThreadFunc(threadInfo->exitCode, thread->GetDesc().userArgs);
 
-    return 0;
-}
+    // スレッドを抜ける前にスロットの値とスクラッチ領域を片付ける
+    context->Term();
 
-static sint32_t GetNativeThreadPriority(const FwThreadPriority priority) {
-#if FW_THREAD == FW_THREAD_WIN32
-    switch (priority) {
-    case FwThreadPriorityMin:            return THREAD_BASE_PRIORITY_IDLE;
-    case FwThreadPriorityLowest:         return THREAD_PRIORITY_LOWEST;
-    case FwThreadPriorityBelowNormal:    return THREAD_PRIORITY_BELOW_NORMAL;
-    case FwThreadPriorityNormal:         return THREAD_PRIORITY_NORMAL;
-    case FwThreadPriorityAboveNormal:    return THREAD_PRIORITY_ABOVE_NORMAL;
-    case FwThreadPriorityHighest:        return THREAD_PRIORITY_HIGHEST;
-    case FwThreadPriorityMax:            return THREAD_PRIORITY_TIME_CRITICAL;
-    }
     return 0;
-#elif FW_THREAD == FW_THREAD_STL
-    return priority;
-#endif
 }
+
 END_NAMESPACE_NONAME
 
 FwThread::FwThread()
@@ -161,7 +426,14 @@ void FwThread::Shutdown() {
         FwThreadInfo * ptr = threadInfo;
         threadInfo = nullptr;
 
-        FwDelete(ptr);
+#if FW_THREAD == FW_THREAD_STL
+        // ワーカースレッドはWaitThreadで合流しないので、終了を待ってから破棄する
+        if (ptr->thread.joinable()) {
+            ptr->thread.join();
+        }
+#endif
+
+        GetThreadInfoPool().Delete(ptr);
     }
 }
 
@@ -185,13 +457,15 @@ void FwThread::StartWorker(const FwThreadDesc * threadDesc) {
 
 void FwThread::StartThread(const bool workerThread) {
     if (threadInfo == nullptr) {
-        threadInfo = FwNew<FwThreadInfo>();
+        threadInfo = GetThreadInfoPool().New();
     }
     threadInfo->Init(workerThread);
 
 #if defined(FW_UNICODE)
     size_t dstResult = 0;
     tstring::WCharToChar(&dstResult, threadInfo->name, FW_ARRAY_SIZEOF(threadInfo->name), desc.name, FW_ARRAY_SIZEOF(desc.name));
+#else
+    tstring::Copy(threadInfo->name, FW_ARRAY_SIZEOF(threadInfo->name), desc.name);
 #endif
 
 #if FW_THREAD == FW_THREAD_WIN32
@@ -211,15 +485,11 @@ void FwThread::StartThread(const bool workerThread) {
     ::SetThreadAffinityMask(reinterpret_cast<HANDLE>(hThread), desc.affinity);
     ::SetThreadPriority(reinterpret_cast<HANDLE>(hThread), GetNativeThreadPriority(desc.priority));
 #else
-    //! @todo プラットフォーム対応
+    // Linuxではスレッド自身がSetThreadScheduleで設定する
 #endif
 
     // 初期化処理前で止まっているスレッドを起こす
-    {
-        std::lock_guard<std::mutex> lock(threadInfo->threadMtx);
-        threadInfo->raiseThread = true;
-    }
-    threadInfo->raiseThreadCV.notify_one();
+    RaiseThread(threadInfo);
 }
 
 void FwThread::TerminateThread() {
@@ -231,19 +501,14 @@ void FwThread::TerminateThread() {
 
 void FwThread::RestartThread() {
     if (threadInfo != nullptr && threadInfo->isWorkerThread) {
-        {
-            std::lock_guard<std::mutex> lock(threadInfo->threadMtx);
-            threadInfo->raiseThread = true;
-        }
-        threadInfo->raiseThreadCV.notify_one();
+        RaiseThread(threadInfo);
     }
 }
 
 sint32_t FwThread::WaitThread(const uint32_t millisecond) {
     if (threadInfo != nullptr) {
-        std::unique_lock<std::mutex> lock(threadInfo->threadMtx);
-
         if (threadInfo->isWorkerThread) {
+            std::unique_lock<std::mutex> lock(threadInfo->threadMtx);
             bool result = threadInfo->waitThreadCV.wait_for(lock, std::chrono::milliseconds(millisecond), [&] {return threadInfo->waitWorkerThread;});
             return result ? FW_OK : WAIT_TIMEOUT;
         } else {
@@ -251,7 +516,10 @@ sint32_t FwThread::WaitThread(const uint32_t millisecond) {
             DWORD result = WaitForSingleObject((HANDLE)threadHandle, millisecond);
             return result == WAIT_OBJECT_0 ? FW_OK : (result == WAIT_TIMEOUT ? ERR_TIMEOUT : ERR_FAILED);
 #else
-            threadInfo->thread.join();
+            // ロックしたまま合流するとスレッド側のロックと競合する
+            if (threadInfo->thread.joinable()) {
+                threadInfo->thread.join();
+            }
             return FW_OK;
 #endif
         }
@@ -301,4 +569,94 @@ void FwThread::YieldThread() {
     std::this_thread::yield();
 }
 
+//-------------------------------------------
+// CPU topology
+//-------------------------------------------
+sint32_t FwGetCpuTopology(FwCpuTopology * topology) {
+    if (topology == nullptr) {
+        return ERR_INVALID_PARMS;
+    }
+
+    topology->numLogicalCpus = 0;
+    topology->numCores = 0;
+    topology->numL3Domains = 0;
+    for (uint32_t i = 0; i < FwMaxCpus; ++i) {
+        topology->coreMasks[i] = 0;
+        topology->l3DomainMasks[i] = 0;
+        topology->cpuCores[i] = -1;
+        topology->cpuL3Domains[i] = -1;
+    }
+
+#if defined(FW_PLATFORM_WIN32)
+    DWORD length = 0;
+    ::GetLogicalProcessorInformation(nullptr, &length);
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION * infos = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION *>(FwMalloc(length, FwDefaultMemAllocatorTag));
+    if (infos != nullptr && ::GetLogicalProcessorInformation(infos, &length)) {
+        const DWORD numInfos = length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+        for (DWORD i = 0; i < numInfos; ++i) {
+            const FwThreadAffinity mask = static_cast<FwThreadAffinity>(infos[i].ProcessorMask);
+            if (infos[i].Relationship == RelationProcessorCore) {
+                const sint32_t core = AddCpuMask(topology->coreMasks, &topology->numCores, mask);
+                for (uint32_t cpu = 0; cpu < FwMaxCpus; ++cpu) {
+                    if ((mask & (static_cast<FwThreadAffinity>(1) << cpu)) != 0) {
+                        topology->cpuCores[cpu] = core;
+                    }
+                }
+            } else if (infos[i].Relationship == RelationCache && infos[i].Cache.Level == 3) {
+                const sint32_t domain = AddCpuMask(topology->l3DomainMasks, &topology->numL3Domains, mask);
+                for (uint32_t cpu = 0; cpu < FwMaxCpus; ++cpu) {
+                    if ((mask & (static_cast<FwThreadAffinity>(1) << cpu)) != 0) {
+                        topology->cpuL3Domains[cpu] = domain;
+                    }
+                }
+            }
+        }
+    }
+    FwFree(infos);
+#elif defined(FW_PLATFORM_LINUX)
+    char path[128];
+    for (uint32_t cpu = 0; cpu < FwMaxCpus; ++cpu) {
+        // オフラインのCPUにはtopologyが無い
+        FwThreadAffinity siblings = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list", cpu);
+        if (!ReadCpuList(path, &siblings)) {
+            continue;
+        }
+        topology->cpuCores[cpu] = AddCpuMask(topology->coreMasks, &topology->numCores, siblings);
+
+        FwThreadAffinity shared = 0;
+        if (ReadL3SharedCpus(cpu, &shared)) {
+            topology->cpuL3Domains[cpu] = AddCpuMask(topology->l3DomainMasks, &topology->numL3Domains, shared);
+        }
+    }
+#endif
+
+    // 取得できなかった分は論理CPU毎に1コアとみなす
+    if (topology->numCores == 0) {
+        const uint32_t numCpus = Min(Max(std::thread::hardware_concurrency(), 1u), FwMaxCpus);
+        for (uint32_t cpu = 0; cpu < numCpus; ++cpu) {
+            topology->cpuCores[cpu] = AddCpuMask(topology->coreMasks, &topology->numCores, static_cast<FwThreadAffinity>(1) << cpu);
+        }
+    }
+
+    FwThreadAffinity allCpus = 0;
+    for (uint32_t i = 0; i < topology->numCores; ++i) {
+        allCpus |= topology->coreMasks[i];
+    }
+    for (uint32_t cpu = 0; cpu < FwMaxCpus; ++cpu) {
+        if ((allCpus & (static_cast<FwThreadAffinity>(1) << cpu)) == 0) {
+            continue;
+        }
+        ++topology->numLogicalCpus;
+
+        // L3の情報が無いCPUは、キャッシュを共有していると分かっている物理コア毎に別のドメインにする
+        // 他のドメインにまとめると、キャッシュを共有しないCPU同士が近いものとして扱われる
+        if (topology->cpuL3Domains[cpu] < 0) {
+            const FwThreadAffinity coreMask = topology->coreMasks[topology->cpuCores[cpu]];
+            topology->cpuL3Domains[cpu] = AddCpuMask(topology->l3DomainMasks, &topology->numL3Domains, coreMask);
+        }
+    }
+    return FW_OK;
+}
+
 END_NAMESPACE_FW
\ No newline at end of file
@@ -0,0 +1,125 @@
+﻿/**
+ * @file fw_thread_context.cpp
+ */
+#include "precompiled.h"
+#include "threading/fw_thread_context.h"
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+static_assert(FwMaxThreadContextSlots <= 32, "slot mask is 32bit");
+
+static std::atomic<uint32_t>                    s_usedSlots(0);
+static std::atomic<FwThreadContextDestructor>   s_slotDestructors[FwMaxThreadContextSlots];
+static std::atomic<uint32_t>                    s_randomSeed(0x9e3779b9u);
+
+static thread_local FwThreadContext             s_threadContext;
+
+END_NAMESPACE_NONAME
+
+
+FwThreadContext * FwThreadContext::GetCurrent() {
+    return &s_threadContext;
+}
+
+void * FwThreadContext::AllocScratch(const size_t size, const size_t alignment) {
+    FwAssert(IsPowerOfTwo(alignment));
+    if (scratch == nullptr) {
+        if (scratchSize == 0) {
+            scratchSize = DefaultFwThreadScratchSize;
+        }
+        scratch = reinterpret_cast<uint8_t *>(FwMallocAligned(scratchSize, 64, FwDefaultMemAllocatorTag));
+        if (scratch == nullptr) {
+            return nullptr;
+        }
+    }
+
+    const size_t offset = RoundUp(scratchUsed, alignment);
+    if (scratchSize < offset || scratchSize - offset < size) {
+        return nullptr;
+    }
+    scratchUsed = offset + size;
+    return scratch + offset;
+}
+
+void FwThreadContext::Attach(FwThread * _thread, const size_t _scratchSize) {
+    FwAssert(scratch == nullptr);
+    thread = _thread;
+    scratchSize = _scratchSize;
+}
+
+void FwThreadContext::Term() {
+    // デストラクタが他のスロットに値を入れ直すこともあるので、空になるまで繰り返す
+    bool found = true;
+    for (sint32_t retry = 0; found && retry < 4; ++retry) {
+        found = false;
+        for (sint32_t i = 0; i < FwMaxThreadContextSlots; ++i) {
+            void * value = slots[i];
+            if (value == nullptr) {
+                continue;
+            }
+            slots[i] = nullptr;
+            found = true;
+
+            FwThreadContextDestructor destructor = s_slotDestructors[i].load(std::memory_order_acquire);
+            if (destructor != nullptr) {
+                destructor(value);
+            }
+        }
+    }
+
+    FwFree(scratch);
+    scratch = nullptr;
+    scratchSize = 0;
+    scratchUsed = 0;
+    thread = nullptr;
+}
+
+FwThreadContext::FwThreadContext()
+: thread(nullptr)
+, taskFactory(nullptr)
+, workerIndex(-1)
+, randomState(0)
+, scratch(nullptr)
+, scratchSize(0)
+, scratchUsed(0) {
+    for (sint32_t i = 0; i < FwMaxThreadContextSlots; ++i) {
+        slots[i] = nullptr;
+    }
+
+    // スレッド毎に違う系列になるように。xorshiftは0だと進まない
+    randomState = s_randomSeed.fetch_add(0x9e3779b9u, std::memory_order_relaxed) | 1;
+}
+
+FwThreadContext::~FwThreadContext() {
+    Term();
+}
+
+
+FwThreadContextSlot FwAllocThreadContextSlot(FwThreadContextDestructor destructor) {
+    uint32_t used = s_usedSlots.load(std::memory_order_relaxed);
+    for (;;) {
+        FwThreadContextSlot slot = 0;
+        while (slot < FwMaxThreadContextSlots && (used & (1u << slot)) != 0) {
+            ++slot;
+        }
+        if (FwMaxThreadContextSlots <= slot) {
+            return FwInvalidThreadContextSlot;
+        }
+        if (s_usedSlots.compare_exchange_weak(used, used | (1u << slot), std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            s_slotDestructors[slot].store(destructor, std::memory_order_release);
+            return slot;
+        }
+    }
+}
+
+void FwFreeThreadContextSlot(const FwThreadContextSlot slot) {
+    if (slot < 0 || FwMaxThreadContextSlots <= slot) {
+        return;
+    }
+    s_slotDestructors[slot].store(nullptr, std::memory_order_release);
+    s_usedSlots.fetch_and(~(1u << slot), std::memory_order_acq_rel);
+}
+
+END_NAMESPACE_FW
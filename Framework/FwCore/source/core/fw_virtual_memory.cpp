@@ -0,0 +1,246 @@
+﻿/**
+ * @file fw_virtual_memory.cpp
+ */
+#include "precompiled.h"
+#include "fw_virtual_memory.h"
+
+#if !defined(FW_PLATFORM_WIN32)
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+#if defined(FW_PLATFORM_LINUX)
+    #include <stdio.h>
+    #include <sys/syscall.h>
+#endif
+
+
+BEGIN_NAMESPACE_FW
+
+#if defined(FW_PLATFORM_LINUX)
+BEGIN_NAMESPACE_NONAME
+// libnumaに依存しないようにシステムコールを直接呼ぶ（numaif.hのMPOL_PREFERRED/MPOL_DEFAULT）
+static const int        s_mpolDefault           = 0;
+static const int        s_mpolPreferred         = 1;
+static const sint32_t   s_maxNumaNodeMaskBits   = 64;
+
+/**
+ * @brief /sys/devices/system/node/onlineからノード数を読み取る
+ */
+sint32_t ReadNumaNodeCount() {
+    FILE * fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp == nullptr) {
+        return 1;
+    }
+
+    // "0" や "0-1" の形式なので最後の数字が最大のノード番号になる
+    sint32_t maxNode = 0;
+    int value = 0;
+    while (fscanf(fp, "%d", &value) == 1) {
+        maxNode = Max<sint32_t>(maxNode, value);
+        if (fgetc(fp) == EOF) {
+            break;
+        }
+    }
+    fclose(fp);
+    return Min<sint32_t>(maxNode + 1, s_maxNumaNodeMaskBits);
+}
+END_NAMESPACE_NONAME
+#endif
+
+size_t FwVirtualMemoryPageSize() {
+#if defined(FW_PLATFORM_WIN32)
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    return static_cast<size_t>(info.dwPageSize);
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+void * FwVirtualMemoryReserve(const size_t size) {
+#if defined(FW_PLATFORM_WIN32)
+    return ::VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void * ptr = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return (ptr != MAP_FAILED) ? ptr : nullptr;
+#endif
+}
+
+bool FwVirtualMemoryCommit(void * ptr, const size_t size) {
+#if defined(FW_PLATFORM_WIN32)
+    return ::VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+    return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+void FwVirtualMemoryDecommit(void * ptr, const size_t size) {
+#if defined(FW_PLATFORM_WIN32)
+    ::VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+    madvise(ptr, size, MADV_DONTNEED);
+    mprotect(ptr, size, PROT_NONE);
+#endif
+}
+
+void FwVirtualMemoryDiscard(void * ptr, const size_t size) {
+#if defined(FW_PLATFORM_WIN32)
+    ::VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise(ptr, size, MADV_DONTNEED);
+#endif
+}
+
+size_t FwVirtualMemoryHugePageSize() {
+#if defined(FW_PLATFORM_WIN32)
+    return static_cast<size_t>(::GetLargePageMinimum());
+#elif defined(FW_PLATFORM_LINUX)
+    return 2 * 1024 * 1024;
+#else
+    return 0;
+#endif
+}
+
+bool FwVirtualMemoryAdviseHugePages(void * ptr, const size_t size) {
+#if defined(FW_PLATFORM_LINUX) && defined(MADV_HUGEPAGE)
+    return madvise(ptr, size, MADV_HUGEPAGE) == 0;
+#else
+    return false;
+#endif
+}
+
+void * FwVirtualMemoryReserveHugePages(const size_t size) {
+#if defined(FW_PLATFORM_WIN32)
+    if (::GetLargePageMinimum() == 0) {
+        return nullptr;
+    }
+    return ::VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+#elif defined(FW_PLATFORM_LINUX) && defined(MAP_HUGETLB)
+    // プールが足りないときにアクセスしてから落ちないように、MAP_NORESERVEは付けない
+    void * ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    return (ptr != MAP_FAILED) ? ptr : nullptr;
+#else
+    return nullptr;
+#endif
+}
+
+bool FwVirtualMemoryRemap(void * dst, const size_t dstSize, void * src, const size_t srcSize) {
+#if defined(FW_PLATFORM_LINUX) && defined(MREMAP_DONTUNMAP)
+    // 移動元を残しておかないと、別スレッドのmmapに空いたアドレスを取られてしまう
+    void * ptr = mremap(src, srcSize, srcSize, MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, dst);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    if (srcSize < dstSize && !FwVirtualMemoryCommit(reinterpret_cast<uint8_t *>(dst) + srcSize, dstSize - srcSize)) {
+        // 元に戻す
+        mremap(dst, srcSize, srcSize, MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, src);
+        FwVirtualMemoryDecommit(dst, srcSize);
+        return false;
+    }
+    FwVirtualMemoryDecommit(src, srcSize);
+    return true;
+#else
+    (void)dst;
+    (void)dstSize;
+    (void)src;
+    (void)srcSize;
+    return false;
+#endif
+}
+
+sint32_t FwVirtualMemoryNumaNodeCount() {
+#if defined(FW_PLATFORM_WIN32)
+    ULONG highestNode = 0;
+    if (!::GetNumaHighestNodeNumber(&highestNode)) {
+        return 1;
+    }
+    return static_cast<sint32_t>(highestNode) + 1;
+#elif defined(FW_PLATFORM_LINUX)
+    static const sint32_t s_numNodes = ReadNumaNodeCount();
+    return s_numNodes;
+#else
+    return 1;
+#endif
+}
+
+sint32_t FwVirtualMemoryCurrentNumaNode() {
+#if defined(FW_PLATFORM_WIN32)
+    PROCESSOR_NUMBER processor;
+    ::GetCurrentProcessorNumberEx(&processor);
+    USHORT node = 0;
+    if (!::GetNumaProcessorNodeEx(&processor, &node)) {
+        return 0;
+    }
+    return static_cast<sint32_t>(node);
+#elif defined(FW_PLATFORM_LINUX) && defined(SYS_getcpu)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return static_cast<sint32_t>(node);
+#else
+    return 0;
+#endif
+}
+
+void * FwVirtualMemoryReserveOnNode(const size_t size, const sint32_t node, bool * bound) {
+    if (bound != nullptr) {
+        *bound = false;
+    }
+#if defined(FW_PLATFORM_WIN32)
+    // ノードの指定は予約時にしか行えない
+    void * ptr = ::VirtualAllocExNuma(::GetCurrentProcess(), nullptr, size, MEM_RESERVE, PAGE_NOACCESS, static_cast<DWORD>(node));
+    if (ptr != nullptr) {
+        if (bound != nullptr) {
+            *bound = true;
+        }
+        return ptr;
+    }
+    return FwVirtualMemoryReserve(size);
+#else
+    void * ptr = FwVirtualMemoryReserve(size);
+#if defined(FW_PLATFORM_LINUX) && defined(SYS_mbind)
+    // まだ触れていないので、以降に割り当てられるページは全てノードに従う
+    if (ptr != nullptr && 0 <= node && node < s_maxNumaNodeMaskBits) {
+        const uint64_t nodeMask = static_cast<uint64_t>(1) << node;
+        if (syscall(SYS_mbind, ptr, size, s_mpolPreferred, &nodeMask, s_maxNumaNodeMaskBits + 1, 0) == 0 && bound != nullptr) {
+            *bound = true;
+        }
+    }
+#else
+    (void)node;
+#endif
+    return ptr;
+#endif
+}
+
+bool FwVirtualMemorySetThreadNumaNode(const sint32_t node) {
+#if defined(FW_PLATFORM_LINUX) && defined(SYS_set_mempolicy)
+    if (node < 0) {
+        return syscall(SYS_set_mempolicy, s_mpolDefault, nullptr, 0) == 0;
+    }
+    if (s_maxNumaNodeMaskBits <= node) {
+        return false;
+    }
+    const uint64_t nodeMask = static_cast<uint64_t>(1) << node;
+    return syscall(SYS_set_mempolicy, s_mpolPreferred, &nodeMask, s_maxNumaNodeMaskBits + 1) == 0;
+#else
+    // Windowsではスレッドが動いているプロセッサのノードから割り当てられる
+    (void)node;
+    return false;
+#endif
+}
+
+void FwVirtualMemoryRelease(void * ptr, const size_t size) {
+    if (ptr == nullptr) {
+        return;
+    }
+#if defined(FW_PLATFORM_WIN32)
+    ::VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, size);
+#endif
+}
+
+END_NAMESPACE_FW
@@ -0,0 +1,113 @@
+﻿/**
+ * @file fw_virtual_memory.h
+ * @brief 仮想メモリ操作（内部使用）
+ */
+#ifndef FW_VIRTUAL_MEMORY_H_
+#define FW_VIRTUAL_MEMORY_H_
+
+BEGIN_NAMESPACE_FW
+
+/**
+ * @brief ページサイズを取得
+ */
+size_t FwVirtualMemoryPageSize();
+
+/**
+ * @brief アドレス空間を予約する
+ * @param[in] size 予約サイズ（ページサイズの倍数）
+ * @return 予約した領域の先頭。失敗時はnullptr
+ */
+void * FwVirtualMemoryReserve(const size_t size);
+
+/**
+ * @brief 予約済み領域を使用可能にする
+ * @param[in] ptr  先頭（ページ境界）
+ * @param[in] size サイズ（ページサイズの倍数）
+ */
+bool FwVirtualMemoryCommit(void * ptr, const size_t size);
+
+/**
+ * @brief 物理メモリをOSへ返却して予約状態に戻す
+ * @param[in] ptr  先頭（ページ境界）
+ * @param[in] size サイズ（ページサイズの倍数）
+ */
+void FwVirtualMemoryDecommit(void * ptr, const size_t size);
+
+/**
+ * @brief 物理メモリだけをOSへ返却する
+ * @note  アクセス可能なまま残り、次にアクセスしたときはゼロ埋めされたページが割り当てられる
+ * @param[in] ptr  先頭（ページ境界）
+ * @param[in] size サイズ（ページサイズの倍数）
+ */
+void FwVirtualMemoryDiscard(void * ptr, const size_t size);
+
+/**
+ * @brief ヒュージページのサイズを取得
+ * @return ヒュージページを使えない環境では0
+ */
+size_t FwVirtualMemoryHugePageSize();
+
+/**
+ * @brief 予約済み領域にTransparent Huge Pageを使うようにOSへ通知する
+ * @return 通知できなかったらfalse
+ */
+bool FwVirtualMemoryAdviseHugePages(void * ptr, const size_t size);
+
+/**
+ * @brief ヒュージページで領域を確保する
+ * @note  予約と同時に使用可能になる。Linuxではhugetlbfsのプール、Windowsではロックメモリ特権が必要
+ * @param[in] size サイズ（ヒュージページサイズの倍数）
+ * @return 確保した領域の先頭。使えない環境ではnullptr
+ */
+void * FwVirtualMemoryReserveHugePages(const size_t size);
+
+/**
+ * @brief 使用可能な領域の物理ページを別の予約済み領域へ付け替える
+ * @note  中身はコピーせずに移動し、移動元は予約済みの状態に戻る
+ * @param[in] dst     移動先の先頭（予約済み、ページ境界）
+ * @param[in] dstSize 移動先のサイズ。srcSizeを超えた部分は使用可能になる
+ * @param[in] src     移動元の先頭（使用可能、ページ境界）
+ * @param[in] srcSize 移動元のサイズ（ページサイズの倍数）
+ * @return 付け替えられない環境ではfalse（どちらの領域も変化しない）
+ */
+bool FwVirtualMemoryRemap(void * dst, const size_t dstSize, void * src, const size_t srcSize);
+
+/**
+ * @brief NUMAノード数を取得
+ * @return NUMAに対応していない環境では1
+ */
+sint32_t FwVirtualMemoryNumaNodeCount();
+
+/**
+ * @brief 現在のスレッドが動いているCPUのNUMAノードを取得
+ * @return 取得できない環境では0
+ */
+sint32_t FwVirtualMemoryCurrentNumaNode();
+
+/**
+ * @brief 物理メモリを指定したNUMAノードから割り当てるように予約する
+ * @note  ノードを指定できない環境では通常の予約と同じ
+ * @param[in] size  サイズ（ページサイズの倍数）
+ * @param[in] node  NUMAノード
+ * @param[out] bound ノードを指定できたか（nullptr可）
+ * @return 予約した領域の先頭。失敗した場合はnullptr
+ */
+void * FwVirtualMemoryReserveOnNode(const size_t size, const sint32_t node, bool * bound);
+
+/**
+ * @brief 現在のスレッドが新たに使うページを指定したNUMAノードから割り当てるようにする
+ * @param[in] node NUMAノード。負の値なら指定を解除する
+ * @return 指定できない環境ではfalse
+ */
+bool FwVirtualMemorySetThreadNumaNode(const sint32_t node);
+
+/**
+ * @brief 予約を解除する
+ * @param[in] ptr  FwVirtualMemoryReserveで取得した先頭
+ * @param[in] size 予約サイズ
+ */
+void FwVirtualMemoryRelease(void * ptr, const size_t size);
+
+END_NAMESPACE_FW
+
+#endif  // FW_VIRTUAL_MEMORY_H_
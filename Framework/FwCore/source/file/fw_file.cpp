@@ -7,7 +7,71 @@
 #include "file/fw_file_types.h"
 #include "file/fw_path.h"
 
+#if defined(FW_PLATFORM_WIN32)
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+
 BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+static const uint64_t s_maxTransferSize = 1ull << 30;   ///< 1回のシステムコールで読み書きする最大サイズ
+
+/**
+ * @brief 位置を指定して1回読み書きする
+ * @param[out] transferred 読み書きしたサイズ。末尾に達したら0
+ */
+static sint32_t TransferAt(FwFile & fp, const bool isRead, void * buffer, const uint64_t size, const uint64_t offset, uint64_t & transferred) {
+    transferred = 0;
+#if defined(FW_PLATFORM_WIN32)
+#if FW_FILE == FW_FILE_WIN32
+    HANDLE nativeHandle = fp.nativeHandle;
+#else
+    HANDLE nativeHandle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(fp.nativeHandle)));
+#endif
+    // OVERLAPPEDで位置を指定すると、同期ハンドルでもその位置から読み書きする
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset & 0xffffffff);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    const DWORD requestSize = static_cast<DWORD>(Min(size, s_maxTransferSize));
+    DWORD numTransferred = 0;
+    BOOL r = isRead ? ReadFile(nativeHandle, buffer, requestSize, &numTransferred, &overlapped)
+                    : WriteFile(nativeHandle, buffer, requestSize, &numTransferred, &overlapped);
+    if (!r) {
+        DWORD error = GetLastError();
+        if (error == ERROR_IO_PENDING) {
+            // FILE_FLAG_OVERLAPPEDで開かれたハンドル
+            r = GetOverlappedResult(nativeHandle, &overlapped, &numTransferred, TRUE);
+            error = r ? ERROR_SUCCESS : GetLastError();
+        }
+        if (error == ERROR_HANDLE_EOF) {
+            return FW_OK;
+        }
+        if (error != ERROR_SUCCESS) {
+            return ERR_INVALID;
+        }
+    }
+    transferred = static_cast<uint64_t>(numTransferred);
+#else
+    const int fd = fileno(fp.nativeHandle);
+    const size_t requestSize = static_cast<size_t>(Min(size, s_maxTransferSize));
+    ssize_t ret = 0;
+    do {
+        ret = isRead ? pread(fd, buffer, requestSize, static_cast<off_t>(offset))
+                     : pwrite(fd, buffer, requestSize, static_cast<off_t>(offset));
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return ERR_INVALID;
+    }
+    transferred = static_cast<uint64_t>(ret);
+#endif
+    return FW_OK;
+}
+
+END_NAMESPACE_NONAME
 
 sint32_t FwFileOpen(const str_t name, const uint32_t options, FwFile & fp) {
     if (name == nullptr || (options & FwFileOptAccessMask) == 0) {
@@ -234,6 +298,60 @@ sint32_t FwFileWrite(FwFile & fp, const void * src, const uint64_t toWriteSize,
     return FW_OK;
 }
 
+sint32_t FwFileReadAt(FwFile & fp, void * dst, const uint64_t toReadSize, const uint64_t offset, uint64_t * readSize) {
+    if (fp.nativeHandle == nullptr || dst == nullptr || toReadSize == 0) {
+        return ERR_INVALID_PARMS;
+    }
+
+    uint64_t readOffset = 0;
+    while (readOffset < toReadSize) {
+        void * dstBuffer = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(dst) + readOffset);
+
+        uint64_t numReads = 0;
+        const sint32_t result = TransferAt(fp, true, dstBuffer, toReadSize - readOffset, offset + readOffset, numReads);
+        if (result != FW_OK) {
+            return result;
+        }
+        if (numReads == 0) {
+            break;
+        }
+        readOffset += numReads;
+    }
+    if (readSize != nullptr) {
+        *readSize = readOffset;
+    }
+    if (readOffset == 0) {
+        return ERR_EOF;
+    }
+    return FW_OK;
+}
+
+sint32_t FwFileWriteAt(FwFile & fp, const void * src, const uint64_t toWriteSize, const uint64_t offset, uint64_t * writeSize) {
+    if (fp.nativeHandle == nullptr || src == nullptr || toWriteSize == 0) {
+        return ERR_INVALID_PARMS;
+    }
+
+    uint64_t writeOffset = 0;
+    sint32_t result = FW_OK;
+    while (writeOffset < toWriteSize) {
+        void * srcBuffer = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(src) + writeOffset);
+
+        uint64_t numWrites = 0;
+        result = TransferAt(fp, false, srcBuffer, toWriteSize - writeOffset, offset + writeOffset, numWrites);
+        if (result == FW_OK && numWrites == 0) {
+            result = ERR_FAILED;
+        }
+        if (result != FW_OK) {
+            break;
+        }
+        writeOffset += numWrites;
+    }
+    if (writeSize != nullptr) {
+        *writeSize = writeOffset;
+    }
+    return result;
+}
+
 sint32_t FwFileGetLengthByName(const str_t name, uint64_t * length) {
     if (length == nullptr) {
         return ERR_INVALID_PARMS;
@@ -329,7 +447,32 @@ sint32_t FwFileSeek(FwFile & fp, const sint64_t offset, const FwSeekOrigin origi
     SetFilePointerEx(fp.nativeHandle, liDistanceToMove, NULL, oriTbl[origin]);
 #elif FW_FILE == FW_FILE_LIBC
     int oriTbl[] = { SEEK_SET, SEEK_CUR, SEEK_END };
-    _fseeki64(fp.nativeHandle, 0, oriTbl[origin]);
+    _fseeki64(fp.nativeHandle, offset, oriTbl[origin]);
+#endif
+
+    return FW_OK;
+}
+
+sint32_t FwFileTell(FwFile & fp, uint64_t * offset) {
+    if (fp.nativeHandle == nullptr || offset == nullptr) {
+        return ERR_INVALID_PARMS;
+    }
+
+#if FW_FILE == FW_FILE_WIN32
+    LARGE_INTEGER liDistanceToMove;
+    liDistanceToMove.QuadPart = 0;
+
+    LARGE_INTEGER liNewFilePointer;
+    if (!SetFilePointerEx(fp.nativeHandle, liDistanceToMove, &liNewFilePointer, FILE_CURRENT)) {
+        return ERR_INVALID;
+    }
+    *offset = static_cast<uint64_t>(liNewFilePointer.QuadPart);
+#elif FW_FILE == FW_FILE_LIBC
+    const sint64_t current = _ftelli64(fp.nativeHandle);
+    if (current < 0) {
+        return ERR_INVALID;
+    }
+    *offset = static_cast<uint64_t>(current);
 #endif
 
     return FW_OK;
@@ -0,0 +1,382 @@
+﻿/**
+ * @file fw_file_io.h
+ * @brief ファイルI/Oスレッドへ渡すコマンドと、非同期I/Oのバックエンド（内部使用）
+ */
+#ifndef FW_FILE_IO_H_
+#define FW_FILE_IO_H_
+
+#include "file/fw_file.h"
+#include "file/fw_file_stream.h"
+#include "file/fw_file_manager.h"
+#include "misc/fw_noncopyable.h"
+#include "container/fw_deque.h"
+#include "container/fw_vector.h"
+#include "container/fw_mpsc_queue.h"
+#include "core/fw_pool.h"
+
+BEGIN_NAMESPACE_FW
+
+/**
+ * @struct FwFileIONotification
+ * @brief ストリームが送出した処理の完了待ち
+ * @note  完了する前に続けて送出できるので、完了していないコマンドの数を数えて全て完了したら起こします
+ */
+struct FwFileIONotification {
+    std::mutex                  _mutexFileIO;
+    std::condition_variable     _condFileIO;
+    sint32_t                    _numPending;    ///< 完了していないコマンド数
+    sint32_t                    _result;        ///< 最初に失敗した処理の結果
+
+    /**
+     * @brief 送出したコマンドを数える
+     */
+    void Add(const sint32_t numCommands) {
+        std::lock_guard<std::mutex> lock(_mutexFileIO);
+        if (_numPending == 0) {
+            _result = FW_OK;
+        }
+        _numPending += numCommands;
+    }
+
+    /**
+     * @brief コマンド1つの完了
+     */
+    void Complete(const sint32_t result) {
+        // 起きた側がストリームを破棄しうるので、ロックを持ったまま起こす
+        std::lock_guard<std::mutex> lock(_mutexFileIO);
+        if (result != FW_OK && _result == FW_OK) {
+            _result = result;
+        }
+        if (--_numPending == 0) {
+            _condFileIO.notify_all();
+        }
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(_mutexFileIO);
+        _condFileIO.wait(lock, [this]() { return _numPending == 0; });
+    }
+
+    bool WaitFor(const uint32_t milliseconds) {
+        std::unique_lock<std::mutex> lock(_mutexFileIO);
+        return _condFileIO.wait_for(lock, std::chrono::milliseconds(milliseconds), [this]() { return _numPending == 0; });
+    }
+
+    FwFileIONotification()
+    : _numPending(0)
+    , _result(FW_OK) {
+    }
+};
+
+/**
+ * @struct FwFileIOSubmitGroup
+ * @brief コールバック付きで送出した1回分のコマンド
+ * @note  最後に完了したコマンドがコールバックを呼び、自身を破棄します
+ */
+struct FwFileIOSubmitGroup {
+    std::atomic<sint32_t>       _numPending;
+    std::atomic<sint32_t>       _result;        ///< 最初に失敗した処理の結果
+    FwFileStreamCallback        _callback;
+    void *                      _callbackContext;
+
+    FwFileIOSubmitGroup(const sint32_t numCommands, FwFileStreamCallback callback, void * callbackContext)
+    : _numPending(numCommands)
+    , _result(FW_OK)
+    , _callback(callback)
+    , _callbackContext(callbackContext) {
+    }
+};
+
+/**
+ * @struct FwFileIOCompletionNode
+ * @brief 完了キューに積む要素
+ */
+struct FwFileIOCompletionNode : public FwMpscQueueNode {
+    FwFileCompletion            _completion;
+};
+
+/**
+ * @struct FwFileIOCommand
+ */
+struct FwFileIOCommand {
+    enum {
+        kFlagFileRead       = FW_BIT32(0),
+        kFlagFileWrite      = FW_BIT32(1),
+        kFlagFileSeek       = FW_BIT32(2),
+        kFlagFileAt         = FW_BIT32(3),     ///< _offsetの位置へ読み書きする（ファイルの現在位置に依存しない）
+        kFlagPostCompletion = FW_BIT32(4),     ///< 完了キューへ積む
+        kFlagFileSequential = FW_BIT32(5),     ///< ストリームの現在位置からの読み書き（kFlagFileAtが無ければ、同じファイルのコマンドとは積んだ順に1つずつ処理する）
+        kFlagFileKeepSeek   = FW_BIT32(6),     ///< 現在位置からの読み書きと同じFILEを使うので、libcのバッファを書き出してから読み書きし、現在位置を元に戻す
+    };
+
+    FwFile          _fp;
+    sint32_t        _flags;
+    uint32_t        _priority;
+    FwSeekOrigin    _seekOrigin;
+    sint64_t        _seekOffset;
+    uint64_t        _offset;        ///< 読み書きするファイル上の位置（kFlagFileAtの場合）
+    sint32_t        _fileSlot;      ///< io_uringに登録したファイルの番号（未登録は-1）
+
+    void *      _rwBuffer;
+    uint64_t    _rwSize;
+    uint64_t    _submitTime;    ///< 積んだ時刻（マイクロ秒）
+    uint64_t    _sequence;      ///< 積んだ順番
+
+    FwFileRequestToken      _token;             ///< 発行した番号（個別に完了を受け取らない場合はFwInvalidFileRequestToken）
+    FwFileStream *          _stream;
+    FwFileRequestCallback   _requestCallback;
+    void *                  _userData;
+
+    FwFileIOSubmitGroup *   _group;             ///< コールバック付きで送出した場合
+    FwFileIONotification *  notification;
+};
+
+static const uint32_t FwFileIOMaxBatchCommands = 32;   ///< 1つの読み込みに合体するコマンドの最大数
+
+/**
+ * @struct FwFileIOBatch
+ * @brief 合体した読み込み
+ * @note  [_offset, _offset + _size)を1回で読み込み、各コマンドの読み込み先へ分配します
+ */
+struct FwFileIOBatch {
+    FwFileIOCommand     _cmds[FwFileIOMaxBatchCommands];
+    uint32_t            _numCommands;
+    uint64_t            _offset;
+    uint64_t            _size;
+};
+
+/**
+ * @class FwFileIOScheduler
+ * @brief I/Oスレッドへ渡すコマンドの順番を決める
+ * @note  優先度の高い順に取り出します。同じ優先度の中では
+ *        - 位置を指定したコマンドは（ファイル, 位置）順に並べ、前回の続きから一方向に進みます（C-SCAN）
+ *        - 位置の近い読み込みは、合わせてmaxMergeSize以下なら1つの読み込みに合体します
+ *        - ファイルの現在位置を使うコマンド（kFlagFileSequentialでkFlagFileAtの無いもの）は積んだ順に取り出します
+ *        ファイルの現在位置を使うコマンドは、同じファイルの先に積んだコマンドが全て完了するまで取り出さず、
+ *        後から積んだ同じファイルのコマンドは、これが完了するまで取り出しません
+ *        位置を指定したコマンドは、書き込みと範囲の重なる同じファイルの読み書きだけを積んだ順に処理します（読み込み同士は並行に処理します）
+ *        順番の判断はファイル毎に完了していないコマンドを調べるので、他のファイルのコマンドが多くても遅くなりません
+ */
+class FwFileIOScheduler : public NonCopyable<FwFileIOScheduler> {
+public:
+    /**
+     * @brief 初期化
+     * @param[in] maxMergeSize 合体した読み込みの最大サイズ（0なら合体しない）
+     * @param[in] maxMergeGap  合体する読み込みの間の隙間の最大サイズ（余分に読んで捨てる量）
+     */
+    void Init(const uint64_t maxMergeSize, const uint64_t maxMergeGap);
+
+    /**
+     * @brief コマンドを積む
+     */
+    void Push(FwFileIOCommand * cmds, const uint32_t numCommands);
+
+    /**
+     * @brief 次のコマンドを1つ取り出す
+     * @return 空ならfalse
+     */
+    bool Pop(FwFileIOCommand & cmd);
+
+    /**
+     * @brief 次のコマンドを、続けて読める読み込みと合体して取り出す
+     * @return 空ならfalse
+     */
+    bool PopBatch(FwFileIOBatch & batch);
+
+    /**
+     * @brief 読み書き1つ毎の番号を発行する
+     */
+    FW_INLINE FwFileRequestToken NewToken() {
+        return _nextToken.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief コールバック付きで送出するコマンドのグループを生成
+     * @note  最後のコマンドが完了した時に破棄されます
+     */
+    FwFileIOSubmitGroup * NewSubmitGroup(const sint32_t numCommands, FwFileStreamCallback callback, void * callbackContext);
+
+    /**
+     * @brief 完了キューから取り出す
+     * @note  複数のスレッドから呼べます
+     */
+    uint32_t PollCompletions(FwFileCompletion * completions, const uint32_t maxCompletions);
+
+    /**
+     * @brief 実際に発行した読み書きを記録する
+     */
+    void RecordIssue(const uint64_t size);
+
+    /**
+     * @brief コマンドの完了を記録して通知する
+     * @note  個別のコールバック、完了キュー、送出したグループ、ストリームの順に通知します
+     */
+    void Complete(FwFileIOCommand & cmd, const sint32_t result);
+
+    /**
+     * @brief 統計を取得
+     */
+    void GetStats(FwFileIOStats & stats);
+
+    /**
+     * @brief 統計をリセット
+     */
+    void ResetStats();
+
+    FwFileIOScheduler();
+    ~FwFileIOScheduler();
+
+
+private:
+    /**
+     * @struct PendingRange
+     * @brief 完了していない位置を指定したコマンドの範囲
+     */
+    struct PendingRange {
+        uint64_t    _sequence;
+        uint64_t    _offset;
+        uint64_t    _size;
+        bool        _write;
+        bool        _completed;     ///< 完了したが、先に積んだものが残っているので消していない
+    };
+
+    /**
+     * @struct FileState
+     * @brief ファイル毎の、積んでから完了していないコマンド
+     */
+    struct FileState {
+        uintptr_t               _file;
+        deque<FwFileIOCommand>  _orderedQueue;      ///< 現在位置を使うコマンド（積んだ順）
+        uint64_t                _orderedInFlight;   ///< 処理中の現在位置を使うコマンドの番号（無ければkNoSequence）
+        deque<PendingRange>     _pending;           ///< 位置を指定したコマンド（積んだ順。処理中のものも含み、先頭は完了していない）
+        uint32_t                _numWrites;         ///< _pendingのうち書き込みの数
+    };
+
+    static const uint64_t kNoSequence = ~0ull;
+
+    FileState * FindFile(const uintptr_t file);
+    const FileState * FindFile(const uintptr_t file) const;
+    FileState & GetFile(const uintptr_t file);
+    bool IsBlocked(const FwFileIOCommand & cmd) const;
+    FileState * FindOrdered();
+    deque<FwFileIOCommand>::iterator FindSorted();
+    bool FindNext(FileState *& ordered, deque<FwFileIOCommand>::iterator & itr);
+    void PopOrdered(FileState & file, FwFileIOCommand & cmd);
+    void Retire(const FwFileIOCommand & cmd);
+
+    std::mutex                  _mutex;
+    vector<FileState>           _files;         ///< 完了していないコマンドのあるファイル（ファイル順）
+    deque<FwFileIOCommand>      _sortedQueue;   ///< 位置を指定したコマンドを(優先度, ファイル, 位置)順に並べたもの
+    uint64_t                    _nextSequence;
+    uintptr_t                   _cursorFile;    ///< 最後に取り出した位置
+    uint64_t                    _cursorOffset;
+    uint64_t                    _maxMergeSize;
+    uint64_t                    _maxMergeGap;
+
+    std::atomic<FwFileRequestToken>             _nextToken;
+    FwSharedPool<FwFileIOSubmitGroup>           _groupPool;
+    FwSharedPool<FwFileIOCompletionNode>        _completionPool;
+    FwMpscQueue<FwFileIOCompletionNode>         _completionQueue;
+    std::mutex                                  _completionMutex;   ///< 取り出す側を1つにする
+
+    std::mutex                  _statsMutex;
+    FwFileIOStats               _stats;
+    uint64_t                    _statsStartTime;
+    uint64_t                    _busyStartTime;
+    uint64_t                    _numOutstanding;
+};
+
+
+#if defined(FW_PLATFORM_LINUX)
+/**
+ * @class FwFileIOUring
+ * @brief io_uringでコマンドを非同期に発行する
+ * @note  liburingは使わずにシステムコールを直接呼びます
+ *        ファイルは登録しておくと発行毎の参照カウント操作が省けます
+ *        登録したバッファに収まる読み書きはREAD_FIXED/WRITE_FIXEDで発行し、ページの固定を省きます
+ */
+class FwFileIOUring : public NonCopyable<FwFileIOUring> {
+public:
+    /**
+     * @brief 初期化
+     * @param[in] queueDepth       同時に発行する要求数
+     * @param[in] maxFiles         登録できるファイル数
+     * @param[in] registeredBuffer 登録するバッファ（nullptr可）
+     * @param[in] bufferSize       registeredBufferのサイズ
+     * @return io_uringを使えなければfalse
+     */
+    bool Init(const uint32_t queueDepth, const uint32_t maxFiles, void * registeredBuffer, const uint64_t bufferSize);
+
+    /**
+     * @brief 破棄
+     * @attention 発行中の要求が無い状態で呼んでください
+     */
+    void Term();
+
+    /**
+     * @brief ファイルを登録
+     * @return 登録した番号。登録できなければ-1（登録しなくても読み書きはできる）
+     */
+    sint32_t RegisterFile(const FwFile & fp);
+
+    /**
+     * @brief ファイルの登録を解除
+     * @attention そのファイルの要求が全て完了してから呼んでください
+     */
+    void UnregisterFile(const sint32_t slot);
+
+    /**
+     * @brief キューが空になり、発行した要求が全て完了するまで処理する
+     * @note  空きがある限りスケジューラから取り出して発行し、完了はまとめて刈り取ります
+     *        カーネルのブロック層が隣接する要求を合体するので、ここでは合体せずに並んだ順に発行します
+     */
+    void Run(FwFileIOScheduler * scheduler);
+
+    FwFileIOUring();
+    ~FwFileIOUring();
+
+
+private:
+    struct Request;
+
+    void Prepare(const uint32_t index);
+    void Reap();
+    void Enter(const uint32_t minComplete);
+
+    sint32_t                _ringFd;
+    void *                  _sqRing;
+    size_t                  _sqRingSize;
+    void *                  _cqRing;
+    size_t                  _cqRingSize;
+    void *                  _sqes;
+    size_t                  _sqesSize;
+
+    uint32_t *              _sqHead;
+    uint32_t *              _sqTail;
+    uint32_t                _sqMask;
+    uint32_t *              _sqArray;
+    uint32_t *              _cqHead;
+    uint32_t *              _cqTail;
+    uint32_t                _cqMask;
+    void *                  _cqes;
+    uint32_t                _numUnsubmitted;    ///< 積んだがまだカーネルへ渡していないSQE数
+
+    FwFileIOScheduler *     _scheduler;
+    Request *               _requests;
+    uint32_t *              _freeRequests;
+    uint32_t                _numFreeRequests;
+    uint32_t                _queueDepth;
+
+    std::mutex              _fileMutex;
+    sint32_t *              _freeFileSlots;
+    uint32_t                _numFreeFileSlots;
+    uint32_t                _maxFiles;
+
+    uint8_t *               _registeredBuffer;
+    uint64_t                _registeredBufferSize;
+};
+#endif
+
+END_NAMESPACE_FW
+
+#endif  // FW_FILE_IO_H_
@@ -0,0 +1,499 @@
+﻿/**
+ * @file fw_file_io_scheduler.cpp
+ */
+#include "precompiled.h"
+#include "fw_file_io.h"
+
+#include <chrono>
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+static uint64_t GetTimeMicroseconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static FW_INLINE uintptr_t GetFileKey(const FwFileIOCommand & cmd) {
+    return reinterpret_cast<uintptr_t>(cmd._fp.nativeHandle);
+}
+
+static FW_INLINE bool IsRead(const FwFileIOCommand & cmd) {
+    return (cmd._flags & FwFileIOCommand::kFlagFileRead) != 0;
+}
+
+/**
+ * @brief ファイルの現在位置を使うか（同じファイルのコマンドとは積んだ順に1つずつ処理する）
+ */
+static FW_INLINE bool IsOrdered(const FwFileIOCommand & cmd) {
+    return (cmd._flags & FwFileIOCommand::kFlagFileSequential) != 0 && (cmd._flags & FwFileIOCommand::kFlagFileAt) == 0;
+}
+
+static FW_INLINE bool IsOverlapped(const uint64_t offsetA, const uint64_t sizeA, const uint64_t offsetB, const uint64_t sizeB) {
+    return offsetA < offsetB + sizeB && offsetB < offsetA + sizeA;
+}
+
+/**
+ * @brief 優先度だけで比較する
+ */
+static bool LessPriority(const FwFileIOCommand & a, const FwFileIOCommand & b) {
+    return a._priority < b._priority;
+}
+
+/**
+ * @brief (優先度, ファイル, 位置)の順に比較する
+ */
+static bool LessSortKey(const FwFileIOCommand & a, const FwFileIOCommand & b) {
+    if (a._priority != b._priority) {
+        return a._priority < b._priority;
+    }
+    const uintptr_t fileA = GetFileKey(a);
+    const uintptr_t fileB = GetFileKey(b);
+    if (fileA != fileB) {
+        return fileA < fileB;
+    }
+    return a._offset < b._offset;
+}
+
+/**
+ * @brief 完了までの時間のバケット（16us以下, 32us以下, ...）
+ */
+static sint32_t GetLatencyBucket(const uint64_t latency) {
+    sint32_t bucket = 0;
+    uint64_t limit = 16;
+    while (bucket < FwFileIOLatencyHistogramBuckets - 1 && limit < latency) {
+        limit <<= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+/**
+ * @brief 末尾に足したコマンドを並べてから、並んでいる部分と合わせる
+ * @note  どちらも安定なので、同じ順位のコマンドは積んだ順のまま
+ */
+template<class _Compare>
+static void MergeAppended(deque<FwFileIOCommand> & queue, const size_t numSorted, _Compare comp) {
+    auto middle = queue.begin() + numSorted;
+    std::stable_sort(middle, queue.end(), comp);
+    std::inplace_merge(queue.begin(), middle, queue.end(), comp);
+}
+
+END_NAMESPACE_NONAME
+
+
+void FwFileIOScheduler::Init(const uint64_t maxMergeSize, const uint64_t maxMergeGap) {
+    _maxMergeSize = maxMergeSize;
+    _maxMergeGap = maxMergeGap;
+    ResetStats();
+}
+
+FwFileIOScheduler::FileState * FwFileIOScheduler::FindFile(const uintptr_t file) {
+    auto itr = std::lower_bound(_files.begin(), _files.end(), file, [](const FileState & state, const uintptr_t key) { return state._file < key; });
+    return (itr != _files.end() && itr->_file == file) ? &*itr : nullptr;
+}
+
+const FwFileIOScheduler::FileState * FwFileIOScheduler::FindFile(const uintptr_t file) const {
+    return const_cast<FwFileIOScheduler *>(this)->FindFile(file);
+}
+
+FwFileIOScheduler::FileState & FwFileIOScheduler::GetFile(const uintptr_t file) {
+    auto itr = std::lower_bound(_files.begin(), _files.end(), file, [](const FileState & state, const uintptr_t key) { return state._file < key; });
+    if (itr == _files.end() || itr->_file != file) {
+        FileState state;
+        state._file = file;
+        state._orderedInFlight = kNoSequence;
+        state._numWrites = 0;
+        itr = _files.insert(itr, std::move(state));
+    }
+    return *itr;
+}
+
+void FwFileIOScheduler::Push(FwFileIOCommand * cmds, const uint32_t numCommands) {
+    const uint64_t now = GetTimeMicroseconds();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const size_t numSorted = _sortedQueue.size();
+        for (uint32_t i = 0; i < numCommands; ++i) {
+            FwFileIOCommand & cmd = cmds[i];
+            cmd._submitTime = now;
+            cmd._sequence = _nextSequence++;
+            FileState & state = GetFile(GetFileKey(cmd));
+            if (IsOrdered(cmd)) {
+                state._orderedQueue.push_back(cmd);
+            } else {
+                PendingRange range;
+                range._sequence = cmd._sequence;
+                range._offset = cmd._offset;
+                range._size = cmd._rwSize;
+                range._write = !IsRead(cmd);
+                range._completed = false;
+                state._pending.push_back(range);
+                if (range._write) {
+                    ++state._numWrites;
+                }
+                _sortedQueue.push_back(cmd);
+            }
+        }
+        if (numSorted != _sortedQueue.size()) {
+            MergeAppended(_sortedQueue, numSorted, LessSortKey);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    if (_numOutstanding == 0) {
+        _busyStartTime = now;
+    }
+    _numOutstanding += numCommands;
+}
+
+bool FwFileIOScheduler::IsBlocked(const FwFileIOCommand & cmd) const {
+    const FileState * state = FindFile(GetFileKey(cmd));
+    FwAssert(state != nullptr);
+    if (state == nullptr) {
+        return false;
+    }
+
+    // 先に積んだ現在位置を使うコマンドが完了するまで待つ
+    if (state->_orderedInFlight < cmd._sequence) {
+        return true;
+    }
+    if (!state->_orderedQueue.empty() && state->_orderedQueue.front()._sequence < cmd._sequence) {
+        return true;
+    }
+
+    // 読み込み同士は入れ替えてよいので、書き込みが無ければ調べなくてよい
+    const bool read = IsRead(cmd);
+    if (read && state->_numWrites == 0) {
+        return false;
+    }
+    // 書き込みは、先に積んだ範囲の重なる読み書きと入れ替えない
+    for (const PendingRange & other : state->_pending) {
+        if (cmd._sequence <= other._sequence) {
+            break;
+        }
+        if (!other._completed && (other._write || !read) && IsOverlapped(other._offset, other._size, cmd._offset, cmd._rwSize)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+FwFileIOScheduler::FileState * FwFileIOScheduler::FindOrdered() {
+    // 先頭のコマンドは、処理中のものが無く、先に積んだ位置指定のコマンドが全て完了していれば取り出せる
+    FileState * best = nullptr;
+    for (FileState & state : _files) {
+        if (state._orderedQueue.empty() || state._orderedInFlight != kNoSequence) {
+            continue;
+        }
+        const FwFileIOCommand & head = state._orderedQueue.front();
+        if (!state._pending.empty() && state._pending.front()._sequence < head._sequence) {
+            continue;
+        }
+        if (best == nullptr) {
+            best = &state;
+            continue;
+        }
+        const FwFileIOCommand & bestHead = best->_orderedQueue.front();
+        if (head._priority < bestHead._priority || (head._priority == bestHead._priority && head._sequence < bestHead._sequence)) {
+            best = &state;
+        }
+    }
+    return best;
+}
+
+deque<FwFileIOCommand>::iterator FwFileIOScheduler::FindSorted() {
+    // 高い優先度の範囲から、前回取り出した位置の続きを探す。末尾まで進んだら範囲の先頭へ戻る
+    auto first = _sortedQueue.begin();
+    while (first != _sortedQueue.end()) {
+        auto last = std::upper_bound(first, _sortedQueue.end(), *first, LessPriority);
+
+        FwFileIOCommand cursor;
+        cursor._priority = first->_priority;
+        cursor._fp.nativeHandle = reinterpret_cast<decltype(cursor._fp.nativeHandle)>(_cursorFile);
+        cursor._offset = _cursorOffset;
+        auto start = std::lower_bound(first, last, cursor, LessSortKey);
+        for (auto itr = start; itr != last; ++itr) {
+            if (!IsBlocked(*itr)) {
+                return itr;
+            }
+        }
+        for (auto itr = first; itr != start; ++itr) {
+            if (!IsBlocked(*itr)) {
+                return itr;
+            }
+        }
+
+        // 全て待たされていれば次の優先度へ
+        first = last;
+    }
+    return _sortedQueue.end();
+}
+
+bool FwFileIOScheduler::FindNext(FileState *& ordered, deque<FwFileIOCommand>::iterator & itr) {
+    ordered = FindOrdered();
+    itr = FindSorted();
+    if (ordered == nullptr && itr == _sortedQueue.end()) {
+        return false;
+    }
+
+    // 同じ優先度なら現在位置を使うコマンドを先に
+    if (ordered != nullptr && itr != _sortedQueue.end() && itr->_priority < ordered->_orderedQueue.front()._priority) {
+        ordered = nullptr;
+    }
+    return true;
+}
+
+void FwFileIOScheduler::PopOrdered(FileState & file, FwFileIOCommand & cmd) {
+    cmd = file._orderedQueue.front();
+    file._orderedQueue.pop_front();
+    file._orderedInFlight = cmd._sequence;
+}
+
+void FwFileIOScheduler::Retire(const FwFileIOCommand & cmd) {
+    auto itr = std::lower_bound(_files.begin(), _files.end(), GetFileKey(cmd), [](const FileState & state, const uintptr_t key) { return state._file < key; });
+    FwAssert(itr != _files.end() && itr->_file == GetFileKey(cmd));
+    if (itr == _files.end() || itr->_file != GetFileKey(cmd)) {
+        return;
+    }
+
+    FileState & state = *itr;
+    if (IsOrdered(cmd)) {
+        state._orderedInFlight = kNoSequence;
+    } else {
+        // 位置順に取り出すので完了は積んだ順にならない。途中を消すと詰め直すので、印を付けて先頭から消す
+        auto range = std::lower_bound(state._pending.begin(), state._pending.end(), cmd._sequence, [](const PendingRange & pending, const uint64_t sequence) { return pending._sequence < sequence; });
+        FwAssert(range != state._pending.end() && range->_sequence == cmd._sequence);
+        if (range != state._pending.end() && range->_sequence == cmd._sequence) {
+            if (range->_write) {
+                --state._numWrites;
+            }
+            range->_completed = true;
+        }
+        while (!state._pending.empty() && state._pending.front()._completed) {
+            state._pending.pop_front();
+        }
+    }
+
+    if (state._orderedQueue.empty() && state._orderedInFlight == kNoSequence && state._pending.empty()) {
+        _files.erase(itr);
+    }
+}
+
+bool FwFileIOScheduler::Pop(FwFileIOCommand & cmd) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    FileState * ordered = nullptr;
+    deque<FwFileIOCommand>::iterator itr;
+    if (!FindNext(ordered, itr)) {
+        return false;
+    }
+
+    if (ordered != nullptr) {
+        PopOrdered(*ordered, cmd);
+        return true;
+    }
+    cmd = *itr;
+    _sortedQueue.erase(itr);
+    _cursorFile = GetFileKey(cmd);
+    _cursorOffset = cmd._offset + cmd._rwSize;
+    return true;
+}
+
+bool FwFileIOScheduler::PopBatch(FwFileIOBatch & batch) {
+    uint32_t numCommands = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        FileState * ordered = nullptr;
+        deque<FwFileIOCommand>::iterator first;
+        if (!FindNext(ordered, first)) {
+            return false;
+        }
+        if (ordered != nullptr) {
+            PopOrdered(*ordered, batch._cmds[0]);
+            batch._numCommands = 1;
+            batch._offset = batch._cmds[0]._offset;
+            batch._size = batch._cmds[0]._rwSize;
+            return true;
+        }
+
+        auto last = first + 1;
+        const FwFileIOCommand & head = *first;
+        uint64_t begin = head._offset;
+        uint64_t end = head._offset + head._rwSize;
+        batch._cmds[0] = head;
+        numCommands = 1;
+
+        // 同じファイルの続く読み込みを、隙間と全体のサイズが収まる間だけ合体する
+        if (IsRead(head) && _maxMergeSize != 0) {
+            for (; last != _sortedQueue.end() && numCommands < FwFileIOMaxBatchCommands; ++last) {
+                const FwFileIOCommand & next = *last;
+                if (next._priority != head._priority || GetFileKey(next) != GetFileKey(head) || !IsRead(next)) {
+                    break;
+                }
+                if (end + _maxMergeGap < next._offset) {
+                    break;
+                }
+                const uint64_t nextEnd = Max(end, next._offset + next._rwSize);
+                if (_maxMergeSize < nextEnd - begin) {
+                    break;
+                }
+                // 待たされているコマンドは合体しない
+                if (IsBlocked(next)) {
+                    break;
+                }
+                batch._cmds[numCommands++] = next;
+                end = nextEnd;
+            }
+        }
+
+        _cursorFile = GetFileKey(head);
+        _cursorOffset = end;
+        _sortedQueue.erase(first, last);
+
+        batch._numCommands = numCommands;
+        batch._offset = begin;
+        batch._size = end - begin;
+    }
+
+    if (1 < numCommands) {
+        std::lock_guard<std::mutex> lock(_statsMutex);
+        _stats.numMerged += numCommands;
+    }
+    return true;
+}
+
+void FwFileIOScheduler::RecordIssue(const uint64_t size) {
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    ++_stats.numIssued;
+    _stats.bytesIssued += size;
+}
+
+void FwFileIOScheduler::Complete(FwFileIOCommand & cmd, const sint32_t result) {
+    const uint64_t now = GetTimeMicroseconds();
+    {
+        // 待たせていたコマンドを取り出せるようにする
+        std::lock_guard<std::mutex> lock(_mutex);
+        Retire(cmd);
+    }
+    const uint64_t latency = (cmd._submitTime < now) ? now - cmd._submitTime : 0;
+    {
+        std::lock_guard<std::mutex> lock(_statsMutex);
+        ++_stats.numCommands;
+        if (result == FW_OK) {
+            _stats.bytesRequested += cmd._rwSize;
+        } else {
+            ++_stats.numFailed;
+        }
+        _stats.totalLatency += latency;
+        _stats.maxLatency = Max(_stats.maxLatency, latency);
+        ++_stats.latencyHistogram[GetLatencyBucket(latency)];
+
+        if (0 < _numOutstanding && --_numOutstanding == 0) {
+            _stats.busyTime += now - _busyStartTime;
+        }
+    }
+
+    // 読み書き1つ毎の通知
+    if (cmd._requestCallback != nullptr || (cmd._flags & FwFileIOCommand::kFlagPostCompletion) != 0) {
+        FwFileCompletion completion;
+        completion.token = cmd._token;
+        completion.stream = cmd._stream;
+        completion.userData = cmd._userData;
+        completion.result = result;
+
+        if (cmd._requestCallback != nullptr) {
+            cmd._requestCallback(completion);
+        }
+        if ((cmd._flags & FwFileIOCommand::kFlagPostCompletion) != 0) {
+            FwFileIOCompletionNode * node = _completionPool.New();
+            FwAssert(node != nullptr);
+            if (node != nullptr) {
+                node->_completion = completion;
+                _completionQueue.Push(node);
+            }
+        }
+    }
+
+    // 送出した1回分の通知
+    FwFileIOSubmitGroup * group = cmd._group;
+    if (group != nullptr) {
+        if (result != FW_OK) {
+            sint32_t expected = FW_OK;
+            group->_result.compare_exchange_strong(expected, result, std::memory_order_relaxed);
+        }
+        if (group->_numPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            group->_callback(group->_callbackContext, group->_result.load(std::memory_order_relaxed));
+            _groupPool.Delete(group);
+        }
+    }
+
+    // 通知すると待っている側がストリームを破棄しうるので最後に
+    cmd.notification->Complete(result);
+}
+
+FwFileIOSubmitGroup * FwFileIOScheduler::NewSubmitGroup(const sint32_t numCommands, FwFileStreamCallback callback, void * callbackContext) {
+    return _groupPool.New(numCommands, callback, callbackContext);
+}
+
+uint32_t FwFileIOScheduler::PollCompletions(FwFileCompletion * completions, const uint32_t maxCompletions) {
+    if (completions == nullptr || maxCompletions == 0) {
+        return 0;
+    }
+
+    // 取り出す側は1つだけにしておく。他のスレッドが取り出している間は空として返す
+    std::unique_lock<std::mutex> lock(_completionMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return 0;
+    }
+
+    uint32_t numCompletions = 0;
+    while (numCompletions < maxCompletions) {
+        FwFileIOCompletionNode * node = _completionQueue.Pop();
+        if (node == nullptr) {
+            break;
+        }
+        completions[numCompletions++] = node->_completion;
+        _completionPool.Delete(node);
+    }
+    return numCompletions;
+}
+
+void FwFileIOScheduler::GetStats(FwFileIOStats & stats) {
+    const uint64_t now = GetTimeMicroseconds();
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    stats = _stats;
+    stats.elapsedTime = now - _statsStartTime;
+    if (0 < _numOutstanding) {
+        stats.busyTime += now - _busyStartTime;
+    }
+}
+
+void FwFileIOScheduler::ResetStats() {
+    const uint64_t now = GetTimeMicroseconds();
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    _stats.Init();
+    _statsStartTime = now;
+    _busyStartTime = now;
+}
+
+FwFileIOScheduler::FwFileIOScheduler()
+: _cursorFile(0)
+, _cursorOffset(0)
+, _nextSequence(0)
+, _maxMergeSize(DefaultFwFileIOMaxMergeSize)
+, _maxMergeGap(DefaultFwFileIOMaxMergeGap)
+, _nextToken(FwInvalidFileRequestToken + 1)
+, _statsStartTime(0)
+, _busyStartTime(0)
+, _numOutstanding(0) {
+    _stats.Init();
+}
+
+FwFileIOScheduler::~FwFileIOScheduler() {
+    // 取り出されなかった完了を破棄
+    while (FwFileIOCompletionNode * node = _completionQueue.Pop()) {
+        _completionPool.Delete(node);
+    }
+}
+
+END_NAMESPACE_FW
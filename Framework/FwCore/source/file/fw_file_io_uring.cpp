@@ -0,0 +1,393 @@
+﻿/**
+ * @file fw_file_io_uring.cpp
+ */
+#include "precompiled.h"
+#include "fw_file_io.h"
+
+#if defined(FW_PLATFORM_LINUX)
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+static const uint64_t s_maxTransferSize = 1ull << 30;   ///< 1回のSQEで読み書きする最大サイズ（lenは32bit）
+
+static sint32_t IoUringSetup(const uint32_t entries, io_uring_params * params) {
+    return static_cast<sint32_t>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static sint32_t IoUringEnter(const sint32_t fd, const uint32_t toSubmit, const uint32_t minComplete, const uint32_t flags) {
+    return static_cast<sint32_t>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+static sint32_t IoUringRegister(const sint32_t fd, const uint32_t opcode, const void * args, const uint32_t numArgs) {
+    return static_cast<sint32_t>(syscall(__NR_io_uring_register, fd, opcode, args, numArgs));
+}
+
+template<class T>
+static FW_INLINE T * RingPointer(void * ring, const uint32_t offset) {
+    return reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(ring) + offset);
+}
+
+static sint32_t ToFileResult(const sint32_t error) {
+    switch (error) {
+    case EBADF:
+    case EINVAL:
+    case EFAULT:
+        return ERR_INVALID_PARMS;
+    case ENOMEM:
+        return ERR_OUT_OF_MEMORY;
+    default:
+        return ERR_FAILED;
+    }
+}
+
+END_NAMESPACE_NONAME
+
+
+/**
+ * @struct FwFileIOUring::Request
+ * @brief 発行中の要求
+ */
+struct FwFileIOUring::Request {
+    FwFileIOCommand     cmd;
+    uint64_t            transferred;    ///< 読み書きできたサイズ（短い読み込みは残りを発行し直す）
+    struct iovec        iov;
+};
+
+bool FwFileIOUring::Init(const uint32_t queueDepth, const uint32_t maxFiles, void * registeredBuffer, const uint64_t bufferSize) {
+    FwAssert(_ringFd < 0);
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    _ringFd = IoUringSetup(queueDepth, &params);
+    if (_ringFd < 0) {
+        return false;
+    }
+
+    // リングを共有メモリとしてマップする
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        _sqRingSize = _cqRingSize = Max(_sqRingSize, _cqRingSize);
+    }
+    _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+    if (_sqRing == MAP_FAILED) {
+        _sqRing = nullptr;
+        Term();
+        return false;
+    }
+    if (singleMap) {
+        _cqRing = _sqRing;
+    } else {
+        _cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+        if (_cqRing == MAP_FAILED) {
+            _cqRing = nullptr;
+            Term();
+            return false;
+        }
+    }
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        _sqes = nullptr;
+        Term();
+        return false;
+    }
+
+    _sqHead  = RingPointer<uint32_t>(_sqRing, params.sq_off.head);
+    _sqTail  = RingPointer<uint32_t>(_sqRing, params.sq_off.tail);
+    _sqMask  = *RingPointer<uint32_t>(_sqRing, params.sq_off.ring_mask);
+    _sqArray = RingPointer<uint32_t>(_sqRing, params.sq_off.array);
+    _cqHead  = RingPointer<uint32_t>(_cqRing, params.cq_off.head);
+    _cqTail  = RingPointer<uint32_t>(_cqRing, params.cq_off.tail);
+    _cqMask  = *RingPointer<uint32_t>(_cqRing, params.cq_off.ring_mask);
+    _cqes    = RingPointer<void>(_cqRing, params.cq_off.cqes);
+
+    // 要求はSQのエントリ数までしか同時に発行しないので、再発行でSQが溢れることはない
+    _queueDepth = params.sq_entries;
+    _requests = reinterpret_cast<Request *>(FwMalloc(sizeof(Request) * _queueDepth, FwDefaultMemAllocatorTag));
+    _freeRequests = reinterpret_cast<uint32_t *>(FwMalloc(sizeof(uint32_t) * _queueDepth, FwDefaultMemAllocatorTag));
+    if (_requests == nullptr || _freeRequests == nullptr) {
+        Term();
+        return false;
+    }
+    for (uint32_t i = 0; i < _queueDepth; ++i) {
+        _freeRequests[i] = _queueDepth - 1 - i;
+    }
+    _numFreeRequests = _queueDepth;
+
+    // 空の表を登録しておき、開いたファイルを順に差し込む（使えないカーネルでは登録しない）
+    if (0 < maxFiles) {
+        sint32_t * fds = reinterpret_cast<sint32_t *>(FwMalloc(sizeof(sint32_t) * maxFiles, FwDefaultMemAllocatorTag));
+        _freeFileSlots = reinterpret_cast<sint32_t *>(FwMalloc(sizeof(sint32_t) * maxFiles, FwDefaultMemAllocatorTag));
+        if (fds != nullptr && _freeFileSlots != nullptr) {
+            for (uint32_t i = 0; i < maxFiles; ++i) {
+                fds[i] = -1;
+                _freeFileSlots[i] = static_cast<sint32_t>(maxFiles - 1 - i);
+            }
+            if (IoUringRegister(_ringFd, IORING_REGISTER_FILES, fds, maxFiles) == 0) {
+                _maxFiles = maxFiles;
+                _numFreeFileSlots = maxFiles;
+            }
+        }
+        FwFree(fds);
+    }
+
+    // バッファの固定はロックできるメモリの上限を超えると失敗するので、その場合は使わない
+    if (registeredBuffer != nullptr && 0 < bufferSize) {
+        struct iovec iov;
+        iov.iov_base = registeredBuffer;
+        iov.iov_len = static_cast<size_t>(bufferSize);
+        if (IoUringRegister(_ringFd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+            _registeredBuffer = reinterpret_cast<uint8_t *>(registeredBuffer);
+            _registeredBufferSize = bufferSize;
+        }
+    }
+    return true;
+}
+
+void FwFileIOUring::Term() {
+    FwAssert(_requests == nullptr || _numFreeRequests == _queueDepth);
+
+    if (_sqes != nullptr) {
+        munmap(_sqes, _sqesSize);
+    }
+    if (_cqRing != nullptr && _cqRing != _sqRing) {
+        munmap(_cqRing, _cqRingSize);
+    }
+    if (_sqRing != nullptr) {
+        munmap(_sqRing, _sqRingSize);
+    }
+    // 閉じると登録したファイルとバッファも解除される
+    if (_ringFd >= 0) {
+        close(_ringFd);
+    }
+    FwFree(_requests);
+    FwFree(_freeRequests);
+    FwFree(_freeFileSlots);
+
+    _ringFd = -1;
+    _sqRing = _cqRing = _sqes = nullptr;
+    _requests = nullptr;
+    _freeRequests = nullptr;
+    _numFreeRequests = 0;
+    _queueDepth = 0;
+    _freeFileSlots = nullptr;
+    _numFreeFileSlots = 0;
+    _maxFiles = 0;
+    _registeredBuffer = nullptr;
+    _registeredBufferSize = 0;
+}
+
+sint32_t FwFileIOUring::RegisterFile(const FwFile & fp) {
+    if (fp.nativeHandle == nullptr) {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(_fileMutex);
+    if (_numFreeFileSlots == 0) {
+        return -1;
+    }
+    const sint32_t slot = _freeFileSlots[--_numFreeFileSlots];
+
+    sint32_t fd = fileno(fp.nativeHandle);
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = static_cast<uint32_t>(slot);
+    update.fds = reinterpret_cast<uintptr_t>(&fd);
+    if (IoUringRegister(_ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1) {
+        _freeFileSlots[_numFreeFileSlots++] = slot;
+        return -1;
+    }
+    return slot;
+}
+
+void FwFileIOUring::UnregisterFile(const sint32_t slot) {
+    if (slot < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_fileMutex);
+    sint32_t fd = -1;
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = static_cast<uint32_t>(slot);
+    update.fds = reinterpret_cast<uintptr_t>(&fd);
+    IoUringRegister(_ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+    _freeFileSlots[_numFreeFileSlots++] = slot;
+}
+
+void FwFileIOUring::Run(FwFileIOScheduler * scheduler) {
+    _scheduler = scheduler;
+    for (;;) {
+        // 空きがある限り取り出して積む
+        FwFileIOCommand cmd;
+        while (0 < _numFreeRequests && scheduler->Pop(cmd)) {
+            if ((cmd._flags & (FwFileIOCommand::kFlagFileRead | FwFileIOCommand::kFlagFileWrite)) == 0 || cmd._rwSize == 0) {
+                scheduler->Complete(cmd, FW_OK);
+                continue;
+            }
+            scheduler->RecordIssue(cmd._rwSize);
+            const uint32_t index = _freeRequests[--_numFreeRequests];
+            Request & request = _requests[index];
+            request.cmd = cmd;
+            request.transferred = 0;
+            Prepare(index);
+        }
+
+        if (_numFreeRequests == _queueDepth) {
+            FwAssert(_numUnsubmitted == 0);
+            return;
+        }
+
+        // 積んだ分を渡し、1つ以上完了するまで待ってからまとめて刈り取る
+        Enter(1);
+        Reap();
+    }
+}
+
+void FwFileIOUring::Prepare(const uint32_t index) {
+    Request & request = _requests[index];
+    const FwFileIOCommand & cmd = request.cmd;
+    const bool isRead = (cmd._flags & FwFileIOCommand::kFlagFileRead) != 0;
+
+    uint8_t * buffer = reinterpret_cast<uint8_t *>(cmd._rwBuffer) + request.transferred;
+    const uint64_t size = Min(cmd._rwSize - request.transferred, s_maxTransferSize);
+    request.iov.iov_base = buffer;
+    request.iov.iov_len = static_cast<size_t>(size);
+
+    const uint32_t tail = *_sqTail;
+    const uint32_t sqIndex = tail & _sqMask;
+    io_uring_sqe * sqe = &reinterpret_cast<io_uring_sqe *>(_sqes)[sqIndex];
+    memset(sqe, 0, sizeof(*sqe));
+
+    const bool fixedBuffer = (_registeredBuffer != nullptr) && (_registeredBuffer <= buffer) && (buffer + size <= _registeredBuffer + _registeredBufferSize);
+    if (fixedBuffer) {
+        sqe->opcode = isRead ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+        sqe->len = static_cast<uint32_t>(size);
+        sqe->buf_index = 0;
+    } else {
+        sqe->opcode = isRead ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->addr = reinterpret_cast<uintptr_t>(&request.iov);
+        sqe->len = 1;
+    }
+    if (0 <= cmd._fileSlot) {
+        sqe->fd = cmd._fileSlot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = fileno(cmd._fp.nativeHandle);
+    }
+    sqe->off = cmd._offset + request.transferred;
+    sqe->user_data = index;
+
+    _sqArray[sqIndex] = sqIndex;
+    __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++_numUnsubmitted;
+}
+
+void FwFileIOUring::Reap() {
+    uint32_t head = *_cqHead;
+    const uint32_t tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return;
+    }
+
+    for (; head != tail; ++head) {
+        const io_uring_cqe & cqe = reinterpret_cast<const io_uring_cqe *>(_cqes)[head & _cqMask];
+        const uint32_t index = static_cast<uint32_t>(cqe.user_data);
+        const sint32_t res = cqe.res;
+        Request & request = _requests[index];
+
+        sint32_t result = FW_OK;
+        if (res == -EINTR || res == -EAGAIN) {
+            // やり直す
+            Prepare(index);
+            continue;
+        } else if (res < 0) {
+            result = ToFileResult(-res);
+        } else if (res == 0) {
+            // 読み込みで末尾に達した
+            if ((request.cmd._flags & FwFileIOCommand::kFlagFileRead) != 0 && request.transferred == 0) {
+                result = ERR_EOF;
+            }
+        } else {
+            request.transferred += static_cast<uint64_t>(res);
+            if (request.transferred < request.cmd._rwSize) {
+                // 短い読み書きは残りを発行し直す
+                Prepare(index);
+                continue;
+            }
+        }
+
+        _scheduler->Complete(request.cmd, result);
+        _freeRequests[_numFreeRequests++] = index;
+    }
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+}
+
+void FwFileIOUring::Enter(const uint32_t minComplete) {
+    for (;;) {
+        const sint32_t ret = IoUringEnter(_ringFd, _numUnsubmitted, minComplete, IORING_ENTER_GETEVENTS);
+        if (ret >= 0) {
+            _numUnsubmitted -= Min(static_cast<uint32_t>(ret), _numUnsubmitted);
+            return;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EBUSY || errno == EAGAIN) {
+            // 完了キューが詰まっているので先に刈り取る
+            Reap();
+            continue;
+        }
+        FwAssertMessage(false, "io_uring_enter failed");
+        return;
+    }
+}
+
+FwFileIOUring::FwFileIOUring()
+: _ringFd(-1)
+, _sqRing(nullptr)
+, _sqRingSize(0)
+, _cqRing(nullptr)
+, _cqRingSize(0)
+, _sqes(nullptr)
+, _sqesSize(0)
+, _sqHead(nullptr)
+, _sqTail(nullptr)
+, _sqMask(0)
+, _sqArray(nullptr)
+, _cqHead(nullptr)
+, _cqTail(nullptr)
+, _cqMask(0)
+, _cqes(nullptr)
+, _numUnsubmitted(0)
+, _scheduler(nullptr)
+, _requests(nullptr)
+, _freeRequests(nullptr)
+, _numFreeRequests(0)
+, _queueDepth(0)
+, _freeFileSlots(nullptr)
+, _numFreeFileSlots(0)
+, _maxFiles(0)
+, _registeredBuffer(nullptr)
+, _registeredBufferSize(0) {
+}
+
+FwFileIOUring::~FwFileIOUring() {
+    Term();
+}
+
+END_NAMESPACE_FW
+
+#endif  // FW_PLATFORM_LINUX
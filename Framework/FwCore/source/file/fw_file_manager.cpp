@@ -6,126 +6,213 @@
 #include "file/fw_file_manager.h"
 #include "file/fw_file_stream.h"
 #include "file/fw_file.h"
+#include "core/fw_pool.h"
 #include "threading/fw_thread.h"
 #include "container/fw_deque.h"
 #include "container/fw_vector.h"
+#include "threading/fw_thread_context.h"
+#include "fw_file_io.h"
 
 
 BEGIN_NAMESPACE_FW
 BEGIN_NAMESPACE_NONAME
 
 /**
- * @struct FwFileIONotification
+ * @brief 現在位置を移動してから読み書きする
  */
-struct FwFileIONotification {
-    std::mutex                  _mutexFileIO;
-    std::condition_variable     _condFileIO;
-    bool                        _ready;
-
-    void Reset() {
-        _ready = false;
-    }
-
-    void Notify() {
-        {
-            std::lock_guard<std::mutex> lock(_mutexFileIO);
-            _ready = true;
+static sint32_t ExecuteCommand(FwFileIOCommand & cmd) {
+    // 読み込み／書き込み位置を移動
+    if ((cmd._flags & FwFileIOCommand::kFlagFileSeek) != 0) {
+        sint32_t result = FwFileSeek(cmd._fp, cmd._seekOffset, cmd._seekOrigin);
+        FwAssert(result == FW_OK);
+        if (result != FW_OK) {
+            return result;
         }
-        _condFileIO.notify_all();
     }
 
-    void Wait() {
-        std::unique_lock<std::mutex> lock(_mutexFileIO);
-        _condFileIO.wait(lock, [this]() { return _ready; });
+    // ファイルアクセス
+    sint32_t result = FW_OK;
+    if ((cmd._flags & FwFileIOCommand::kFlagFileRead) != 0) {
+        result = FwFileRead(cmd._fp, cmd._rwBuffer, cmd._rwSize, nullptr);
+        FwAssert(result == FW_OK);
+    } else if ((cmd._flags & FwFileIOCommand::kFlagFileWrite) != 0) {
+        result = FwFileWrite(cmd._fp, cmd._rwBuffer, cmd._rwSize, nullptr);
+        FwAssert(result == FW_OK);
     }
+    return result;
+}
 
-    bool WaitFor(const uint32_t milliseconds) {
-        std::unique_lock<std::mutex> lock(_mutexFileIO);
-        return _condFileIO.wait_for(lock, std::chrono::milliseconds(milliseconds), [this]() { return _ready; });
+/**
+ * @brief kFlagFileKeepSeekのコマンドを位置を指定して読み書きする前に、libcのバッファを書き出して現在位置を取得する
+ * @return 後でEndKeepSeekを呼ぶ必要があればtrue
+ */
+static bool BeginKeepSeek(FwFileIOCommand & cmd, uint64_t & current) {
+    // 位置を指定した読み書きはlibcのバッファを経由せず、Win32では現在位置も動かす
+    if ((cmd._flags & FwFileIOCommand::kFlagFileKeepSeek) == 0 || FwFileTell(cmd._fp, &current) != FW_OK) {
+        return false;
     }
-};
+#if FW_FILE == FW_FILE_LIBC
+    FwFileFlushBuffer(cmd._fp);
+#endif
+    return true;
+}
 
 /**
- * @struct FwFileIOCommand
+ * @brief BeginKeepSeekで取得した現在位置へ戻す
+ * @note  位置を指定し直すと、次の現在位置からの読み込みは古くなったバッファを捨てて読み直す
  */
-struct FwFileIOCommand {
-    enum {
-        kFlagFileRead       = FW_BIT32(0),
-        kFlagFileWrite      = FW_BIT32(1),
-        kFlagFileSeek       = FW_BIT32(2),
-        kFlagNotification   = FW_BIT32(3),
-    };
-
-    FwFile          _fp;
-    sint32_t        _flags;
-    uint32_t        _priority;
-    FwSeekOrigin    _seekOrigin;
-    sint64_t        _seekOffset;
-
-    void *      _rwBuffer;
-    uint64_t    _rwSize;
-
-    FwFileIONotification * notification;
-};
+static void EndKeepSeek(FwFileIOCommand & cmd, const uint64_t current) {
+    FwFileSeek(cmd._fp, static_cast<sint64_t>(current), FwSeekOriginBegin);
+}
 
+/**
+ * @brief ファイル上の位置を指定して読み書きする
+ * @note  ファイルの現在位置を使わないので、同じファイルのコマンドを複数のスレッドで並行に処理できる
+ */
+static sint32_t ExecuteCommandAt(FwFileIOCommand & cmd) {
+    uint64_t current = 0;
+    const bool keepSeek = BeginKeepSeek(cmd, current);
+
+    sint32_t result = FW_OK;
+    if ((cmd._flags & FwFileIOCommand::kFlagFileRead) != 0) {
+        result = FwFileReadAt(cmd._fp, cmd._rwBuffer, cmd._rwSize, cmd._offset, nullptr);
+    } else if ((cmd._flags & FwFileIOCommand::kFlagFileWrite) != 0) {
+        result = FwFileWriteAt(cmd._fp, cmd._rwBuffer, cmd._rwSize, cmd._offset, nullptr);
+    }
+
+    if (keepSeek) {
+        EndKeepSeek(cmd, current);
+    }
+    return result;
+}
 
 /**
- * @struct FwFileIOSharedBuffer
+ * @brief 合体した読み込みを実行し、各コマンドの読み込み先へ分配する
  */
-struct FwFileIOSharedBuffer {
-    deque<FwFileIOCommand>  _commandQueue;
-    std::mutex              _commandQueueMutex;
-};
+static void ExecuteBatch(FwFileIOScheduler * scheduler, FwFileIOBatch & batch) {
+    // 読み込み先はスレッドのスクラッチ領域を使う
+    FwThreadScratchScope scratch;
+    uint8_t * staging = reinterpret_cast<uint8_t *>(scratch.Alloc(static_cast<size_t>(batch._size)));
+    if (staging == nullptr) {
+        // 入りきらなければ1つずつ読む
+        for (uint32_t i = 0; i < batch._numCommands; ++i) {
+            scheduler->RecordIssue(batch._cmds[i]._rwSize);
+            scheduler->Complete(batch._cmds[i], ExecuteCommandAt(batch._cmds[i]));
+        }
+        return;
+    }
+
+    // 合体したコマンドは全て同じファイルなので、先頭で判断する
+    uint64_t current = 0;
+    const bool keepSeek = BeginKeepSeek(batch._cmds[0], current);
+
+    uint64_t readSize = 0;
+    const sint32_t result = FwFileReadAt(batch._cmds[0]._fp, staging, batch._size, batch._offset, &readSize);
+    scheduler->RecordIssue(batch._size);
+
+    if (keepSeek) {
+        EndKeepSeek(batch._cmds[0], current);
+    }
+
+    for (uint32_t i = 0; i < batch._numCommands; ++i) {
+        FwFileIOCommand & cmd = batch._cmds[i];
+        const uint64_t begin = cmd._offset - batch._offset;
+        sint32_t cmdResult = result;
+        if (result == FW_OK || result == ERR_EOF) {
+            // 単独で読んだ場合と同じく、1バイトも読めなければERR_EOF
+            if (readSize <= begin) {
+                cmdResult = ERR_EOF;
+            } else {
+                memcpy(cmd._rwBuffer, staging + begin, static_cast<size_t>(Min(cmd._rwSize, readSize - begin)));
+                cmdResult = FW_OK;
+            }
+        }
+        scheduler->Complete(cmd, cmdResult);
+    }
+}
 
 /**
  * @class FwFileIOThread
  */
 class FwFileIOThread : public FwThread {
 public:
-    FwFileIOSharedBuffer *  _sharedBuffer;
+    FwFileIOScheduler *     _scheduler;
+#if defined(FW_PLATFORM_LINUX)
+    FwFileIOUring *         _ring;          ///< io_uringで発行する場合
+#endif
 
 
     virtual sint32_t ThreadFunc(void * userArgs) FW_OVERRIDE {
-        
-        while (true) {
-            FwFileIOCommand cmd;
-            
-            // キューからコマンドを取得
-            bool foundNewCommand = false;
-            if (!_sharedBuffer->_commandQueue.empty()) {
-                std::lock_guard<std::mutex> lock(_sharedBuffer->_commandQueueMutex);
-                if (!_sharedBuffer->_commandQueue.empty()) {
-                    cmd = _sharedBuffer->_commandQueue.front();
-                    _sharedBuffer->_commandQueue.pop_front();
-                    foundNewCommand = true;
-                }
-            }
-            if (!foundNewCommand) {
-                break;
+#if defined(FW_PLATFORM_LINUX)
+        if (_ring != nullptr) {
+            _ring->Run(_scheduler);
+            return 0;
+        }
+#endif
+
+        // スケジューラから取り出して順に処理する
+        FwFileIOBatch batch;
+        while (_scheduler->PopBatch(batch)) {
+            if (1 < batch._numCommands) {
+                ExecuteBatch(_scheduler, batch);
+                continue;
             }
 
-            // 読み込み／書き込み位置を移動
-            if ((cmd._flags & FwFileIOCommand::kFlagFileSeek) != 0) {
-                sint32_t result = FwFileSeek(cmd._fp, cmd._seekOffset, cmd._seekOrigin);
-                FwAssert(result != FW_OK);
-            }
+            FwFileIOCommand & cmd = batch._cmds[0];
+            const bool positional = (cmd._flags & FwFileIOCommand::kFlagFileAt) != 0;
+            _scheduler->RecordIssue(cmd._rwSize);
+            const sint32_t result = positional ? ExecuteCommandAt(cmd) : ExecuteCommand(cmd);
+            _scheduler->Complete(cmd, result);
+        }
 
-            // ファイルアクセス
-            if ((cmd._flags & FwFileIOCommand::kFlagFileRead) != 0) {
-                sint32_t result = FwFileRead(cmd._fp, cmd._rwBuffer, cmd._rwSize, nullptr);
-                FwAssert(result == FW_OK);
-            } else if ((cmd._flags & FwFileIOCommand::kFlagFileWrite) != 0) {
-                sint32_t result = FwFileWrite(cmd._fp, cmd._rwBuffer, cmd._rwSize, nullptr);
-                FwAssert(result == FW_OK);
-            }
+        return 0;
+    }
 
-            // 終了通知
-            if ((cmd._flags & FwFileIOCommand::kFlagNotification) != 0) {
-                cmd.notification->Notify();
-            }
+    FwFileIOThread()
+    : _scheduler(nullptr)
+#if defined(FW_PLATFORM_LINUX)
+    , _ring(nullptr)
+#endif
+    {
+    }
+};
+
+/**
+ * @struct FwFileIOThreadPool
+ * @brief コマンドを処理するスレッドとバックエンド
+ */
+struct FwFileIOThreadPool {
+    FwFileIOScheduler       scheduler;
+    FwFileIOThread          threads[FwMaxFileIOThreads];
+    uint32_t                numThreads;
+    std::atomic<uint32_t>   nextThread;     ///< 次に起こすスレッド
+    FwFileIOBackend         backend;
+#if defined(FW_PLATFORM_LINUX)
+    FwFileIOUring           ring;
+#endif
+
+    /**
+     * @brief 位置を指定して読み書きするか
+     */
+    FW_INLINE bool IsPositional() const {
+        return backend != FwFileIOBackendSync;
+    }
+
+    /**
+     * @brief 積んだコマンドの数だけスレッドを起こす
+     */
+    void Wake(const uint32_t numCommands) {
+        const uint32_t numWakes = Min(numCommands, numThreads);
+        const uint32_t start = nextThread.fetch_add(numWakes, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < numWakes; ++i) {
+            threads[(start + i) % numThreads].RestartThread();
         }
+    }
 
-        return 0;
+    FwFileIOThreadPool()
+    : numThreads(0)
+    , nextThread(0)
+    , backend(FwFileIOBackendSync) {
     }
 };
 
@@ -141,20 +228,28 @@ public:
     sint64_t        seekOffset;
     FwSeekOrigin    seekOrigin;
     bool            updateFileSeek;
+    uint64_t        position;       ///< 次に読み書きする位置（位置指定で読み書きするバックエンド用）
+    sint32_t        fileSlot;       ///< io_uringに登録した番号
 
     vector<FwFileIOCommand>   localBuffer;
     FwFileIONotification      finishNotification;
 
-    FwFileIOThread *          fileIOThread;
+    FwFileIOThreadPool *      ioThreads;
+    FwSharedPool<FileStreamImpl> *  streamPool;
 
 
     // ファイルを閉じる
     virtual void DoClose() FW_OVERRIDE {
         Wait();
+#if defined(FW_PLATFORM_LINUX)
+        if (0 <= fileSlot) {
+            ioThreads->ring.UnregisterFile(fileSlot);
+        }
+#endif
         FwFileClose(fileHandle);
 
         // 自身を破棄
-        FwDelete<FileStreamImpl>(this);
+        streamPool->Delete(this);
     }
 
     // ファイルの長さを取得
@@ -167,6 +262,17 @@ public:
 
     // ファイルの位置を移動する
     virtual void DoSeek(const sint64_t offset, const FwSeekOrigin origin) FW_OVERRIDE {
+        // 位置を指定して読み書きする場合はここで位置を決めておく
+        if (ioThreads->IsPositional()) {
+            sint64_t base = 0;
+            if (origin == FwSeekOriginCurrent) {
+                base = static_cast<sint64_t>(position);
+            } else if (origin == FwSeekOriginEnd) {
+                base = static_cast<sint64_t>(DoLength());
+            }
+            position = static_cast<uint64_t>(Max<sint64_t>(base + offset, 0));
+        }
+
         if (seekOffset != offset || seekOrigin != origin) {
             seekOffset = offset;
             seekOrigin = origin;
@@ -176,73 +282,175 @@ public:
     }
 
     // ファイルを読み込む
-    virtual sint32_t DoRead(void * dst, const sint64_t dstSize, const sint64_t readSize) FW_OVERRIDE {
+    virtual sint32_t DoRead(void * dst, const sint64_t dstSize, const sint64_t readSize, const FwFileRequestDesc * desc, FwFileRequestToken * token) FW_OVERRIDE {
         if ((fileHandle.options & FwFileOptAccessRead) == 0) {
             return ERR_INVALID;
         }
+        if (dstSize < readSize) {
+            return ERR_INVALID_PARMS;
+        }
 
         FwFileIOCommand & cmd = localBuffer.append();
         cmd._fp              = fileHandle;
-        cmd._flags           = FwFileIOCommand::kFlagFileRead;
+        cmd._flags           = FwFileIOCommand::kFlagFileRead | FwFileIOCommand::kFlagFileSequential;
         cmd._priority        = priority;
         cmd._seekOrigin      = seekOrigin;
         cmd._seekOffset      = seekOffset;
+        cmd._offset          = position;
+        cmd._fileSlot        = fileSlot;
         cmd._rwBuffer        = dst;
         cmd._rwSize          = readSize;
+        position += readSize;
 
-        if (updateFileSeek) {
+        // 位置を決めて積めば、範囲の重なる書き込みとだけ積んだ順に処理され、読み込み同士は並行に処理される
+        if (ioThreads->IsPositional()) {
+            cmd._flags |= FwFileIOCommand::kFlagFileAt;
+        } else if (updateFileSeek) {
             cmd._flags |= FwFileIOCommand::kFlagFileSeek;
             updateFileSeek = false;
         }
+        SetRequest(cmd, desc, token);
 
         return FW_OK;
     }
 
     // ファイルへ書き込む
-    virtual sint32_t DoWrite(const void * src, const sint64_t srcSize, const sint64_t writeSize) FW_OVERRIDE {
+    virtual sint32_t DoWrite(const void * src, const sint64_t srcSize, const sint64_t writeSize, const FwFileRequestDesc * desc, FwFileRequestToken * token) FW_OVERRIDE {
         if ((fileHandle.options & FwFileOptAccessWrite) == 0) {
             return ERR_INVALID;
         }
 
         FwFileIOCommand & cmd = localBuffer.append();
         cmd._fp              = fileHandle;
-        cmd._flags           = FwFileIOCommand::kFlagFileWrite;
+        cmd._flags           = FwFileIOCommand::kFlagFileWrite | FwFileIOCommand::kFlagFileSequential;
+        cmd._priority        = priority;
         cmd._seekOrigin      = seekOrigin;
         cmd._seekOffset      = seekOffset;
+        cmd._offset          = position;
+        cmd._fileSlot        = fileSlot;
         cmd._rwBuffer        = const_cast<void *>(src);
         cmd._rwSize          = writeSize;
+        position += writeSize;
 
-        if (updateFileSeek) {
+        if (ioThreads->IsPositional()) {
+            cmd._flags |= FwFileIOCommand::kFlagFileAt;
+        } else if (updateFileSeek) {
             cmd._flags |= FwFileIOCommand::kFlagFileSeek;
             updateFileSeek = false;
         }
+        SetRequest(cmd, desc, token);
 
         return FW_OK;
     }
 
-    // 処理を送出する
-    virtual void DoSubmit() FW_OVERRIDE {
-        auto & cmd = localBuffer.back();
-        cmd._flags |= FwFileIOCommand::kFlagNotification;
-        cmd.notification = &finishNotification;
+    // 位置を指定してファイルを読み込む
+    virtual sint32_t DoReadAt(void * dst, const sint64_t dstSize, const sint64_t readSize, const uint64_t offset, const FwFileRequestDesc * desc, FwFileRequestToken * token) FW_OVERRIDE {
+        if ((fileHandle.options & FwFileOptAccessRead) == 0) {
+            return ERR_INVALID;
+        }
+        if (dstSize < readSize) {
+            return ERR_INVALID_PARMS;
+        }
+
+        // 現在位置には触れない
+        FwFileIOCommand & cmd = localBuffer.append();
+        cmd._fp              = fileHandle;
+        cmd._flags           = FwFileIOCommand::kFlagFileRead | FwFileIOCommand::kFlagFileAt;
+        cmd._priority        = priority;
+        cmd._seekOrigin      = FwSeekOriginBegin;
+        cmd._seekOffset      = 0;
+        cmd._offset          = offset;
+        cmd._fileSlot        = fileSlot;
+        cmd._rwBuffer        = dst;
+        cmd._rwSize          = readSize;
+        if (!ioThreads->IsPositional()) {
+            // 現在位置から読み書きするコマンドと同じFILEを使う
+            cmd._flags |= FwFileIOCommand::kFlagFileKeepSeek;
+        }
+        SetRequest(cmd, desc, token);
+
+        return FW_OK;
+    }
+
+    // 位置を指定してファイルへ書き込む
+    virtual sint32_t DoWriteAt(const void * src, const sint64_t srcSize, const sint64_t writeSize, const uint64_t offset, const FwFileRequestDesc * desc, FwFileRequestToken * token) FW_OVERRIDE {
+        if ((fileHandle.options & FwFileOptAccessWrite) == 0) {
+            return ERR_INVALID;
+        }
+        if (srcSize < writeSize) {
+            return ERR_INVALID_PARMS;
+        }
+
+        FwFileIOCommand & cmd = localBuffer.append();
+        cmd._fp              = fileHandle;
+        cmd._flags           = FwFileIOCommand::kFlagFileWrite | FwFileIOCommand::kFlagFileAt;
+        cmd._priority        = priority;
+        cmd._seekOrigin      = FwSeekOriginBegin;
+        cmd._seekOffset      = 0;
+        cmd._offset          = offset;
+        cmd._fileSlot        = fileSlot;
+        cmd._rwBuffer        = const_cast<void *>(src);
+        cmd._rwSize          = writeSize;
+        if (!ioThreads->IsPositional()) {
+            cmd._flags |= FwFileIOCommand::kFlagFileKeepSeek;
+        }
+        SetRequest(cmd, desc, token);
+
+        return FW_OK;
+    }
 
-        finishNotification.Reset();
+    // 読み書き1つ毎の完了の受け取り方を設定
+    void SetRequest(FwFileIOCommand & cmd, const FwFileRequestDesc * desc, FwFileRequestToken * token) {
+        cmd._token = FwInvalidFileRequestToken;
+        cmd._stream = this;
+        cmd._requestCallback = nullptr;
+        cmd._userData = nullptr;
+        cmd._group = nullptr;
+
+        if (desc != nullptr) {
+            cmd._requestCallback = desc->_callback;
+            cmd._userData = desc->_userData;
+            if (desc->_postCompletion) {
+                cmd._flags |= FwFileIOCommand::kFlagPostCompletion;
+            }
+        }
+        if (desc != nullptr || token != nullptr) {
+            cmd._token = ioThreads->scheduler.NewToken();
+        }
+        if (token != nullptr) {
+            *token = cmd._token;
+        }
+    }
 
-        FwFileIOSharedBuffer * sharedBuffer = fileIOThread->_sharedBuffer;
-        {
-            // 共有バッファのキューにコマンドを積む
-            std::lock_guard<std::mutex> lock(sharedBuffer->_commandQueueMutex);
+    // 処理を送出する
+    virtual void DoSubmit(FwFileStreamCallback callback, void * context) FW_OVERRIDE {
+        const uint32_t numCommands = static_cast<uint32_t>(localBuffer.size());
+        if (numCommands == 0) {
+            if (callback != nullptr) {
+                callback(context, FW_OK);
+            }
+            return;
+        }
 
-            // 優先度でソート
-            auto itr = std::lower_bound(sharedBuffer->_commandQueue.begin(), sharedBuffer->_commandQueue.end(),
-                localBuffer.front(), [](const FwFileIOCommand & a, const FwFileIOCommand & b) { return a._priority - b._priority; });
+        // コールバックは、今回送出したコマンドの最後に完了したものが呼ぶ
+        FwFileIOSubmitGroup * group = nullptr;
+        if (callback != nullptr) {
+            group = ioThreads->scheduler.NewSubmitGroup(static_cast<sint32_t>(numCommands), callback, context);
+            FwAssert(group != nullptr);
+        }
 
-            // 見つかった位置に全て挿入
-            sharedBuffer->_commandQueue.insert(itr, localBuffer.begin(), localBuffer.end());
+        // 前に送出した処理が残っていても、全て完了するまでWaitが待つように足しておく
+        for (auto & cmd : localBuffer) {
+            cmd.notification = &finishNotification;
+            cmd._group = group;
         }
+        finishNotification.Add(static_cast<sint32_t>(numCommands));
+
+        // 並べる順番はスケジューラが決める
+        ioThreads->scheduler.Push(localBuffer.data(), numCommands);
 
         // スレッドを起こす
-        fileIOThread->RestartThread();
+        ioThreads->Wake(numCommands);
 
         // 送ったので消しておく
         localBuffer.clear();
@@ -265,6 +473,8 @@ public:
         seekOrigin = FwSeekOriginCurrent;
         seekOffset = 0;
         updateFileSeek = true;
+        position = 0;
+        fileSlot = -1;
     }
 };
 
@@ -282,15 +492,46 @@ public:
         threadDesc.Init();
         threadDesc.affinity = desc->_threadAffinity;
         threadDesc.priority = desc->_threadPriority;
+        threadDesc.flags = FwThreadFlagAdaptiveWait;
         string::Copy(threadDesc.name, FW_ARRAY_SIZEOF(threadDesc.name), _T("FileIO Thread"));
 
-        fileIOThread._sharedBuffer = &this->sharedBuffer;
-        fileIOThread.StartWorker(&threadDesc);
+        // 使えるバックエンドを選ぶ
+        FwFileIOBackend backend = desc->_ioBackend;
+#if defined(FW_PLATFORM_LINUX)
+        if (backend == FwFileIOBackendAuto || backend == FwFileIOBackendIoUring) {
+            const bool initialized = ioThreads.ring.Init(Max(desc->_ioQueueDepth, 1u), desc->_maxRegisteredFiles, desc->_registeredBuffer, desc->_registeredBufferSize);
+            backend = initialized ? FwFileIOBackendIoUring : FwFileIOBackendThreadPool;
+        }
+#else
+        if (backend != FwFileIOBackendSync) {
+            backend = FwFileIOBackendThreadPool;
+        }
+#endif
+        ioThreads.backend = backend;
+        ioThreads.numThreads = (backend == FwFileIOBackendThreadPool) ? Clamp(desc->_numIOThreads, 1u, FwMaxFileIOThreads) : 1;
+        ioThreads.scheduler.Init(desc->_maxMergeSize, desc->_maxMergeGap);
+
+        // 合体した読み込みはスクラッチ領域へ読み込む
+        threadDesc.scratchSize = static_cast<size_t>(Max<uint64_t>(desc->_maxMergeSize, DefaultFwThreadScratchSize));
+
+        for (uint32_t i = 0; i < ioThreads.numThreads; ++i) {
+            FwFileIOThread & thread = ioThreads.threads[i];
+            thread._scheduler = &ioThreads.scheduler;
+#if defined(FW_PLATFORM_LINUX)
+            thread._ring = (backend == FwFileIOBackendIoUring) ? &ioThreads.ring : nullptr;
+#endif
+            thread.StartWorker(&threadDesc);
+        }
     }
 
     // 破棄
     virtual void DoShutdown() FW_OVERRIDE {
-        fileIOThread.Shutdown();
+        for (uint32_t i = 0; i < ioThreads.numThreads; ++i) {
+            ioThreads.threads[i].Shutdown();
+        }
+#if defined(FW_PLATFORM_LINUX)
+        ioThreads.ring.Term();
+#endif
     }
 
     // ファイルストリームを開く
@@ -301,10 +542,20 @@ public:
             return nullptr;
         }
 
-        FileStreamImpl * stream = FwNew<FileStreamImpl>();
+        FileStreamImpl * stream = streamPool.New();
+        if (stream == nullptr) {
+            FwFileClose(fp);
+            return nullptr;
+        }
         stream->fileHandle = fp;
         stream->priority = priority;
-        stream->fileIOThread = &fileIOThread;
+        stream->ioThreads = &ioThreads;
+#if defined(FW_PLATFORM_LINUX)
+        if (ioThreads.backend == FwFileIOBackendIoUring) {
+            stream->fileSlot = ioThreads.ring.RegisterFile(fp);
+        }
+#endif
+        stream->streamPool = &streamPool;
         string::Copy(stream->filePath, FW_ARRAY_SIZEOF(stream->filePath), filePath);
 
         return stream;
@@ -320,6 +571,26 @@ public:
         return basePath;
     }
 
+    // 実際に使っているI/Oのバックエンドを取得
+    virtual FwFileIOBackend DoGetIOBackend() const FW_OVERRIDE {
+        return ioThreads.backend;
+    }
+
+    // 完了した読み書きを取り出す
+    virtual uint32_t DoPollCompletions(FwFileCompletion * completions, const uint32_t maxCompletions) FW_OVERRIDE {
+        return ioThreads.scheduler.PollCompletions(completions, maxCompletions);
+    }
+
+    // I/Oの統計を取得
+    virtual void DoGetIOStats(FwFileIOStats & stats) FW_OVERRIDE {
+        ioThreads.scheduler.GetStats(stats);
+    }
+
+    // I/Oの統計をリセット
+    virtual void DoResetIOStats() FW_OVERRIDE {
+        ioThreads.scheduler.ResetStats();
+    }
+
     // コンストラクタ
     FileManagerImpl() {
 
@@ -334,8 +605,9 @@ public:
 private:
     char_t  basePath[FwPath::kMaxPathLen + 1];
 
-    FwFileIOSharedBuffer  sharedBuffer;
-    FwFileIOThread        fileIOThread;
+    FwFileIOThreadPool    ioThreads;
+
+    FwSharedPool<FileStreamImpl>  streamPool;
 };
 
 END_NAMESPACE_NONAME
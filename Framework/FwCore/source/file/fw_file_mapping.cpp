@@ -0,0 +1,204 @@
+﻿/**
+ * @file fw_file_mapping.cpp
+ */
+#include "precompiled.h"
+#include "file/fw_file_mapping.h"
+#include "file/fw_file_types.h"
+
+#if defined(FW_PLATFORM_WIN32)
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+BEGIN_NAMESPACE_FW
+BEGIN_NAMESPACE_NONAME
+
+/**
+ * @brief マップする位置の単位を取得
+ * @note  Win32はページサイズではなく割り当ての単位（通常64KB）に揃える必要がある
+ */
+static uint64_t GetMapGranularity() {
+#if defined(FW_PLATFORM_WIN32)
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    return static_cast<uint64_t>(info.dwAllocationGranularity);
+#else
+    return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+#if defined(FW_PLATFORM_WIN32)
+static HANDLE GetNativeFileHandle(FwFile & fp) {
+#if FW_FILE == FW_FILE_WIN32
+    return fp.nativeHandle;
+#else
+    return reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(fp.nativeHandle)));
+#endif
+}
+#endif
+
+END_NAMESPACE_NONAME
+
+
+sint32_t FwFileMap(FwFile & fp, const uint64_t offset, const uint64_t size, const FwFileMapMode mode, FwFileMapping & mapping) {
+    if (fp.nativeHandle == nullptr || FwFileMapModeCopyOnWrite < mode) {
+        return ERR_INVALID_PARMS;
+    }
+    FwFileUnmap(mapping);
+
+    // ファイルの長さを調べる（FwFileGetLengthは現在位置を動かすので使わない）
+    uint64_t fileLength = 0;
+#if defined(FW_PLATFORM_WIN32)
+    HANDLE fileHandle = GetNativeFileHandle(fp);
+    LARGE_INTEGER len;
+    if (!GetFileSizeEx(fileHandle, &len)) {
+        return ERR_INVALID;
+    }
+    fileLength = static_cast<uint64_t>(len.QuadPart);
+#else
+    const int fd = fileno(fp.nativeHandle);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return ERR_INVALID;
+    }
+    fileLength = static_cast<uint64_t>(st.st_size);
+#endif
+
+    if (fileLength < offset) {
+        return ERR_INVALID_PARMS;
+    }
+    const uint64_t mapSize = (size == 0) ? fileLength - offset : size;
+    if (fileLength - offset < mapSize) {
+        // 末尾を越えた部分に触れるとバスエラーになる
+        return ERR_INVALID_PARMS;
+    }
+    if (mapSize == 0) {
+        return FW_OK;
+    }
+    if (static_cast<uint64_t>(SIZE_MAX) < mapSize) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    // 位置を境界に揃えて、ずれた分は先頭を進めて返す
+    const uint64_t granularity = GetMapGranularity();
+    const uint64_t baseOffset = offset & ~(granularity - 1);
+    const uint64_t delta = offset - baseOffset;
+    const uint64_t baseSize = delta + mapSize;
+
+    void * base = nullptr;
+#if defined(FW_PLATFORM_WIN32)
+    const DWORD protect = (mode == FwFileMapModeCopyOnWrite) ? PAGE_WRITECOPY : PAGE_READONLY;
+    HANDLE mappingHandle = CreateFileMapping(fileHandle, NULL, protect, 0, 0, NULL);
+    if (mappingHandle == NULL) {
+        return ERR_INVALID;
+    }
+
+    const DWORD access = (mode == FwFileMapModeCopyOnWrite) ? FILE_MAP_COPY : FILE_MAP_READ;
+    base = MapViewOfFile(mappingHandle, access, static_cast<DWORD>(baseOffset >> 32), static_cast<DWORD>(baseOffset & 0xffffffff), static_cast<SIZE_T>(baseSize));
+
+    // ビューが参照しているので、マッピングオブジェクトはすぐに閉じてよい
+    CloseHandle(mappingHandle);
+    if (base == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+#else
+    // 読み込み専用はページキャッシュをそのまま共有し、コピーオンライトは書き込んだページだけ複製する
+    const int prot = (mode == FwFileMapModeCopyOnWrite) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    const int flags = (mode == FwFileMapModeCopyOnWrite) ? MAP_PRIVATE : MAP_SHARED;
+    base = mmap(nullptr, static_cast<size_t>(baseSize), prot, flags, fd, static_cast<off_t>(baseOffset));
+    if (base == MAP_FAILED) {
+        return ERR_OUT_OF_MEMORY;
+    }
+#endif
+
+    mapping.base = base;
+    mapping.baseSize = baseSize;
+    mapping.data = reinterpret_cast<uint8_t *>(base) + delta;
+    mapping.size = mapSize;
+
+    return FW_OK;
+}
+
+sint32_t FwFileMapByName(const str_t name, const FwFileMapMode mode, FwFileMapping & mapping) {
+    FwFile fp;
+    auto result = FwFileOpen(name, FwFileOptAccessRead | FwFileOptSharedRead, fp);
+    if (result != FW_OK) {
+        return result;
+    }
+
+    result = FwFileMap(fp, 0, 0, mode, mapping);
+
+    FwFileClose(fp);
+
+    return result;
+}
+
+sint32_t FwFileUnmap(FwFileMapping & mapping) {
+    if (mapping.base == nullptr) {
+        mapping.data = nullptr;
+        mapping.size = 0;
+        return FW_OK;
+    }
+
+#if defined(FW_PLATFORM_WIN32)
+    UnmapViewOfFile(mapping.base);
+#else
+    munmap(mapping.base, static_cast<size_t>(mapping.baseSize));
+#endif
+
+    mapping.data = nullptr;
+    mapping.size = 0;
+    mapping.base = nullptr;
+    mapping.baseSize = 0;
+
+    return FW_OK;
+}
+
+sint32_t FwFileMapAdvise(FwFileMapping & mapping, const uint64_t offset, const uint64_t size, const FwFileMapAdvice advice) {
+    if (mapping.base == nullptr || mapping.size < offset) {
+        return ERR_INVALID_PARMS;
+    }
+    const uint64_t adviseSize = (size == 0) ? mapping.size - offset : Min(size, mapping.size - offset);
+    if (adviseSize == 0) {
+        return FW_OK;
+    }
+
+#if defined(FW_PLATFORM_WIN32)
+#if _WIN32_WINNT >= 0x0602
+    if (advice == FwFileMapAdviceWillNeed) {
+        WIN32_MEMORY_RANGE_ENTRY entry;
+        entry.VirtualAddress = reinterpret_cast<uint8_t *>(mapping.data) + offset;
+        entry.NumberOfBytes = static_cast<SIZE_T>(adviseSize);
+        if (!PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0)) {
+            return ERR_FAILED;
+        }
+    }
+#endif
+#else
+    // madviseはページの境界から始める必要がある
+    const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const uintptr_t start = reinterpret_cast<uintptr_t>(mapping.data) + static_cast<uintptr_t>(offset);
+    const uintptr_t alignedStart = start & ~(pageSize - 1);
+    const size_t length = static_cast<size_t>(adviseSize + (start - alignedStart));
+
+    int nativeAdvice = MADV_NORMAL;
+    switch (advice) {
+    case FwFileMapAdviceSequential: nativeAdvice = MADV_SEQUENTIAL; break;
+    case FwFileMapAdviceRandom:     nativeAdvice = MADV_RANDOM;     break;
+    case FwFileMapAdviceWillNeed:   nativeAdvice = MADV_WILLNEED;   break;
+    case FwFileMapAdviceDontNeed:   nativeAdvice = MADV_DONTNEED;   break;
+    default:                        break;
+    }
+    if (madvise(reinterpret_cast<void *>(alignedStart), length, nativeAdvice) != 0) {
+        return ERR_FAILED;
+    }
+#endif
+
+    return FW_OK;
+}
+
+END_NAMESPACE_FW
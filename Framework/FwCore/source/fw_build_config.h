@@ -13,4 +13,19 @@
 //! t@C̓IɕWC֐ɂ
 #define FW_BUILD_CONFIG_FORCE_USE_LIBC_FILE             (0)
 
+//! FwDefaultAllocator ̏TCYubNXbhɃLbV
+#define FW_BUILD_CONFIG_ENABLE_MEM_THREAD_CACHE         (1)
+
+//! jp^[Ŗ߂鏈IɗL
+#define FW_BUILD_CONFIG_FORCE_ENABLE_MEM_POISON         (0)
+
+//! FwMallocDebug ɂ郁gpʂ̋L^IɗL
+#define FW_BUILD_CONFIG_FORCE_ENABLE_MEM_TRACKING       (0)
+
+//! ubÑwb_/tb^ɂI[o[oIɗLi͏TCYubÑwb_Ȃj
+#define FW_BUILD_CONFIG_FORCE_ENABLE_MEM_GUARD          (0)
+
+//! C++20̃R[`ico_awaitjŃ^XNO[vƃt@CXg[҂Ă悤ɂiRpCΉĂꍇ̂݁j
+#define FW_BUILD_CONFIG_ENABLE_COROUTINE                (0)
+
 #endif  // FW_BUILD_CONFIG_H_
@@ -24,7 +24,9 @@ struct MainThreadArgs {
 }   // namespace ""
 
 
-MainThread::MainThread() {
+MainThread::MainThread()
+: args(nullptr)
+, frameAllocator(nullptr) {
 
 }
 
@@ -60,11 +62,24 @@ sint32_t MainThread::ThreadFunc(void * userArgs) {
 sint32_t MainThread::Initialzie(void * userArgs) {
     MainThreadArgs * args = reinterpret_cast<MainThreadArgs *>(userArgs);
 
+    // フレームアロケータ
+    FwFrameAllocatorDesc frameAllocatorDesc;
+    frameAllocatorDesc.Init();
+    frameAllocator = FwCreateFrameAllocator(&frameAllocatorDesc);
+    if (frameAllocator == nullptr) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    FwSetMemAllocator(frameAllocatorDesc.tag, frameAllocator);
+
     return FW_OK;
 }
 
 void MainThread::Shutdown() {
-
+    if (frameAllocator != nullptr) {
+        FwSetMemAllocator(FwFrameMemAllocatorTag, nullptr);
+        FwDestroyFrameAllocator(frameAllocator);
+        frameAllocator = nullptr;
+    }
 }
 
 void MainThread::StartMainThread(const str_t name) {
@@ -99,5 +114,6 @@ void MainThread::OnFrameUpdate(const float delta) {
 }
 
 void MainThread::OnEndFrame() {
-
+    // 最も古いフレームの一時メモリを破棄
+    frameAllocator->EndFrame();
 }
\ No newline at end of file
@@ -74,7 +74,8 @@ private:
 
 
 
-    void *  args;
+    void *                          args;
+    NAMESPACE_FW FwFrameAllocator * frameAllocator;
 };
 
 #endif  // MAIN_THREAD_H_